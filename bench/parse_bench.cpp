@@ -0,0 +1,161 @@
+//-----------------------------------------------------------------------------
+// Parser microbenchmark for ModelOBJ::import().
+//
+// Writes a synthetic OBJ file with v/vt/vn lines in the short fixed-point
+// form most exporters write, plus the faces of a grid over those vertices.
+// The file is then imported with the fscanf() based PARSER_STDIO and with
+// the memory mapped PARSER_MAPPED, whose numbers go through ParseFloat() and
+// ParseInt(). Each parser runs on one thread so only the number parsing
+// kernels differ, and the best of several runs is reported.
+//
+// This isn't part of the viewer's project. Build it on its own, e.g.
+//
+//   g++ -O2 -std=c++14 -pthread -I.. -o parse_bench parse_bench.cpp ../model_obj.cpp
+//   cl /O2 /EHsc /I.. parse_bench.cpp ..\model_obj.cpp
+//
+// Usage: parse_bench [vertices (default 2000000)] [runs (default 3)]
+//-----------------------------------------------------------------------------
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+
+#include "model_obj.h"
+
+namespace
+{
+    bool WriteSyntheticObj(const char *pszFilename, int numberOfVertices)
+    {
+        // The vertices form a square grid so that every face references
+        // vertices that exist. Coordinates are printed with six decimals.
+
+        FILE *pFile = fopen(pszFilename, "w");
+
+        if (!pFile)
+            return false;
+
+        int side = 2;
+
+        while (side * side < numberOfVertices)
+            ++side;
+
+        unsigned int seed = 12345;
+
+        for (int y = 0; y < side; ++y)
+        {
+            for (int x = 0; x < side; ++x)
+            {
+                seed = seed * 1664525 + 1013904223;
+
+                float h = static_cast<float>(seed >> 8) / 16777216.0f - 0.5f;
+
+                fprintf(pFile, "v %.6f %.6f %.6f\n",
+                    x * 0.013f - 10.0f, h, y * 0.017f - 12.0f);
+                fprintf(pFile, "vt %.6f %.6f\n",
+                    static_cast<float>(x) / side, static_cast<float>(y) / side);
+                fprintf(pFile, "vn %.6f %.6f %.6f\n", h * 0.3f, 0.95f, -h * 0.1f);
+            }
+        }
+
+        for (int y = 0; y < side - 1; ++y)
+        {
+            for (int x = 0; x < side - 1; ++x)
+            {
+                int a = y * side + x + 1;
+                int b = a + 1;
+                int c = a + side;
+                int d = c + 1;
+
+                fprintf(pFile, "f %d/%d/%d %d/%d/%d %d/%d/%d\n", a, a, a, b, b, b, d, d, d);
+                fprintf(pFile, "f %d/%d/%d %d/%d/%d %d/%d/%d\n", a, a, a, d, d, d, c, c, c);
+            }
+        }
+
+        bool succeeded = ferror(pFile) == 0;
+
+        fclose(pFile);
+        return succeeded;
+    }
+
+    bool RunParser(const char *pszFilename, ModelOBJ::ParserType parser,
+                   int runs, ModelOBJ::ImportStats &best)
+    {
+        ModelOBJ::ImportOptions options;
+
+        options.parser = parser;
+        options.numThreads = 1;
+        options.lean = true;
+
+        for (int i = 0; i < runs; ++i)
+        {
+            ModelOBJ model;
+
+            if (!model.import(pszFilename, options))
+                return false;
+
+            const ModelOBJ::ImportStats &stats = model.getImportStats();
+
+            if (i == 0 || stats.totalTime < best.totalTime)
+                best = stats;
+        }
+
+        return true;
+    }
+
+    void PrintStats(const char *pszName, const ModelOBJ::ImportStats &stats,
+                    int numbers)
+    {
+        printf("%-8s parse %8.1f ms  build %8.1f ms  total %8.1f ms  %6.1f ns/number\n",
+            pszName, stats.parseTime, stats.buildTime, stats.totalTime,
+            stats.parseTime * 1.0e6 / numbers);
+    }
+}
+
+int main(int argc, char *argv[])
+{
+    int numberOfVertices = (argc > 1) ? atoi(argv[1]) : 2000000;
+    int runs = (argc > 2) ? atoi(argv[2]) : 3;
+    const char *pszFilename = "parse_bench.obj";
+
+    if (numberOfVertices < 4 || runs < 1)
+    {
+        fprintf(stderr, "usage: parse_bench [vertices] [runs]\n");
+        return 1;
+    }
+
+    if (!WriteSyntheticObj(pszFilename, numberOfVertices))
+    {
+        fprintf(stderr, "failed to write %s\n", pszFilename);
+        return 1;
+    }
+
+    ModelOBJ::ImportStats stdio;
+    ModelOBJ::ImportStats mapped;
+
+    if (!RunParser(pszFilename, ModelOBJ::PARSER_STDIO, runs, stdio)
+        || !RunParser(pszFilename, ModelOBJ::PARSER_MAPPED, runs, mapped))
+    {
+        fprintf(stderr, "failed to import %s\n", pszFilename);
+        remove(pszFilename);
+        return 1;
+    }
+
+    remove(pszFilename);
+
+    // Eight floats per vertex and nine integers per triangle.
+
+    int numbers = mapped.positionLines * 3 + mapped.texCoordLines * 2
+        + mapped.normalLines * 3 + mapped.faceLines * 9;
+
+    printf("%llu bytes, %d vertices, %d faces, best of %d\n",
+        mapped.bytesRead, mapped.positionLines, mapped.faceLines, runs);
+
+    PrintStats("stdio", stdio, numbers);
+    PrintStats("mapped", mapped, numbers);
+
+    if (mapped.totalTime > 0.0)
+        printf("speedup  %.2fx total\n", stdio.totalTime / mapped.totalTime);
+
+    return 0;
+}
@@ -20,8 +20,10 @@
 #include <shellapi.h>   // for drag and drop support
 #include <GL/gl.h>
 #include <GL/glu.h>
+#include <algorithm>
 #include <cassert>
 #include <cmath>
+#include <cstddef>
 #include <map>
 #include <sstream>
 #include <stdexcept>
@@ -67,6 +69,41 @@
 
 typedef std::map<std::string, GLuint> ModelTextures;
 
+// A material compiled into the GL state needed to draw it. The draw states
+// are built once when a model is loaded so that drawing a mesh doesn't need
+// any texture or uniform lookups.
+struct DrawState
+{
+    const ModelOBJ::Material *pMaterial;
+    GLuint program;                 // 0 for the fixed function pipeline
+    GLuint colorMap;                // 0 if the color map wasn't loaded
+    GLuint normalMap;               // 0 if the normal map wasn't loaded
+    GLint materialAlphaLocation;
+    bool transparent;
+};
+
+// One mesh in the render queue. The queue is sorted by 'key' so that meshes
+// sharing a draw state are drawn together. See CreateRenderQueue().
+struct DrawCommand
+{
+    unsigned long long key;
+    int drawState;
+    int mesh;
+    int startIndex;
+    int indexCount;
+    int firstMeshlet;
+    int meshletCount;               // 0 if the mesh has no meshlets
+};
+
+// Frustum culling counters for the last frame drawn.
+struct CullStats
+{
+    int meshesDrawn;
+    int meshesCulled;
+    int meshletsDrawn;
+    int meshletsCulled;
+};
+
 //-----------------------------------------------------------------------------
 // Globals.
 //-----------------------------------------------------------------------------
@@ -82,6 +119,10 @@ int                 g_msaaSamples;
 GLuint              g_nullTexture;
 GLuint              g_blinnPhongShader;
 GLuint              g_normalMappingShader;
+GLint               g_blinnPhongAlphaLocation;
+GLint               g_normalMappingAlphaLocation;
+GLuint              g_modelVertexBuffer;
+GLuint              g_modelIndexBuffer;
 float               g_maxAnisotrophy;
 float               g_heading;
 float               g_pitch;
@@ -92,20 +133,39 @@ bool                g_hasFocus;
 bool                g_enableWireframe;
 bool                g_enableTextures = true;
 bool                g_supportsProgrammablePipeline;
+bool                g_supportsBufferObjects;
 bool                g_cullBackFaces = true;
 ModelOBJ            g_model;
+ModelOBJ::AsyncImport *g_pModelImport;
 ModelTextures       g_modelTextures;
+std::string         g_modelName;
+std::vector<DrawState> g_drawStates;
+std::vector<DrawCommand> g_renderQueue;
+std::vector<unsigned char> g_visibleMeshes;
+std::vector<unsigned char> g_visibleMeshlets;
+std::vector<GLsizei> g_drawCounts;
+std::vector<const void *> g_drawIndices;
+CullStats           g_cullStats;
 
 //-----------------------------------------------------------------------------
 // Functions Prototypes.
 //-----------------------------------------------------------------------------
 
+void    BindModelVertexArrays(bool bindTangents);
+void    CancelModelLoad();
 void    Cleanup();
 void    CleanupApp();
+bool    CompareDrawCommands(const DrawCommand &lhs, const DrawCommand &rhs);
+bool    CompareDrawStates(const DrawState *pLhs, const DrawState *pRhs);
 GLuint  CompileShader(GLenum type, const GLchar *pszSource, GLint length);
 HWND    CreateAppWindow(const WNDCLASSEX &wcl, const char *pszTitle);
+void    CreateModelBuffers();
 GLuint  CreateNullTexture(int width, int height);
+void    CreateRenderQueue();
+void    CullModel();
+void    DestroyModelBuffers();
 void    DrawFrame();
+void    DrawMesh(const DrawCommand &command, const int *pIndices);
 void    DrawModelUsingFixedFuncPipeline();
 void    DrawModelUsingProgrammablePipeline();
 bool    ExtensionSupported(const char *pszExtensionName);
@@ -115,6 +175,7 @@ void    InitApp();
 void    InitGL();
 GLuint  LinkShaders(GLuint vertShader, GLuint fragShader);
 void    LoadModel(const char *pszFilename);
+void    LoadModelTextures();
 GLuint  LoadShaderProgramFromResource(const char *pResouceId, std::string &infoLog);
 GLuint  LoadTexture(const char *pszFilename);
 void    Log(const char *pszMessage);
@@ -124,9 +185,11 @@ void    ReadTextFileFromResource(const char *pResouceId, std::string &buffer);
 void    ResetCamera();
 void    SetProcessorAffinity();
 void    ToggleFullScreen();
+void    UnbindModelVertexArrays(bool bindTangents);
 void    UnloadModel();
 void    UpdateFrame(float elapsedTimeSec);
 void    UpdateFrameRate(float elapsedTimeSec);
+void    UpdateModelLoad();
 LRESULT CALLBACK WindowProc(HWND hWnd, UINT msg, WPARAM wParam, LPARAM lParam);
 
 //-----------------------------------------------------------------------------
@@ -191,6 +254,12 @@ int WINAPI WinMain(HINSTANCE hInstance, HINSTANCE hPrevInstance, LPSTR lpCmdLine
                     DrawFrame();
                     SwapBuffers(g_hDC);
                 }
+                else if (g_pModelImport)
+                {
+                    // Keep polling the background import while inactive.
+                    UpdateModelLoad();
+                    MsgWaitForMultipleObjects(0, 0, FALSE, 100, QS_ALLINPUT);
+                }
                 else
                 {
                     WaitMessage();
@@ -234,7 +303,10 @@ LRESULT CALLBACK WindowProc(HWND hWnd, UINT msg, WPARAM wParam, LPARAM lParam)
         switch (static_cast<int>(wParam))
         {
         case VK_ESCAPE:
-            PostMessage(hWnd, WM_CLOSE, 0, 0);
+            if (g_pModelImport)
+                CancelModelLoad();
+            else
+                PostMessage(hWnd, WM_CLOSE, 0, 0);
             break;
 
         case 'r':
@@ -277,11 +349,7 @@ LRESULT CALLBACK WindowProc(HWND hWnd, UINT msg, WPARAM wParam, LPARAM lParam)
         try
         {
             if (strstr(szFilename, ".obj") || strstr(szFilename, ".OBJ"))
-            {
-                UnloadModel();
                 LoadModel(szFilename);
-                ResetCamera();
-            }
             else
             {
                 throw std::runtime_error("File is not a valid .OBJ file");
@@ -311,6 +379,75 @@ LRESULT CALLBACK WindowProc(HWND hWnd, UINT msg, WPARAM wParam, LPARAM lParam)
     return DefWindowProc(hWnd, msg, wParam, lParam);
 }
 
+void BindModelVertexArrays(bool bindTangents)
+{
+    // Point the vertex arrays at the model's buffer objects. This is done once
+    // per frame rather than once per mesh since every mesh shares the same
+    // vertex buffer. Without buffer objects the arrays are sourced from the
+    // model's client-side vertex buffer instead. The tangents are passed to
+    // the normal mapping shader through texture unit 1.
+
+    const GLubyte *pVertices = 0;
+    GLsizei stride = g_model.getVertexSize();
+
+    if (g_modelVertexBuffer)
+        glBindBuffer(GL_ARRAY_BUFFER, g_modelVertexBuffer);
+    else
+        pVertices = reinterpret_cast<const GLubyte *>(g_model.getVertexBuffer());
+
+    if (g_modelIndexBuffer)
+        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, g_modelIndexBuffer);
+
+    if (g_model.hasPositions())
+    {
+        glEnableClientState(GL_VERTEX_ARRAY);
+        glVertexPointer(3, GL_FLOAT, stride,
+            pVertices + offsetof(ModelOBJ::Vertex, position));
+    }
+
+    if (g_model.hasTextureCoords())
+    {
+        if (bindTangents)
+            glClientActiveTexture(GL_TEXTURE0);
+
+        glEnableClientState(GL_TEXTURE_COORD_ARRAY);
+        glTexCoordPointer(2, GL_FLOAT, stride,
+            pVertices + offsetof(ModelOBJ::Vertex, texCoord));
+    }
+
+    if (g_model.hasNormals())
+    {
+        glEnableClientState(GL_NORMAL_ARRAY);
+        glNormalPointer(GL_FLOAT, stride,
+            pVertices + offsetof(ModelOBJ::Vertex, normal));
+    }
+
+    if (bindTangents && g_model.hasTangents())
+    {
+        glClientActiveTexture(GL_TEXTURE1);
+        glEnableClientState(GL_TEXTURE_COORD_ARRAY);
+        glTexCoordPointer(4, GL_FLOAT, stride,
+            pVertices + offsetof(ModelOBJ::Vertex, tangent));
+    }
+}
+
+void CancelModelLoad()
+{
+    // Cancel the background import (if any), or release it once its model
+    // has been swapped in. The model currently displayed is kept.
+
+    if (!g_pModelImport)
+        return;
+
+    delete g_pModelImport;
+    g_pModelImport = 0;
+
+    if (g_modelName.empty())
+        SetWindowText(g_hWnd, APP_TITLE);
+    else
+        SetWindowText(g_hWnd, (std::string(APP_TITLE) + " - " + g_modelName).c_str());
+}
+
 void Cleanup()
 {
     CleanupApp();
@@ -331,6 +468,7 @@ void Cleanup()
 
 void CleanupApp()
 {
+    CancelModelLoad();
     UnloadModel();
 
     if (g_nullTexture)
@@ -357,6 +495,28 @@ void CleanupApp()
     }
 }
 
+bool CompareDrawCommands(const DrawCommand &lhs, const DrawCommand &rhs)
+{
+    return lhs.key < rhs.key;
+}
+
+bool CompareDrawStates(const DrawState *pLhs, const DrawState *pRhs)
+{
+    // Orders draw states from the most to the least expensive state change:
+    // shader program, then textures, then the material constants.
+
+    if (pLhs->program != pRhs->program)
+        return pLhs->program < pRhs->program;
+
+    if (pLhs->normalMap != pRhs->normalMap)
+        return pLhs->normalMap < pRhs->normalMap;
+
+    if (pLhs->colorMap != pRhs->colorMap)
+        return pLhs->colorMap < pRhs->colorMap;
+
+    return pLhs->pMaterial < pRhs->pMaterial;
+}
+
 GLuint CompileShader(GLenum type, const GLchar *pszSource, GLint length)
 {
     // Compiles the shader given it's source code. Returns the shader object.
@@ -427,6 +587,37 @@ HWND CreateAppWindow(const WNDCLASSEX &wcl, const char *pszTitle)
     return hWnd;
 }
 
+void CreateModelBuffers()
+{
+    // Upload the model's vertices and indices into static buffer objects once
+    // the model has been swapped in. The draw calls then read the geometry
+    // from GPU memory instead of the driver copying the client-side arrays
+    // on every draw.
+
+    if (!g_supportsBufferObjects)
+        return;
+
+    const ModelOBJ::Vertex *pVertices = g_model.getVertexBuffer();
+    const int *pIndices = g_model.getIndexBuffer();
+
+    if (!pVertices || !pIndices)
+        return;
+
+    glGenBuffers(1, &g_modelVertexBuffer);
+    glBindBuffer(GL_ARRAY_BUFFER, g_modelVertexBuffer);
+    glBufferData(GL_ARRAY_BUFFER,
+        static_cast<GLsizeiptr>(g_model.getNumberOfVertices()) * g_model.getVertexSize(),
+        pVertices, GL_STATIC_DRAW);
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+
+    glGenBuffers(1, &g_modelIndexBuffer);
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, g_modelIndexBuffer);
+    glBufferData(GL_ELEMENT_ARRAY_BUFFER,
+        static_cast<GLsizeiptr>(g_model.getNumberOfIndices()) * g_model.getIndexSize(),
+        pIndices, GL_STATIC_DRAW);
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+}
+
 GLuint CreateNullTexture(int width, int height)
 {
     // Create an empty white texture. This texture is applied to OBJ models
@@ -451,6 +642,191 @@ GLuint CreateNullTexture(int width, int height)
     return texture;
 }
 
+void CreateRenderQueue()
+{
+    // Compile each material into a draw state and queue one draw command per
+    // mesh. Opaque meshes are sorted by draw state to minimize program and
+    // texture switches. Transparent meshes are drawn last in their original
+    // order so that blending isn't affected by the sort.
+
+    const ModelOBJ::Material *pMaterials = 0;
+    const ModelOBJ::Mesh *pMesh = 0;
+    ModelTextures::const_iterator iter;
+    std::vector<const DrawState *> sortedStates;
+    std::vector<unsigned long long> stateRanks;
+    std::vector<int> firstMeshlets(g_model.getNumberOfMeshes(), 0);
+    std::vector<int> meshletCounts(g_model.getNumberOfMeshes(), 0);
+
+    g_drawStates.clear();
+    g_renderQueue.clear();
+
+    if (!g_model.getNumberOfMaterials())
+        return;
+
+    pMaterials = &g_model.getMaterial(0);
+    g_drawStates.resize(g_model.getNumberOfMaterials());
+
+    for (int i = 0; i < g_model.getNumberOfMaterials(); ++i)
+    {
+        DrawState &state = g_drawStates[i];
+
+        state.pMaterial = &pMaterials[i];
+        state.program = 0;
+        state.colorMap = 0;
+        state.normalMap = 0;
+        state.materialAlphaLocation = -1;
+        state.transparent = state.pMaterial->alpha < 1.0f;
+
+        iter = g_modelTextures.find(state.pMaterial->colorMapFilename);
+
+        if (iter != g_modelTextures.end())
+            state.colorMap = iter->second;
+
+        if (!g_supportsProgrammablePipeline)
+            continue;
+
+        if (state.pMaterial->bumpMapFilename.empty())
+        {
+            state.program = g_blinnPhongShader;
+            state.materialAlphaLocation = g_blinnPhongAlphaLocation;
+        }
+        else
+        {
+            state.program = g_normalMappingShader;
+            state.materialAlphaLocation = g_normalMappingAlphaLocation;
+
+            iter = g_modelTextures.find(state.pMaterial->bumpMapFilename);
+
+            if (iter != g_modelTextures.end())
+                state.normalMap = iter->second;
+        }
+    }
+
+    // Rank the draw states. The rank forms the high bits of an opaque mesh's
+    // sort key and the mesh's index forms the low bits. The top bit is set
+    // for transparent meshes.
+
+    sortedStates.resize(g_drawStates.size());
+    stateRanks.resize(g_drawStates.size());
+
+    for (int i = 0; i < static_cast<int>(g_drawStates.size()); ++i)
+        sortedStates[i] = &g_drawStates[i];
+
+    std::sort(sortedStates.begin(), sortedStates.end(), CompareDrawStates);
+
+    for (int i = 0; i < static_cast<int>(sortedStates.size()); ++i)
+        stateRanks[sortedStates[i] - &g_drawStates[0]] = i;
+
+    // The meshlets are listed in mesh order, so each mesh's meshlets are
+    // consecutive.
+
+    for (int i = g_model.getNumberOfMeshlets() - 1; i >= 0; --i)
+    {
+        firstMeshlets[g_model.getMeshlet(i).mesh] = i;
+        ++meshletCounts[g_model.getMeshlet(i).mesh];
+    }
+
+    g_renderQueue.resize(g_model.getNumberOfMeshes());
+
+    for (int i = 0; i < g_model.getNumberOfMeshes(); ++i)
+    {
+        DrawCommand &command = g_renderQueue[i];
+
+        pMesh = &g_model.getMesh(i);
+        command.drawState = static_cast<int>(pMesh->pMaterial - pMaterials);
+        command.mesh = i;
+        command.startIndex = pMesh->startIndex;
+        command.indexCount = pMesh->triangleCount * 3;
+        command.firstMeshlet = firstMeshlets[i];
+        command.meshletCount = meshletCounts[i];
+
+        if (g_drawStates[command.drawState].transparent)
+            command.key = (1ULL << 63) | static_cast<unsigned long long>(i);
+        else
+            command.key = (stateRanks[command.drawState] << 32) | static_cast<unsigned long long>(i);
+    }
+
+    std::sort(g_renderQueue.begin(), g_renderQueue.end(), CompareDrawCommands);
+}
+
+void CullModel()
+{
+    // Cull the model's meshes and meshlets against the view frustum. When
+    // back faces are culled the meshlets facing away from the camera are
+    // culled as well. The meshlets of culled meshes are never drawn.
+
+    float projection[16];
+    float modelview[16];
+    float viewProjection[16];
+    float eye[3];
+
+    glGetFloatv(GL_PROJECTION_MATRIX, projection);
+    glGetFloatv(GL_MODELVIEW_MATRIX, modelview);
+
+    for (int col = 0; col < 4; ++col)
+    {
+        for (int row = 0; row < 4; ++row)
+        {
+            viewProjection[col * 4 + row] = 0.0f;
+
+            for (int k = 0; k < 4; ++k)
+                viewProjection[col * 4 + row] += projection[k * 4 + row] * modelview[col * 4 + k];
+        }
+    }
+
+    // The modelview matrix only rotates and translates, so the eye position
+    // in model space is the inverse rotation applied to minus the
+    // translation.
+
+    for (int i = 0; i < 3; ++i)
+    {
+        eye[i] = -(modelview[i * 4 + 0] * modelview[12] +
+            modelview[i * 4 + 1] * modelview[13] +
+            modelview[i * 4 + 2] * modelview[14]);
+    }
+
+    g_visibleMeshes.resize(g_model.getNumberOfMeshes());
+    g_visibleMeshlets.resize(g_model.getNumberOfMeshlets());
+
+    memset(&g_cullStats, 0, sizeof(g_cullStats));
+
+    if (!g_visibleMeshes.empty())
+    {
+        g_cullStats.meshesDrawn = g_model.cullMeshes(viewProjection, &g_visibleMeshes[0]);
+        g_cullStats.meshesCulled = g_model.getNumberOfMeshes() - g_cullStats.meshesDrawn;
+    }
+
+    if (!g_visibleMeshlets.empty())
+    {
+        g_model.cullMeshlets(viewProjection, g_cullBackFaces ? eye : 0, &g_visibleMeshlets[0]);
+
+        for (int i = 0; i < g_model.getNumberOfMeshlets(); ++i)
+        {
+            if (!g_visibleMeshes[g_model.getMeshlet(i).mesh])
+                g_visibleMeshlets[i] = 0;
+
+            g_cullStats.meshletsDrawn += g_visibleMeshlets[i];
+        }
+
+        g_cullStats.meshletsCulled = g_model.getNumberOfMeshlets() - g_cullStats.meshletsDrawn;
+    }
+}
+
+void DestroyModelBuffers()
+{
+    if (g_modelVertexBuffer)
+    {
+        glDeleteBuffers(1, &g_modelVertexBuffer);
+        g_modelVertexBuffer = 0;
+    }
+
+    if (g_modelIndexBuffer)
+    {
+        glDeleteBuffers(1, &g_modelIndexBuffer);
+        g_modelIndexBuffer = 0;
+    }
+}
+
 void DrawFrame()
 {
     glViewport(0, 0, g_windowWidth, g_windowHeight);
@@ -472,232 +848,199 @@ void DrawFrame()
     glRotatef(g_pitch, 1.0f, 0.0f, 0.0f);
     glRotatef(g_heading, 0.0f, 1.0f, 0.0f);
 
+    CullModel();
+
     if (g_supportsProgrammablePipeline)
         DrawModelUsingProgrammablePipeline();
     else
         DrawModelUsingFixedFuncPipeline();
 }
 
-void DrawModelUsingFixedFuncPipeline()
+void DrawMesh(const DrawCommand &command, const int *pIndices)
 {
-    const ModelOBJ::Mesh *pMesh = 0;
-    const ModelOBJ::Material *pMaterial = 0;
-    const ModelOBJ::Vertex *pVertices = 0;
-    ModelTextures::const_iterator iter;
+    // Draw the meshlets of a mesh that survived culling. Runs of visible
+    // meshlets that are next to each other in the index buffer are merged
+    // into one range, and all of the mesh's ranges are then submitted with
+    // a single glMultiDrawElements() call when it's available.
 
-    for (int i = 0; i < g_model.getNumberOfMeshes(); ++i)
+    if (command.meshletCount == 0)
     {
-        pMesh = &g_model.getMesh(i);
-        pMaterial = pMesh->pMaterial;
-        pVertices = g_model.getVertexBuffer();
+        glDrawElements(GL_TRIANGLES, command.indexCount, GL_UNSIGNED_INT,
+            pIndices + command.startIndex);
+        return;
+    }
 
-        glMaterialfv(GL_FRONT_AND_BACK, GL_AMBIENT, pMaterial->ambient);
-        glMaterialfv(GL_FRONT_AND_BACK, GL_DIFFUSE, pMaterial->diffuse);
-        glMaterialfv(GL_FRONT_AND_BACK, GL_SPECULAR, pMaterial->specular);
-        glMaterialf(GL_FRONT_AND_BACK, GL_SHININESS, pMaterial->shininess * 128.0f);
+    int rangeEnd = -1;
 
-        if (g_enableTextures)
-        {
-            iter = g_modelTextures.find(pMaterial->colorMapFilename);
+    g_drawCounts.clear();
+    g_drawIndices.clear();
 
-            if (iter == g_modelTextures.end())
-            {
-                glDisable(GL_TEXTURE_2D);
-            }
-            else
-            {
-                glEnable(GL_TEXTURE_2D);
-                glBindTexture(GL_TEXTURE_2D, iter->second);
-            }
-        }
-        else
-        {
-            glDisable(GL_TEXTURE_2D);
-        }
+    for (int i = command.firstMeshlet; i < command.firstMeshlet + command.meshletCount; ++i)
+    {
+        const ModelOBJ::Meshlet &meshlet = g_model.getMeshlet(i);
 
-        if (g_model.hasPositions())
-        {
-            glEnableClientState(GL_VERTEX_ARRAY);
-            glVertexPointer(3, GL_FLOAT, g_model.getVertexSize(),
-                g_model.getVertexBuffer()->position);
-        }
+        if (!g_visibleMeshlets[i])
+            continue;
 
-        if (g_model.hasTextureCoords())
+        if (meshlet.startIndex == rangeEnd)
         {
-            glEnableClientState(GL_TEXTURE_COORD_ARRAY);
-            glTexCoordPointer(2, GL_FLOAT, g_model.getVertexSize(),
-                g_model.getVertexBuffer()->texCoord);
+            g_drawCounts.back() += meshlet.triangleCount * 3;
         }
-
-        if (g_model.hasNormals())
+        else
         {
-            glEnableClientState(GL_NORMAL_ARRAY);
-            glNormalPointer(GL_FLOAT, g_model.getVertexSize(),
-                g_model.getVertexBuffer()->normal);
+            g_drawCounts.push_back(meshlet.triangleCount * 3);
+            g_drawIndices.push_back(pIndices + meshlet.startIndex);
         }
 
-        glDrawElements(GL_TRIANGLES, pMesh->triangleCount * 3, GL_UNSIGNED_INT,
-            g_model.getIndexBuffer() + pMesh->startIndex);
-
-        if (g_model.hasNormals())
-            glDisableClientState(GL_NORMAL_ARRAY);
+        rangeEnd = meshlet.startIndex + meshlet.triangleCount * 3;
+    }
 
-        if (g_model.hasTextureCoords())
-            glDisableClientState(GL_TEXTURE_COORD_ARRAY);
+    if (g_drawCounts.empty())
+        return;
 
-        if (g_model.hasPositions())
-            glDisableClientState(GL_VERTEX_ARRAY);
+    if (glMultiDrawElements)
+    {
+        glMultiDrawElements(GL_TRIANGLES, &g_drawCounts[0], GL_UNSIGNED_INT,
+            &g_drawIndices[0], static_cast<GLsizei>(g_drawCounts.size()));
+    }
+    else
+    {
+        for (int i = 0; i < static_cast<int>(g_drawCounts.size()); ++i)
+            glDrawElements(GL_TRIANGLES, g_drawCounts[i], GL_UNSIGNED_INT, g_drawIndices[i]);
     }
 }
 
-void DrawModelUsingProgrammablePipeline()
+void DrawModelUsingFixedFuncPipeline()
 {
-    const ModelOBJ::Mesh *pMesh = 0;
     const ModelOBJ::Material *pMaterial = 0;
-    const ModelOBJ::Vertex *pVertices = 0;
-    ModelTextures::const_iterator iter;
+    const int *pIndices = g_modelIndexBuffer ? 0 : g_model.getIndexBuffer();
     GLuint texture = 0;
+    GLuint boundTexture = 0;
+    bool textureEnabled = true;
 
-    glEnable(GL_BLEND);
-    glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+    // Start from a known texture state, since culled meshes may leave the
+    // first draw anywhere in the queue.
 
-    for (int i = 0; i < g_model.getNumberOfMeshes(); ++i)
+    glEnable(GL_TEXTURE_2D);
+    BindModelVertexArrays(false);
+
+    for (int i = 0; i < static_cast<int>(g_renderQueue.size()); ++i)
     {
-        pMesh = &g_model.getMesh(i);
-        pMaterial = pMesh->pMaterial;
-        pVertices = g_model.getVertexBuffer();
+        const DrawCommand &command = g_renderQueue[i];
+        const DrawState &state = g_drawStates[command.drawState];
 
-        glMaterialfv(GL_FRONT_AND_BACK, GL_AMBIENT, pMaterial->ambient);
-        glMaterialfv(GL_FRONT_AND_BACK, GL_DIFFUSE, pMaterial->diffuse);
-        glMaterialfv(GL_FRONT_AND_BACK, GL_SPECULAR, pMaterial->specular);
-        glMaterialf(GL_FRONT_AND_BACK, GL_SHININESS, pMaterial->shininess * 128.0f);
+        if (!g_visibleMeshes[command.mesh])
+            continue;
 
-        if (pMaterial->bumpMapFilename.empty())
-        {
-            // Per fragment Blinn-Phong code path.
+        // Only submit the state that differs from the previous draw.
 
-            glUseProgram(g_blinnPhongShader);
+        if (state.pMaterial != pMaterial)
+        {
+            pMaterial = state.pMaterial;
 
-            // Bind the color map texture.
+            glMaterialfv(GL_FRONT_AND_BACK, GL_AMBIENT, pMaterial->ambient);
+            glMaterialfv(GL_FRONT_AND_BACK, GL_DIFFUSE, pMaterial->diffuse);
+            glMaterialfv(GL_FRONT_AND_BACK, GL_SPECULAR, pMaterial->specular);
+            glMaterialf(GL_FRONT_AND_BACK, GL_SHININESS, pMaterial->shininess * 128.0f);
+        }
 
-            texture = g_nullTexture;
+        texture = g_enableTextures ? state.colorMap : 0;
 
-            if (g_enableTextures)
-            {
-                iter = g_modelTextures.find(pMaterial->colorMapFilename);
+        if ((texture != 0) != textureEnabled)
+        {
+            textureEnabled = (texture != 0);
 
-                if (iter != g_modelTextures.end())
-                    texture = iter->second;
-            }
+            if (textureEnabled)
+                glEnable(GL_TEXTURE_2D);
+            else
+                glDisable(GL_TEXTURE_2D);
+        }
 
-            glActiveTexture(GL_TEXTURE0);
-            glEnable(GL_TEXTURE_2D);
+        if (texture && texture != boundTexture)
+        {
             glBindTexture(GL_TEXTURE_2D, texture);
-
-            // Update shader parameters.
-
-            glUniform1i(glGetUniformLocation(
-                g_blinnPhongShader, "colorMap"), 0);
-            glUniform1f(glGetUniformLocation(
-                g_blinnPhongShader, "materialAlpha"), pMaterial->alpha);
+            boundTexture = texture;
         }
-        else
-        {
-            // Normal mapping code path.
-
-            glUseProgram(g_normalMappingShader);
-
-            // Bind the normal map texture.
-
-            iter = g_modelTextures.find(pMaterial->bumpMapFilename);
-
-            if (iter != g_modelTextures.end())
-            {
-                glActiveTexture(GL_TEXTURE1);
-                glEnable(GL_TEXTURE_2D);
-                glBindTexture(GL_TEXTURE_2D, iter->second);
-            }
 
-            // Bind the color map texture.
+        DrawMesh(command, pIndices);
+    }
 
-            texture = g_nullTexture;
+    UnbindModelVertexArrays(false);
+}
 
-            if (g_enableTextures)
-            {
-                iter = g_modelTextures.find(pMaterial->colorMapFilename);
+void DrawModelUsingProgrammablePipeline()
+{
+    const DrawState *pState = 0;
+    const int *pIndices = g_modelIndexBuffer ? 0 : g_model.getIndexBuffer();
+    GLuint program = 0;
+    GLuint texture = 0;
+    GLuint boundColorMap = 0;
+    GLuint boundNormalMap = 0;
+    bool programChanged = false;
 
-                if (iter != g_modelTextures.end())
-                    texture = iter->second;
-            }
+    glEnable(GL_BLEND);
+    glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
 
-            glActiveTexture(GL_TEXTURE0);
-            glEnable(GL_TEXTURE_2D);
-            glBindTexture(GL_TEXTURE_2D, texture);
+    glActiveTexture(GL_TEXTURE0);
+    BindModelVertexArrays(true);
 
-            // Update shader parameters.
+    for (int i = 0; i < static_cast<int>(g_renderQueue.size()); ++i)
+    {
+        const DrawCommand &command = g_renderQueue[i];
+        const DrawState &state = g_drawStates[command.drawState];
 
-            glUniform1i(glGetUniformLocation(
-                g_normalMappingShader, "colorMap"), 0);
-            glUniform1i(glGetUniformLocation(
-                g_normalMappingShader, "normalMap"), 1);
-            glUniform1f(glGetUniformLocation(
-                g_normalMappingShader, "materialAlpha"), pMaterial->alpha);
-        }        
+        if (!g_visibleMeshes[command.mesh])
+            continue;
 
-        // Render mesh.
+        // Only submit the state that differs from the previous draw. The
+        // sampler uniforms never change and were set when the shaders were
+        // loaded. The alpha uniform is per program so it's set again
+        // whenever the program changes.
 
-        if (g_model.hasPositions())
-        {
-            glEnableClientState(GL_VERTEX_ARRAY);
-            glVertexPointer(3, GL_FLOAT, g_model.getVertexSize(),
-                g_model.getVertexBuffer()->position);
-        }
+        programChanged = (state.program != program);
 
-        if (g_model.hasTextureCoords())
+        if (programChanged)
         {
-            glClientActiveTexture(GL_TEXTURE0);
-            glEnableClientState(GL_TEXTURE_COORD_ARRAY);
-            glTexCoordPointer(2, GL_FLOAT, g_model.getVertexSize(),
-                g_model.getVertexBuffer()->texCoord);
+            program = state.program;
+            glUseProgram(program);
         }
 
-        if (g_model.hasNormals())
+        if (&state != pState)
         {
-            glEnableClientState(GL_NORMAL_ARRAY);
-            glNormalPointer(GL_FLOAT, g_model.getVertexSize(),
-                g_model.getVertexBuffer()->normal);
+            glMaterialfv(GL_FRONT_AND_BACK, GL_AMBIENT, state.pMaterial->ambient);
+            glMaterialfv(GL_FRONT_AND_BACK, GL_DIFFUSE, state.pMaterial->diffuse);
+            glMaterialfv(GL_FRONT_AND_BACK, GL_SPECULAR, state.pMaterial->specular);
+            glMaterialf(GL_FRONT_AND_BACK, GL_SHININESS, state.pMaterial->shininess * 128.0f);
         }
 
-        if (g_model.hasTangents())
-        {
-            glClientActiveTexture(GL_TEXTURE1);
-            glEnableClientState(GL_TEXTURE_COORD_ARRAY);
-            glTexCoordPointer(4, GL_FLOAT, g_model.getVertexSize(),
-                g_model.getVertexBuffer()->tangent);
-        }
+        if (&state != pState || programChanged)
+            glUniform1f(state.materialAlphaLocation, state.pMaterial->alpha);
 
-        glDrawElements(GL_TRIANGLES, pMesh->triangleCount * 3, GL_UNSIGNED_INT,
-            g_model.getIndexBuffer() + pMesh->startIndex);
+        pState = &state;
 
-        if (g_model.hasTangents())
+        if (state.normalMap && state.normalMap != boundNormalMap)
         {
-            glClientActiveTexture(GL_TEXTURE1);
-            glDisableClientState(GL_TEXTURE_COORD_ARRAY);
+            glActiveTexture(GL_TEXTURE1);
+            glBindTexture(GL_TEXTURE_2D, state.normalMap);
+            glActiveTexture(GL_TEXTURE0);
+            boundNormalMap = state.normalMap;
         }
 
-        if (g_model.hasNormals())
-            glDisableClientState(GL_NORMAL_ARRAY);
+        texture = (g_enableTextures && state.colorMap) ? state.colorMap : g_nullTexture;
 
-        if (g_model.hasTextureCoords())
+        if (texture != boundColorMap)
         {
-            glClientActiveTexture(GL_TEXTURE0);
-            glDisableClientState(GL_TEXTURE_COORD_ARRAY);
+            glBindTexture(GL_TEXTURE_2D, texture);
+            boundColorMap = texture;
         }
 
-        if (g_model.hasPositions())
-            glDisableClientState(GL_VERTEX_ARRAY);
+        // Render mesh.
+
+        DrawMesh(command, pIndices);
     }
 
+    UnbindModelVertexArrays(true);
+
     glBindTexture(GL_TEXTURE_2D, 0);
     glUseProgram(0);
     glDisable(GL_BLEND);
@@ -839,15 +1182,26 @@ void InitApp()
             reinterpret_cast<const char *>(SHADER_NORMAL_MAPPING), infoLog)))
             throw std::runtime_error("Failed to load normal mapping shader.\n" + infoLog);
 
+        // The samplers always read from the same texture units so set them
+        // once here. Only the material alpha changes between draws.
+
+        glUseProgram(g_blinnPhongShader);
+        glUniform1i(glGetUniformLocation(g_blinnPhongShader, "colorMap"), 0);
+        g_blinnPhongAlphaLocation = glGetUniformLocation(g_blinnPhongShader, "materialAlpha");
+
+        glUseProgram(g_normalMappingShader);
+        glUniform1i(glGetUniformLocation(g_normalMappingShader, "colorMap"), 0);
+        glUniform1i(glGetUniformLocation(g_normalMappingShader, "normalMap"), 1);
+        g_normalMappingAlphaLocation = glGetUniformLocation(g_normalMappingShader, "materialAlpha");
+
+        glUseProgram(0);
+
         if (!(g_nullTexture = CreateNullTexture(2, 2)))
             throw std::runtime_error("Failed to create null texture.");
     }
 
     if (__argc == 2)
-    {
         LoadModel(__argv[1]);
-        ResetCamera();
-    }
 }
 
 void InitGL()
@@ -893,6 +1247,7 @@ void InitGL()
     GL2Init();
 
     g_supportsProgrammablePipeline = GL2SupportsGLVersion(2, 0);
+    g_supportsBufferObjects = GL2SupportsGLVersion(1, 5);
 
     // Check for GL_EXT_texture_filter_anisotropic support.
     if (ExtensionSupported("GL_EXT_texture_filter_anisotropic"))
@@ -952,18 +1307,29 @@ GLuint LinkShaders(GLuint vertShader, GLuint fragShader)
 
 void LoadModel(const char *pszFilename)
 {
-    // Import the OBJ file and normalize to unit length.
-
-    SetCursor(LoadCursor(0, IDC_WAIT));
-
-    if (!g_model.import(pszFilename))
-    {
-        SetCursor(LoadCursor(0, IDC_ARROW));
-        throw std::runtime_error("Failed to load model.");
-    }
-
-    g_model.normalize();
+    // Import the OBJ file on a background thread. The current model is
+    // displayed until the new one has been imported. UpdateModelLoad() then
+    // swaps it in. Loading another file cancels the pending import. Each
+    // material is drawn with one call, the triangles are reordered for the
+    // GPU's post-transform vertex cache, and the vertices are then reordered
+    // to match. The meshes are also split into meshlets that are culled
+    // against the view frustum every frame. The worker also normalizes the
+    // model to unit length so the message loop isn't stalled by large files.
+
+    ModelOBJ::ImportOptions options;
+
+    options.mergeMeshesByMaterial = true;
+    options.optimizeVertexCache = true;
+    options.optimizeVertexFetch = true;
+    options.buildMeshlets = true;
+    options.normalize = true;
+
+    CancelModelLoad();
+    g_pModelImport = new ModelOBJ::AsyncImport(pszFilename, options);
+}
 
+void LoadModelTextures()
+{
     // Load any associated textures.
     // Note the path where the textures are assumed to be located.
 
@@ -1024,18 +1390,6 @@ void LoadModel(const char *pszFilename)
         if (textureId)
             g_modelTextures[pMaterial->bumpMapFilename] = textureId;
     }
-
-    SetCursor(LoadCursor(0, IDC_ARROW));
-
-    // Update the window caption.
-
-    std::ostringstream caption;
-    const char *pszBareFilename = strrchr(pszFilename, '\\');
-
-    pszBareFilename = (pszBareFilename != 0) ? ++pszBareFilename : pszFilename;
-    caption << APP_TITLE << " - " << pszBareFilename;
-
-    SetWindowText(g_hWnd, caption.str().c_str());
 }
 
 GLuint LoadShaderProgramFromResource(const char *pResouceId, std::string &infoLog)
@@ -1153,15 +1507,12 @@ void ProcessMenu(HWND hWnd, WPARAM wParam, LPARAM lParam)
         ofn.Flags = OFN_FILEMUSTEXIST | OFN_READONLY | OFN_PATHMUSTEXIST;
 
         if (GetOpenFileName(reinterpret_cast<LPOPENFILENAME>(&ofn)))
-        {
-            UnloadModel();
             LoadModel(szFilename);
-            ResetCamera();
-        }
 
         break;
 
     case MENU_FILE_CLOSE:	// ݱ ޴
+        CancelModelLoad();
         UnloadModel();
         break;
 
@@ -1468,6 +1819,35 @@ void ToggleFullScreen()
     }
 }
 
+void UnbindModelVertexArrays(bool bindTangents)
+{
+    if (bindTangents && g_model.hasTangents())
+    {
+        glClientActiveTexture(GL_TEXTURE1);
+        glDisableClientState(GL_TEXTURE_COORD_ARRAY);
+    }
+
+    if (g_model.hasNormals())
+        glDisableClientState(GL_NORMAL_ARRAY);
+
+    if (g_model.hasTextureCoords())
+    {
+        if (bindTangents)
+            glClientActiveTexture(GL_TEXTURE0);
+
+        glDisableClientState(GL_TEXTURE_COORD_ARRAY);
+    }
+
+    if (g_model.hasPositions())
+        glDisableClientState(GL_VERTEX_ARRAY);
+
+    if (g_modelIndexBuffer)
+        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+
+    if (g_modelVertexBuffer)
+        glBindBuffer(GL_ARRAY_BUFFER, 0);
+}
+
 
 // ε尡  ʾ 
 void UnloadModel()
@@ -1483,7 +1863,11 @@ void UnloadModel()
     }
 
     g_modelTextures.clear();
+    g_drawStates.clear();
+    g_renderQueue.clear();
+    DestroyModelBuffers();
     g_model.destroy();
+    g_modelName.clear();
 
     SetCursor(LoadCursor(0, IDC_ARROW));
     SetWindowText(g_hWnd, APP_TITLE);
@@ -1492,6 +1876,7 @@ void UnloadModel()
 void UpdateFrame(float elapsedTimeSec)
 {
     UpdateFrameRate(elapsedTimeSec);
+    UpdateModelLoad();
 }
 
 void UpdateFrameRate(float elapsedTimeSec)
@@ -1507,9 +1892,97 @@ void UpdateFrameRate(float elapsedTimeSec)
 
         frames = 0;
         accumTimeSec = 0.0f;
+
+        // Show the frame rate and the culling counters in the window
+        // caption, unless it's showing the progress of an import.
+
+        if (!g_pModelImport && !g_modelName.empty())
+        {
+            std::ostringstream caption;
+
+            caption << APP_TITLE << " - " << g_modelName
+                << " - " << g_framesPerSecond << " fps"
+                << " - meshes " << g_cullStats.meshesDrawn << " drawn, "
+                << g_cullStats.meshesCulled << " culled";
+
+            if (g_model.getNumberOfMeshlets() > 0)
+            {
+                caption << " - meshlets " << g_cullStats.meshletsDrawn << " drawn, "
+                    << g_cullStats.meshletsCulled << " culled";
+            }
+
+            SetWindowText(g_hWnd, caption.str().c_str());
+        }
     }
     else
     {
         ++frames;
     }
+}
+
+void UpdateModelLoad()
+{
+    if (!g_pModelImport)
+        return;
+
+    const char *pszFilename = g_pModelImport->getFilename().c_str();
+    const char *pszBareFilename = strrchr(pszFilename, '\\');
+
+    pszBareFilename = (pszBareFilename != 0) ? ++pszBareFilename : pszFilename;
+
+    if (!g_pModelImport->finished())
+    {
+        // Show the import's progress in the window caption.
+
+        const ModelOBJ::ImportProgress &progress = g_pModelImport->getProgress();
+        std::ostringstream caption;
+
+        caption << APP_TITLE << " - Loading " << pszBareFilename;
+
+        switch (progress.phase)
+        {
+        case ModelOBJ::PHASE_PARSING:
+            if (progress.bytesTotal > 0)
+                caption << " (reading " << progress.bytesParsed * 100 / progress.bytesTotal << "%)";
+            break;
+
+        case ModelOBJ::PHASE_BUILDING:
+            if (progress.trianglesTotal > 0)
+                caption << " (building " << static_cast<long long>(progress.trianglesBuilt) * 100 / progress.trianglesTotal << "%)";
+            break;
+
+        default:
+            caption << " (processing)";
+            break;
+        }
+
+        SetWindowText(g_hWnd, caption.str().c_str());
+        return;
+    }
+
+    std::string modelName = pszBareFilename;
+
+    if (!g_pModelImport->succeeded())
+    {
+        // Release the import before showing the error so the message box's
+        // own message loop can't re-enter this function.
+
+        std::string message = "Failed to load model " + modelName + ".";
+
+        CancelModelLoad();
+        MessageBox(g_hWnd, message.c_str(), "Error", MB_ICONSTOP);
+        return;
+    }
+
+    // Swap in the new model. It was normalized on the worker thread.
+
+    UnloadModel();
+    g_model.swap(g_pModelImport->getModel());
+    g_modelName = modelName;
+
+    CancelModelLoad();
+    CreateModelBuffers();
+    LoadModelTextures();
+    CreateRenderQueue();
+    ResetCamera();
 }
\ No newline at end of file
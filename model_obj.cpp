@@ -35,262 +35,6516 @@
 //
 //-----------------------------------------------------------------------------
 
+#if defined(_WIN32)
+#if !defined(WIN32_LEAN_AND_MEAN)
+#define WIN32_LEAN_AND_MEAN
+#endif
+#if !defined(NOMINMAX)
+#define NOMINMAX
+#endif
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
 #include <algorithm>
+#include <chrono>
+#include <clocale>
 #include <cmath>
+#include <cstdlib>
 #include <cstring>
+#include <functional>
+#include <iomanip>
+#include <istream>
 #include <limits>
+#include <locale>
+#include <sstream>
 #include <string>
+#include <thread>
 #include "model_obj.h"
 
-namespace
-{
-    bool MeshCompFunc(const ModelOBJ::Mesh &lhs, const ModelOBJ::Mesh &rhs)
+namespace
+{
+    typedef std::chrono::steady_clock Clock;
+
+    inline double MillisecondsSince(Clock::time_point start)
+    {
+        return std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+    }
+
+    inline size_t StringHeapBytes(const std::string &str)
+    {
+        return (str.capacity() >= sizeof(std::string)) ? str.capacity() + 1 : 0;
+    }
+
+    bool MeshCompFunc(const ModelOBJ::Mesh &lhs, const ModelOBJ::Mesh &rhs)
+    {
+        return lhs.pMaterial->alpha > rhs.pMaterial->alpha;
+    }
+
+    //-------------------------------------------------------------------------
+    // Hashing helpers for the open addressing caches used by addVertex().
+    //-------------------------------------------------------------------------
+
+    inline unsigned int MixHash(unsigned int hash)
+    {
+        hash ^= hash >> 16;
+        hash *= 0x85EBCA6BU;
+        hash ^= hash >> 13;
+        hash *= 0xC2B2AE35U;
+        hash ^= hash >> 16;
+        return hash;
+    }
+
+    inline unsigned int HashVertex(int v, int vt, int vn)
+    {
+        unsigned int hash = static_cast<unsigned int>(v) * 0x9E3779B1U;
+
+        hash ^= static_cast<unsigned int>(vt + 1) * 0x85EBCA77U;
+        hash ^= static_cast<unsigned int>(vn + 1) * 0xC2B2AE3DU;
+        return MixHash(hash);
+    }
+
+    inline int NextPowerOfTwo(int value)
+    {
+        int result = 1;
+
+        while (result < value)
+            result <<= 1;
+
+        return result;
+    }
+
+    int FindAttributeClass(const std::vector<float> &values, int size, int index,
+                           std::vector<int> &table)
+    {
+        // Returns the first attribute that is bitwise identical to attribute
+        // 'index'. 'table' is an open addressing hash table of these first
+        // attributes. All zero attributes are given the class -1, which is
+        // also the class of vertices that don't have the attribute at all.
+
+        const float *pValue = &values[index * size];
+        unsigned int bits = 0;
+        unsigned int hash = 2166136261U;
+        bool zero = true;
+
+        for (int i = 0; i < size; ++i)
+        {
+            memcpy(&bits, &pValue[i], sizeof(bits));
+            hash = (hash ^ bits) * 16777619U;
+            zero = zero && bits == 0;
+        }
+
+        if (zero)
+            return -1;
+
+        unsigned int mask = static_cast<unsigned int>(table.size()) - 1;
+        unsigned int slot = MixHash(hash) & mask;
+        int candidate = 0;
+
+        while ((candidate = table[slot]) != -1)
+        {
+            if (memcmp(&values[candidate * size], pValue, size * sizeof(float)) == 0)
+                return candidate;
+
+            slot = (slot + 1) & mask;
+        }
+
+        table[slot] = index;
+        return index;
+    }
+
+    //-------------------------------------------------------------------------
+    // Parallel LSD radix sort used by ModelOBJ::weldVertices().
+    //-------------------------------------------------------------------------
+
+    const int RADIX_BITS = 11;
+    const int RADIX_BUCKETS = 1 << RADIX_BITS;
+
+    struct SortItem
+    {
+        unsigned int key;
+        int corner;
+    };
+
+    inline void GetTaskRange(int count, int task, int numTasks, int &begin, int &end)
+    {
+        begin = static_cast<int>(static_cast<long long>(count) * task / numTasks);
+        end = static_cast<int>(static_cast<long long>(count) * (task + 1) / numTasks);
+    }
+
+    inline int GetThreadCount(int numThreads)
+    {
+        // 0 or less means one thread per core.
+
+        if (numThreads <= 0)
+            numThreads = std::max(1, static_cast<int>(std::thread::hardware_concurrency()));
+
+        return numThreads;
+    }
+
+    template <typename Task>
+    void RunTasks(int numTasks, Task task)
+    {
+        // Runs task(0) ... task(numTasks - 1) in parallel. Task 0 runs on
+        // the calling thread.
+
+        std::vector<std::thread> workers;
+
+        for (int i = 1; i < numTasks; ++i)
+            workers.push_back(std::thread(task, i));
+
+        task(0);
+
+        for (int i = 0; i < static_cast<int>(workers.size()); ++i)
+            workers[i].join();
+    }
+
+    void RadixSortPass(const SortItem *pSrc, SortItem *pDst, int count,
+                       int shift, int numTasks)
+    {
+        // Stable counting sort on RADIX_BITS bits of the keys. Each task
+        // counts its own block. Offsets are assigned bucket by bucket and
+        // then task by task so that equal digits keep their order.
+
+        std::vector<int> histograms(numTasks * RADIX_BUCKETS, 0);
+
+        RunTasks(numTasks, [&](int task)
+        {
+            int *pHistogram = &histograms[task * RADIX_BUCKETS];
+            int begin = 0;
+            int end = 0;
+
+            GetTaskRange(count, task, numTasks, begin, end);
+
+            for (int i = begin; i < end; ++i)
+                ++pHistogram[(pSrc[i].key >> shift) & (RADIX_BUCKETS - 1)];
+        });
+
+        int offset = 0;
+
+        for (int bucket = 0; bucket < RADIX_BUCKETS; ++bucket)
+        {
+            for (int task = 0; task < numTasks; ++task)
+            {
+                int &slot = histograms[task * RADIX_BUCKETS + bucket];
+                int size = slot;
+
+                slot = offset;
+                offset += size;
+            }
+        }
+
+        RunTasks(numTasks, [&](int task)
+        {
+            int *pOffsets = &histograms[task * RADIX_BUCKETS];
+            int begin = 0;
+            int end = 0;
+
+            GetTaskRange(count, task, numTasks, begin, end);
+
+            for (int i = begin; i < end; ++i)
+                pDst[pOffsets[(pSrc[i].key >> shift) & (RADIX_BUCKETS - 1)]++] = pSrc[i];
+        });
+    }
+
+    //-------------------------------------------------------------------------
+    // Vertex views for the post-processing passes. The normal and tangent
+    // passes are written once as templates and compiled for both the
+    // interleaved and the structure of arrays vertex storage. The simpler
+    // passes work on one component stream at a time so that their loops
+    // vectorize.
+    //-------------------------------------------------------------------------
+
+    struct InterleavedVertices
+    {
+        ModelOBJ::Vertex *pVertices;
+
+        float &position(int i, int k) const { return pVertices[i].position[k]; }
+        float &texCoord(int i, int k) const { return pVertices[i].texCoord[k]; }
+        float &normal(int i, int k) const { return pVertices[i].normal[k]; }
+        float &tangent(int i, int k) const { return pVertices[i].tangent[k]; }
+        float &bitangent(int i, int k) const { return pVertices[i].bitangent[k]; }
+    };
+
+    struct SeparateVertices
+    {
+        float *pStreams[ModelOBJ::NUMBER_OF_COMPONENTS];
+
+        float &position(int i, int k) const { return pStreams[ModelOBJ::COMPONENT_POSITION_X + k][i]; }
+        float &texCoord(int i, int k) const { return pStreams[ModelOBJ::COMPONENT_TEXCOORD_U + k][i]; }
+        float &normal(int i, int k) const { return pStreams[ModelOBJ::COMPONENT_NORMAL_X + k][i]; }
+        float &tangent(int i, int k) const { return pStreams[ModelOBJ::COMPONENT_TANGENT_X + k][i]; }
+        float &bitangent(int i, int k) const { return pStreams[ModelOBJ::COMPONENT_BITANGENT_X + k][i]; }
+    };
+
+    void StreamBounds(const float *pStream, int count, float &minimum, float &maximum)
+    {
+        // Four independent minimums and maximums so that the compiler can
+        // turn the main loop into packed min and max instructions without
+        // relaxed floating point rules.
+
+        float lo[4] = {minimum, minimum, minimum, minimum};
+        float hi[4] = {maximum, maximum, maximum, maximum};
+        int i = 0;
+
+        for (; i + 4 <= count; i += 4)
+        {
+            for (int k = 0; k < 4; ++k)
+            {
+                lo[k] = (pStream[i + k] < lo[k]) ? pStream[i + k] : lo[k];
+                hi[k] = (pStream[i + k] > hi[k]) ? pStream[i + k] : hi[k];
+            }
+        }
+
+        for (; i < count; ++i)
+        {
+            lo[0] = (pStream[i] < lo[0]) ? pStream[i] : lo[0];
+            hi[0] = (pStream[i] > hi[0]) ? pStream[i] : hi[0];
+        }
+
+        for (int k = 0; k < 4; ++k)
+        {
+            minimum = (lo[k] < minimum) ? lo[k] : minimum;
+            maximum = (hi[k] > maximum) ? hi[k] : maximum;
+        }
+    }
+
+    void ScaleStream(float *pStream, int count, float offset, float scaleFactor)
+    {
+        for (int i = 0; i < count; ++i)
+            pStream[i] = (pStream[i] + offset) * scaleFactor;
+    }
+
+    void NegateStream(float *pStream, int count)
+    {
+        for (int i = 0; i < count; ++i)
+            pStream[i] = -pStream[i];
+    }
+
+    template <class Vertices>
+    void GenerateNormalsSerial(const Vertices &vertices, const int *pIndices,
+                               int totalVertices, int totalTriangles)
+    {
+        const int *pTriangle = 0;
+        int i0 = 0;
+        int i1 = 0;
+        int i2 = 0;
+        float edge1[3] = {0.0f, 0.0f, 0.0f};
+        float edge2[3] = {0.0f, 0.0f, 0.0f};
+        float normal[3] = {0.0f, 0.0f, 0.0f};
+        float length = 0.0f;
+
+        // Initialize all the vertex normals.
+        for (int i = 0; i < totalVertices; ++i)
+        {
+            vertices.normal(i, 0) = 0.0f;
+            vertices.normal(i, 1) = 0.0f;
+            vertices.normal(i, 2) = 0.0f;
+        }
+
+        // Calculate the vertex normals.
+        for (int i = 0; i < totalTriangles; ++i)
+        {
+            pTriangle = &pIndices[i * 3];
+
+            i0 = pTriangle[0];
+            i1 = pTriangle[1];
+            i2 = pTriangle[2];
+
+            // Calculate triangle face normal.
+
+            edge1[0] = vertices.position(i1, 0) - vertices.position(i0, 0);
+            edge1[1] = vertices.position(i1, 1) - vertices.position(i0, 1);
+            edge1[2] = vertices.position(i1, 2) - vertices.position(i0, 2);
+
+            edge2[0] = vertices.position(i2, 0) - vertices.position(i0, 0);
+            edge2[1] = vertices.position(i2, 1) - vertices.position(i0, 1);
+            edge2[2] = vertices.position(i2, 2) - vertices.position(i0, 2);
+
+            normal[0] = (edge1[1] * edge2[2]) - (edge1[2] * edge2[1]);
+            normal[1] = (edge1[2] * edge2[0]) - (edge1[0] * edge2[2]);
+            normal[2] = (edge1[0] * edge2[1]) - (edge1[1] * edge2[0]);
+
+            // Accumulate the normals.
+
+            vertices.normal(i0, 0) += normal[0];
+            vertices.normal(i0, 1) += normal[1];
+            vertices.normal(i0, 2) += normal[2];
+
+            vertices.normal(i1, 0) += normal[0];
+            vertices.normal(i1, 1) += normal[1];
+            vertices.normal(i1, 2) += normal[2];
+
+            vertices.normal(i2, 0) += normal[0];
+            vertices.normal(i2, 1) += normal[1];
+            vertices.normal(i2, 2) += normal[2];
+        }
+
+        // Normalize the vertex normals.
+        for (int i = 0; i < totalVertices; ++i)
+        {
+            length = 1.0f / sqrtf(vertices.normal(i, 0) * vertices.normal(i, 0) +
+                vertices.normal(i, 1) * vertices.normal(i, 1) +
+                vertices.normal(i, 2) * vertices.normal(i, 2));
+
+            vertices.normal(i, 0) *= length;
+            vertices.normal(i, 1) *= length;
+            vertices.normal(i, 2) *= length;
+        }
+    }
+
+    struct VertexWindow
+    {
+        int first;                  // first vertex the task's triangles use
+        int last;                   // last vertex the task's triangles use
+        std::vector<float> sums;    // per vertex sums for vertices [first, last]
+    };
+
+    inline void FindVertexWindow(const int *pIndices, int begin, int end, VertexWindow &window)
+    {
+        // Finds the range of vertices used by triangles [begin, end).
+
+        window.first = std::numeric_limits<int>::max();
+        window.last = -1;
+
+        for (int i = begin * 3; i < end * 3; ++i)
+        {
+            window.first = std::min(window.first, pIndices[i]);
+            window.last = std::max(window.last, pIndices[i]);
+        }
+    }
+
+    int FindVertexWindows(const int *pIndices, int totalVertices, int totalTriangles,
+                          int numThreads, std::vector<VertexWindow> &windows)
+    {
+        // Splits the triangles into one block per task and finds the window
+        // of vertices each block uses. Returns the number of blocks. Small
+        // meshes, and meshes whose blocks share so many vertices that the
+        // windows would take up too much memory, get a single block with a
+        // window covering every vertex.
+
+        const int minTrianglesPerTask = 64 * 1024;
+        int numTasks = std::max(1, std::min(numThreads, totalTriangles / minTrianglesPerTask));
+        long long windowSizes = 0;
+
+        windows.resize(numTasks);
+
+        if (numTasks > 1)
+        {
+            RunTasks(numTasks, [&](int task)
+            {
+                int begin = 0;
+                int end = 0;
+
+                GetTaskRange(totalTriangles, task, numTasks, begin, end);
+                FindVertexWindow(pIndices, begin, end, windows[task]);
+            });
+
+            for (int i = 0; i < numTasks; ++i)
+                windowSizes += std::max(0, windows[i].last - windows[i].first + 1);
+
+            if (windowSizes <= 2LL * totalVertices)
+                return numTasks;
+        }
+
+        windows.resize(1);
+        windows[0].first = 0;
+        windows[0].last = totalVertices - 1;
+        return 1;
+    }
+
+    template <class Vertices>
+    void GenerateNormalsParallel(const Vertices &vertices, const int *pIndices,
+                                 int totalVertices, int totalTriangles,
+                                 std::vector<VertexWindow> &windows)
+    {
+        // Each task adds the face normals of its own block of triangles into
+        // a private window covering just the vertices those triangles use.
+        // Since the vertices are numbered in the order the triangles first
+        // use them, the windows are small and mostly don't overlap. The
+        // windows are then added together per vertex and normalized. A
+        // vertex used by a single task gets exactly the serial result. Only
+        // vertices shared by two blocks are summed in a different order.
+
+        int numTasks = static_cast<int>(windows.size());
+
+        RunTasks(numTasks, [&](int task)
+        {
+            VertexWindow &window = windows[task];
+            const int *pTriangle = 0;
+            float edge1[3] = {0.0f, 0.0f, 0.0f};
+            float edge2[3] = {0.0f, 0.0f, 0.0f};
+            float normal[3] = {0.0f, 0.0f, 0.0f};
+            float *pSum = 0;
+            int begin = 0;
+            int end = 0;
+
+            GetTaskRange(totalTriangles, task, numTasks, begin, end);
+
+            if (window.last < window.first)
+                return;
+
+            window.sums.assign((window.last - window.first + 1) * 3, 0.0f);
+
+            for (int i = begin; i < end; ++i)
+            {
+                pTriangle = &pIndices[i * 3];
+
+                edge1[0] = vertices.position(pTriangle[1], 0) - vertices.position(pTriangle[0], 0);
+                edge1[1] = vertices.position(pTriangle[1], 1) - vertices.position(pTriangle[0], 1);
+                edge1[2] = vertices.position(pTriangle[1], 2) - vertices.position(pTriangle[0], 2);
+
+                edge2[0] = vertices.position(pTriangle[2], 0) - vertices.position(pTriangle[0], 0);
+                edge2[1] = vertices.position(pTriangle[2], 1) - vertices.position(pTriangle[0], 1);
+                edge2[2] = vertices.position(pTriangle[2], 2) - vertices.position(pTriangle[0], 2);
+
+                normal[0] = (edge1[1] * edge2[2]) - (edge1[2] * edge2[1]);
+                normal[1] = (edge1[2] * edge2[0]) - (edge1[0] * edge2[2]);
+                normal[2] = (edge1[0] * edge2[1]) - (edge1[1] * edge2[0]);
+
+                for (int k = 0; k < 3; ++k)
+                {
+                    pSum = &window.sums[(pTriangle[k] - window.first) * 3];
+                    pSum[0] += normal[0];
+                    pSum[1] += normal[1];
+                    pSum[2] += normal[2];
+                }
+            }
+        });
+
+        RunTasks(numTasks, [&](int task)
+        {
+            const float *pSum = 0;
+            float normal[3] = {0.0f, 0.0f, 0.0f};
+            float length = 0.0f;
+            int begin = 0;
+            int end = 0;
+
+            GetTaskRange(totalVertices, task, numTasks, begin, end);
+
+            for (int i = begin; i < end; ++i)
+            {
+                normal[0] = normal[1] = normal[2] = 0.0f;
+
+                for (int j = 0; j < numTasks; ++j)
+                {
+                    if (i < windows[j].first || i > windows[j].last)
+                        continue;
+
+                    pSum = &windows[j].sums[(i - windows[j].first) * 3];
+                    normal[0] += pSum[0];
+                    normal[1] += pSum[1];
+                    normal[2] += pSum[2];
+                }
+
+                length = 1.0f / sqrtf(normal[0] * normal[0] +
+                    normal[1] * normal[1] +
+                    normal[2] * normal[2]);
+
+                vertices.normal(i, 0) = normal[0] * length;
+                vertices.normal(i, 1) = normal[1] * length;
+                vertices.normal(i, 2) = normal[2] * length;
+            }
+        });
+    }
+
+    template <class Vertices>
+    void GenerateNormals(const Vertices &vertices, const int *pIndices,
+                         int totalVertices, int totalTriangles, int numThreads)
+    {
+        // The serial version needs no windows, so it's used when the mesh
+        // can't be split.
+
+        std::vector<VertexWindow> windows;
+
+        if (FindVertexWindows(pIndices, totalVertices, totalTriangles, numThreads, windows) > 1)
+            GenerateNormalsParallel(vertices, pIndices, totalVertices, totalTriangles, windows);
+        else
+            GenerateNormalsSerial(vertices, pIndices, totalVertices, totalTriangles);
+    }
+
+    // Floats summed per vertex by the tangent generators.
+    const int TANGENT_SUMS = 6;
+
+    template <class Vertices>
+    void AddFaceTangents(const Vertices &vertices, const int *pTriangle, float *pSums[3])
+    {
+        // Adds the triangle's texture space tangent and bitangent to each of
+        // its vertices.
+
+        float edge1[3] = {0.0f, 0.0f, 0.0f};
+        float edge2[3] = {0.0f, 0.0f, 0.0f};
+        float texEdge1[2] = {0.0f, 0.0f};
+        float texEdge2[2] = {0.0f, 0.0f};
+        float tangent[3] = {0.0f, 0.0f, 0.0f};
+        float bitangent[3] = {0.0f, 0.0f, 0.0f};
+        float det = 0.0f;
+
+        for (int k = 0; k < 3; ++k)
+        {
+            edge1[k] = vertices.position(pTriangle[1], k) - vertices.position(pTriangle[0], k);
+            edge2[k] = vertices.position(pTriangle[2], k) - vertices.position(pTriangle[0], k);
+        }
+
+        texEdge1[0] = vertices.texCoord(pTriangle[1], 0) - vertices.texCoord(pTriangle[0], 0);
+        texEdge1[1] = vertices.texCoord(pTriangle[1], 1) - vertices.texCoord(pTriangle[0], 1);
+
+        texEdge2[0] = vertices.texCoord(pTriangle[2], 0) - vertices.texCoord(pTriangle[0], 0);
+        texEdge2[1] = vertices.texCoord(pTriangle[2], 1) - vertices.texCoord(pTriangle[0], 1);
+
+        det = texEdge1[0] * texEdge2[1] - texEdge2[0] * texEdge1[1];
+
+        if (fabs(det) < 1e-6f)
+        {
+            tangent[0] = 1.0f;
+            tangent[1] = 0.0f;
+            tangent[2] = 0.0f;
+
+            bitangent[0] = 0.0f;
+            bitangent[1] = 1.0f;
+            bitangent[2] = 0.0f;
+        }
+        else
+        {
+            det = 1.0f / det;
+
+            for (int k = 0; k < 3; ++k)
+            {
+                tangent[k] = (texEdge2[1] * edge1[k] - texEdge1[1] * edge2[k]) * det;
+                bitangent[k] = (-texEdge2[0] * edge1[k] + texEdge1[0] * edge2[k]) * det;
+            }
+        }
+
+        for (int corner = 0; corner < 3; ++corner)
+        {
+            for (int k = 0; k < 3; ++k)
+            {
+                pSums[corner][k] += tangent[k];
+                pSums[corner][k + 3] += bitangent[k];
+            }
+        }
+    }
+
+    template <class Vertices>
+    void FinishFaceTangent(const Vertices &vertices, int i, const float *pSum,
+                           bool storeBitangent)
+    {
+        float tangent[3] = {pSum[0], pSum[1], pSum[2]};
+        float bitangent[3] = {0.0f, 0.0f, 0.0f};
+        float nDotT = 0.0f;
+        float bDotB = 0.0f;
+        float length = 0.0f;
+
+        // Gram-Schmidt orthogonalize tangent with normal.
+
+        nDotT = vertices.normal(i, 0) * tangent[0] +
+                vertices.normal(i, 1) * tangent[1] +
+                vertices.normal(i, 2) * tangent[2];
+
+        tangent[0] -= vertices.normal(i, 0) * nDotT;
+        tangent[1] -= vertices.normal(i, 1) * nDotT;
+        tangent[2] -= vertices.normal(i, 2) * nDotT;
+
+        // Normalize the tangent.
+
+        length = 1.0f / sqrtf(tangent[0] * tangent[0] +
+                              tangent[1] * tangent[1] +
+                              tangent[2] * tangent[2]);
+
+        tangent[0] *= length;
+        tangent[1] *= length;
+        tangent[2] *= length;
+
+        // Calculate the handedness of the local tangent space. The
+        // bitangent vector is the cross product between the triangle face
+        // normal vector and the calculated tangent vector. The resulting
+        // bitangent vector should be the same as the bitangent vector
+        // calculated from the set of linear equations above. If they point
+        // in different directions then we need to invert the cross product
+        // calculated bitangent vector. We store this scalar multiplier in
+        // the tangent vector's 'w' component so that the correct bitangent
+        // vector can be generated in the normal mapping shader's vertex
+        // shader.
+        //
+        // Normal maps have a left handed coordinate system with the origin
+        // located at the top left of the normal map texture. The x
+        // coordinates run horizontally from left to right. The y
+        // coordinates run vertically from top to bottom. The z coordinates
+        // run out of the normal map texture towards the viewer. Our
+        // handedness calculations must take this fact into account as well
+        // so that the normal mapping shader's vertex shader will generate
+        // the correct bitangent vectors. Some normal map authoring tools
+        // such as Crazybump (http://www.crazybump.com/) includes options to
+        // allow you to control the orientation of the normal map normal's
+        // y-axis.
+
+        bitangent[0] = (vertices.normal(i, 1) * tangent[2]) -
+                       (vertices.normal(i, 2) * tangent[1]);
+        bitangent[1] = (vertices.normal(i, 2) * tangent[0]) -
+                       (vertices.normal(i, 0) * tangent[2]);
+        bitangent[2] = (vertices.normal(i, 0) * tangent[1]) -
+                       (vertices.normal(i, 1) * tangent[0]);
+
+        bDotB = bitangent[0] * pSum[3] +
+                bitangent[1] * pSum[4] +
+                bitangent[2] * pSum[5];
+
+        vertices.tangent(i, 0) = tangent[0];
+        vertices.tangent(i, 1) = tangent[1];
+        vertices.tangent(i, 2) = tangent[2];
+        vertices.tangent(i, 3) = (bDotB < 0.0f) ? 1.0f : -1.0f;
+
+        if (storeBitangent)
+        {
+            vertices.bitangent(i, 0) = bitangent[0];
+            vertices.bitangent(i, 1) = bitangent[1];
+            vertices.bitangent(i, 2) = bitangent[2];
+        }
+    }
+
+    inline float ProjectAndNormalize(const float normal[3], float v[3])
+    {
+        // Removes the part of v along the unit normal and normalizes what's
+        // left. Returns the length before normalizing, or 0 (leaving v zero) if
+        // nothing is left.
+
+        float nDotV = normal[0] * v[0] + normal[1] * v[1] + normal[2] * v[2];
+
+        for (int k = 0; k < 3; ++k)
+            v[k] -= normal[k] * nDotV;
+
+        float length = sqrtf(v[0] * v[0] + v[1] * v[1] + v[2] * v[2]);
+
+        if (length <= std::numeric_limits<float>::min())
+        {
+            v[0] = v[1] = v[2] = 0.0f;
+            return 0.0f;
+        }
+
+        v[0] /= length;
+        v[1] /= length;
+        v[2] /= length;
+        return length;
+    }
+
+    template <class Vertices>
+    int TexCoordOrientation(const Vertices &vertices, const int *pTriangle)
+    {
+        // Returns 1 if the texture mapping preserves the triangle's
+        // orientation, -1 if it mirrors it, and 0 if the triangle has no
+        // texture space area.
+
+        float t21[2] = {0.0f, 0.0f};
+        float t31[2] = {0.0f, 0.0f};
+
+        for (int k = 0; k < 2; ++k)
+        {
+            t21[k] = vertices.texCoord(pTriangle[1], k) - vertices.texCoord(pTriangle[0], k);
+            t31[k] = vertices.texCoord(pTriangle[2], k) - vertices.texCoord(pTriangle[0], k);
+        }
+
+        float signedArea = t21[0] * t31[1] - t21[1] * t31[0];
+
+        if (fabsf(signedArea) <= std::numeric_limits<float>::min())
+            return 0;
+
+        return (signedArea > 0.0f) ? 1 : -1;
+    }
+
+    template <class Vertices>
+    void AddMikkTSpaceTangents(const Vertices &vertices, const int *pTriangle, float *pSums[3])
+    {
+        // Adds the triangle's tangent to each of its vertices the way
+        // MikkTSpace does: the unit face tangent is projected onto the plane
+        // of the vertex normal and weighted by the angle of the triangle at
+        // that vertex. The angle is also added, signed by whether the
+        // texture mapping preserves the triangle's orientation. Triangles
+        // without texture space area don't contribute.
+
+        float edge1[3] = {0.0f, 0.0f, 0.0f};
+        float edge2[3] = {0.0f, 0.0f, 0.0f};
+        float faceTangent[3] = {0.0f, 0.0f, 0.0f};
+        float tangent[3] = {0.0f, 0.0f, 0.0f};
+        float normal[3] = {0.0f, 0.0f, 0.0f};
+        float toPrev[3] = {0.0f, 0.0f, 0.0f};
+        float toNext[3] = {0.0f, 0.0f, 0.0f};
+
+        float t21[2] = {0.0f, 0.0f};
+        float t31[2] = {0.0f, 0.0f};
+
+        for (int k = 0; k < 3; ++k)
+        {
+            edge1[k] = vertices.position(pTriangle[1], k) - vertices.position(pTriangle[0], k);
+            edge2[k] = vertices.position(pTriangle[2], k) - vertices.position(pTriangle[0], k);
+        }
+
+        for (int k = 0; k < 2; ++k)
+        {
+            t21[k] = vertices.texCoord(pTriangle[1], k) - vertices.texCoord(pTriangle[0], k);
+            t31[k] = vertices.texCoord(pTriangle[2], k) - vertices.texCoord(pTriangle[0], k);
+        }
+
+        int sign = TexCoordOrientation(vertices, pTriangle);
+
+        if (sign == 0)
+            return;
+
+        float orientation = static_cast<float>(sign);
+
+        for (int k = 0; k < 3; ++k)
+            faceTangent[k] = (t31[1] * edge1[k] - t21[1] * edge2[k]) * orientation;
+
+        for (int corner = 0; corner < 3; ++corner)
+        {
+            int vertex = pTriangle[corner];
+            int prev = pTriangle[(corner + 2) % 3];
+            int next = pTriangle[(corner + 1) % 3];
+
+            for (int k = 0; k < 3; ++k)
+            {
+                normal[k] = vertices.normal(vertex, k);
+                tangent[k] = faceTangent[k];
+                toPrev[k] = vertices.position(prev, k) - vertices.position(vertex, k);
+                toNext[k] = vertices.position(next, k) - vertices.position(vertex, k);
+            }
+
+            ProjectAndNormalize(normal, tangent);
+            ProjectAndNormalize(normal, toPrev);
+            ProjectAndNormalize(normal, toNext);
+
+            float cosine = toPrev[0] * toNext[0] + toPrev[1] * toNext[1] + toPrev[2] * toNext[2];
+            float angle = acosf(std::min(std::max(cosine, -1.0f), 1.0f));
+
+            pSums[corner][0] += tangent[0] * angle;
+            pSums[corner][1] += tangent[1] * angle;
+            pSums[corner][2] += tangent[2] * angle;
+            pSums[corner][3] += orientation * angle;
+        }
+    }
+
+    template <class Vertices>
+    void FinishMikkTSpaceTangent(const Vertices &vertices, int i, const float *pSum,
+                                 bool storeBitangent)
+    {
+        // The summed tangent already lies in the plane of the normal. Vertices
+        // without a usable tangent get one perpendicular to the normal. The
+        // mirrored vertices have been split, so all of a vertex's triangles
+        // have the orientation in the sign of pSum[3]. w uses the same top
+        // left origin convention as FinishFaceTangent(): -1 where the texture
+        // mapping preserves the orientation. The bitangent is the one the
+        // normal mapping shader rebuilds, w * cross(normal, tangent).
+
+        float normal[3] = {vertices.normal(i, 0), vertices.normal(i, 1), vertices.normal(i, 2)};
+        float tangent[3] = {pSum[0], pSum[1], pSum[2]};
+        float w = (pSum[3] < 0.0f) ? 1.0f : -1.0f;
+
+        if (ProjectAndNormalize(normal, tangent) == 0.0f)
+        {
+            tangent[0] = (fabsf(normal[0]) < 0.9f) ? 1.0f : 0.0f;
+            tangent[1] = (fabsf(normal[0]) < 0.9f) ? 0.0f : 1.0f;
+            tangent[2] = 0.0f;
+
+            ProjectAndNormalize(normal, tangent);
+        }
+
+        vertices.tangent(i, 0) = tangent[0];
+        vertices.tangent(i, 1) = tangent[1];
+        vertices.tangent(i, 2) = tangent[2];
+        vertices.tangent(i, 3) = w;
+
+        if (storeBitangent)
+        {
+            vertices.bitangent(i, 0) = w * (normal[1] * tangent[2] - normal[2] * tangent[1]);
+            vertices.bitangent(i, 1) = w * (normal[2] * tangent[0] - normal[0] * tangent[2]);
+            vertices.bitangent(i, 2) = w * (normal[0] * tangent[1] - normal[1] * tangent[0]);
+        }
+    }
+
+    template <class Vertices>
+    void GenerateTangents(const Vertices &vertices, const int *pIndices,
+                          int totalVertices, int totalTriangles, int numThreads,
+                          bool mikkTSpace, bool storeBitangents)
+    {
+        // Each task sums the tangents of its block of triangles into its
+        // vertex window, then the windows are added together per vertex and
+        // each vertex's tangent is finished. Vertices used by a single block
+        // get the same tangent as summing all the triangles in order would.
+
+        std::vector<VertexWindow> windows;
+        int numTasks = FindVertexWindows(pIndices, totalVertices, totalTriangles, numThreads, windows);
+
+        RunTasks(numTasks, [&](int task)
+        {
+            VertexWindow &window = windows[task];
+            const int *pTriangle = 0;
+            float *pSums[3] = {0, 0, 0};
+            int begin = 0;
+            int end = 0;
+
+            GetTaskRange(totalTriangles, task, numTasks, begin, end);
+
+            if (window.last < window.first)
+                return;
+
+            window.sums.assign((window.last - window.first + 1) * TANGENT_SUMS, 0.0f);
+
+            for (int i = begin; i < end; ++i)
+            {
+                pTriangle = &pIndices[i * 3];
+
+                for (int k = 0; k < 3; ++k)
+                    pSums[k] = &window.sums[(pTriangle[k] - window.first) * TANGENT_SUMS];
+
+                if (mikkTSpace)
+                    AddMikkTSpaceTangents(vertices, pTriangle, pSums);
+                else
+                    AddFaceTangents(vertices, pTriangle, pSums);
+            }
+        });
+
+        RunTasks(numTasks, [&](int task)
+        {
+            const float *pWindowSum = 0;
+            float sum[TANGENT_SUMS];
+            int begin = 0;
+            int end = 0;
+
+            GetTaskRange(totalVertices, task, numTasks, begin, end);
+
+            for (int i = begin; i < end; ++i)
+            {
+                for (int k = 0; k < TANGENT_SUMS; ++k)
+                    sum[k] = 0.0f;
+
+                for (int j = 0; j < numTasks; ++j)
+                {
+                    if (i < windows[j].first || i > windows[j].last)
+                        continue;
+
+                    pWindowSum = &windows[j].sums[(i - windows[j].first) * TANGENT_SUMS];
+
+                    for (int k = 0; k < TANGENT_SUMS; ++k)
+                        sum[k] += pWindowSum[k];
+                }
+
+                if (mikkTSpace)
+                    FinishMikkTSpaceTangent(vertices, i, sum, storeBitangents);
+                else
+                    FinishFaceTangent(vertices, i, sum, storeBitangents);
+            }
+        });
+    }
+
+    template <class Vertices>
+    void FindTexCoordOrientations(const Vertices &vertices, const int *pIndices,
+                                  int totalTriangles, int numThreads,
+                                  std::vector<signed char> &orientations)
+    {
+        // Stores TexCoordOrientation() for each triangle.
+
+        orientations.resize(totalTriangles);
+
+        int numTasks = std::max(1, std::min(numThreads, totalTriangles / 4096));
+
+        RunTasks(numTasks, [&](int task)
+        {
+            int begin = 0;
+            int end = 0;
+
+            GetTaskRange(totalTriangles, task, numTasks, begin, end);
+
+            for (int i = begin; i < end; ++i)
+                orientations[i] = static_cast<signed char>(TexCoordOrientation(vertices, &pIndices[i * 3]));
+        });
+    }
+
+    //-------------------------------------------------------------------------
+    // Post-transform vertex cache optimization used by
+    // ModelOBJ::optimizeVertexCache(). Triangles are reordered with Tom
+    // Forsyth's linear speed algorithm: each vertex is scored by its position
+    // in a simulated LRU cache and by how many unemitted triangles still use
+    // it, and the triangle whose vertices score highest is emitted next.
+    //-------------------------------------------------------------------------
+
+    const int VERTEX_CACHE_SIZE = 32;   // LRU cache simulated while reordering
+    const int VERTEX_FIFO_SIZE = 16;    // FIFO cache used to measure ACMR and ATVR
+    const int VERTEX_VALENCE_SCORES = 32;
+
+    struct VertexCacheScratch
+    {
+        // Per vertex arrays cover the whole vertex buffer. Only the current
+        // mesh's vertices are touched and they're reset after each mesh.
+
+        std::vector<int> valence;           // unemitted triangles using the vertex
+        std::vector<int> firstTriangle;     // start of the vertex's triangle list
+        std::vector<int> cachePosition;     // -1 if not in the LRU cache
+        std::vector<float> score;
+        std::vector<int> fifoTime;          // miss count when the vertex was loaded
+
+        std::vector<int> vertices;          // vertices used by the mesh
+        std::vector<int> triangles;         // triangle lists of the vertices
+        std::vector<float> triangleScore;
+        std::vector<char> emitted;
+        std::vector<int> output;
+
+        float cacheScores[VERTEX_CACHE_SIZE];
+        float valenceScores[VERTEX_VALENCE_SCORES];
+
+        void init(int numVertices);
+    };
+
+    void VertexCacheScratch::init(int numVertices)
+    {
+        const float cacheDecayPower = 1.5f;
+        const float lastTriangleScore = 0.75f;
+        const float valenceBoostScale = 2.0f;
+        const float valenceBoostPower = 0.5f;
+
+        valence.assign(numVertices, 0);
+        firstTriangle.assign(numVertices, 0);
+        cachePosition.assign(numVertices, -1);
+        score.assign(numVertices, 0.0f);
+        fifoTime.assign(numVertices, -1);
+
+        // The vertices of the last triangle get a fixed score a little lower
+        // than the next few cache entries so that the order doesn't keep
+        // going back to the triangle that was just emitted.
+
+        for (int i = 0; i < VERTEX_CACHE_SIZE; ++i)
+        {
+            if (i < 3)
+                cacheScores[i] = lastTriangleScore;
+            else
+                cacheScores[i] = powf(1.0f - (i - 3) * (1.0f / (VERTEX_CACHE_SIZE - 3)), cacheDecayPower);
+        }
+
+        // Vertices with few triangles left are boosted so that they're
+        // finished off rather than left behind as lone triangles. Valences
+        // past the end of the table use the last entry.
+
+        valenceScores[0] = 0.0f;
+
+        for (int i = 1; i < VERTEX_VALENCE_SCORES; ++i)
+            valenceScores[i] = valenceBoostScale * powf(static_cast<float>(i), -valenceBoostPower);
+    }
+
+    inline float VertexCacheScore(const VertexCacheScratch &scratch, int vertex)
+    {
+        int valence = scratch.valence[vertex];
+        int position = scratch.cachePosition[vertex];
+        float score = 0.0f;
+
+        if (valence == 0)
+            return -1.0f;
+
+        if (position >= 0)
+            score = scratch.cacheScores[position];
+
+        return score + scratch.valenceScores[std::min(valence, VERTEX_VALENCE_SCORES - 1)];
+    }
+
+    int MeasureVertexCache(const int *pIndices, int numTriangles,
+                           VertexCacheScratch &scratch, int &vertices)
+    {
+        // Returns the number of vertices a FIFO post-transform cache would
+        // have to transform to draw the triangles, and the number of
+        // distinct vertices they use. A vertex is in the cache if fewer
+        // than VERTEX_FIFO_SIZE misses happened since it was loaded.
+
+        int numMisses = 0;
+        int vertex = 0;
+
+        vertices = 0;
+
+        for (int i = 0; i < numTriangles * 3; ++i)
+        {
+            vertex = pIndices[i];
+
+            if (scratch.fifoTime[vertex] < 0)
+            {
+                scratch.vertices.push_back(vertex);
+                ++vertices;
+            }
+            else if (numMisses - scratch.fifoTime[vertex] < VERTEX_FIFO_SIZE)
+            {
+                continue;
+            }
+
+            scratch.fifoTime[vertex] = numMisses++;
+        }
+
+        for (int i = 0; i < static_cast<int>(scratch.vertices.size()); ++i)
+            scratch.fifoTime[scratch.vertices[i]] = -1;
+
+        scratch.vertices.clear();
+        return numMisses;
+    }
+
+    void OptimizeVertexCache(int *pIndices, int numTriangles, VertexCacheScratch &scratch)
+    {
+        int cache[VERTEX_CACHE_SIZE + 3];
+        int newCache[VERTEX_CACHE_SIZE + 3];
+        int cacheSize = 0;
+        int newCacheSize = 0;
+        int vertex = 0;
+        int offset = 0;
+
+        // Build the list of triangles using each vertex. The list offsets
+        // are filled in from the end so that they end up at the start.
+
+        for (int i = 0; i < numTriangles * 3; ++i)
+        {
+            if (scratch.valence[pIndices[i]]++ == 0)
+                scratch.vertices.push_back(pIndices[i]);
+        }
+
+        for (int i = 0; i < static_cast<int>(scratch.vertices.size()); ++i)
+        {
+            vertex = scratch.vertices[i];
+            offset += scratch.valence[vertex];
+            scratch.firstTriangle[vertex] = offset;
+        }
+
+        scratch.triangles.resize(numTriangles * 3);
+
+        for (int i = 0; i < numTriangles * 3; ++i)
+            scratch.triangles[--scratch.firstTriangle[pIndices[i]]] = i / 3;
+
+        for (int i = 0; i < static_cast<int>(scratch.vertices.size()); ++i)
+            scratch.score[scratch.vertices[i]] = VertexCacheScore(scratch, scratch.vertices[i]);
+
+        scratch.triangleScore.resize(numTriangles);
+        scratch.emitted.assign(numTriangles, 0);
+        scratch.output.resize(numTriangles * 3);
+
+        int bestTriangle = 0;
+        int nextTriangle = 0;
+
+        for (int i = 0; i < numTriangles; ++i)
+        {
+            scratch.triangleScore[i] = scratch.score[pIndices[i * 3]] +
+                                       scratch.score[pIndices[i * 3 + 1]] +
+                                       scratch.score[pIndices[i * 3 + 2]];
+
+            if (scratch.triangleScore[i] > scratch.triangleScore[bestTriangle])
+                bestTriangle = i;
+        }
+
+        for (int emitted = 0; emitted < numTriangles; ++emitted)
+        {
+            // When no triangle touches the cache, carry on with the next
+            // triangle in the original order.
+
+            if (bestTriangle < 0)
+            {
+                while (scratch.emitted[nextTriangle])
+                    ++nextTriangle;
+
+                bestTriangle = nextTriangle;
+            }
+
+            const int *pTriangle = &pIndices[bestTriangle * 3];
+
+            scratch.emitted[bestTriangle] = 1;
+            memcpy(&scratch.output[emitted * 3], pTriangle, 3 * sizeof(int));
+
+            // Remove the triangle from its vertices' triangle lists and put
+            // its vertices at the front of the cache.
+
+            newCacheSize = 0;
+
+            for (int k = 0; k < 3; ++k)
+            {
+                vertex = pTriangle[k];
+
+                int *pFirst = &scratch.triangles[scratch.firstTriangle[vertex]];
+                int *pLast = pFirst + --scratch.valence[vertex];
+
+                *std::find(pFirst, pLast, bestTriangle) = *pLast;
+
+                if (std::find(newCache, newCache + newCacheSize, vertex) == newCache + newCacheSize)
+                    newCache[newCacheSize++] = vertex;
+            }
+
+            for (int i = 0; i < cacheSize; ++i)
+            {
+                if (cache[i] != pTriangle[0] && cache[i] != pTriangle[1] && cache[i] != pTriangle[2])
+                    newCache[newCacheSize++] = cache[i];
+            }
+
+            // Rescore the vertices whose cache position changed, including
+            // the ones pushed out, and the triangles they're still used by.
+
+            bestTriangle = -1;
+
+            for (int i = 0; i < newCacheSize; ++i)
+            {
+                vertex = newCache[i];
+                scratch.cachePosition[vertex] = (i < VERTEX_CACHE_SIZE) ? i : -1;
+                scratch.score[vertex] = VertexCacheScore(scratch, vertex);
+            }
+
+            for (int i = 0; i < newCacheSize; ++i)
+            {
+                vertex = newCache[i];
+
+                const int *pFirst = &scratch.triangles[scratch.firstTriangle[vertex]];
+
+                for (int j = 0; j < scratch.valence[vertex]; ++j)
+                {
+                    int triangle = pFirst[j];
+
+                    scratch.triangleScore[triangle] = scratch.score[pIndices[triangle * 3]] +
+                                                      scratch.score[pIndices[triangle * 3 + 1]] +
+                                                      scratch.score[pIndices[triangle * 3 + 2]];
+
+                    if (bestTriangle < 0 ||
+                        scratch.triangleScore[triangle] > scratch.triangleScore[bestTriangle])
+                    {
+                        bestTriangle = triangle;
+                    }
+                }
+            }
+
+            cacheSize = std::min(newCacheSize, VERTEX_CACHE_SIZE);
+            memcpy(cache, newCache, cacheSize * sizeof(int));
+        }
+
+        memcpy(pIndices, &scratch.output[0], numTriangles * 3 * sizeof(int));
+
+        for (int i = 0; i < static_cast<int>(scratch.vertices.size()); ++i)
+            scratch.cachePosition[scratch.vertices[i]] = -1;
+
+        scratch.vertices.clear();
+    }
+
+    //-------------------------------------------------------------------------
+    // Vertex fetch helpers used by ModelOBJ::optimizeVertexFetch().
+    //-------------------------------------------------------------------------
+
+    const int FETCH_LINE_SIZE = 64;         // bytes per cache line
+    const int FETCH_CACHE_LINES = 256;      // 16 KB FIFO cache of lines
+
+    float AnalyzeVertexFetch(const int *pIndices, int numIndices, int numVertices,
+                             int vertexSize)
+    {
+        // Returns the bytes of cache lines loaded per byte of vertex data
+        // used, when the indices are drawn through a VERTEX_FIFO_SIZE entry
+        // post-transform cache and the vertex fetches go through a
+        // FETCH_CACHE_LINES line FIFO cache. 1.0 means every line loaded is
+        // fully used once.
+
+        int numLines = static_cast<int>((static_cast<long long>(numVertices) * vertexSize + FETCH_LINE_SIZE - 1) / FETCH_LINE_SIZE);
+        std::vector<int> vertexTime(numVertices, -1);
+        std::vector<int> lineTime(numLines, -1);
+        int vertexMisses = 0;
+        int lineMisses = 0;
+        int vertices = 0;
+
+        for (int i = 0; i < numIndices; ++i)
+        {
+            int vertex = pIndices[i];
+
+            if (vertexTime[vertex] < 0)
+                ++vertices;
+            else if (vertexMisses - vertexTime[vertex] < VERTEX_FIFO_SIZE)
+                continue;
+
+            vertexTime[vertex] = vertexMisses++;
+
+            long long start = static_cast<long long>(vertex) * vertexSize;
+            int firstLine = static_cast<int>(start / FETCH_LINE_SIZE);
+            int lastLine = static_cast<int>((start + vertexSize - 1) / FETCH_LINE_SIZE);
+
+            for (int line = firstLine; line <= lastLine; ++line)
+            {
+                if (lineTime[line] >= 0 && lineMisses - lineTime[line] < FETCH_CACHE_LINES)
+                    continue;
+
+                lineTime[line] = lineMisses++;
+            }
+        }
+
+        if (vertices == 0)
+            return 0.0f;
+
+        return static_cast<float>(static_cast<double>(lineMisses) * FETCH_LINE_SIZE /
+                                  (static_cast<double>(vertices) * vertexSize));
+    }
+
+    void BuildFetchRemap(const int *pIndices, int numIndices, int numVertices,
+                         std::vector<int> &remap)
+    {
+        // Numbers the vertices in the order the indices first use them.
+        // Vertices no triangle uses go last, in their original order.
+
+        int next = 0;
+
+        remap.assign(numVertices, -1);
+
+        for (int i = 0; i < numIndices; ++i)
+        {
+            if (remap[pIndices[i]] < 0)
+                remap[pIndices[i]] = next++;
+        }
+
+        for (int i = 0; i < numVertices; ++i)
+        {
+            if (remap[i] < 0)
+                remap[i] = next++;
+        }
+    }
+
+    template <typename T>
+    void RemapArray(T *pArray, const std::vector<int> &remap)
+    {
+        std::vector<T> old(pArray, pArray + remap.size());
+
+        for (int i = 0; i < static_cast<int>(remap.size()); ++i)
+            pArray[remap[i]] = old[i];
+    }
+
+    //-------------------------------------------------------------------------
+    // Quadric error mesh simplification used by ModelOBJ::generateLods().
+    // Edges are collapsed into one of their end vertices, so every level of
+    // detail indexes the model's own vertex buffer. Vertices with the same
+    // position but different attributes (UV and normal seams) collapse
+    // together along the seam, vertices on open borders only collapse along
+    // the border, and vertices shared by meshes with different materials
+    // never move.
+    //-------------------------------------------------------------------------
+
+    const float BORDER_QUADRIC_WEIGHT = 10.0f;
+
+    enum SimplifyVertexKind
+    {
+        KIND_MANIFOLD,      // interior vertex, collapses in any direction
+        KIND_BORDER,        // on an open border, collapses along it
+        KIND_SEAM,          // one of a pair on a seam, collapses along it
+        KIND_LOCKED         // never collapses
+    };
+
+    struct Quadric
+    {
+        // Area weighted sum of squared distances to planes. The symmetric
+        // matrix is stored as its upper triangle.
+
+        float a00, a11, a22, a01, a02, a12;
+        float b0, b1, b2;
+        float c;
+        float weight;
+    };
+
+    void AddPlaneQuadric(Quadric &q, const float normal[3], float distance, float weight)
+    {
+        q.a00 += normal[0] * normal[0] * weight;
+        q.a11 += normal[1] * normal[1] * weight;
+        q.a22 += normal[2] * normal[2] * weight;
+        q.a01 += normal[0] * normal[1] * weight;
+        q.a02 += normal[0] * normal[2] * weight;
+        q.a12 += normal[1] * normal[2] * weight;
+        q.b0 += normal[0] * distance * weight;
+        q.b1 += normal[1] * distance * weight;
+        q.b2 += normal[2] * distance * weight;
+        q.c += distance * distance * weight;
+        q.weight += weight;
+    }
+
+    void AddQuadric(Quadric &q, const Quadric &other)
+    {
+        q.a00 += other.a00;
+        q.a11 += other.a11;
+        q.a22 += other.a22;
+        q.a01 += other.a01;
+        q.a02 += other.a02;
+        q.a12 += other.a12;
+        q.b0 += other.b0;
+        q.b1 += other.b1;
+        q.b2 += other.b2;
+        q.c += other.c;
+        q.weight += other.weight;
+    }
+
+    float QuadricError(const Quadric &q, const float *pPosition)
+    {
+        // Mean squared distance of the point to the quadric's planes.
+
+        float x = pPosition[0];
+        float y = pPosition[1];
+        float z = pPosition[2];
+
+        float ax = q.a00 * x + q.a01 * y + q.a02 * z;
+        float ay = q.a01 * x + q.a11 * y + q.a12 * z;
+        float az = q.a02 * x + q.a12 * y + q.a22 * z;
+
+        float error = x * ax + y * ay + z * az + 2.0f * (q.b0 * x + q.b1 * y + q.b2 * z) + q.c;
+
+        return (q.weight > 0.0f) ? fabsf(error) / q.weight : 0.0f;
+    }
+
+    inline void TriangleNormal(const float *p0, const float *p1, const float *p2, float normal[3])
+    {
+        // Not normalized, its length is twice the triangle's area.
+
+        float e1[3] = {p1[0] - p0[0], p1[1] - p0[1], p1[2] - p0[2]};
+        float e2[3] = {p2[0] - p0[0], p2[1] - p0[1], p2[2] - p0[2]};
+
+        normal[0] = e1[1] * e2[2] - e1[2] * e2[1];
+        normal[1] = e1[2] * e2[0] - e1[0] * e2[2];
+        normal[2] = e1[0] * e2[1] - e1[1] * e2[0];
+    }
+
+    class Simplifier
+    {
+    public:
+        // pPositions holds 3 floats per vertex. pTriangleMeshes gives each
+        // triangle's mesh, and vertices used by more than one mesh are
+        // locked.
+        Simplifier(const float *pPositions, int numVertices, const int *pIndices,
+                   int numTriangles, const int *pTriangleMeshes);
+
+        // Collapses edges, cheapest first, until no more than
+        // targetTriangles are left or no edge can be collapsed. Returns the
+        // square root of the largest collapse error so far.
+        float simplify(int targetTriangles);
+
+        int getNumberOfTriangles() const { return static_cast<int>(m_triangleMeshes.size()); }
+        const int *getIndices() const { return m_indices.empty() ? 0 : &m_indices[0]; }
+        const int *getTriangleMeshes() const { return m_triangleMeshes.empty() ? 0 : &m_triangleMeshes[0]; }
+
+    private:
+        struct Collapse
+        {
+            int from;
+            int to;
+            float error;
+
+            bool operator<(const Collapse &other) const { return error < other.error; }
+        };
+
+        const float *position(int vertex) const { return &m_pPositions[m_positionIds[vertex] * 3]; }
+
+        void buildPositionIds(int numVertices);
+        void buildTriangleLists();
+        void classifyVertices();
+        void buildQuadrics();
+        bool hasEdge(int from, int to) const;
+        bool hasPositionEdge(int from, int to) const;
+        bool canCollapse(int from, int to, int &siblingTo) const;
+        bool flipsTriangles(int from, int to) const;
+        void removeDegenerateTriangles();
+        void lockNeighbours(int vertex, std::vector<int> &lockedPositions);
+        void updateOpenEdges(int from, int to);
+
+        const float *m_pPositions;
+        std::vector<int> m_positionIds;     // first vertex with the same position
+        std::vector<int> m_nextSibling;     // circular list of the vertices at a position
+        std::vector<int> m_indices;
+        std::vector<int> m_triangleMeshes;
+        std::vector<int> m_triangleFirst;   // per vertex, into m_triangleList
+        std::vector<int> m_triangleList;
+        std::vector<unsigned char> m_kinds;
+        std::vector<int> m_openOut;         // vertex at the end of the open edge from the vertex
+        std::vector<int> m_openIn;          // vertex at the start of the open edge to the vertex
+        std::vector<Quadric> m_quadrics;    // per position id
+        std::vector<int> m_collapses;
+        std::vector<unsigned char> m_locked;
+        float m_maxError;
+    };
+
+    Simplifier::Simplifier(const float *pPositions, int numVertices, const int *pIndices,
+                           int numTriangles, const int *pTriangleMeshes)
+    {
+        m_pPositions = pPositions;
+        m_maxError = 0.0f;
+
+        buildPositionIds(numVertices);
+
+        m_indices.assign(pIndices, pIndices + numTriangles * 3);
+        m_triangleMeshes.assign(pTriangleMeshes, pTriangleMeshes + numTriangles);
+        removeDegenerateTriangles();
+
+        buildTriangleLists();
+        classifyVertices();
+        buildQuadrics();
+
+        m_collapses.resize(numVertices);
+        m_locked.assign(numVertices, 0);
+
+        for (int i = 0; i < numVertices; ++i)
+            m_collapses[i] = i;
+    }
+
+    void Simplifier::buildPositionIds(int numVertices)
+    {
+        // Sort the vertices by position so that vertices with identical
+        // positions are next to each other.
+
+        std::vector<int> order(numVertices);
+        const float *pPositions = m_pPositions;
+
+        for (int i = 0; i < numVertices; ++i)
+            order[i] = i;
+
+        std::sort(order.begin(), order.end(), [pPositions](int a, int b)
+        {
+            int result = memcmp(&pPositions[a * 3], &pPositions[b * 3], 3 * sizeof(float));
+            return (result != 0) ? (result < 0) : (a < b);
+        });
+
+        m_positionIds.resize(numVertices);
+        m_nextSibling.resize(numVertices);
+
+        for (int i = 0; i < numVertices; )
+        {
+            int end = i + 1;
+
+            while (end < numVertices &&
+                   memcmp(&pPositions[order[i] * 3], &pPositions[order[end] * 3], 3 * sizeof(float)) == 0)
+            {
+                ++end;
+            }
+
+            for (int j = i; j < end; ++j)
+            {
+                m_positionIds[order[j]] = order[i];
+                m_nextSibling[order[j]] = order[(j + 1 < end) ? j + 1 : i];
+            }
+
+            i = end;
+        }
+    }
+
+    void Simplifier::buildTriangleLists()
+    {
+        // The triangles using each vertex. Filling the lists moves each
+        // offset to the end of its list, which is the start of the next.
+
+        int numVertices = static_cast<int>(m_positionIds.size());
+        int numIndices = static_cast<int>(m_indices.size());
+
+        m_triangleFirst.assign(numVertices + 1, 0);
+
+        for (int i = 0; i < numIndices; ++i)
+            ++m_triangleFirst[m_indices[i] + 1];
+
+        for (int i = 0; i < numVertices; ++i)
+            m_triangleFirst[i + 1] += m_triangleFirst[i];
+
+        m_triangleList.resize(numIndices);
+
+        for (int i = 0; i < numIndices; ++i)
+            m_triangleList[m_triangleFirst[m_indices[i]]++] = i / 3;
+
+        for (int i = numVertices; i > 0; --i)
+            m_triangleFirst[i] = m_triangleFirst[i - 1];
+
+        m_triangleFirst[0] = 0;
+    }
+
+    bool Simplifier::hasEdge(int from, int to) const
+    {
+        // True if a triangle has the directed edge from -> to.
+
+        for (int i = m_triangleFirst[from]; i < m_triangleFirst[from + 1]; ++i)
+        {
+            const int *pTriangle = &m_indices[m_triangleList[i] * 3];
+
+            for (int k = 0; k < 3; ++k)
+            {
+                if (pTriangle[k] == from && pTriangle[(k + 1) % 3] == to)
+                    return true;
+            }
+        }
+
+        return false;
+    }
+
+    bool Simplifier::hasPositionEdge(int from, int to) const
+    {
+        // As hasEdge() but between any vertices at the two positions.
+
+        int toPosition = m_positionIds[to];
+        int vertex = from;
+
+        do
+        {
+            for (int i = m_triangleFirst[vertex]; i < m_triangleFirst[vertex + 1]; ++i)
+            {
+                const int *pTriangle = &m_indices[m_triangleList[i] * 3];
+
+                for (int k = 0; k < 3; ++k)
+                {
+                    if (pTriangle[k] == vertex && m_positionIds[pTriangle[(k + 1) % 3]] == toPosition)
+                        return true;
+                }
+            }
+
+            vertex = m_nextSibling[vertex];
+        }
+        while (vertex != from);
+
+        return false;
+    }
+
+    void Simplifier::classifyVertices()
+    {
+        int numVertices = static_cast<int>(m_positionIds.size());
+        int numTriangles = getNumberOfTriangles();
+        std::vector<int> positionMeshes(numVertices, -1);
+        std::vector<unsigned char> lockedPositions(numVertices, 0);
+
+        // Positions used by more than one mesh are on a material boundary.
+
+        for (int i = 0; i < numTriangles; ++i)
+        {
+            for (int k = 0; k < 3; ++k)
+            {
+                int position = m_positionIds[m_indices[i * 3 + k]];
+
+                if (positionMeshes[position] < 0)
+                    positionMeshes[position] = m_triangleMeshes[i];
+                else if (positionMeshes[position] != m_triangleMeshes[i])
+                    lockedPositions[position] = 1;
+            }
+        }
+
+        // Find the open edges, the edges without a matching edge in the
+        // other direction. -2 marks vertices with more than one.
+
+        m_openOut.assign(numVertices, -1);
+        m_openIn.assign(numVertices, -1);
+
+        for (int i = 0; i < numTriangles * 3; ++i)
+        {
+            int from = m_indices[i];
+            int to = m_indices[(i % 3 == 2) ? i - 2 : i + 1];
+
+            if (hasEdge(to, from))
+                continue;
+
+            m_openOut[from] = (m_openOut[from] == -1) ? to : -2;
+            m_openIn[to] = (m_openIn[to] == -1) ? from : -2;
+        }
+
+        m_kinds.assign(numVertices, KIND_LOCKED);
+
+        for (int i = 0; i < numVertices; ++i)
+        {
+            int sibling = m_nextSibling[i];
+
+            if (lockedPositions[m_positionIds[i]])
+                continue;
+
+            if (sibling == i)
+            {
+                if (m_openOut[i] == -1 && m_openIn[i] == -1)
+                    m_kinds[i] = KIND_MANIFOLD;
+                else if (m_openOut[i] >= 0 && m_openIn[i] >= 0)
+                    m_kinds[i] = KIND_BORDER;
+            }
+            else if (m_nextSibling[sibling] == i)
+            {
+                // A seam pair: the open edges of each vertex continue as
+                // the open edges of the other in the opposite direction.
+
+                if (m_openOut[i] >= 0 && m_openIn[i] >= 0 &&
+                    m_openOut[sibling] >= 0 && m_openIn[sibling] >= 0 &&
+                    m_positionIds[m_openOut[i]] == m_positionIds[m_openIn[sibling]] &&
+                    m_positionIds[m_openIn[i]] == m_positionIds[m_openOut[sibling]])
+                {
+                    m_kinds[i] = KIND_SEAM;
+                }
+            }
+        }
+    }
+
+    void Simplifier::buildQuadrics()
+    {
+        // Each position gets the planes of its triangles, weighted by area.
+        // Edges on open borders add a plane through the edge at right angles
+        // to the triangle, so that borders keep their shape.
+
+        int numVertices = static_cast<int>(m_positionIds.size());
+        int numTriangles = getNumberOfTriangles();
+        float normal[3] = {0.0f, 0.0f, 0.0f};
+        float edgeNormal[3] = {0.0f, 0.0f, 0.0f};
+        float edge[3] = {0.0f, 0.0f, 0.0f};
+
+        m_quadrics.resize(numVertices);
+        memset(&m_quadrics[0], 0, numVertices * sizeof(Quadric));
+
+        for (int i = 0; i < numTriangles; ++i)
+        {
+            const int *pTriangle = &m_indices[i * 3];
+
+            TriangleNormal(position(pTriangle[0]), position(pTriangle[1]), position(pTriangle[2]), normal);
+
+            float length = sqrtf(normal[0] * normal[0] + normal[1] * normal[1] + normal[2] * normal[2]);
+
+            if (length <= 0.0f)
+                continue;
+
+            normal[0] /= length;
+            normal[1] /= length;
+            normal[2] /= length;
+
+            const float *p0 = position(pTriangle[0]);
+            float distance = -(normal[0] * p0[0] + normal[1] * p0[1] + normal[2] * p0[2]);
+
+            for (int k = 0; k < 3; ++k)
+                AddPlaneQuadric(m_quadrics[m_positionIds[pTriangle[k]]], normal, distance, length * 0.5f);
+
+            for (int k = 0; k < 3; ++k)
+            {
+                int from = pTriangle[k];
+                int to = pTriangle[(k + 1) % 3];
+
+                if (m_openOut[from] != to || hasPositionEdge(to, from))
+                    continue;
+
+                const float *pFrom = position(from);
+                const float *pTo = position(to);
+
+                edge[0] = pTo[0] - pFrom[0];
+                edge[1] = pTo[1] - pFrom[1];
+                edge[2] = pTo[2] - pFrom[2];
+
+                float edgeLength = sqrtf(edge[0] * edge[0] + edge[1] * edge[1] + edge[2] * edge[2]);
+
+                edgeNormal[0] = edge[1] * normal[2] - edge[2] * normal[1];
+                edgeNormal[1] = edge[2] * normal[0] - edge[0] * normal[2];
+                edgeNormal[2] = edge[0] * normal[1] - edge[1] * normal[0];
+
+                if (edgeLength <= 0.0f)
+                    continue;
+
+                edgeNormal[0] /= edgeLength;
+                edgeNormal[1] /= edgeLength;
+                edgeNormal[2] /= edgeLength;
+
+                distance = -(edgeNormal[0] * pFrom[0] + edgeNormal[1] * pFrom[1] + edgeNormal[2] * pFrom[2]);
+
+                float weight = edgeLength * edgeLength * BORDER_QUADRIC_WEIGHT;
+
+                AddPlaneQuadric(m_quadrics[m_positionIds[from]], edgeNormal, distance, weight);
+                AddPlaneQuadric(m_quadrics[m_positionIds[to]], edgeNormal, distance, weight);
+            }
+        }
+    }
+
+    bool Simplifier::canCollapse(int from, int to, int &siblingTo) const
+    {
+        // Borders and seams only collapse along their open edges, onto
+        // vertices that are also on them. A seam vertex's sibling collapses
+        // onto the vertex at the target position its own open edge leads to.
+
+        siblingTo = -1;
+
+        if (m_positionIds[from] == m_positionIds[to])
+            return false;
+
+        switch (m_kinds[from])
+        {
+        case KIND_MANIFOLD:
+            return true;
+
+        case KIND_BORDER:
+            return (m_openOut[from] == to || m_openIn[from] == to) &&
+                   (m_kinds[to] == KIND_BORDER || m_kinds[to] == KIND_LOCKED);
+
+        case KIND_SEAM:
+            {
+                int sibling = m_nextSibling[from];
+                int toPosition = m_positionIds[to];
+
+                if (!(m_openOut[from] == to || m_openIn[from] == to) ||
+                    !(m_kinds[to] == KIND_SEAM || m_kinds[to] == KIND_LOCKED))
+                {
+                    return false;
+                }
+
+                if (m_openOut[sibling] >= 0 && m_positionIds[m_openOut[sibling]] == toPosition)
+                    siblingTo = m_openOut[sibling];
+                else if (m_openIn[sibling] >= 0 && m_positionIds[m_openIn[sibling]] == toPosition)
+                    siblingTo = m_openIn[sibling];
+
+                return siblingTo >= 0;
+            }
+
+        default:
+            return false;
+        }
+    }
+
+    bool Simplifier::flipsTriangles(int from, int to) const
+    {
+        // True if moving 'from' and its siblings onto 'to' turns any of
+        // their triangles that don't collapse by more than about 75 degrees.
+
+        int toPosition = m_positionIds[to];
+        int vertex = from;
+        const float *pCorners[3] = {0, 0, 0};
+        float before[3] = {0.0f, 0.0f, 0.0f};
+        float after[3] = {0.0f, 0.0f, 0.0f};
+
+        do
+        {
+            for (int i = m_triangleFirst[vertex]; i < m_triangleFirst[vertex + 1]; ++i)
+            {
+                const int *pTriangle = &m_indices[m_triangleList[i] * 3];
+                bool collapses = false;
+
+                for (int k = 0; k < 3; ++k)
+                {
+                    pCorners[k] = position(pTriangle[k]);
+                    collapses = collapses || (m_positionIds[pTriangle[k]] == toPosition);
+                }
+
+                if (collapses)
+                    continue;
+
+                TriangleNormal(pCorners[0], pCorners[1], pCorners[2], before);
+
+                for (int k = 0; k < 3; ++k)
+                {
+                    if (pTriangle[k] == vertex)
+                        pCorners[k] = position(to);
+                }
+
+                TriangleNormal(pCorners[0], pCorners[1], pCorners[2], after);
+
+                float dot = before[0] * after[0] + before[1] * after[1] + before[2] * after[2];
+                float lengths = sqrtf((before[0] * before[0] + before[1] * before[1] + before[2] * before[2]) *
+                                      (after[0] * after[0] + after[1] * after[1] + after[2] * after[2]));
+
+                if (dot <= 0.25f * lengths)
+                    return true;
+            }
+
+            vertex = m_nextSibling[vertex];
+        }
+        while (vertex != from);
+
+        return false;
+    }
+
+    void Simplifier::removeDegenerateTriangles()
+    {
+        // Removes triangles with two corners at the same position, keeping
+        // the order of the rest.
+
+        int numTriangles = getNumberOfTriangles();
+        int count = 0;
+
+        for (int i = 0; i < numTriangles; ++i)
+        {
+            int p0 = m_positionIds[m_indices[i * 3]];
+            int p1 = m_positionIds[m_indices[i * 3 + 1]];
+            int p2 = m_positionIds[m_indices[i * 3 + 2]];
+
+            if (p0 == p1 || p1 == p2 || p2 == p0)
+                continue;
+
+            memmove(&m_indices[count * 3], &m_indices[i * 3], 3 * sizeof(int));
+            m_triangleMeshes[count++] = m_triangleMeshes[i];
+        }
+
+        m_indices.resize(count * 3);
+        m_triangleMeshes.resize(count);
+    }
+
+    void Simplifier::lockNeighbours(int vertex, std::vector<int> &lockedPositions)
+    {
+        // Locks the positions of the triangles around the vertex and its
+        // siblings, which includes the vertex itself.
+
+        int sibling = vertex;
+
+        do
+        {
+            for (int i = m_triangleFirst[sibling]; i < m_triangleFirst[sibling + 1]; ++i)
+            {
+                const int *pTriangle = &m_indices[m_triangleList[i] * 3];
+
+                for (int k = 0; k < 3; ++k)
+                {
+                    int position = m_positionIds[pTriangle[k]];
+
+                    if (!m_locked[position])
+                    {
+                        m_locked[position] = 1;
+                        lockedPositions.push_back(position);
+                    }
+                }
+            }
+
+            sibling = m_nextSibling[sibling];
+        }
+        while (sibling != vertex);
+    }
+
+    void Simplifier::updateOpenEdges(int from, int to)
+    {
+        // When a vertex collapses along its open edge, the open edge on its
+        // other side now ends or starts at the target vertex.
+
+        if (m_openOut[from] == to)
+            m_openIn[to] = m_openIn[from];
+
+        if (m_openIn[from] == to)
+            m_openOut[to] = m_openOut[from];
+    }
+
+    float Simplifier::simplify(int targetTriangles)
+    {
+        std::vector<Collapse> collapses;
+        std::vector<int> collapsed;
+        std::vector<int> lockedPositions;
+
+        while (getNumberOfTriangles() > targetTriangles)
+        {
+            int numTriangles = getNumberOfTriangles();
+            int siblingTo = 0;
+
+            buildTriangleLists();
+            collapses.clear();
+
+            // Find the cheapest allowed direction of every edge. Edges
+            // shared by two triangles are only looked at from one side.
+
+            for (int i = 0; i < numTriangles * 3; ++i)
+            {
+                int a = m_indices[i];
+                int b = m_indices[(i % 3 == 2) ? i - 2 : i + 1];
+
+                if (a > b && hasEdge(b, a))
+                    continue;
+
+                Collapse collapse = {-1, -1, std::numeric_limits<float>::max()};
+
+                if (canCollapse(a, b, siblingTo))
+                {
+                    collapse.from = a;
+                    collapse.to = b;
+                    collapse.error = QuadricError(m_quadrics[m_positionIds[a]], position(b));
+                }
+
+                if (canCollapse(b, a, siblingTo))
+                {
+                    float error = QuadricError(m_quadrics[m_positionIds[b]], position(a));
+
+                    if (error < collapse.error)
+                    {
+                        collapse.from = b;
+                        collapse.to = a;
+                        collapse.error = error;
+                    }
+                }
+
+                if (collapse.from >= 0)
+                    collapses.push_back(collapse);
+            }
+
+            std::sort(collapses.begin(), collapses.end());
+
+            // Collapse the cheapest edges. Once a vertex moves, the
+            // positions around it are locked for the rest of the pass, so
+            // the collapses don't chain and the flip checks stay valid.
+
+            int removed = 0;
+            int goal = numTriangles - targetTriangles;
+
+            collapsed.clear();
+            lockedPositions.clear();
+
+            for (int i = 0; i < static_cast<int>(collapses.size()) && removed < goal; ++i)
+            {
+                const Collapse &collapse = collapses[i];
+                int fromPosition = m_positionIds[collapse.from];
+                int toPosition = m_positionIds[collapse.to];
+
+                if (m_locked[fromPosition] || m_locked[toPosition])
+                    continue;
+
+                if (!canCollapse(collapse.from, collapse.to, siblingTo) ||
+                    flipsTriangles(collapse.from, collapse.to))
+                {
+                    continue;
+                }
+
+                m_collapses[collapse.from] = collapse.to;
+                collapsed.push_back(collapse.from);
+                updateOpenEdges(collapse.from, collapse.to);
+
+                if (siblingTo >= 0)
+                {
+                    m_collapses[m_nextSibling[collapse.from]] = siblingTo;
+                    collapsed.push_back(m_nextSibling[collapse.from]);
+                    updateOpenEdges(m_nextSibling[collapse.from], siblingTo);
+                }
+
+                lockNeighbours(collapse.from, lockedPositions);
+
+                AddQuadric(m_quadrics[toPosition], m_quadrics[fromPosition]);
+                m_maxError = std::max(m_maxError, collapse.error);
+                removed += (m_kinds[collapse.from] == KIND_BORDER) ? 1 : 2;
+            }
+
+            if (removed == 0)
+                break;
+
+            // Apply the collapses to the triangles and to the open edges
+            // that lead to collapsed vertices, then reset the per pass
+            // state.
+
+            for (int i = 0; i < numTriangles * 3; ++i)
+                m_indices[i] = m_collapses[m_indices[i]];
+
+            for (int i = 0; i < static_cast<int>(m_openOut.size()); ++i)
+            {
+                if (m_openOut[i] >= 0)
+                    m_openOut[i] = m_collapses[m_openOut[i]];
+
+                if (m_openIn[i] >= 0)
+                    m_openIn[i] = m_collapses[m_openIn[i]];
+            }
+
+            for (int i = 0; i < static_cast<int>(collapsed.size()); ++i)
+                m_collapses[collapsed[i]] = collapsed[i];
+
+            for (int i = 0; i < static_cast<int>(lockedPositions.size()); ++i)
+                m_locked[lockedPositions[i]] = 0;
+
+            removeDegenerateTriangles();
+        }
+
+        return sqrtf(m_maxError);
+    }
+
+    void NormalizeLodRatios(const std::vector<float> &ratios, std::vector<float> &normalized)
+    {
+        // Keeps the ratios between 0 and 1, finest first, without repeats.
+
+        normalized.clear();
+
+        for (int i = 0; i < static_cast<int>(ratios.size()); ++i)
+        {
+            if (ratios[i] > 0.0f && ratios[i] < 1.0f)
+                normalized.push_back(ratios[i]);
+        }
+
+        std::sort(normalized.begin(), normalized.end(), std::greater<float>());
+        normalized.erase(std::unique(normalized.begin(), normalized.end()), normalized.end());
+    }
+
+    //-------------------------------------------------------------------------
+    // Meshlet helpers used by ModelOBJ::buildMeshlets(). Each block of a
+    // mesh's triangles is partitioned on its own: a meshlet grows from the
+    // first unused triangle by adding the neighbouring triangle that brings
+    // in the fewest new vertices, and falls back to the next unused triangle
+    // in index buffer order when it has no usable neighbours.
+    //-------------------------------------------------------------------------
+
+    const int MESHLET_BLOCK_TRIANGLES = 64 * 1024;
+
+    struct MeshletRange
+    {
+        int startTriangle;      // relative to the block
+        int triangleCount;
+        int vertexCount;
+    };
+
+    struct MeshletScratch
+    {
+        std::vector<int> localIndex;        // per model vertex, -1 if unused by the block
+        std::vector<int> vertices;          // model vertices used by the block
+        std::vector<int> corners;           // local vertex of each corner
+        std::vector<int> triangleFirst;     // per local vertex, into triangleList
+        std::vector<int> triangleList;
+        std::vector<int> stamps;            // per local vertex, last meshlet it's in
+        std::vector<int> meshletVertices;   // local vertices of the current meshlet
+        std::vector<char> used;
+        std::vector<int> order;
+    };
+
+    struct MeshletBlock
+    {
+        int mesh;
+        int startIndex;
+        int triangleCount;
+    };
+
+    void PartitionMeshlets(int *pIndices, int numTriangles, int maxVertices, int maxTriangles,
+                           MeshletScratch &scratch, std::vector<MeshletRange> &meshlets)
+    {
+        // Reorders the block's triangles so that each meshlet's triangles
+        // are consecutive, and appends the meshlets.
+
+        int numLocal = 0;
+
+        scratch.corners.resize(numTriangles * 3);
+
+        for (int i = 0; i < numTriangles * 3; ++i)
+        {
+            int &local = scratch.localIndex[pIndices[i]];
+
+            if (local < 0)
+            {
+                local = numLocal++;
+                scratch.vertices.push_back(pIndices[i]);
+            }
+
+            scratch.corners[i] = local;
+        }
+
+        scratch.triangleFirst.assign(numLocal + 1, 0);
+
+        for (int i = 0; i < numTriangles * 3; ++i)
+            ++scratch.triangleFirst[scratch.corners[i] + 1];
+
+        for (int i = 0; i < numLocal; ++i)
+            scratch.triangleFirst[i + 1] += scratch.triangleFirst[i];
+
+        scratch.triangleList.resize(numTriangles * 3);
+
+        for (int i = 0; i < numTriangles * 3; ++i)
+            scratch.triangleList[scratch.triangleFirst[scratch.corners[i]]++] = i / 3;
+
+        for (int i = numLocal; i > 0; --i)
+            scratch.triangleFirst[i] = scratch.triangleFirst[i - 1];
+
+        scratch.triangleFirst[0] = 0;
+        scratch.stamps.assign(numLocal, -1);
+        scratch.used.assign(numTriangles, 0);
+        scratch.order.clear();
+
+        int nextTriangle = 0;
+        int meshletId = static_cast<int>(meshlets.size());
+
+        while (static_cast<int>(scratch.order.size()) < numTriangles)
+        {
+            MeshletRange meshlet = {static_cast<int>(scratch.order.size()), 0, 0};
+            int triangle = -1;
+
+            scratch.meshletVertices.clear();
+
+            while (scratch.used[nextTriangle])
+                ++nextTriangle;
+
+            triangle = nextTriangle;
+
+            while (triangle >= 0)
+            {
+                const int *pCorners = &scratch.corners[triangle * 3];
+
+                for (int k = 0; k < 3; ++k)
+                {
+                    if (scratch.stamps[pCorners[k]] != meshletId)
+                    {
+                        scratch.stamps[pCorners[k]] = meshletId;
+                        scratch.meshletVertices.push_back(pCorners[k]);
+                        ++meshlet.vertexCount;
+                    }
+                }
+
+                scratch.used[triangle] = 1;
+                scratch.order.push_back(triangle);
+
+                if (++meshlet.triangleCount == maxTriangles)
+                    break;
+
+                // Pick the unused triangle around the meshlet's vertices that
+                // adds the fewest new vertices and still fits.
+
+                int bestNew = 3;
+
+                triangle = -1;
+
+                for (int i = 0; i < static_cast<int>(scratch.meshletVertices.size()) && bestNew > 0; ++i)
+                {
+                    int vertex = scratch.meshletVertices[i];
+
+                    for (int j = scratch.triangleFirst[vertex]; j < scratch.triangleFirst[vertex + 1]; ++j)
+                    {
+                        int candidate = scratch.triangleList[j];
+
+                        if (scratch.used[candidate])
+                            continue;
+
+                        const int *pCandidate = &scratch.corners[candidate * 3];
+                        int newVertices = (scratch.stamps[pCandidate[0]] != meshletId) +
+                                          (scratch.stamps[pCandidate[1]] != meshletId) +
+                                          (scratch.stamps[pCandidate[2]] != meshletId);
+
+                        if (newVertices < bestNew && meshlet.vertexCount + newVertices <= maxVertices)
+                        {
+                            triangle = candidate;
+                            bestNew = newVertices;
+
+                            if (bestNew == 0)
+                                break;
+                        }
+                    }
+                }
+
+                if (triangle >= 0)
+                    continue;
+
+                // No neighbour fits, so try the next unused triangle.
+
+                while (nextTriangle < numTriangles && scratch.used[nextTriangle])
+                    ++nextTriangle;
+
+                if (nextTriangle < numTriangles && meshlet.vertexCount + 3 <= maxVertices)
+                    triangle = nextTriangle;
+            }
+
+            meshlets.push_back(meshlet);
+            ++meshletId;
+        }
+
+        // Write the triangles back in meshlet order and reset the scratch
+        // arrays that cover the whole vertex buffer.
+
+        for (int i = 0; i < numTriangles; ++i)
+        {
+            for (int k = 0; k < 3; ++k)
+                pIndices[i * 3 + k] = scratch.vertices[scratch.corners[scratch.order[i] * 3 + k]];
+        }
+
+        for (int i = 0; i < numLocal; ++i)
+            scratch.localIndex[scratch.vertices[i]] = -1;
+
+        scratch.vertices.clear();
+    }
+
+    void ComputeMeshletBounds(const float *pCorners, int numTriangles, ModelOBJ::Meshlet &meshlet)
+    {
+        // pCorners holds the 3 corner positions of each triangle. The
+        // bounding sphere is centred on the bounding box. The normal cone's
+        // axis is the average triangle normal, and its apex is moved back
+        // along the axis until it's behind every triangle's plane, so the
+        // cone test is conservative for eye positions anywhere.
+
+        float boxMin[3] = {pCorners[0], pCorners[1], pCorners[2]};
+        float boxMax[3] = {pCorners[0], pCorners[1], pCorners[2]};
+        float axis[3] = {0.0f, 0.0f, 0.0f};
+        float normal[3] = {0.0f, 0.0f, 0.0f};
+        float radius = 0.0f;
+
+        for (int i = 0; i < numTriangles * 3; ++i)
+        {
+            for (int k = 0; k < 3; ++k)
+            {
+                boxMin[k] = std::min(boxMin[k], pCorners[i * 3 + k]);
+                boxMax[k] = std::max(boxMax[k], pCorners[i * 3 + k]);
+            }
+        }
+
+        for (int k = 0; k < 3; ++k)
+            meshlet.center[k] = (boxMin[k] + boxMax[k]) * 0.5f;
+
+        for (int i = 0; i < numTriangles * 3; ++i)
+        {
+            float dx = pCorners[i * 3] - meshlet.center[0];
+            float dy = pCorners[i * 3 + 1] - meshlet.center[1];
+            float dz = pCorners[i * 3 + 2] - meshlet.center[2];
+
+            radius = std::max(radius, dx * dx + dy * dy + dz * dz);
+        }
+
+        meshlet.radius = sqrtf(radius);
+
+        // A meshlet whose triangles face too many ways can't be culled.
+
+        meshlet.coneApex[0] = meshlet.center[0];
+        meshlet.coneApex[1] = meshlet.center[1];
+        meshlet.coneApex[2] = meshlet.center[2];
+        meshlet.coneAxis[0] = meshlet.coneAxis[1] = meshlet.coneAxis[2] = 0.0f;
+        meshlet.coneCutoff = 1.0f;
+
+        for (int i = 0; i < numTriangles; ++i)
+        {
+            const float *p = &pCorners[i * 9];
+
+            TriangleNormal(p, p + 3, p + 6, normal);
+
+            float length = sqrtf(normal[0] * normal[0] + normal[1] * normal[1] + normal[2] * normal[2]);
+
+            for (int k = 0; k < 3 && length > 0.0f; ++k)
+                axis[k] += normal[k] / length;
+        }
+
+        float axisLength = sqrtf(axis[0] * axis[0] + axis[1] * axis[1] + axis[2] * axis[2]);
+
+        if (axisLength <= 0.0f)
+            return;
+
+        axis[0] /= axisLength;
+        axis[1] /= axisLength;
+        axis[2] /= axisLength;
+
+        float minDot = 1.0f;
+        float maxT = 0.0f;
+
+        for (int pass = 0; pass < 2; ++pass)
+        {
+            for (int i = 0; i < numTriangles; ++i)
+            {
+                const float *p = &pCorners[i * 9];
+
+                TriangleNormal(p, p + 3, p + 6, normal);
+
+                float length = sqrtf(normal[0] * normal[0] + normal[1] * normal[1] + normal[2] * normal[2]);
+
+                if (length <= 0.0f)
+                    continue;
+
+                float dn = (axis[0] * normal[0] + axis[1] * normal[1] + axis[2] * normal[2]) / length;
+
+                if (pass == 0)
+                {
+                    minDot = std::min(minDot, dn);
+                    continue;
+                }
+
+                float dc = ((meshlet.center[0] - p[0]) * normal[0] +
+                            (meshlet.center[1] - p[1]) * normal[1] +
+                            (meshlet.center[2] - p[2]) * normal[2]) / length;
+
+                maxT = std::max(maxT, dc / dn);
+            }
+
+            if (minDot <= 0.1f)
+                return;
+        }
+
+        for (int k = 0; k < 3; ++k)
+        {
+            meshlet.coneApex[k] = meshlet.center[k] - axis[k] * maxT;
+            meshlet.coneAxis[k] = axis[k];
+        }
+
+        meshlet.coneCutoff = sqrtf(1.0f - minDot * minDot);
+    }
+
+    //-------------------------------------------------------------------------
+    // BVH helpers used by ModelOBJ::buildBvh() and the BVH queries. Nodes are
+    // split with a binned surface area heuristic. The top of the tree is
+    // built on one thread until the triangle ranges are small enough, then
+    // the subtrees below are built on all the threads.
+    //-------------------------------------------------------------------------
+
+    const int BVH_BINS = 16;
+    const int BVH_MAX_LEAF_TRIANGLES = 8;
+    const int BVH_MAX_DEPTH = 64;               // also the traversal stack size
+    const float BVH_TRAVERSAL_COST = 2.0f;      // relative to a triangle test
+    const int BVH_PACKET_SIZE = 4;
+
+    struct BvhTask
+    {
+        int node;
+        int begin;
+        int end;
+        int depth;
+    };
+
+    // Triangles are partitioned by moving these records rather than
+    // indices to them, so that each pass over a range reads memory in order.
+    struct BvhPrimitive
+    {
+        float boxMin[3];
+        float boxMax[3];
+        float centroid[3];
+        int triangle;
+    };
+
+    inline float BoxHalfArea(const float boxMin[3], const float boxMax[3])
+    {
+        float dx = boxMax[0] - boxMin[0];
+        float dy = boxMax[1] - boxMin[1];
+        float dz = boxMax[2] - boxMin[2];
+
+        return dx * dy + dy * dz + dz * dx;
+    }
+
+    inline void ResetBox(float boxMin[3], float boxMax[3])
+    {
+        boxMin[0] = boxMin[1] = boxMin[2] = std::numeric_limits<float>::max();
+        boxMax[0] = boxMax[1] = boxMax[2] = -std::numeric_limits<float>::max();
+    }
+
+    inline void GrowBox(float boxMin[3], float boxMax[3], const float *pMin, const float *pMax)
+    {
+        for (int k = 0; k < 3; ++k)
+        {
+            boxMin[k] = std::min(boxMin[k], pMin[k]);
+            boxMax[k] = std::max(boxMax[k], pMax[k]);
+        }
+    }
+
+    inline int BvhBin(float centroid, float centroidMin, float binScale, int numBins)
+    {
+        return std::min(numBins - 1, static_cast<int>((centroid - centroidMin) * binScale));
+    }
+
+    void BuildBvhNode(BvhPrimitive *pPrimitives, std::vector<ModelOBJ::BvhNode> &nodes,
+                      int node, int begin, int end, int depth, int deferLimit,
+                      std::vector<BvhTask> *pDeferred)
+    {
+        // Builds the subtree for BVH triangles [begin, end) at nodes[node].
+        // With pDeferred, ranges of deferLimit triangles or fewer are left
+        // as leaves and recorded so that they can be built later.
+
+        float centroidMin[3];
+        float centroidMax[3];
+        ModelOBJ::BvhNode bounds;
+        int count = end - begin;
+
+        ResetBox(bounds.boundsMin, bounds.boundsMax);
+        ResetBox(centroidMin, centroidMax);
+
+        for (int i = begin; i < end; ++i)
+        {
+            const BvhPrimitive &primitive = pPrimitives[i];
+
+            GrowBox(bounds.boundsMin, bounds.boundsMax, primitive.boxMin, primitive.boxMax);
+            GrowBox(centroidMin, centroidMax, primitive.centroid, primitive.centroid);
+        }
+
+        bounds.first = begin;
+        bounds.count = count;
+        nodes[node] = bounds;
+
+        if (count <= 1 || depth >= BVH_MAX_DEPTH - 1)
+            return;
+
+        if (pDeferred && count <= deferLimit)
+        {
+            BvhTask task = {node, begin, end, depth};
+
+            pDeferred->push_back(task);
+            return;
+        }
+
+        // Bin the triangles on all three axes in one pass, then find the
+        // cheapest split between bins. The costs are triangle counts
+        // weighted by half surface areas. Small ranges use fewer bins, since
+        // near the leaves the per node overhead outweighs the binning.
+
+        int numBins = std::min(count, BVH_BINS);
+        float binScales[3];
+        float binMin[3][BVH_BINS][3];
+        float binMax[3][BVH_BINS][3];
+        int binCounts[3][BVH_BINS] = {{0}};
+        float bestCost = std::numeric_limits<float>::max();
+        int bestAxis = -1;
+        int bestBin = 0;
+
+        for (int axis = 0; axis < 3; ++axis)
+        {
+            float extent = centroidMax[axis] - centroidMin[axis];
+
+            binScales[axis] = (extent > 0.0f) ? numBins / extent : 0.0f;
+
+            for (int i = 0; i < numBins; ++i)
+                ResetBox(binMin[axis][i], binMax[axis][i]);
+        }
+
+        for (int i = begin; i < end; ++i)
+        {
+            const BvhPrimitive &primitive = pPrimitives[i];
+
+            for (int axis = 0; axis < 3; ++axis)
+            {
+                int bin = BvhBin(primitive.centroid[axis], centroidMin[axis], binScales[axis], numBins);
+
+                GrowBox(binMin[axis][bin], binMax[axis][bin], primitive.boxMin, primitive.boxMax);
+                ++binCounts[axis][bin];
+            }
+        }
+
+        for (int axis = 0; axis < 3; ++axis)
+        {
+            float rightCosts[BVH_BINS];
+            float boxMin[3];
+            float boxMax[3];
+            int triangles = 0;
+
+            if (binScales[axis] == 0.0f)
+                continue;
+
+            ResetBox(boxMin, boxMax);
+
+            for (int i = numBins - 1; i > 0; --i)
+            {
+                GrowBox(boxMin, boxMax, binMin[axis][i], binMax[axis][i]);
+                triangles += binCounts[axis][i];
+                rightCosts[i] = triangles ? BoxHalfArea(boxMin, boxMax) * triangles : 0.0f;
+            }
+
+            ResetBox(boxMin, boxMax);
+            triangles = 0;
+
+            for (int i = 0; i < numBins - 1; ++i)
+            {
+                GrowBox(boxMin, boxMax, binMin[axis][i], binMax[axis][i]);
+                triangles += binCounts[axis][i];
+
+                if (triangles == 0 || triangles == count)
+                    continue;
+
+                float cost = BoxHalfArea(boxMin, boxMax) * triangles + rightCosts[i + 1];
+
+                if (cost < bestCost)
+                {
+                    bestCost = cost;
+                    bestAxis = axis;
+                    bestBin = i;
+                }
+            }
+        }
+
+        // Keep small ranges as leaves when splitting doesn't pay off. Larger
+        // ones are split anyway, in the middle if all the centroids coincide.
+
+        float area = BoxHalfArea(bounds.boundsMin, bounds.boundsMax);
+        bool split = bestAxis >= 0 && BVH_TRAVERSAL_COST * area + bestCost < count * area;
+
+        if (!split && count <= BVH_MAX_LEAF_TRIANGLES)
+            return;
+
+        int middle = begin + count / 2;
+
+        if (bestAxis >= 0)
+        {
+            float binScale = binScales[bestAxis];
+
+            middle = static_cast<int>(std::partition(pPrimitives + begin, pPrimitives + end,
+                [&](const BvhPrimitive &primitive)
+                {
+                    return BvhBin(primitive.centroid[bestAxis], centroidMin[bestAxis], binScale, numBins) <= bestBin;
+                }) - pPrimitives);
+        }
+
+        int left = static_cast<int>(nodes.size());
+
+        nodes.resize(left + 2);
+        nodes[node].first = left;
+        nodes[node].count = 0;
+
+        BuildBvhNode(pPrimitives, nodes, left, begin, middle, depth + 1, deferLimit, pDeferred);
+        BuildBvhNode(pPrimitives, nodes, left + 1, middle, end, depth + 1, deferLimit, pDeferred);
+    }
+
+    inline void ClipToSlab(float nearPlane, float farPlane, float origin, float inverse,
+                           float &tEnter, float &tExit)
+    {
+        // Narrows [tEnter, tExit] to the ray parameters between a slab's
+        // near and far planes along the ray. A zero direction component
+        // gives an infinite inverse, and a NaN where the ray lies in one of
+        // the planes. The ray is then inside the slab, and the comparisons
+        // are ordered so that NaNs don't narrow the range.
+
+        float tNear = (nearPlane - origin) * inverse;
+        float tFar = (farPlane - origin) * inverse;
+
+        tEnter = (tNear > tEnter) ? tNear : tEnter;
+        tExit = (tFar < tExit) ? tFar : tExit;
+    }
+
+    inline bool RayHitsBox(const ModelOBJ::BvhNode &node, const float origin[3],
+                           const float inverse[3], float maxDistance, float &entry)
+    {
+        float tEnter = 0.0f;
+        float tExit = maxDistance;
+
+        for (int k = 0; k < 3; ++k)
+        {
+            if (inverse[k] < 0.0f)
+                ClipToSlab(node.boundsMax[k], node.boundsMin[k], origin[k], inverse[k], tEnter, tExit);
+            else
+                ClipToSlab(node.boundsMin[k], node.boundsMax[k], origin[k], inverse[k], tEnter, tExit);
+        }
+
+        entry = tEnter;
+        return tEnter <= tExit;
+    }
+
+    inline bool RayHitsTriangle(const float *pCorners, const float origin[3], const float direction[3],
+                                float maxDistance, float &t, float &u, float &v)
+    {
+        // Moller-Trumbore intersection, hitting both sides of the triangle.
+
+        const float *p0 = pCorners;
+        float e1[3] = {pCorners[3] - p0[0], pCorners[4] - p0[1], pCorners[5] - p0[2]};
+        float e2[3] = {pCorners[6] - p0[0], pCorners[7] - p0[1], pCorners[8] - p0[2]};
+        float p[3] = {direction[1] * e2[2] - direction[2] * e2[1],
+                      direction[2] * e2[0] - direction[0] * e2[2],
+                      direction[0] * e2[1] - direction[1] * e2[0]};
+        float det = e1[0] * p[0] + e1[1] * p[1] + e1[2] * p[2];
+
+        if (det == 0.0f)
+            return false;
+
+        float inverseDet = 1.0f / det;
+        float s[3] = {origin[0] - p0[0], origin[1] - p0[1], origin[2] - p0[2]};
+
+        u = (s[0] * p[0] + s[1] * p[1] + s[2] * p[2]) * inverseDet;
+
+        if (u < 0.0f || u > 1.0f)
+            return false;
+
+        float q[3] = {s[1] * e1[2] - s[2] * e1[1],
+                      s[2] * e1[0] - s[0] * e1[2],
+                      s[0] * e1[1] - s[1] * e1[0]};
+
+        v = (direction[0] * q[0] + direction[1] * q[1] + direction[2] * q[2]) * inverseDet;
+
+        if (v < 0.0f || u + v > 1.0f)
+            return false;
+
+        t = (e2[0] * q[0] + e2[1] * q[1] + e2[2] * q[2]) * inverseDet;
+        return t >= 0.0f && t <= maxDistance;
+    }
+
+    inline float BoxDistanceSquared(const ModelOBJ::BvhNode &node, const float point[3])
+    {
+        float distance = 0.0f;
+
+        for (int k = 0; k < 3; ++k)
+        {
+            float d = std::max(std::max(node.boundsMin[k] - point[k], point[k] - node.boundsMax[k]), 0.0f);
+
+            distance += d * d;
+        }
+
+        return distance;
+    }
+
+    void ClosestPointOnTriangle(const float *pCorners, const float point[3], float &u, float &v)
+    {
+        // Returns the barycentric weights of the 2nd and 3rd corners for the
+        // point on the triangle closest to 'point', by testing the Voronoi
+        // regions of the corners and edges (Ericson, Real-Time Collision
+        // Detection, 5.1.5).
+
+        const float *a = pCorners;
+        float ab[3] = {pCorners[3] - a[0], pCorners[4] - a[1], pCorners[5] - a[2]};
+        float ac[3] = {pCorners[6] - a[0], pCorners[7] - a[1], pCorners[8] - a[2]};
+        float ap[3] = {point[0] - a[0], point[1] - a[1], point[2] - a[2]};
+        float d1 = ab[0] * ap[0] + ab[1] * ap[1] + ab[2] * ap[2];
+        float d2 = ac[0] * ap[0] + ac[1] * ap[1] + ac[2] * ap[2];
+
+        u = v = 0.0f;
+
+        if (d1 <= 0.0f && d2 <= 0.0f)
+            return;
+
+        float bp[3] = {point[0] - pCorners[3], point[1] - pCorners[4], point[2] - pCorners[5]};
+        float d3 = ab[0] * bp[0] + ab[1] * bp[1] + ab[2] * bp[2];
+        float d4 = ac[0] * bp[0] + ac[1] * bp[1] + ac[2] * bp[2];
+
+        if (d3 >= 0.0f && d4 <= d3)
+        {
+            u = 1.0f;
+            return;
+        }
+
+        float vc = d1 * d4 - d3 * d2;
+
+        if (vc <= 0.0f && d1 >= 0.0f && d3 <= 0.0f)
+        {
+            u = (d1 > d3) ? d1 / (d1 - d3) : 0.0f;
+            return;
+        }
+
+        float cp[3] = {point[0] - pCorners[6], point[1] - pCorners[7], point[2] - pCorners[8]};
+        float d5 = ab[0] * cp[0] + ab[1] * cp[1] + ab[2] * cp[2];
+        float d6 = ac[0] * cp[0] + ac[1] * cp[1] + ac[2] * cp[2];
+
+        if (d6 >= 0.0f && d5 <= d6)
+        {
+            v = 1.0f;
+            return;
+        }
+
+        float vb = d5 * d2 - d1 * d6;
+
+        if (vb <= 0.0f && d2 >= 0.0f && d6 <= 0.0f)
+        {
+            v = (d2 > d6) ? d2 / (d2 - d6) : 0.0f;
+            return;
+        }
+
+        float va = d3 * d6 - d5 * d4;
+
+        if (va <= 0.0f && (d4 - d3) >= 0.0f && (d5 - d6) >= 0.0f)
+        {
+            v = (d4 - d3) / ((d4 - d3) + (d5 - d6));
+            u = 1.0f - v;
+            return;
+        }
+
+        float denominator = va + vb + vc;
+
+        if (denominator <= 0.0f)
+            return;
+
+        u = vb / denominator;
+        v = vc / denominator;
+    }
+
+    inline void BarycentricPoint(const float *pCorners, float u, float v, float position[3])
+    {
+        for (int k = 0; k < 3; ++k)
+            position[k] = pCorners[k] + (pCorners[3 + k] - pCorners[k]) * u + (pCorners[6 + k] - pCorners[k]) * v;
+    }
+
+    template <bool AnyHit>
+    bool TraceRay(const ModelOBJ::BvhNode *pNodes, const float *pPositions,
+                  const float origin[3], const float direction[3], float maxDistance,
+                  int &hitTriangle, float &t, float &u, float &v)
+    {
+        // Returns the BVH triangle of the closest hit, or of the first hit
+        // found with AnyHit. The nearer child is visited first and the other
+        // one is skipped if a closer hit was found by the time it's popped.
+
+        float inverse[3] = {1.0f / direction[0], 1.0f / direction[1], 1.0f / direction[2]};
+        int stack[BVH_MAX_DEPTH];
+        float stackEntries[BVH_MAX_DEPTH];
+        int stackSize = 0;
+        float entry = 0.0f;
+        float hitU = 0.0f;
+        float hitV = 0.0f;
+        float hitT = 0.0f;
+
+        hitTriangle = -1;
+        t = maxDistance;
+
+        if (!RayHitsBox(pNodes[0], origin, inverse, t, entry))
+            return false;
+
+        stack[stackSize] = 0;
+        stackEntries[stackSize++] = entry;
+
+        while (stackSize > 0)
+        {
+            --stackSize;
+
+            if (stackEntries[stackSize] > t)
+                continue;
+
+            const ModelOBJ::BvhNode *pNode = &pNodes[stack[stackSize]];
+
+            while (pNode && pNode->count == 0)
+            {
+                const ModelOBJ::BvhNode *pNear = &pNodes[pNode->first];
+                const ModelOBJ::BvhNode *pFar = pNear + 1;
+                float nearEntry = 0.0f;
+                float farEntry = 0.0f;
+                bool hitsNear = RayHitsBox(*pNear, origin, inverse, t, nearEntry);
+                bool hitsFar = RayHitsBox(*pFar, origin, inverse, t, farEntry);
+
+                if (hitsNear && hitsFar)
+                {
+                    if (farEntry < nearEntry)
+                    {
+                        std::swap(pNear, pFar);
+                        std::swap(nearEntry, farEntry);
+                    }
+
+                    stack[stackSize] = static_cast<int>(pFar - pNodes);
+                    stackEntries[stackSize++] = farEntry;
+                    pNode = pNear;
+                }
+                else
+                {
+                    pNode = hitsNear ? pNear : (hitsFar ? pFar : 0);
+                }
+            }
+
+            if (!pNode)
+                continue;
+
+            for (int i = pNode->first; i < pNode->first + pNode->count; ++i)
+            {
+                if (RayHitsTriangle(&pPositions[i * 9], origin, direction, t, hitT, hitU, hitV))
+                {
+                    hitTriangle = i;
+                    t = hitT;
+                    u = hitU;
+                    v = hitV;
+
+                    if (AnyHit)
+                        return true;
+                }
+            }
+        }
+
+        return hitTriangle >= 0;
+    }
+
+    void TraceRayPacket(const ModelOBJ::BvhNode *pNodes, const float *pPositions,
+                        const float *pOrigins, const float *pDirections, int numRays,
+                        float maxDistance, int hitTriangles[BVH_PACKET_SIZE],
+                        float t[BVH_PACKET_SIZE], float u[BVH_PACKET_SIZE], float v[BVH_PACKET_SIZE])
+    {
+        // Traces up to BVH_PACKET_SIZE rays together. A node is visited when
+        // any of the rays hits its box, and children are visited nearest
+        // first along the first ray. The per ray loops have a fixed trip
+        // count and no early exits so that they vectorize. Unused lanes get
+        // a negative maximum distance, so they never hit anything.
+
+        float origins[3][BVH_PACKET_SIZE];
+        float directions[3][BVH_PACKET_SIZE];
+        float inverses[3][BVH_PACKET_SIZE];
+        int stack[BVH_MAX_DEPTH * 2];
+        int stackSize = 0;
+
+        for (int lane = 0; lane < BVH_PACKET_SIZE; ++lane)
+        {
+            int ray = std::min(lane, numRays - 1);
+
+            for (int k = 0; k < 3; ++k)
+            {
+                origins[k][lane] = pOrigins[ray * 3 + k];
+                directions[k][lane] = pDirections[ray * 3 + k];
+                inverses[k][lane] = 1.0f / directions[k][lane];
+            }
+
+            hitTriangles[lane] = -1;
+            t[lane] = (lane < numRays) ? maxDistance : -1.0f;
+            u[lane] = v[lane] = 0.0f;
+        }
+
+        stack[stackSize++] = 0;
+
+        while (stackSize > 0)
+        {
+            const ModelOBJ::BvhNode &node = pNodes[stack[--stackSize]];
+            int hits = 0;
+
+            for (int lane = 0; lane < BVH_PACKET_SIZE; ++lane)
+            {
+                float tEnter = 0.0f;
+                float tExit = t[lane];
+
+                for (int k = 0; k < 3; ++k)
+                {
+                    bool negative = inverses[k][lane] < 0.0f;
+
+                    ClipToSlab(negative ? node.boundsMax[k] : node.boundsMin[k],
+                               negative ? node.boundsMin[k] : node.boundsMax[k],
+                               origins[k][lane], inverses[k][lane], tEnter, tExit);
+                }
+
+                hits |= (tEnter <= tExit) ? 1 : 0;
+            }
+
+            if (!hits)
+                continue;
+
+            if (node.count == 0)
+            {
+                const ModelOBJ::BvhNode &left = pNodes[node.first];
+                const ModelOBJ::BvhNode &right = pNodes[node.first + 1];
+                float along = 0.0f;
+
+                for (int k = 0; k < 3; ++k)
+                {
+                    along += (right.boundsMin[k] + right.boundsMax[k] - left.boundsMin[k] - left.boundsMax[k]) *
+                        directions[k][0];
+                }
+
+                stack[stackSize++] = (along < 0.0f) ? node.first : node.first + 1;
+                stack[stackSize++] = (along < 0.0f) ? node.first + 1 : node.first;
+                continue;
+            }
+
+            for (int i = node.first; i < node.first + node.count; ++i)
+            {
+                const float *p0 = &pPositions[i * 9];
+                float e1[3] = {p0[3] - p0[0], p0[4] - p0[1], p0[5] - p0[2]};
+                float e2[3] = {p0[6] - p0[0], p0[7] - p0[1], p0[8] - p0[2]};
+
+                for (int lane = 0; lane < BVH_PACKET_SIZE; ++lane)
+                {
+                    float dx = directions[0][lane];
+                    float dy = directions[1][lane];
+                    float dz = directions[2][lane];
+                    float px = dy * e2[2] - dz * e2[1];
+                    float py = dz * e2[0] - dx * e2[2];
+                    float pz = dx * e2[1] - dy * e2[0];
+                    float det = e1[0] * px + e1[1] * py + e1[2] * pz;
+                    float inverseDet = (det != 0.0f) ? 1.0f / det : 0.0f;
+                    float sx = origins[0][lane] - p0[0];
+                    float sy = origins[1][lane] - p0[1];
+                    float sz = origins[2][lane] - p0[2];
+                    float qx = sy * e1[2] - sz * e1[1];
+                    float qy = sz * e1[0] - sx * e1[2];
+                    float qz = sx * e1[1] - sy * e1[0];
+                    float hitU = (sx * px + sy * py + sz * pz) * inverseDet;
+                    float hitV = (dx * qx + dy * qy + dz * qz) * inverseDet;
+                    float hitT = (e2[0] * qx + e2[1] * qy + e2[2] * qz) * inverseDet;
+                    bool hit = det != 0.0f && hitU >= 0.0f && hitV >= 0.0f && hitU + hitV <= 1.0f &&
+                               hitT >= 0.0f && hitT <= t[lane];
+
+                    hitTriangles[lane] = hit ? i : hitTriangles[lane];
+                    t[lane] = hit ? hitT : t[lane];
+                    u[lane] = hit ? hitU : u[lane];
+                    v[lane] = hit ? hitV : v[lane];
+                }
+            }
+        }
+    }
+
+    //-------------------------------------------------------------------------
+    // Frustum culling helpers used by ModelOBJ::cullGroups(),
+    // ModelOBJ::cullMeshes() and ModelOBJ::cullMeshlets(). Bounds are tested
+    // CULL_BATCH_SIZE at a time against all six planes. The per bound loops
+    // have a fixed trip count and no early exits so that they vectorize.
+    //-------------------------------------------------------------------------
+
+    const int CULL_BATCH_SIZE = 8;
+
+    void ExtractFrustumPlanes(const float m[16], float planes[6][4])
+    {
+        // The planes are sums and differences of the rows of the column
+        // major clip matrix, in the order left, right, bottom, top, near and
+        // far. A position p is inside when dot(plane.xyz, p) + plane.w >= 0.
+        // The planes are normalized so that spheres can be tested too.
+
+        for (int i = 0; i < 6; ++i)
+        {
+            int row = i / 2;
+            float sign = (i & 1) ? -1.0f : 1.0f;
+            float length = 0.0f;
+
+            for (int k = 0; k < 4; ++k)
+                planes[i][k] = m[k * 4 + 3] + sign * m[k * 4 + row];
+
+            length = sqrtf(planes[i][0] * planes[i][0] + planes[i][1] * planes[i][1] +
+                           planes[i][2] * planes[i][2]);
+
+            if (length > 0.0f)
+            {
+                for (int k = 0; k < 4; ++k)
+                    planes[i][k] /= length;
+            }
+        }
+    }
+
+    int CullBoxes(const float planes[6][4], const ModelOBJ::BoundingBox *pBoxes, int count,
+                  unsigned char *pVisible)
+    {
+        // A box is outside when its center is further outside one of the
+        // planes than the box's projected half extent along the plane normal.
+
+        float centers[3][CULL_BATCH_SIZE];
+        float extents[3][CULL_BATCH_SIZE];
+        int numVisible = 0;
+
+        for (int i = 0; i < count; i += CULL_BATCH_SIZE)
+        {
+            int batchSize = std::min(count - i, CULL_BATCH_SIZE);
+            int outside[CULL_BATCH_SIZE] = {0};
+
+            for (int lane = 0; lane < CULL_BATCH_SIZE; ++lane)
+            {
+                const ModelOBJ::BoundingBox &box = pBoxes[i + std::min(lane, batchSize - 1)];
+
+                for (int k = 0; k < 3; ++k)
+                {
+                    centers[k][lane] = (box.boundsMin[k] + box.boundsMax[k]) * 0.5f;
+                    extents[k][lane] = (box.boundsMax[k] - box.boundsMin[k]) * 0.5f;
+                }
+            }
+
+            for (int p = 0; p < 6; ++p)
+            {
+                const float *plane = planes[p];
+
+                for (int lane = 0; lane < CULL_BATCH_SIZE; ++lane)
+                {
+                    float distance = plane[0] * centers[0][lane] + plane[1] * centers[1][lane] +
+                                     plane[2] * centers[2][lane] + plane[3];
+                    float radius = fabsf(plane[0]) * extents[0][lane] + fabsf(plane[1]) * extents[1][lane] +
+                                   fabsf(plane[2]) * extents[2][lane];
+
+                    outside[lane] |= (distance + radius < 0.0f) ? 1 : 0;
+                }
+            }
+
+            for (int lane = 0; lane < batchSize; ++lane)
+            {
+                pVisible[i + lane] = outside[lane] ? 0 : 1;
+                numVisible += outside[lane] ? 0 : 1;
+            }
+        }
+
+        return numVisible;
+    }
+
+    int CullMeshlets(const float planes[6][4], const float *pEye, const ModelOBJ::Meshlet *pMeshlets,
+                     int count, unsigned char *pVisible)
+    {
+        // A meshlet is outside when its bounding sphere is entirely outside
+        // one of the planes. With an eye position it's also culled when it
+        // faces away from the eye: dot(apex - eye, axis) >= cutoff * |apex - eye|.
+        // Meshlets with a cutoff of 1 can't be back face culled.
+
+        float centers[3][CULL_BATCH_SIZE];
+        float radii[CULL_BATCH_SIZE];
+        float apexes[3][CULL_BATCH_SIZE];
+        float axes[3][CULL_BATCH_SIZE];
+        float cutoffs[CULL_BATCH_SIZE];
+        int numVisible = 0;
+
+        for (int i = 0; i < count; i += CULL_BATCH_SIZE)
+        {
+            int batchSize = std::min(count - i, CULL_BATCH_SIZE);
+            int outside[CULL_BATCH_SIZE] = {0};
+
+            for (int lane = 0; lane < CULL_BATCH_SIZE; ++lane)
+            {
+                const ModelOBJ::Meshlet &meshlet = pMeshlets[i + std::min(lane, batchSize - 1)];
+
+                for (int k = 0; k < 3; ++k)
+                {
+                    centers[k][lane] = meshlet.center[k];
+                    apexes[k][lane] = meshlet.coneApex[k];
+                    axes[k][lane] = meshlet.coneAxis[k];
+                }
+
+                radii[lane] = meshlet.radius;
+                cutoffs[lane] = meshlet.coneCutoff;
+            }
+
+            for (int p = 0; p < 6; ++p)
+            {
+                const float *plane = planes[p];
+
+                for (int lane = 0; lane < CULL_BATCH_SIZE; ++lane)
+                {
+                    float distance = plane[0] * centers[0][lane] + plane[1] * centers[1][lane] +
+                                     plane[2] * centers[2][lane] + plane[3];
+
+                    outside[lane] |= (distance < -radii[lane]) ? 1 : 0;
+                }
+            }
+
+            if (pEye)
+            {
+                for (int lane = 0; lane < CULL_BATCH_SIZE; ++lane)
+                {
+                    float dx = apexes[0][lane] - pEye[0];
+                    float dy = apexes[1][lane] - pEye[1];
+                    float dz = apexes[2][lane] - pEye[2];
+                    float along = dx * axes[0][lane] + dy * axes[1][lane] + dz * axes[2][lane];
+                    float length = sqrtf(dx * dx + dy * dy + dz * dz);
+
+                    outside[lane] |= (cutoffs[lane] < 1.0f && along >= cutoffs[lane] * length) ? 1 : 0;
+                }
+            }
+
+            for (int lane = 0; lane < batchSize; ++lane)
+            {
+                pVisible[i + lane] = outside[lane] ? 0 : 1;
+                numVisible += outside[lane] ? 0 : 1;
+            }
+        }
+
+        return numVisible;
+    }
+
+    //-------------------------------------------------------------------------
+    // Vertex packing helpers used by ModelOBJ::packVertexBuffer().
+    //-------------------------------------------------------------------------
+
+    inline int RoundToInt(float value)
+    {
+        return static_cast<int>(floorf(value + 0.5f));
+    }
+
+    unsigned short FloatToHalf(float value)
+    {
+        // Round to nearest even. Values too large for a half float are
+        // clamped to the largest finite half float.
+
+        unsigned int bits = 0;
+
+        memcpy(&bits, &value, sizeof(bits));
+
+        unsigned int sign = (bits >> 16) & 0x8000;
+        unsigned int mantissa = bits & 0x7FFFFF;
+        unsigned int biasedExponent = (bits >> 23) & 0xFF;
+
+        if (biasedExponent == 0xFF)
+            return static_cast<unsigned short>(sign | (mantissa ? 0x7E00 : 0x7BFF));
+
+        int exponent = static_cast<int>(biasedExponent) - 127 + 15;
+
+        if (exponent >= 31)
+            return static_cast<unsigned short>(sign | 0x7BFF);
+
+        unsigned int half = 0;
+        unsigned int remainder = 0;
+        unsigned int halfway = 0;
+
+        if (exponent <= 0)
+        {
+            // Subnormal half float.
+
+            if (exponent < -10)
+                return static_cast<unsigned short>(sign);
+
+            int shift = 14 - exponent;
+
+            mantissa |= 0x800000;
+            half = mantissa >> shift;
+            remainder = mantissa & ((1U << shift) - 1);
+            halfway = 1U << (shift - 1);
+        }
+        else
+        {
+            half = (static_cast<unsigned int>(exponent) << 10) | (mantissa >> 13);
+            remainder = mantissa & 0x1FFF;
+            halfway = 0x1000;
+        }
+
+        if (remainder > halfway || (remainder == halfway && (half & 1)))
+            ++half;
+
+        if (half > 0x7BFF)
+            half = 0x7BFF;
+
+        return static_cast<unsigned short>(sign | half);
+    }
+
+    float HalfToFloat(unsigned short half)
+    {
+        unsigned int exponent = (half >> 10) & 0x1F;
+        unsigned int mantissa = half & 0x3FF;
+        float value = 0.0f;
+
+        if (exponent == 0)
+            value = ldexpf(static_cast<float>(mantissa), -24);
+        else if (exponent == 31)
+            value = mantissa ? std::numeric_limits<float>::quiet_NaN() : std::numeric_limits<float>::infinity();
+        else
+            value = ldexpf(static_cast<float>(mantissa | 0x400), static_cast<int>(exponent) - 25);
+
+        return (half & 0x8000) ? -value : value;
+    }
+
+    unsigned short QuantizeUnorm16(float value, float offset, float scale)
+    {
+        if (scale <= 0.0f)
+            return 0;
+
+        float t = (value - offset) / scale;
+
+        t = std::min(std::max(t, 0.0f), 1.0f);
+        return static_cast<unsigned short>(RoundToInt(t * 65535.0f));
+    }
+
+    inline float DequantizeUnorm16(unsigned short value, float offset, float scale)
+    {
+        return offset + scale * (value / 65535.0f);
+    }
+
+    inline float SignNotZero(float value)
+    {
+        return (value >= 0.0f) ? 1.0f : -1.0f;
+    }
+
+    unsigned int EncodeOctahedral(const float normal[3])
+    {
+        // Projects the normal onto an octahedron and unfolds the lower half
+        // over the upper half, giving two snorm16 values.
+
+        float length = fabsf(normal[0]) + fabsf(normal[1]) + fabsf(normal[2]);
+
+        if (length == 0.0f)
+            return 0;
+
+        float x = normal[0] / length;
+        float y = normal[1] / length;
+
+        if (normal[2] < 0.0f)
+        {
+            float foldedX = (1.0f - fabsf(y)) * SignNotZero(x);
+            float foldedY = (1.0f - fabsf(x)) * SignNotZero(y);
+
+            x = foldedX;
+            y = foldedY;
+        }
+
+        unsigned int qx = static_cast<unsigned short>(RoundToInt(std::min(std::max(x, -1.0f), 1.0f) * 32767.0f));
+        unsigned int qy = static_cast<unsigned short>(RoundToInt(std::min(std::max(y, -1.0f), 1.0f) * 32767.0f));
+
+        return qx | (qy << 16);
+    }
+
+    void DecodeOctahedral(unsigned int packed, float normal[3])
+    {
+        float x = std::max(static_cast<short>(packed & 0xFFFF) / 32767.0f, -1.0f);
+        float y = std::max(static_cast<short>(packed >> 16) / 32767.0f, -1.0f);
+        float z = 1.0f - fabsf(x) - fabsf(y);
+
+        if (z < 0.0f)
+        {
+            float unfoldedX = (1.0f - fabsf(y)) * SignNotZero(x);
+            float unfoldedY = (1.0f - fabsf(x)) * SignNotZero(y);
+
+            x = unfoldedX;
+            y = unfoldedY;
+        }
+
+        float length = sqrtf(x * x + y * y + z * z);
+
+        normal[0] = x / length;
+        normal[1] = y / length;
+        normal[2] = z / length;
+    }
+
+    inline unsigned int PackSnorm(float value, int bits)
+    {
+        float maximum = static_cast<float>((1 << (bits - 1)) - 1);
+        int quantized = RoundToInt(std::min(std::max(value, -1.0f), 1.0f) * maximum);
+
+        return static_cast<unsigned int>(quantized) & ((1U << bits) - 1);
+    }
+
+    inline float UnpackSnorm(unsigned int packed, int bits)
+    {
+        int quantized = static_cast<int>(packed & ((1U << bits) - 1));
+
+        if (quantized & (1 << (bits - 1)))
+            quantized -= 1 << bits;
+
+        return std::max(quantized / static_cast<float>((1 << (bits - 1)) - 1), -1.0f);
+    }
+
+    float AngleBetween(const float a[3], const float b[3])
+    {
+        // Angle in degrees between two directions of any length.
+
+        float lengths = sqrtf((a[0] * a[0] + a[1] * a[1] + a[2] * a[2]) *
+            (b[0] * b[0] + b[1] * b[1] + b[2] * b[2]));
+
+        if (lengths == 0.0f)
+            return 0.0f;
+
+        float cosine = (a[0] * b[0] + a[1] * b[1] + a[2] * b[2]) / lengths;
+
+        return acosf(std::min(std::max(cosine, -1.0f), 1.0f)) * (180.0f / 3.14159265f);
+    }
+
+    //-------------------------------------------------------------------------
+    // Read only view of an entire file mapped into the address space.
+    //-------------------------------------------------------------------------
+
+    class MappedFile
+    {
+    public:
+        MappedFile();
+        ~MappedFile();
+
+        bool open(const char *pszFilename, bool copyOnWrite = false);
+        void close();
+
+        char *data() { return m_pData; }
+        const char *data() const { return m_pData; }
+        size_t size() const { return m_size; }
+
+    private:
+        MappedFile(const MappedFile &);
+        MappedFile &operator=(const MappedFile &);
+
+        char *m_pData;
+        size_t m_size;
+#if defined(_WIN32)
+        HANDLE m_hFile;
+        HANDLE m_hMapping;
+#else
+        int m_fd;
+#endif
+    };
+
+#if defined(_WIN32)
+    MappedFile::MappedFile()
+        : m_pData(0), m_size(0), m_hFile(INVALID_HANDLE_VALUE), m_hMapping(0)
+    {
+    }
+
+    bool MappedFile::open(const char *pszFilename, bool copyOnWrite)
+    {
+        // Copy on write views can be modified in memory without changing
+        // the file.
+
+        close();
+
+        m_hFile = CreateFileA(pszFilename, GENERIC_READ, FILE_SHARE_READ, 0,
+            OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL | FILE_FLAG_SEQUENTIAL_SCAN, 0);
+
+        if (m_hFile == INVALID_HANDLE_VALUE)
+            return false;
+
+        // Empty files can't be mapped. Files larger than the address space
+        // (i.e., multi-GB files in a 32-bit process) can't be mapped in one
+        // view. The caller falls back to the stdio parser for both.
+
+        LARGE_INTEGER fileSize = {0};
+
+        if (!GetFileSizeEx(m_hFile, &fileSize) || fileSize.QuadPart <= 0 ||
+            static_cast<unsigned __int64>(fileSize.QuadPart) >
+            static_cast<unsigned __int64>(std::numeric_limits<size_t>::max()))
+        {
+            close();
+            return false;
+        }
+
+        if (!(m_hMapping = CreateFileMappingA(m_hFile, 0,
+            copyOnWrite ? PAGE_WRITECOPY : PAGE_READONLY, 0, 0, 0)))
+        {
+            close();
+            return false;
+        }
+
+        if (!(m_pData = static_cast<char *>(MapViewOfFile(m_hMapping,
+            copyOnWrite ? FILE_MAP_COPY : FILE_MAP_READ, 0, 0, 0))))
+        {
+            close();
+            return false;
+        }
+
+        m_size = static_cast<size_t>(fileSize.QuadPart);
+        return true;
+    }
+
+    void MappedFile::close()
+    {
+        if (m_pData)
+        {
+            UnmapViewOfFile(m_pData);
+            m_pData = 0;
+        }
+
+        if (m_hMapping)
+        {
+            CloseHandle(m_hMapping);
+            m_hMapping = 0;
+        }
+
+        if (m_hFile != INVALID_HANDLE_VALUE)
+        {
+            CloseHandle(m_hFile);
+            m_hFile = INVALID_HANDLE_VALUE;
+        }
+
+        m_size = 0;
+    }
+#else
+    MappedFile::MappedFile() : m_pData(0), m_size(0), m_fd(-1)
+    {
+    }
+
+    bool MappedFile::open(const char *pszFilename, bool copyOnWrite)
+    {
+        // Copy on write views can be modified in memory without changing
+        // the file.
+
+        close();
+
+        if ((m_fd = ::open(pszFilename, O_RDONLY)) == -1)
+            return false;
+
+        struct stat info;
+
+        if (fstat(m_fd, &info) != 0 || info.st_size <= 0 ||
+            static_cast<unsigned long long>(info.st_size) >
+            static_cast<unsigned long long>(std::numeric_limits<size_t>::max()))
+        {
+            close();
+            return false;
+        }
+
+        void *pView = mmap(0, static_cast<size_t>(info.st_size),
+            copyOnWrite ? PROT_READ | PROT_WRITE : PROT_READ, MAP_PRIVATE, m_fd, 0);
+
+        if (pView == MAP_FAILED)
+        {
+            close();
+            return false;
+        }
+
+        if (!copyOnWrite)
+            madvise(pView, static_cast<size_t>(info.st_size), MADV_SEQUENTIAL);
+
+        m_pData = static_cast<char *>(pView);
+        m_size = static_cast<size_t>(info.st_size);
+        return true;
+    }
+
+    void MappedFile::close()
+    {
+        if (m_pData)
+        {
+            munmap(m_pData, m_size);
+            m_pData = 0;
+        }
+
+        if (m_fd != -1)
+        {
+            ::close(m_fd);
+            m_fd = -1;
+        }
+
+        m_size = 0;
+    }
+#endif
+
+    MappedFile::~MappedFile()
+    {
+        close();
+    }
+
+    //-------------------------------------------------------------------------
+    // Binary mesh cache. The file starts with a CacheHeader followed by the
+    // vertex buffer and the index buffer, both 16 byte aligned so that they
+    // can be used in place from a mapped view of the file. The meshes, the
+    // materials, and the MTL files the model depends on follow as a packed
+    // byte stream. Numbers are stored in the native byte order.
+    //-------------------------------------------------------------------------
+
+    const char CACHE_MAGIC[8] = {'O', 'B', 'J', 'C', 'A', 'C', 'H', 'E'};
+    const unsigned int CACHE_VERSION = 8;
+
+    enum CacheFlags
+    {
+        CACHE_REBUILD_NORMALS = 1,
+        CACHE_HAS_POSITIONS = 2,
+        CACHE_HAS_TEXCOORDS = 4,
+        CACHE_HAS_NORMALS = 8,
+        CACHE_HAS_TANGENTS = 16,
+        CACHE_MIKKTSPACE = 32,          // ImportOptions::tangentMethod
+        CACHE_OPTIMIZE_VERTEX_CACHE = 64,
+        CACHE_OPTIMIZE_VERTEX_FETCH = 128,
+        CACHE_MERGE_MESHES = 256,       // ImportOptions::mergeMeshesByMaterial
+        CACHE_KEEP_GROUPS = 512,        // ImportOptions::keepGroups
+        CACHE_ATTRIBUTES_SHIFT = 16     // ImportOptions::vertexAttributes
+    };
+
+    struct FileStamp
+    {
+        unsigned long long size;    // ~0 if the file doesn't exist
+        long long time;             // last write time
+    };
+
+    struct CacheHeader
+    {
+        char magic[8];
+        unsigned int version;
+        unsigned int vertexSize;    // sizeof(ModelOBJ::Vertex)
+        FileStamp source;
+        unsigned long long sourceHash;
+        unsigned int flags;         // CacheFlags
+        int numberOfVertices;
+        int numberOfTriangles;
+        int numberOfMaterials;
+        int numberOfMeshes;
+        int numberOfDependencies;
+        int numberOfLods;
+        int numberOfLodIndices;
+        int numberOfMeshlets;
+        int numberOfGroups;
+        int meshletMaxVertices;     // 0 if meshlets weren't built
+        int meshletMaxTriangles;
+        float center[3];
+        float width;
+        float height;
+        float length;
+        float radius;
+        float acmrBefore;           // ModelOBJ::ImportStats
+        float acmrAfter;
+        float atvrBefore;
+        float atvrAfter;
+        float overfetchBefore;
+        float overfetchAfter;
+        unsigned long long vertexOffset;
+        unsigned long long indexOffset;
+        unsigned long long dataOffset;
+        unsigned long long fileSize;
+    };
+
+    inline unsigned long long AlignOffset(unsigned long long offset)
+    {
+        return (offset + 15) & ~15ULL;
+    }
+
+    FileStamp GetFileStamp(const char *pszFilename)
+    {
+        FileStamp stamp = {~0ULL, 0};
+
+#if defined(_WIN32)
+        WIN32_FILE_ATTRIBUTE_DATA info;
+
+        if (GetFileAttributesExA(pszFilename, GetFileExInfoStandard, &info))
+        {
+            stamp.size = (static_cast<unsigned long long>(info.nFileSizeHigh) << 32) | info.nFileSizeLow;
+            stamp.time = static_cast<long long>((static_cast<unsigned long long>(info.ftLastWriteTime.dwHighDateTime) << 32) |
+                info.ftLastWriteTime.dwLowDateTime);
+        }
+#else
+        struct stat info;
+
+        if (stat(pszFilename, &info) == 0)
+        {
+            stamp.size = static_cast<unsigned long long>(info.st_size);
+            stamp.time = static_cast<long long>(info.st_mtime);
+        }
+#endif
+
+        return stamp;
+    }
+
+    unsigned long long HashFileContents(const char *pData, size_t size)
+    {
+        // 64-bit FNV-1a over a sample of the file: small files are hashed
+        // whole, larger ones as 64 evenly spaced 4 KB blocks that include
+        // the first and the last block. Together with the size and the last
+        // write time this catches edited files without reading all of a
+        // multi-GB file on every load.
+
+        const size_t blockSize = 4096;
+        const size_t numBlocks = 64;
+        unsigned long long hash = 14695981039346656037ULL;
+        size_t offset = 0;
+        size_t length = 0;
+
+        for (size_t i = 0; i < numBlocks; ++i)
+        {
+            if (size <= blockSize * numBlocks)
+            {
+                offset = i * size / numBlocks;
+                length = (i + 1) * size / numBlocks - offset;
+            }
+            else
+            {
+                offset = static_cast<size_t>(static_cast<unsigned long long>(size - blockSize) * i / (numBlocks - 1));
+                length = blockSize;
+            }
+
+            for (size_t j = 0; j < length; ++j)
+                hash = (hash ^ static_cast<unsigned char>(pData[offset + j])) * 1099511628211ULL;
+        }
+
+        return hash ^ size;
+    }
+
+    void AppendBytes(std::vector<char> &buffer, const void *pData, size_t size)
+    {
+        const char *pBytes = static_cast<const char *>(pData);
+
+        buffer.insert(buffer.end(), pBytes, pBytes + size);
+    }
+
+    void AppendString(std::vector<char> &buffer, const std::string &str)
+    {
+        unsigned int length = static_cast<unsigned int>(str.size());
+
+        AppendBytes(buffer, &length, sizeof(length));
+        AppendBytes(buffer, str.data(), str.size());
+    }
+
+    bool ReadBytes(const char *&pData, const char *pEnd, void *pOut, size_t size)
+    {
+        if (static_cast<size_t>(pEnd - pData) < size)
+            return false;
+
+        memcpy(pOut, pData, size);
+        pData += size;
+        return true;
+    }
+
+    bool ReadString(const char *&pData, const char *pEnd, std::string &str)
+    {
+        unsigned int length = 0;
+
+        if (!ReadBytes(pData, pEnd, &length, sizeof(length)) ||
+            static_cast<size_t>(pEnd - pData) < length)
+        {
+            return false;
+        }
+
+        str.assign(pData, length);
+        pData += length;
+        return true;
+    }
+
+    //-------------------------------------------------------------------------
+    // In place scanner for OBJ files held in memory. None of these functions
+    // read past 'pEnd', so the buffer doesn't need to be null terminated.
+    //-------------------------------------------------------------------------
+
+    enum FaceType
+    {
+        FACE_POS,
+        FACE_POS_TEXCOORD,
+        FACE_POS_NORMAL,
+        FACE_POS_TEXCOORD_NORMAL
+    };
+
+    struct ObjFace
+    {
+        int numCorners;
+        int type;           // FaceType
+        int material;       // index into ObjGeometry::materialNames or -1
+    };
+
+    struct ObjGroup
+    {
+        std::string object;
+        std::string group;  // empty after an o statement
+        bool objectKnown;   // false before the chunk's first o statement
+    };
+
+    inline int *CopyCorner(const int *pCorner, int type, int *pOut)
+    {
+        // Copies a face corner, dropping the indices the face type doesn't use.
+
+        pOut[0] = pCorner[0];
+        pOut[1] = (type == FACE_POS_TEXCOORD || type == FACE_POS_TEXCOORD_NORMAL) ? pCorner[1] : -1;
+        pOut[2] = (type == FACE_POS_NORMAL || type == FACE_POS_TEXCOORD_NORMAL) ? pCorner[2] : -1;
+        return pOut + 3;
+    }
+
+    inline int MaskFaceType(int type, unsigned int attributes)
+    {
+        // Drops the face's texture coordinates or normals if they aren't
+        // being imported.
+
+        if (!(attributes & ModelOBJ::ATTRIBUTE_TEXCOORD))
+            type = (type == FACE_POS_TEXCOORD_NORMAL) ? FACE_POS_NORMAL : (type == FACE_POS_TEXCOORD ? FACE_POS : type);
+
+        if (!(attributes & ModelOBJ::ATTRIBUTE_NORMAL))
+            type = (type == FACE_POS_TEXCOORD_NORMAL) ? FACE_POS_TEXCOORD : (type == FACE_POS_NORMAL ? FACE_POS : type);
+
+        return type;
+    }
+
+    struct ObjGeometry
+    {
+        std::vector<float> vertexCoords;
+        std::vector<float> textureCoords;
+        std::vector<float> normals;
+        std::vector<int> corners;       // zero based v, vt, vn triples
+        std::vector<size_t> relativeCorners;
+        std::vector<ObjFace> faces;
+        std::vector<std::string> materialNames;
+        std::vector<std::string> materialLibraries;
+        std::vector<int> materialIds;   // materialNames resolved to materials
+        int activeMaterial;             // last usemtl in the chunk or -1
+        int numUseMaterials;            // number of usemtl statements
+        std::vector<ObjGroup> groups;   // o and g statements, keepGroups only
+        std::vector<int> groupIds;      // groups resolved to model groups
+        std::vector<int> faceGroups;    // index into groups or -1, per face
+        int activeGroup;                // last o or g in the chunk or -1
+    };
+
+    inline bool IsBlank(char c)
+    {
+        return c == ' ' || c == '\t' || c == '\r';
+    }
+
+    inline const char *SkipBlanks(const char *p, const char *pEnd)
+    {
+        while (p < pEnd && IsBlank(*p))
+            ++p;
+
+        return p;
+    }
+
+    inline const char *SkipLine(const char *p, const char *pEnd)
+    {
+        const void *pNewline = memchr(p, '\n', pEnd - p);
+        return pNewline ? static_cast<const char *>(pNewline) + 1 : pEnd;
+    }
+
+    inline bool MatchKeyword(const char *p, const char *pEnd, const char *pszKeyword)
+    {
+        // The keyword must be followed by a blank for it to match.
+
+        while (*pszKeyword)
+        {
+            if (p == pEnd || *p++ != *pszKeyword++)
+                return false;
+        }
+
+        return p < pEnd && IsBlank(*p);
+    }
+
+    //-------------------------------------------------------------------------
+    // Numeric parsing kernel for the v, vt, vn, and f lines.
+    //
+    // ParseFloat() is exact. It returns the same correctly rounded float as
+    // strtof() does in the "C" locale, whatever the process locale is.
+    //
+    // Most OBJ exporters write short fixed point decimals such as "-0.125000".
+    // The mantissa of these is accumulated eight digits at a time using SWAR
+    // (SIMD within a register) arithmetic. It is then scaled by an exact
+    // power of ten using a single correctly rounded double multiply or divide
+    // (Clinger's fast path). Rounding that double to a float gives the
+    // correctly rounded result unless the double lands exactly on a halfway
+    // point between two floats. That case, and every other case the fast
+    // path can't handle exactly, is passed to strtof().
+    //-------------------------------------------------------------------------
+
+    const double g_powersOfTen[] =
+    {
+        1e0,  1e1,  1e2,  1e3,  1e4,  1e5,  1e6,  1e7,
+        1e8,  1e9,  1e10, 1e11, 1e12, 1e13, 1e14, 1e15,
+        1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+    };
+
+    inline bool IsDigit(char c)
+    {
+        return static_cast<unsigned char>(c - '0') < 10;
+    }
+
+    inline bool IsEightDigits(unsigned long long chars)
+    {
+        return (((chars & 0xF0F0F0F0F0F0F0F0ULL) |
+            (((chars + 0x0606060606060606ULL) & 0xF0F0F0F0F0F0F0F0ULL) >> 4)) ==
+            0x3333333333333333ULL);
+    }
+
+    inline unsigned int ParseEightDigits(unsigned long long chars)
+    {
+        // 'chars' holds eight ASCII digits loaded little endian, so the first
+        // digit is in the lowest byte. Pairs, then quads, then the full eight
+        // digits are combined using three multiplies.
+
+        const unsigned long long mask = 0x000000FF000000FFULL;
+        const unsigned long long mul1 = 0x000F424000000064ULL;  // 100 + (1000000 << 32)
+        const unsigned long long mul2 = 0x0000271000000001ULL;  // 1 + (10000 << 32)
+
+        chars -= 0x3030303030303030ULL;
+        chars = (chars * 10) + (chars >> 8);
+        chars = (((chars & mask) * mul1) + (((chars >> 16) & mask) * mul2)) >> 32;
+
+        return static_cast<unsigned int>(chars);
+    }
+
+    inline const char *ParseDigits(const char *p, const char *pEnd,
+                                   unsigned long long &mantissa, int &numDigits)
+    {
+        // Appends a run of digits to 'mantissa'. 'numDigits' counts every
+        // digit consumed. Only the first 19 digits fit in the mantissa. The
+        // caller falls back to strtof() when there are more.
+
+        unsigned long long chars = 0;
+
+        while (pEnd - p >= 8 && numDigits <= 11)
+        {
+            memcpy(&chars, p, sizeof(chars));   // x86 and x64 are little endian
+
+            if (!IsEightDigits(chars))
+                break;
+
+            mantissa = mantissa * 100000000ULL + ParseEightDigits(chars);
+            numDigits += 8;
+            p += 8;
+        }
+
+        while (p < pEnd && IsDigit(*p))
+        {
+            if (numDigits < 19)
+                mantissa = mantissa * 10 + static_cast<unsigned int>(*p - '0');
+
+            ++numDigits;
+            ++p;
+        }
+
+        return p;
+    }
+
+    inline bool ParseInt(const char *&p, const char *pEnd, int &value)
+    {
+        bool negative = false;
+
+        if (p < pEnd && (*p == '-' || *p == '+'))
+            negative = (*p++ == '-');
+
+        if (p == pEnd || !IsDigit(*p))
+            return false;
+
+        unsigned int result = 0;
+
+        while (p < pEnd && IsDigit(*p))
+            result = result * 10 + static_cast<unsigned int>(*p++ - '0');
+
+        value = negative ? -static_cast<int>(result) : static_cast<int>(result);
+        return true;
+    }
+
+    bool ParseFloatSlow(const char *pStart, const char *&p, const char *pEnd, float &value)
+    {
+        // strtof() needs a null terminated string, so the token is copied out
+        // of the file. Its '.' is swapped for the decimal point of the current
+        // locale so that the result is the same in every locale.
+
+        const char *pTokenEnd = pStart;
+
+        while (pTokenEnd < pEnd && !IsBlank(*pTokenEnd) && *pTokenEnd != '\n')
+            ++pTokenEnd;
+
+        if (pTokenEnd == pStart)
+        {
+            p = pStart;
+            return false;
+        }
+
+        std::string token(pStart, pTokenEnd);
+        const char *pszDecimalPoint = localeconv()->decimal_point;
+        std::string::size_type offset = token.find('.');
+
+        if (offset != std::string::npos && pszDecimalPoint && strcmp(pszDecimalPoint, ".") != 0)
+            token.replace(offset, 1, pszDecimalPoint);
+
+        char *pStop = 0;
+        float result = strtof(token.c_str(), &pStop);
+
+        p = pTokenEnd;
+
+        if (pStop == token.c_str())
+            return false;
+
+        value = result;
+        return true;
+    }
+
+    inline bool ParseFloat(const char *&p, const char *pEnd, float &value)
+    {
+        const char *pStart = p = SkipBlanks(p, pEnd);
+        const char *pDigits = 0;
+        unsigned long long mantissa = 0;
+        int numDigits = 0;
+        int exponent = 0;
+        bool negative = false;
+        bool hasDigits = false;
+
+        if (p < pEnd && (*p == '-' || *p == '+'))
+            negative = (*p++ == '-');
+
+        // Integer part. Leading zeros aren't significant digits.
+
+        pDigits = p;
+
+        while (p < pEnd && *p == '0')
+            ++p;
+
+        p = ParseDigits(p, pEnd, mantissa, numDigits);
+        hasDigits = p != pDigits;
+
+        // Fractional part. Each digit scales the mantissa down by ten.
+
+        if (p < pEnd && *p == '.')
+        {
+            pDigits = ++p;
+
+            if (numDigits == 0)
+            {
+                while (p < pEnd && *p == '0')
+                    ++p;
+            }
+
+            p = ParseDigits(p, pEnd, mantissa, numDigits);
+            exponent = -static_cast<int>(p - pDigits);
+            hasDigits = hasDigits || p != pDigits;
+        }
+
+        if (!hasDigits)
+            return ParseFloatSlow(pStart, p, pEnd, value);  // inf, nan, etc
+
+        // Exponent.
+
+        if (p < pEnd && (*p == 'e' || *p == 'E'))
+        {
+            const char *pExponent = p + 1;
+            bool negativeExponent = false;
+            int explicitExponent = 0;
+
+            if (pExponent < pEnd && (*pExponent == '-' || *pExponent == '+'))
+                negativeExponent = (*pExponent++ == '-');
+
+            if (pExponent < pEnd && IsDigit(*pExponent))
+            {
+                while (pExponent < pEnd && IsDigit(*pExponent))
+                {
+                    if (explicitExponent < 100000)
+                        explicitExponent = explicitExponent * 10 + (*pExponent - '0');
+
+                    ++pExponent;
+                }
+
+                exponent += negativeExponent ? -explicitExponent : explicitExponent;
+                p = pExponent;
+            }
+        }
+
+        // Anything unusual about the token is left to strtof() to decide.
+
+        if (p < pEnd && !IsBlank(*p) && *p != '\n')
+            return ParseFloatSlow(pStart, p, pEnd, value);
+
+        if (mantissa == 0 && numDigits == 0)
+        {
+            value = negative ? -0.0f : 0.0f;
+            return true;
+        }
+
+        if (numDigits > 19 || mantissa > (1ULL << 53) || exponent < -22 || exponent > 22)
+            return ParseFloatSlow(pStart, p, pEnd, value);
+
+        double result = static_cast<double>(mantissa);
+
+        if (exponent < 0)
+            result /= g_powersOfTen[-exponent];
+        else
+            result *= g_powersOfTen[exponent];
+
+        // Results outside the normal float range, and results exactly halfway
+        // between two floats, can't be rounded from the double.
+
+        unsigned long long bits = 0;
+        int biasedExponent = 0;
+
+        memcpy(&bits, &result, sizeof(bits));
+        biasedExponent = static_cast<int>((bits >> 52) & 0x7FF);
+
+        if (biasedExponent < 1023 - 126 || biasedExponent > 1023 + 127 ||
+            (bits & 0x1FFFFFFFULL) == 0x10000000ULL)
+        {
+            return ParseFloatSlow(pStart, p, pEnd, value);
+        }
+
+        value = static_cast<float>(negative ? -result : result);
+        return true;
+    }
+
+    inline std::string ParseName(const char *p, const char *pEnd)
+    {
+        const char *pStart = SkipBlanks(p, pEnd);
+
+        p = pStart;
+
+        while (p < pEnd && !IsBlank(*p) && *p != '\n')
+            ++p;
+
+        return std::string(pStart, p);
+    }
+
+    inline std::string ParseLastName(const char *p, const char *pEnd)
+    {
+        const char *pLineEnd = SkipLine(p, pEnd);
+
+        while (pLineEnd > p && (IsBlank(pLineEnd[-1]) || pLineEnd[-1] == '\n'))
+            --pLineEnd;
+
+        const char *pStart = pLineEnd;
+
+        while (pStart > p && !IsBlank(pStart[-1]))
+            --pStart;
+
+        return std::string(pStart, pLineEnd);
+    }
+
+    inline std::string ParseLineName(const char *p, const char *pEnd)
+    {
+        // The rest of the line without surrounding blanks, so that a group
+        // statement naming several groups is kept as one name.
+
+        const char *pStart = SkipBlanks(p, pEnd);
+        const char *pLineEnd = pStart;
+
+        while (pLineEnd < pEnd && *pLineEnd != '\n')
+            ++pLineEnd;
+
+        while (pLineEnd > pStart && IsBlank(pLineEnd[-1]))
+            --pLineEnd;
+
+        return std::string(pStart, pLineEnd);
+    }
+
+    void ParseGeometry(const char *p, const char *pEnd, ObjGeometry &geometry,
+                       bool keepGroups, ModelOBJ::ImportProgress *pProgress)
+    {
+        // Single pass over the OBJ file, or one chunk of it. Attribute arrays
+        // grow as the file is read. Face corners are stored as zero based
+        // index triples and are turned into triangles once the whole file has
+        // been read.
+        //
+        // Relative (negative) indices are resolved against the attributes in
+        // this chunk only. Their positions are recorded in relativeCorners so
+        // that the attribute counts of the preceding chunks can be added in
+        // when the chunks are merged.
+        //
+        // The o and g statements are only read when keeping groups. A g
+        // statement before the chunk's first o statement belongs to the
+        // object the previous chunk ended in.
+        //
+        // Progress is reported, and cancellation checked for, about once
+        // every megabyte.
+
+        const size_t reportInterval = 1024 * 1024;
+        std::map<std::string, int> materialSlots;
+        std::map<std::string, int>::const_iterator iter;
+        std::string name;
+        std::string object;
+        bool objectKnown = false;
+        int activeMaterial = -1;
+        int numUseMaterials = 0;
+        int activeGroup = -1;
+        float value[3] = {0.0f};
+        const char *pReported = p;
+        const char *pReport = p + std::min<size_t>(reportInterval, pEnd - p);
+
+        while (p < pEnd)
+        {
+            if (pProgress && p >= pReport)
+            {
+                pProgress->bytesParsed += static_cast<unsigned long long>(p - pReported);
+                pReported = p;
+
+                if (pProgress->cancel)
+                    return;
+
+                pReport = p + std::min<size_t>(reportInterval, pEnd - p);
+            }
+
+            p = SkipBlanks(p, pEnd);
+
+            if (p == pEnd)
+                break;
+
+            switch (*p)
+            {
+            case 'v': // v, vt, or vn
+                if (MatchKeyword(p, pEnd, "v"))
+                {
+                    p += 1;
+                    value[0] = value[1] = value[2] = 0.0f;
+
+                    for (int i = 0; i < 3 && ParseFloat(p, pEnd, value[i]); ++i)
+                        ;
+
+                    geometry.vertexCoords.insert(geometry.vertexCoords.end(), value, value + 3);
+                }
+                else if (MatchKeyword(p, pEnd, "vt"))
+                {
+                    p += 2;
+                    value[0] = value[1] = 0.0f;
+
+                    for (int i = 0; i < 2 && ParseFloat(p, pEnd, value[i]); ++i)
+                        ;
+
+                    geometry.textureCoords.insert(geometry.textureCoords.end(), value, value + 2);
+                }
+                else if (MatchKeyword(p, pEnd, "vn"))
+                {
+                    p += 2;
+                    value[0] = value[1] = value[2] = 0.0f;
+
+                    for (int i = 0; i < 3 && ParseFloat(p, pEnd, value[i]); ++i)
+                        ;
+
+                    geometry.normals.insert(geometry.normals.end(), value, value + 3);
+                }
+                break;
+
+            case 'f': // v, v//vn, v/vt, or v/vt/vn
+                if (MatchKeyword(p, pEnd, "f"))
+                {
+                    int numVertices = static_cast<int>(geometry.vertexCoords.size() / 3);
+                    int numTexCoords = static_cast<int>(geometry.textureCoords.size() / 2);
+                    int numNormals = static_cast<int>(geometry.normals.size() / 3);
+                    ObjFace face = {0, FACE_POS, activeMaterial};
+
+                    p += 1;
+
+                    while (true)
+                    {
+                        int v = 0;
+                        int vt = 0;
+                        int vn = 0;
+                        bool hasTexCoord = false;
+                        bool hasNormal = false;
+
+                        p = SkipBlanks(p, pEnd);
+
+                        if (!ParseInt(p, pEnd, v))
+                            break;
+
+                        if (p < pEnd && *p == '/')
+                        {
+                            ++p;
+                            hasTexCoord = ParseInt(p, pEnd, vt);
+
+                            if (p < pEnd && *p == '/')
+                            {
+                                ++p;
+                                hasNormal = ParseInt(p, pEnd, vn);
+                            }
+                        }
+
+                        // The first corner decides the layout of the face.
+                        if (face.numCorners == 0)
+                        {
+                            if (hasTexCoord)
+                                face.type = hasNormal ? FACE_POS_TEXCOORD_NORMAL : FACE_POS_TEXCOORD;
+                            else
+                                face.type = hasNormal ? FACE_POS_NORMAL : FACE_POS;
+                        }
+
+                        // Negative indices are relative to the end of the
+                        // attribute lists read so far. Missing attributes are
+                        // stored as -1 and rejected when triangles are built.
+
+                        if (v < 0)
+                        {
+                            v += numVertices;
+                            geometry.relativeCorners.push_back(geometry.corners.size());
+                        }
+                        else
+                        {
+                            v -= 1;
+                        }
+
+                        if (!hasTexCoord)
+                        {
+                            vt = -1;
+                        }
+                        else if (vt < 0)
+                        {
+                            vt += numTexCoords;
+                            geometry.relativeCorners.push_back(geometry.corners.size() + 1);
+                        }
+                        else
+                        {
+                            vt -= 1;
+                        }
+
+                        if (!hasNormal)
+                        {
+                            vn = -1;
+                        }
+                        else if (vn < 0)
+                        {
+                            vn += numNormals;
+                            geometry.relativeCorners.push_back(geometry.corners.size() + 2);
+                        }
+                        else
+                        {
+                            vn -= 1;
+                        }
+
+                        geometry.corners.push_back(v);
+                        geometry.corners.push_back(vt);
+                        geometry.corners.push_back(vn);
+                        ++face.numCorners;
+                    }
+
+                    if (face.numCorners >= 3)
+                    {
+                        geometry.faces.push_back(face);
+
+                        if (keepGroups)
+                            geometry.faceGroups.push_back(activeGroup);
+                    }
+                    else
+                    {
+                        size_t numCorners = geometry.corners.size() - face.numCorners * 3;
+
+                        while (!geometry.relativeCorners.empty() && geometry.relativeCorners.back() >= numCorners)
+                            geometry.relativeCorners.pop_back();
+
+                        geometry.corners.resize(numCorners);
+                    }
+                }
+                break;
+
+            case 'u': // usemtl
+                if (MatchKeyword(p, pEnd, "usemtl"))
+                {
+                    ++numUseMaterials;
+                    name = ParseName(p + 6, pEnd);
+                    iter = materialSlots.find(name);
+
+                    if (iter == materialSlots.end())
+                    {
+                        activeMaterial = static_cast<int>(geometry.materialNames.size());
+                        materialSlots[name] = activeMaterial;
+                        geometry.materialNames.push_back(name);
+                    }
+                    else
+                    {
+                        activeMaterial = iter->second;
+                    }
+                }
+                break;
+
+            case 'm': // mtllib
+                if (MatchKeyword(p, pEnd, "mtllib"))
+                    geometry.materialLibraries.push_back(ParseName(p + 6, pEnd));
+                break;
+
+            case 'o': // o
+            case 'g': // g
+                if (keepGroups && (p + 1 == pEnd || IsBlank(p[1]) || p[1] == '\n'))
+                {
+                    name = ParseLineName(p + 1, pEnd);
+
+                    if (*p == 'o')
+                    {
+                        object = name;
+                        objectKnown = true;
+                        name.clear();
+                    }
+
+                    ObjGroup group = {object, name, objectKnown};
+
+                    activeGroup = static_cast<int>(geometry.groups.size());
+                    geometry.groups.push_back(group);
+                }
+                break;
+
+            default:
+                break;
+            }
+
+            p = SkipLine(p, pEnd);
+        }
+
+        if (pProgress)
+            pProgress->bytesParsed += static_cast<unsigned long long>(p - pReported);
+
+        geometry.activeMaterial = activeMaterial;
+        geometry.numUseMaterials = numUseMaterials;
+        geometry.activeGroup = activeGroup;
+    }
+}
+
+//-----------------------------------------------------------------------------
+// Copy on write view of the binary cache a model was loaded from.
+//-----------------------------------------------------------------------------
+
+class ModelOBJ::CacheFile : public MappedFile
+{
+};
+
+static_assert(sizeof(ModelOBJ::Vertex) == sizeof(ModelOBJ::VertexPTNTB),
+    "Vertex and VertexLayout<ATTRIBUTE_ALL> must have the same layout");
+
+ModelOBJ::ModelOBJ()
+{
+    m_pMaterialResolver = 0;
+    m_vertexAttributes = ATTRIBUTE_ALL;
+    m_pProgress = 0;
+    m_pCacheFile = 0;
+    m_pCacheVertexBuffer = 0;
+    m_pCacheIndexBuffer = 0;
+    m_numberOfCacheVertices = 0;
+    m_vertexStorage = STORAGE_INTERLEAVED;
+    m_vertexStreamOffset = 0;
+    m_vertexStreamStride = 0;
+    m_numberOfStreamVertices = 0;
+
+    m_hasPositions = false;
+    m_hasNormals = false;
+    m_hasTextureCoords = false;
+    m_hasTangents = false;
+
+    m_numberOfVertexCoords = 0;
+    m_numberOfTextureCoords = 0;
+    m_numberOfNormals = 0;
+    m_numberOfTriangles = 0;
+    m_numberOfMaterials = 0;
+    m_numberOfMeshes = 0;
+
+    m_center[0] = m_center[1] = m_center[2] = 0.0f;
+    m_width = m_height = m_length = m_radius = 0.0f;
+}
+
+ModelOBJ::~ModelOBJ()
+{
+    destroy();
+}
+
+void ModelOBJ::bounds(float center[3], float &width, float &height,
+                      float &length, float &radius) const
+{
+    float xMax = std::numeric_limits<float>::min();
+    float yMax = std::numeric_limits<float>::min();
+    float zMax = std::numeric_limits<float>::min();
+
+    float xMin = std::numeric_limits<float>::max();
+    float yMin = std::numeric_limits<float>::max();
+    float zMin = std::numeric_limits<float>::max();
+
+    float x = 0.0f;
+    float y = 0.0f;
+    float z = 0.0f;
+
+    const Vertex *pVertices = getVertexBuffer();
+    int numVerts = getNumberOfVertices();
+
+    if (m_vertexStorage == STORAGE_SOA)
+    {
+        StreamBounds(getVertexStream(COMPONENT_POSITION_X), numVerts, xMin, xMax);
+        StreamBounds(getVertexStream(COMPONENT_POSITION_Y), numVerts, yMin, yMax);
+        StreamBounds(getVertexStream(COMPONENT_POSITION_Z), numVerts, zMin, zMax);
+    }
+    else
+    {
+        for (int i = 0; i < numVerts; ++i)
+        {
+            x = pVertices[i].position[0];
+            y = pVertices[i].position[1];
+            z = pVertices[i].position[2];
+
+            if (x < xMin)
+                xMin = x;
+
+            if (x > xMax)
+                xMax = x;
+
+            if (y < yMin)
+                yMin = y;
+
+            if (y > yMax)
+                yMax = y;
+
+            if (z < zMin)
+                zMin = z;
+
+            if (z > zMax)
+                zMax = z;
+        }
+    }
+
+    center[0] = (xMin + xMax) / 2.0f;
+    center[1] = (yMin + yMax) / 2.0f;
+    center[2] = (zMin + zMax) / 2.0f;
+
+    width = xMax - xMin;
+    height = yMax - yMin;
+    length = zMax - zMin;
+
+    radius = std::max(std::max(width, height), length);
+}
+
+void ModelOBJ::buildBvh(int numThreads)
+{
+    // Builds a BVH over the index buffer's triangles. Triangles are binned
+    // by the centers of their bounding boxes. Rebuild after changing the
+    // index buffer; after moving the vertices refitBvh() is enough.
+
+    int numTriangles = m_numberOfTriangles;
+    const int *pIndices = getIndexBuffer();
+
+    m_bvhNodes.clear();
+    m_bvhTriangles.clear();
+    m_bvhPositions.clear();
+
+    if (numTriangles == 0)
+        return;
+
+    numThreads = GetThreadCount(numThreads);
+
+    std::vector<BvhPrimitive> primitives(numTriangles);
+    int numTasks = std::max(1, std::min(numThreads, numTriangles / 4096));
+
+    RunTasks(numTasks, [&](int task)
+    {
+        float position[3];
+        int begin = 0;
+        int end = 0;
+
+        GetTaskRange(numTriangles, task, numTasks, begin, end);
+
+        for (int i = begin; i < end; ++i)
+        {
+            BvhPrimitive &primitive = primitives[i];
+
+            ResetBox(primitive.boxMin, primitive.boxMax);
+
+            for (int j = 0; j < 3; ++j)
+            {
+                fetchPosition(pIndices[i * 3 + j], position);
+                GrowBox(primitive.boxMin, primitive.boxMax, position, position);
+            }
+
+            for (int k = 0; k < 3; ++k)
+                primitive.centroid[k] = (primitive.boxMin[k] + primitive.boxMax[k]) * 0.5f;
+
+            primitive.triangle = i;
+        }
+    });
+
+    // Build the top of the tree, leaving ranges small enough to spread
+    // across the threads for later.
+
+    std::vector<BvhTask> deferred;
+    int deferLimit = std::max(4096, numTriangles / (numThreads * 8));
+
+    m_bvhNodes.resize(1);
+    BuildBvhNode(&primitives[0], m_bvhNodes, 0, 0, numTriangles, 0, deferLimit,
+                 (numThreads > 1) ? &deferred : 0);
+
+    // Build the deferred subtrees, each into its own node array with its
+    // root first, then put each root in place of its deferred node and
+    // append the rest.
+
+    int numSubtrees = static_cast<int>(deferred.size());
+    std::vector<std::vector<BvhNode> > subtrees(numSubtrees);
+    std::atomic<int> nextSubtree(0);
+
+    RunTasks(std::max(1, std::min(numThreads, numSubtrees)), [&](int /*task*/)
+    {
+        int i = 0;
+
+        while ((i = nextSubtree++) < numSubtrees)
+        {
+            const BvhTask &subtree = deferred[i];
+
+            subtrees[i].resize(1);
+            BuildBvhNode(&primitives[0], subtrees[i], 0, subtree.begin, subtree.end, subtree.depth, 0, 0);
+        }
+    });
+
+    for (int i = 0; i < numSubtrees; ++i)
+    {
+        int offset = static_cast<int>(m_bvhNodes.size()) - 1;
+
+        for (int j = 0; j < static_cast<int>(subtrees[i].size()); ++j)
+        {
+            BvhNode node = subtrees[i][j];
+
+            if (node.count == 0)
+                node.first += offset;
+
+            if (j == 0)
+                m_bvhNodes[deferred[i].node] = node;
+            else
+                m_bvhNodes.push_back(node);
+        }
+    }
+
+    // Drop the spare capacity left by growing the node array.
+
+    std::vector<BvhNode>(m_bvhNodes).swap(m_bvhNodes);
+
+    m_bvhTriangles.resize(numTriangles);
+    m_bvhPositions.resize(numTriangles * 9);
+
+    for (int i = 0; i < numTriangles; ++i)
+        m_bvhTriangles[i] = primitives[i].triangle;
+
+    refitBvh();
+}
+
+void ModelOBJ::computeMeshBounds(int numThreads)
+{
+    // The meshes are split into the same blocks as buildMeshlets() so that
+    // a model merged into a few large meshes still uses all the threads.
+    // The boxes of each mesh's blocks are then merged in order.
+
+    std::vector<MeshletBlock> blocks;
+
+    for (int i = 0; i < m_numberOfMeshes; ++i)
+    {
+        const Mesh &mesh = m_meshes[i];
+
+        for (int j = 0; j < mesh.triangleCount; j += MESHLET_BLOCK_TRIANGLES)
+        {
+            MeshletBlock block = {i, mesh.startIndex + j * 3,
+                                  std::min(mesh.triangleCount - j, MESHLET_BLOCK_TRIANGLES)};
+
+            blocks.push_back(block);
+        }
+    }
+
+    BoundingBox empty;
+
+    for (int k = 0; k < 3; ++k)
+    {
+        empty.boundsMin[k] = std::numeric_limits<float>::max();
+        empty.boundsMax[k] = -std::numeric_limits<float>::max();
+    }
+
+    int numBlocks = static_cast<int>(blocks.size());
+    int numTasks = std::max(1, std::min(numThreads, numBlocks));
+    const int *pIndices = getIndexBuffer();
+    std::vector<BoundingBox> blockBounds(numBlocks, empty);
+    std::atomic<int> nextBlock(0);
+
+    RunTasks(numTasks, [&](int /*task*/)
+    {
+        float position[3];
+        int block = 0;
+
+        while ((block = nextBlock++) < numBlocks)
+        {
+            BoundingBox &box = blockBounds[block];
+            const int *pBlockIndices = pIndices + blocks[block].startIndex;
+
+            for (int i = 0; i < blocks[block].triangleCount * 3; ++i)
+            {
+                fetchPosition(pBlockIndices[i], position);
+
+                for (int k = 0; k < 3; ++k)
+                {
+                    box.boundsMin[k] = std::min(box.boundsMin[k], position[k]);
+                    box.boundsMax[k] = std::max(box.boundsMax[k], position[k]);
+                }
+            }
+        }
+    });
+
+    m_meshBounds.assign(m_numberOfMeshes, empty);
+
+    for (int i = 0; i < numBlocks; ++i)
+    {
+        BoundingBox &box = m_meshBounds[blocks[i].mesh];
+
+        for (int k = 0; k < 3; ++k)
+        {
+            box.boundsMin[k] = std::min(box.boundsMin[k], blockBounds[i].boundsMin[k]);
+            box.boundsMax[k] = std::max(box.boundsMax[k], blockBounds[i].boundsMax[k]);
+        }
+    }
+
+    // Meshes without triangles get an empty box at the origin.
+
+    for (int i = 0; i < m_numberOfMeshes; ++i)
+    {
+        if (m_meshes[i].triangleCount > 0)
+            continue;
+
+        for (int k = 0; k < 3; ++k)
+            m_meshBounds[i].boundsMin[k] = m_meshBounds[i].boundsMax[k] = 0.0f;
+    }
+
+    // A group's meshes include those of its children, so its box is the
+    // union of its meshes' boxes. Groups always have triangles.
+
+    m_groupBounds.assign(m_groups.size(), empty);
+
+    for (int i = 0; i < static_cast<int>(m_groups.size()); ++i)
+    {
+        BoundingBox &box = m_groupBounds[i];
+        const Group &group = m_groups[i];
+
+        for (int j = group.firstMesh; j < group.firstMesh + group.meshCount; ++j)
+        {
+            for (int k = 0; k < 3; ++k)
+            {
+                box.boundsMin[k] = std::min(box.boundsMin[k], m_meshBounds[j].boundsMin[k]);
+                box.boundsMax[k] = std::max(box.boundsMax[k], m_meshBounds[j].boundsMax[k]);
+            }
+        }
+    }
+}
+
+void ModelOBJ::computeMeshletBounds(int numThreads)
+{
+    // The meshlets are small, so each task takes an even share of them and
+    // gathers each meshlet's corner positions before computing its bounds.
+
+    int numMeshlets = static_cast<int>(m_meshlets.size());
+    int numTasks = std::max(1, std::min(numThreads, numMeshlets / 256));
+    const int *pIndices = getIndexBuffer();
+
+    RunTasks(numTasks, [&](int task)
+    {
+        std::vector<float> corners;
+        Vertex vertex;
+        int begin = 0;
+        int end = 0;
+
+        GetTaskRange(numMeshlets, task, numTasks, begin, end);
+
+        for (int i = begin; i < end; ++i)
+        {
+            Meshlet &meshlet = m_meshlets[i];
+
+            if (meshlet.triangleCount == 0)
+                continue;
+
+            corners.resize(meshlet.triangleCount * 9);
+
+            for (int j = 0; j < meshlet.triangleCount * 3; ++j)
+                memcpy(&corners[j * 3], fetchVertex(pIndices[meshlet.startIndex + j], vertex).position, 3 * sizeof(float));
+
+            ComputeMeshletBounds(&corners[0], meshlet.triangleCount, meshlet);
+        }
+    });
+}
+
+int ModelOBJ::cullGroups(const float viewProjection[16], unsigned char *pVisible) const
+{
+    // Same as cullMeshes(), but fills in getNumberOfGroups() flags. A group
+    // that is culled has all of its children culled too.
+
+    float planes[6][4];
+
+    ExtractFrustumPlanes(viewProjection, planes);
+
+    return m_groupBounds.empty() ? 0 :
+        CullBoxes(planes, &m_groupBounds[0], static_cast<int>(m_groupBounds.size()), pVisible);
+}
+
+int ModelOBJ::cullMeshes(const float viewProjection[16], unsigned char *pVisible) const
+{
+    // Tests each mesh's bounding box against the view frustum.
+    // 'viewProjection' is a column major (OpenGL) matrix taking the model's
+    // positions to clip space, i.e. the projection matrix times the
+    // modelview matrix. pVisible receives getNumberOfMeshes() flags, 1 for
+    // the meshes that may be visible. Returns the number of those meshes.
+
+    float planes[6][4];
+
+    ExtractFrustumPlanes(viewProjection, planes);
+
+    return m_meshBounds.empty() ? 0 :
+        CullBoxes(planes, &m_meshBounds[0], static_cast<int>(m_meshBounds.size()), pVisible);
+}
+
+int ModelOBJ::cullMeshlets(const float viewProjection[16], const float *pEye,
+                           unsigned char *pVisible) const
+{
+    // Same as cullMeshes(), but tests each meshlet's bounding sphere and
+    // fills in getNumberOfMeshlets() flags. When 'pEye' is not 0 it's the
+    // eye position in model space, and meshlets whose triangles all face
+    // away from it are culled as well. Only pass the eye position when back
+    // faces are culled.
+
+    float planes[6][4];
+
+    ExtractFrustumPlanes(viewProjection, planes);
+
+    return m_meshlets.empty() ? 0 :
+        CullMeshlets(planes, pEye, &m_meshlets[0], static_cast<int>(m_meshlets.size()), pVisible);
+}
+
+void ModelOBJ::destroy()
+{
+    m_hasPositions = false;
+    m_hasTextureCoords = false;
+    m_hasNormals = false;
+    m_hasTangents = false;
+
+    m_numberOfVertexCoords = 0;
+    m_numberOfTextureCoords = 0;
+    m_numberOfNormals = 0;
+    m_numberOfTriangles = 0;
+    m_numberOfMaterials = 0;
+    m_numberOfMeshes = 0;
+
+    m_center[0] = m_center[1] = m_center[2] = 0.0f;
+    m_width = m_height = m_length = m_radius = 0.0f;
+
+    m_directoryPath.clear();
+    m_importStats = ImportStats();
+
+    m_meshes.clear();
+    m_meshBounds.clear();
+    m_groups.clear();
+    m_groupBounds.clear();
+    m_materials.clear();
+    m_vertexBuffer.clear();
+    m_indexBuffer.clear();
+    m_attributeBuffer.clear();
+    m_groupBuffer.clear();
+
+    m_vertexCoords.clear();
+    m_textureCoords.clear();
+    m_normals.clear();
+
+    m_lods.clear();
+    m_lodMeshes.clear();
+    m_lodIndexBuffer.clear();
+
+    m_meshlets.clear();
+
+    m_bvhNodes.clear();
+    m_bvhTriangles.clear();
+    m_bvhPositions.clear();
+
+    m_vertexStorage = STORAGE_INTERLEAVED;
+    m_vertexStreams.clear();
+    m_vertexStreamOffset = 0;
+    m_vertexStreamStride = 0;
+    m_numberOfStreamVertices = 0;
+
+    m_materialCache.clear();
+    m_groupCache.clear();
+    m_materialFiles.clear();
+    m_vertexCache.clear();
+    m_texCoordCache.clear();
+    m_texCoordClasses.clear();
+    m_normalCache.clear();
+    m_normalClasses.clear();
+
+    delete m_pCacheFile;
+    m_pCacheFile = 0;
+    m_pCacheVertexBuffer = 0;
+    m_pCacheIndexBuffer = 0;
+    m_numberOfCacheVertices = 0;
+}
+
+void ModelOBJ::detachCacheFile()
+{
+    // Copies the vertex and index buffers out of the mapped cache so that
+    // they can be resized or freed.
+
+    if (!m_pCacheFile)
+        return;
+
+    m_vertexBuffer.assign(m_pCacheVertexBuffer, m_pCacheVertexBuffer + m_numberOfCacheVertices);
+    m_indexBuffer.assign(m_pCacheIndexBuffer, m_pCacheIndexBuffer + m_numberOfTriangles * 3);
+
+    delete m_pCacheFile;
+    m_pCacheFile = 0;
+    m_pCacheVertexBuffer = 0;
+    m_pCacheIndexBuffer = 0;
+    m_numberOfCacheVertices = 0;
+}
+
+void ModelOBJ::fetchPosition(int i, float position[3]) const
+{
+    // Reads only the position of vertex i from either vertex storage.
+
+    if (m_vertexStorage == STORAGE_INTERLEAVED)
+    {
+        memcpy(position, getVertexBuffer()[i].position, 3 * sizeof(float));
+        return;
+    }
+
+    position[0] = getVertexStream(COMPONENT_POSITION_X)[i];
+    position[1] = getVertexStream(COMPONENT_POSITION_Y)[i];
+    position[2] = getVertexStream(COMPONENT_POSITION_Z)[i];
+}
+
+const ModelOBJ::Vertex &ModelOBJ::fetchVertex(int i, Vertex &vertex) const
+{
+    // Returns vertex i from either vertex storage. With STORAGE_SOA the
+    // components are gathered into the supplied vertex.
+
+    if (m_vertexStorage == STORAGE_INTERLEAVED)
+        return getVertexBuffer()[i];
+
+    float *pComponents = reinterpret_cast<float *>(&vertex);
+
+    for (int j = 0; j < NUMBER_OF_COMPONENTS; ++j)
+        pComponents[j] = getVertexStream(static_cast<VertexComponent>(j))[i];
+
+    return vertex;
+}
+
+bool ModelOBJ::findNearestPoint(const float point[3], float maxDistance, RayHit &hit) const
+{
+    // Finds the closest point on the model within maxDistance of 'point'.
+    // The nearer child box is visited first, and boxes further away than the
+    // closest point found so far are skipped.
+
+    float best = maxDistance * maxDistance;
+    int bestTriangle = -1;
+    int stack[BVH_MAX_DEPTH];
+    float stackDistances[BVH_MAX_DEPTH];
+    int stackSize = 0;
+    float position[3];
+    float u = 0.0f;
+    float v = 0.0f;
+
+    hit.triangle = -1;
+
+    if (m_bvhNodes.empty() || BoxDistanceSquared(m_bvhNodes[0], point) > best)
+        return false;
+
+    stack[stackSize] = 0;
+    stackDistances[stackSize++] = 0.0f;
+
+    while (stackSize > 0)
+    {
+        --stackSize;
+
+        if (stackDistances[stackSize] > best)
+            continue;
+
+        const BvhNode *pNode = &m_bvhNodes[stack[stackSize]];
+
+        while (pNode && pNode->count == 0)
+        {
+            const BvhNode *pNear = &m_bvhNodes[pNode->first];
+            const BvhNode *pFar = pNear + 1;
+            float nearDistance = BoxDistanceSquared(*pNear, point);
+            float farDistance = BoxDistanceSquared(*pFar, point);
+
+            if (farDistance < nearDistance)
+            {
+                std::swap(pNear, pFar);
+                std::swap(nearDistance, farDistance);
+            }
+
+            if (farDistance <= best)
+            {
+                stack[stackSize] = static_cast<int>(pFar - &m_bvhNodes[0]);
+                stackDistances[stackSize++] = farDistance;
+            }
+
+            pNode = (nearDistance <= best) ? pNear : 0;
+        }
+
+        if (!pNode)
+            continue;
+
+        for (int i = pNode->first; i < pNode->first + pNode->count; ++i)
+        {
+            const float *pCorners = &m_bvhPositions[i * 9];
+
+            ClosestPointOnTriangle(pCorners, point, u, v);
+            BarycentricPoint(pCorners, u, v, position);
+
+            float dx = position[0] - point[0];
+            float dy = position[1] - point[1];
+            float dz = position[2] - point[2];
+            float distance = dx * dx + dy * dy + dz * dz;
+
+            if (distance <= best)
+            {
+                best = distance;
+                bestTriangle = i;
+                hit.barycentric[0] = u;
+                hit.barycentric[1] = v;
+                memcpy(hit.position, position, sizeof(position));
+            }
+        }
+    }
+
+    if (bestTriangle < 0)
+        return false;
+
+    hit.triangle = m_bvhTriangles[bestTriangle];
+    hit.distance = sqrtf(best);
+    return true;
+}
+
+ModelOBJ::ImportProgress::ImportProgress()
+{
+    phase = PHASE_PARSING;
+    bytesParsed = 0;
+    bytesTotal = 0;
+    trianglesBuilt = 0;
+    trianglesTotal = 0;
+    cancel = false;
+}
+
+ModelOBJ::ImportStats::ImportStats()
+{
+    loadedFromCache = false;
+
+    totalTime = 0.0;
+    parseTime = 0.0;
+    buildTime = 0.0;
+    materialTime = 0.0;
+    buildMeshesTime = 0.0;
+    boundsTime = 0.0;
+    normalsTime = 0.0;
+    tangentsTime = 0.0;
+    vertexCacheTime = 0.0;
+    vertexFetchTime = 0.0;
+    lodTime = 0.0;
+    meshletTime = 0.0;
+    bvhTime = 0.0;
+    cacheTime = 0.0;
+
+    bytesRead = 0;
+    positionLines = 0;
+    texCoordLines = 0;
+    normalLines = 0;
+    faceLines = 0;
+    useMaterialLines = 0;
+    materialLibraryLines = 0;
+    trianglesEmitted = 0;
+
+    vertexLookups = 0;
+    vertexHits = 0;
+    cacheProbes = 0;
+    maxProbeLength = 0;
+
+    acmrBefore = 0.0f;
+    acmrAfter = 0.0f;
+    atvrBefore = 0.0f;
+    atvrAfter = 0.0f;
+    overfetchBefore = 0.0f;
+    overfetchAfter = 0.0f;
+
+    vertexBufferBytes = 0;
+    indexBufferBytes = 0;
+    attributeBufferBytes = 0;
+    vertexCoordBytes = 0;
+    textureCoordBytes = 0;
+    normalBytes = 0;
+    vertexCacheBytes = 0;
+    parseScratchBytes = 0;
+}
+
+std::string ModelOBJ::ImportStats::toJson() const
+{
+    // Single line JSON object, suitable for per asset logging.
+
+    std::ostringstream json;
+    double hitRate = (vertexLookups > 0) ? static_cast<double>(vertexHits) / vertexLookups : 0.0;
+
+    json.imbue(std::locale::classic());
+    json << std::fixed << std::setprecision(3);
+
+    json << "{\"loadedFromCache\":" << (loadedFromCache ? "true" : "false");
+
+    json << ",\"times\":{"
+         << "\"total\":" << totalTime
+         << ",\"parse\":" << parseTime
+         << ",\"build\":" << buildTime
+         << ",\"materials\":" << materialTime
+         << ",\"buildMeshes\":" << buildMeshesTime
+         << ",\"bounds\":" << boundsTime
+         << ",\"normals\":" << normalsTime
+         << ",\"tangents\":" << tangentsTime
+         << ",\"vertexCache\":" << vertexCacheTime
+         << ",\"vertexFetch\":" << vertexFetchTime
+         << ",\"lods\":" << lodTime
+         << ",\"meshlets\":" << meshletTime
+         << ",\"bvh\":" << bvhTime
+         << ",\"cache\":" << cacheTime << "}";
+
+    json << ",\"bytesRead\":" << bytesRead;
+
+    json << ",\"lines\":{"
+         << "\"v\":" << positionLines
+         << ",\"vt\":" << texCoordLines
+         << ",\"vn\":" << normalLines
+         << ",\"f\":" << faceLines
+         << ",\"usemtl\":" << useMaterialLines
+         << ",\"mtllib\":" << materialLibraryLines << "}";
+
+    json << ",\"triangles\":" << trianglesEmitted;
+
+    json << ",\"dedup\":{"
+         << "\"lookups\":" << vertexLookups
+         << ",\"hits\":" << vertexHits
+         << ",\"hitRate\":" << hitRate
+         << ",\"probes\":" << cacheProbes
+         << ",\"maxProbeLength\":" << maxProbeLength << "}";
+
+    json << ",\"vertexCache\":{"
+         << "\"acmrBefore\":" << acmrBefore
+         << ",\"acmrAfter\":" << acmrAfter
+         << ",\"atvrBefore\":" << atvrBefore
+         << ",\"atvrAfter\":" << atvrAfter << "}";
+
+    json << ",\"vertexFetch\":{"
+         << "\"overfetchBefore\":" << overfetchBefore
+         << ",\"overfetchAfter\":" << overfetchAfter << "}";
+
+    json << ",\"memory\":{"
+         << "\"vertexBuffer\":" << vertexBufferBytes
+         << ",\"indexBuffer\":" << indexBufferBytes
+         << ",\"attributeBuffer\":" << attributeBufferBytes
+         << ",\"vertexCoords\":" << vertexCoordBytes
+         << ",\"textureCoords\":" << textureCoordBytes
+         << ",\"normals\":" << normalBytes
+         << ",\"vertexCache\":" << vertexCacheBytes
+         << ",\"parseScratch\":" << parseScratchBytes << "}}";
+
+    return json.str();
+}
+
+ModelOBJ::ImportOptions::ImportOptions()
+{
+    parser = PARSER_MAPPED;
+    numThreads = 0;
+    welding = WELD_HASH;
+    rebuildNormals = false;
+    useCache = false;
+    lean = false;
+    vertexAttributes = ATTRIBUTE_ALL;
+    vertexStorage = STORAGE_INTERLEAVED;
+    tangentMethod = TANGENTS_FACE_AVERAGE;
+    optimizeVertexCache = false;
+    optimizeVertexFetch = false;
+    mergeMeshesByMaterial = false;
+    keepGroups = false;
+    buildMeshlets = false;
+    meshletMaxVertices = 64;
+    meshletMaxTriangles = 124;
+    buildBvh = false;
+    normalize = false;
+    pMaterialResolver = 0;
+    pProgress = 0;
+}
+
+bool ModelOBJ::import(const char *pszFilename, bool rebuildNormals)
+{
+    ImportOptions options;
+
+    options.rebuildNormals = rebuildNormals;
+    return import(pszFilename, options);
+}
+
+bool ModelOBJ::import(const char *pszFilename, const ImportOptions &options)
+{
+    Clock::time_point importStart = Clock::now();
+
+    m_importStats = ImportStats();
+    m_vertexAttributes = (options.vertexAttributes & ATTRIBUTE_ALL) | ATTRIBUTE_POSITION;
+
+    // Extract the directory the OBJ file is in from the file name.
+    // This directory path will be used to load the OBJ's associated MTL file.
+
+    m_directoryPath.clear();
+
+    std::string filename = pszFilename;
+    std::string::size_type offset = filename.find_last_of('\\');
+
+    if (offset != std::string::npos)
+    {
+        m_directoryPath = filename.substr(0, ++offset);
+    }
+    else
+    {
+        offset = filename.find_last_of('/');
+
+        if (offset != std::string::npos)
+            m_directoryPath = filename.substr(0, ++offset);
+    }
+
+    // Models imported with a MaterialResolver aren't cached since there's no
+    // way to tell if the MTL data it supplies has changed. The cache holds
+    // interleaved vertices, so it isn't used for structure of arrays storage.
+
+    bool useCache = options.useCache && !options.pMaterialResolver &&
+        options.vertexStorage == STORAGE_INTERLEAVED;
+
+    if (useCache && loadCache(pszFilename, options))
+    {
+        if (options.lean)
+            releaseImportData();
+
+        m_importStats.loadedFromCache = true;
+        m_importStats.cacheTime = MillisecondsSince(importStart);
+
+        // The mesh and group bounds and the BVH aren't cached.
+
+        Clock::time_point boundsStart = Clock::now();
+
+        computeMeshBounds(GetThreadCount(options.numThreads));
+        m_importStats.boundsTime = MillisecondsSince(boundsStart);
+
+        if (options.buildBvh)
+        {
+            Clock::time_point bvhStart = Clock::now();
+
+            buildBvh(options.numThreads);
+            m_importStats.bvhTime = MillisecondsSince(bvhStart);
+        }
+
+        if (options.normalize)
+            normalize();
+
+        m_importStats.totalTime = MillisecondsSince(importStart);
+
+        if (options.pProgress)
+            options.pProgress->phase = PHASE_FINISHED;
+
+        return true;
+    }
+
+    MappedFile mappedFile;
+    FILE *pFile = 0;
+
+    // Files that can't be mapped (empty files, or files too large for the
+    // address space) are read using the stdio parser instead.
+
+    if (options.parser != PARSER_MAPPED || !mappedFile.open(pszFilename))
+    {
+        if (!(pFile = fopen(pszFilename, "r")))
+            return false;
+    }
+
+    // Import the OBJ file.
+
+    m_pMaterialResolver = options.pMaterialResolver;
+    m_pProgress = options.pProgress;
+
+    m_importStats.bytesRead = pFile ? GetFileStamp(pszFilename).size : mappedFile.size();
+
+    if (m_pProgress)
+    {
+        m_pProgress->phase = PHASE_PARSING;
+        m_pProgress->bytesTotal = m_importStats.bytesRead;
+    }
+
+    bool imported = false;
+
+    if (pFile)
+    {
+        Clock::time_point phaseStart = Clock::now();
+
+        importGeometryFirstPass(pFile);
+        m_importStats.parseTime = MillisecondsSince(phaseStart);
+
+        if (!cancelled())
+        {
+            phaseStart = Clock::now();
+            rewind(pFile);
+            importGeometrySecondPass(pFile, options.keepGroups);
+            m_importStats.buildTime = MillisecondsSince(phaseStart);
+        }
+
+        fclose(pFile);
+        imported = !cancelled();
+    }
+    else
+    {
+        imported = importGeometryMapped(mappedFile.data(),
+            mappedFile.data() + mappedFile.size(), options);
+
+        mappedFile.close();
+    }
+
+    imported = imported && postImport(options);
+
+    m_pMaterialResolver = 0;
+    m_pProgress = 0;
+
+    if (!imported)
+    {
+        destroy();
+        return false;
+    }
+
+    if (useCache)
+    {
+        Clock::time_point cacheStart = Clock::now();
+
+        saveCache(pszFilename, options);
+        m_importStats.cacheTime = MillisecondsSince(cacheStart);
+    }
+
+    recordMemoryStats();
+
+    if (options.lean)
+        releaseImportData();
+
+    if (options.normalize)
+        normalize();
+
+    m_importStats.totalTime = MillisecondsSince(importStart);
+
+    if (options.pProgress)
+        options.pProgress->phase = PHASE_FINISHED;
+
+    return true;
+}
+
+bool ModelOBJ::importFromMemory(const void *pData, size_t size, const ImportOptions &options)
+{
+    // The OBJ is parsed in place without copying it. There's no directory to
+    // look for MTL files in, so unless a resolver is supplied mtllib names
+    // are taken to be relative to the current directory.
+
+    Clock::time_point importStart = Clock::now();
+    const char *pBegin = static_cast<const char *>(pData);
+
+    m_importStats = ImportStats();
+    m_importStats.bytesRead = size;
+    m_vertexAttributes = (options.vertexAttributes & ATTRIBUTE_ALL) | ATTRIBUTE_POSITION;
+
+    m_directoryPath.clear();
+    m_pMaterialResolver = options.pMaterialResolver;
+    m_pProgress = options.pProgress;
+
+    if (m_pProgress)
+    {
+        m_pProgress->phase = PHASE_PARSING;
+        m_pProgress->bytesTotal = size;
+    }
+
+    bool imported = importGeometryMapped(pBegin, pBegin + size, options) &&
+        postImport(options);
+
+    m_pMaterialResolver = 0;
+    m_pProgress = 0;
+
+    if (!imported)
+    {
+        destroy();
+        return false;
+    }
+
+    recordMemoryStats();
+
+    if (options.lean)
+        releaseImportData();
+
+    if (options.normalize)
+        normalize();
+
+    m_importStats.totalTime = MillisecondsSince(importStart);
+
+    if (options.pProgress)
+        options.pProgress->phase = PHASE_FINISHED;
+
+    return true;
+}
+
+bool ModelOBJ::importFromStream(std::istream &stream, const ImportOptions &options)
+{
+    // Streams can't be parsed in place. Read the rest of the stream into
+    // memory first.
+
+    const size_t blockSize = 1024 * 1024;
+    std::vector<char> buffer;
+    size_t size = 0;
+
+    while (stream)
+    {
+        buffer.resize(size + blockSize);
+        stream.read(&buffer[size], blockSize);
+        size += static_cast<size_t>(stream.gcount());
+    }
+
+    if (stream.bad())
+        return false;
+
+    buffer.resize(size);
+    return importFromMemory(buffer.empty() ? 0 : &buffer[0], size, options);
+}
+
+bool ModelOBJ::postImport(const ImportOptions &options)
+{
+    // Perform post import tasks. Returns false if the import was cancelled.
+
+    if (m_pProgress)
+        m_pProgress->phase = PHASE_POST_PROCESSING;
+
+    Clock::time_point phaseStart = Clock::now();
+    int numThreads = GetThreadCount(options.numThreads);
+
+    setVertexStorage(options.vertexStorage);
+
+    if (options.mergeMeshesByMaterial)
+        sortTriangles(m_attributeBuffer, m_numberOfMaterials, numThreads);
+
+    // The sort by group comes last so that it keeps each group's triangles
+    // in material order.
+
+    if (!m_groups.empty())
+        buildGroups(numThreads);
+
+    buildMeshes();
+    m_importStats.buildMeshesTime = MillisecondsSince(phaseStart);
+
+    phaseStart = Clock::now();
+    bounds(m_center, m_width, m_height, m_length, m_radius);
+    computeMeshBounds(numThreads);
+    m_importStats.boundsTime = MillisecondsSince(phaseStart);
+
+    if (cancelled())
+        return false;
+
+    // Build vertex normals if required. Normals aren't generated if they
+    // weren't asked for.
+
+    phaseStart = Clock::now();
+
+    if (m_vertexAttributes & ATTRIBUTE_NORMAL)
+    {
+        if (options.rebuildNormals)
+        {
+            generateNormals(numThreads);
+        }
+        else
+        {
+            if (!hasNormals())
+                generateNormals(numThreads);
+        }
+    }
+
+    m_importStats.normalsTime = MillisecondsSince(phaseStart);
+
+    if (cancelled())
+        return false;
+
+    // Build tangents is required.
+
+    phaseStart = Clock::now();
+
+    if (m_vertexAttributes & (ATTRIBUTE_TANGENT | ATTRIBUTE_BITANGENT))
+    {
+        for (int i = 0; i < m_numberOfMaterials; ++i)
+        {
+            if (!m_materials[i].bumpMapFilename.empty())
+            {
+                generateTangents(options.tangentMethod, numThreads);
+                break;
+            }
+        }
+    }
+
+    m_importStats.tangentsTime = MillisecondsSince(phaseStart);
+
+    if (cancelled())
+        return false;
+
+    // Build the levels of detail.
+
+    if (!options.lodRatios.empty())
+    {
+        phaseStart = Clock::now();
+        generateLods(options.lodRatios);
+        m_importStats.lodTime = MillisecondsSince(phaseStart);
+
+        if (cancelled())
+            return false;
+    }
+
+    // Reorder the triangles for the vertex cache last, so that the normals
+    // and tangents are the same with or without it. The vertices are then
+    // reordered to follow the final triangle order.
+
+    if (options.optimizeVertexCache)
+    {
+        phaseStart = Clock::now();
+        optimizeVertexCache(numThreads);
+        m_importStats.vertexCacheTime = MillisecondsSince(phaseStart);
+    }
+
+    // Meshlets reorder the triangles within each mesh, but keep most of the
+    // vertex cache order. Reordering the vertices afterwards doesn't change
+    // the meshlets.
+
+    if (options.buildMeshlets)
+    {
+        phaseStart = Clock::now();
+        buildMeshlets(options.meshletMaxVertices, options.meshletMaxTriangles, numThreads);
+        m_importStats.meshletTime = MillisecondsSince(phaseStart);
+
+        if (cancelled())
+            return false;
+    }
+
+    if (options.optimizeVertexFetch)
+    {
+        phaseStart = Clock::now();
+        optimizeVertexFetch();
+        m_importStats.vertexFetchTime = MillisecondsSince(phaseStart);
+    }
+
+    // The BVH refers to triangles by their place in the index buffer, so
+    // it's built once they've stopped moving.
+
+    if (options.buildBvh)
+    {
+        phaseStart = Clock::now();
+        buildBvh(numThreads);
+        m_importStats.bvhTime = MillisecondsSince(phaseStart);
+    }
+
+    return !cancelled();
+}
+
+bool ModelOBJ::loadCache(const char *pszFilename, const ImportOptions &options)
+{
+    // Use the binary cache next to the OBJ file if it's up to date. The
+    // vertex and index buffers are used in place from a copy on write view
+    // of the cache, so nothing is copied and normalize(), scale() and
+    // reverseWinding() still work without modifying the cache file.
+
+    std::string cacheFilename = std::string(pszFilename) + ".cache";
+    CacheFile *pCacheFile = new CacheFile;
+
+    if (!pCacheFile->open(cacheFilename.c_str(), true) ||
+        !readCache(pszFilename, options, pCacheFile->data(), pCacheFile->size()))
+    {
+        delete pCacheFile;
+        return false;
+    }
+
+    m_pCacheFile = pCacheFile;
+    return true;
+}
+
+bool ModelOBJ::readCache(const char *pszFilename, const ImportOptions &options,
+                         char *pData, size_t size)
+{
+    CacheHeader header;
+    unsigned int flagsMask = CACHE_REBUILD_NORMALS | CACHE_MIKKTSPACE |
+                             CACHE_OPTIMIZE_VERTEX_CACHE | CACHE_OPTIMIZE_VERTEX_FETCH |
+                             CACHE_MERGE_MESHES | CACHE_KEEP_GROUPS |
+                             (ATTRIBUTE_ALL << CACHE_ATTRIBUTES_SHIFT);
+    unsigned int flags = options.rebuildNormals ? CACHE_REBUILD_NORMALS : 0;
+
+    flags |= (options.tangentMethod == TANGENTS_MIKKTSPACE) ? CACHE_MIKKTSPACE : 0;
+    flags |= options.optimizeVertexCache ? CACHE_OPTIMIZE_VERTEX_CACHE : 0;
+    flags |= options.optimizeVertexFetch ? CACHE_OPTIMIZE_VERTEX_FETCH : 0;
+    flags |= options.mergeMeshesByMaterial ? CACHE_MERGE_MESHES : 0;
+    flags |= options.keepGroups ? CACHE_KEEP_GROUPS : 0;
+    flags |= m_vertexAttributes << CACHE_ATTRIBUTES_SHIFT;
+
+    int meshletMaxVertices = options.buildMeshlets ? std::max(options.meshletMaxVertices, 3) : 0;
+    int meshletMaxTriangles = options.buildMeshlets ? std::max(options.meshletMaxTriangles, 1) : 0;
+
+    if (size < sizeof(header))
+        return false;
+
+    memcpy(&header, pData, sizeof(header));
+
+    if (memcmp(header.magic, CACHE_MAGIC, sizeof(CACHE_MAGIC)) != 0 ||
+        header.version != CACHE_VERSION ||
+        header.vertexSize != sizeof(Vertex) ||
+        (header.flags & flagsMask) != flags ||
+        header.fileSize != size ||
+        header.numberOfVertices < 0 || header.numberOfTriangles < 0 ||
+        header.numberOfMaterials <= 0 || header.numberOfMeshes < 0 ||
+        header.numberOfDependencies < 0 || header.numberOfLodIndices < 0 ||
+        header.numberOfMeshlets < 0 || header.numberOfGroups < 0 ||
+        header.meshletMaxVertices != meshletMaxVertices ||
+        header.meshletMaxTriangles != meshletMaxTriangles)
+    {
+        return false;
+    }
+
+    unsigned long long vertexBytes = static_cast<unsigned long long>(header.numberOfVertices) * sizeof(Vertex);
+    unsigned long long indexBytes = static_cast<unsigned long long>(header.numberOfTriangles) * 3 * sizeof(int);
+
+    if (header.vertexOffset != AlignOffset(sizeof(header)) ||
+        header.indexOffset != AlignOffset(header.vertexOffset + vertexBytes) ||
+        header.dataOffset != header.indexOffset + indexBytes ||
+        header.dataOffset > size)
+    {
+        return false;
+    }
+
+    // Check that the OBJ file hasn't changed since the cache was written.
+
+    FileStamp source = GetFileStamp(pszFilename);
+
+    if (source.size != header.source.size || source.time != header.source.time)
+        return false;
+
+    MappedFile sourceFile;
+
+    if (!sourceFile.open(pszFilename) ||
+        HashFileContents(sourceFile.data(), sourceFile.size()) != header.sourceHash)
+    {
+        return false;
+    }
+
+    sourceFile.close();
+
+    // Read the meshes, the materials and the MTL files the materials were
+    // read from. Any MTL file that has changed invalidates the cache.
+
+    const char *pCurrent = pData + header.dataOffset;
+    const char *pEnd = pData + size;
+    std::vector<Mesh> meshes(header.numberOfMeshes);
+    std::vector<int> meshMaterials(header.numberOfMeshes);
+    std::vector<Material> materials(header.numberOfMaterials);
+    std::string dependency;
+    FileStamp stamp = {};
+
+    for (int i = 0; i < header.numberOfMeshes; ++i)
+    {
+        Mesh &mesh = meshes[i];
+
+        if (!ReadBytes(pCurrent, pEnd, &mesh.startIndex, sizeof(mesh.startIndex)) ||
+            !ReadBytes(pCurrent, pEnd, &mesh.triangleCount, sizeof(mesh.triangleCount)) ||
+            !ReadBytes(pCurrent, pEnd, &meshMaterials[i], sizeof(meshMaterials[i])))
+        {
+            return false;
+        }
+
+        if (meshMaterials[i] < 0 || meshMaterials[i] >= header.numberOfMaterials ||
+            mesh.startIndex < 0 || mesh.triangleCount < 0 ||
+            mesh.startIndex / 3 + mesh.triangleCount > header.numberOfTriangles)
+        {
+            return false;
+        }
+    }
+
+    for (int i = 0; i < header.numberOfMaterials; ++i)
+    {
+        Material &material = materials[i];
+
+        if (!ReadBytes(pCurrent, pEnd, material.ambient, sizeof(material.ambient)) ||
+            !ReadBytes(pCurrent, pEnd, material.diffuse, sizeof(material.diffuse)) ||
+            !ReadBytes(pCurrent, pEnd, material.specular, sizeof(material.specular)) ||
+            !ReadBytes(pCurrent, pEnd, &material.shininess, sizeof(material.shininess)) ||
+            !ReadBytes(pCurrent, pEnd, &material.alpha, sizeof(material.alpha)) ||
+            !ReadString(pCurrent, pEnd, material.name) ||
+            !ReadString(pCurrent, pEnd, material.colorMapFilename) ||
+            !ReadString(pCurrent, pEnd, material.bumpMapFilename))
+        {
+            return false;
+        }
+    }
+
+    for (int i = 0; i < header.numberOfDependencies; ++i)
+    {
+        if (!ReadString(pCurrent, pEnd, dependency) ||
+            !ReadBytes(pCurrent, pEnd, &stamp, sizeof(stamp)))
+        {
+            return false;
+        }
+
+        FileStamp current = GetFileStamp(dependency.c_str());
+
+        if (current.size != stamp.size || current.time != stamp.time)
+            return false;
+    }
+
+    // Read the levels of detail. They must have been built with the same
+    // ratios.
+
+    std::vector<float> lodRatios;
+
+    NormalizeLodRatios(options.lodRatios, lodRatios);
+
+    if (header.numberOfLods != static_cast<int>(lodRatios.size()))
+        return false;
+
+    std::vector<Lod> lods(header.numberOfLods);
+    std::vector<Mesh> lodMeshes(header.numberOfLods * header.numberOfMeshes);
+    std::vector<int> lodIndices(header.numberOfLodIndices);
+
+    for (int i = 0; i < header.numberOfLods; ++i)
+    {
+        Lod &lod = lods[i];
+
+        if (!ReadBytes(pCurrent, pEnd, &lod.ratio, sizeof(lod.ratio)) ||
+            !ReadBytes(pCurrent, pEnd, &lod.error, sizeof(lod.error)) ||
+            !ReadBytes(pCurrent, pEnd, &lod.startIndex, sizeof(lod.startIndex)) ||
+            !ReadBytes(pCurrent, pEnd, &lod.triangleCount, sizeof(lod.triangleCount)))
+        {
+            return false;
+        }
+
+        if (lod.ratio != lodRatios[i])
+            return false;
+    }
+
+    for (int i = 0; i < static_cast<int>(lodMeshes.size()); ++i)
+    {
+        Mesh &mesh = lodMeshes[i];
+
+        if (!ReadBytes(pCurrent, pEnd, &mesh.startIndex, sizeof(mesh.startIndex)) ||
+            !ReadBytes(pCurrent, pEnd, &mesh.triangleCount, sizeof(mesh.triangleCount)))
+        {
+            return false;
+        }
+
+        if (mesh.startIndex < 0 || mesh.triangleCount < 0 ||
+            mesh.startIndex / 3 + mesh.triangleCount > header.numberOfLodIndices / 3)
+        {
+            return false;
+        }
+    }
+
+    if (!lodIndices.empty() &&
+        !ReadBytes(pCurrent, pEnd, &lodIndices[0], lodIndices.size() * sizeof(int)))
+    {
+        return false;
+    }
+
+    // Read the meshlets.
+
+    std::vector<Meshlet> meshlets(header.numberOfMeshlets);
+
+    if (!meshlets.empty() &&
+        !ReadBytes(pCurrent, pEnd, &meshlets[0], meshlets.size() * sizeof(Meshlet)))
+    {
+        return false;
+    }
+
+    for (int i = 0; i < header.numberOfMeshlets; ++i)
+    {
+        const Meshlet &meshlet = meshlets[i];
+
+        if (meshlet.mesh < 0 || meshlet.mesh >= header.numberOfMeshes ||
+            meshlet.startIndex < 0 || meshlet.triangleCount < 0 ||
+            meshlet.startIndex / 3 + meshlet.triangleCount > header.numberOfTriangles)
+        {
+            return false;
+        }
+    }
+
+    // Read the groups.
+
+    std::vector<Group> groups(header.numberOfGroups);
+
+    for (int i = 0; i < header.numberOfGroups; ++i)
+    {
+        Group &group = groups[i];
+
+        if (!ReadString(pCurrent, pEnd, group.name) ||
+            !ReadBytes(pCurrent, pEnd, &group.parent, sizeof(group.parent)) ||
+            !ReadBytes(pCurrent, pEnd, &group.childCount, sizeof(group.childCount)) ||
+            !ReadBytes(pCurrent, pEnd, &group.startIndex, sizeof(group.startIndex)) ||
+            !ReadBytes(pCurrent, pEnd, &group.triangleCount, sizeof(group.triangleCount)) ||
+            !ReadBytes(pCurrent, pEnd, &group.firstMesh, sizeof(group.firstMesh)) ||
+            !ReadBytes(pCurrent, pEnd, &group.meshCount, sizeof(group.meshCount)))
+        {
+            return false;
+        }
+
+        if (group.parent < -1 || group.parent >= i ||
+            group.childCount < 0 || group.childCount >= header.numberOfGroups - i ||
+            group.startIndex < 0 || group.triangleCount < 0 ||
+            group.startIndex / 3 + group.triangleCount > header.numberOfTriangles ||
+            group.firstMesh < 0 || group.meshCount < 0 ||
+            group.firstMesh + group.meshCount > header.numberOfMeshes)
+        {
+            return false;
+        }
+    }
+
+    // Every index must refer to a vertex in the cache. The checks above
+    // don't catch a cache that was damaged in place, and a bad index would
+    // read past the vertex buffer. Negative indices fail the unsigned test.
+
+    const unsigned int *pIndices = reinterpret_cast<const unsigned int *>(pData + header.indexOffset);
+    unsigned int numVertices = static_cast<unsigned int>(header.numberOfVertices);
+    int numIndices = header.numberOfTriangles * 3;
+    int numTasks = std::max(1, std::min(GetThreadCount(options.numThreads), numIndices / 65536));
+    std::atomic<bool> indicesValid(true);
+
+    RunTasks(numTasks, [&](int task)
+    {
+        bool valid = true;
+        int begin = 0;
+        int end = 0;
+
+        GetTaskRange(numIndices, task, numTasks, begin, end);
+
+        for (int i = begin; i < end; ++i)
+            valid &= pIndices[i] < numVertices;
+
+        if (!valid)
+            indicesValid = false;
+    });
+
+    if (!indicesValid)
+        return false;
+
+    for (int i = 0; i < static_cast<int>(lodIndices.size()); ++i)
+    {
+        if (static_cast<unsigned int>(lodIndices[i]) >= numVertices)
+            return false;
+    }
+
+    // The cache is valid.
+
+    m_hasPositions = (header.flags & CACHE_HAS_POSITIONS) != 0;
+    m_hasTextureCoords = (header.flags & CACHE_HAS_TEXCOORDS) != 0;
+    m_hasNormals = (header.flags & CACHE_HAS_NORMALS) != 0;
+    m_hasTangents = (header.flags & CACHE_HAS_TANGENTS) != 0;
+
+    m_numberOfTriangles = header.numberOfTriangles;
+    m_numberOfMaterials = header.numberOfMaterials;
+    m_numberOfMeshes = header.numberOfMeshes;
+
+    m_center[0] = header.center[0];
+    m_center[1] = header.center[1];
+    m_center[2] = header.center[2];
+    m_width = header.width;
+    m_height = header.height;
+    m_length = header.length;
+    m_radius = header.radius;
+
+    m_importStats.acmrBefore = header.acmrBefore;
+    m_importStats.acmrAfter = header.acmrAfter;
+    m_importStats.atvrBefore = header.atvrBefore;
+    m_importStats.atvrAfter = header.atvrAfter;
+    m_importStats.overfetchBefore = header.overfetchBefore;
+    m_importStats.overfetchAfter = header.overfetchAfter;
+
+    m_materials.swap(materials);
+    m_meshes.swap(meshes);
+
+    for (int i = 0; i < m_numberOfMeshes; ++i)
+        m_meshes[i].pMaterial = &m_materials[meshMaterials[i]];
+
+    m_lods.swap(lods);
+    m_lodMeshes.swap(lodMeshes);
+    m_lodIndexBuffer.swap(lodIndices);
+
+    for (int i = 0; i < static_cast<int>(m_lodMeshes.size()); ++i)
+        m_lodMeshes[i].pMaterial = m_meshes[i % m_numberOfMeshes].pMaterial;
+
+    m_meshlets.swap(meshlets);
+    m_groups.swap(groups);
+
+    for (int i = 0; i < m_numberOfMaterials; ++i)
+        m_materialCache[m_materials[i].name] = i;
+
+    m_pCacheVertexBuffer = reinterpret_cast<Vertex *>(pData + header.vertexOffset);
+    m_pCacheIndexBuffer = reinterpret_cast<int *>(pData + header.indexOffset);
+    m_numberOfCacheVertices = header.numberOfVertices;
+    return true;
+}
+
+bool ModelOBJ::saveCache(const char *pszFilename, const ImportOptions &options) const
+{
+    // Write the imported model to a binary cache next to the OBJ file. The
+    // cache is written to a temporary file first so that a reader never
+    // sees a partially written cache.
+
+    CacheHeader header;
+
+    if (getNumberOfVertices() == 0 || m_numberOfTriangles == 0)
+        return false;
+
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, CACHE_MAGIC, sizeof(CACHE_MAGIC));
+
+    header.version = CACHE_VERSION;
+    header.vertexSize = sizeof(Vertex);
+    header.source = GetFileStamp(pszFilename);
+
+    MappedFile sourceFile;
+
+    if (!sourceFile.open(pszFilename))
+        return false;
+
+    header.sourceHash = HashFileContents(sourceFile.data(), sourceFile.size());
+    sourceFile.close();
+
+    header.flags = options.rebuildNormals ? CACHE_REBUILD_NORMALS : 0;
+    header.flags |= m_hasPositions ? CACHE_HAS_POSITIONS : 0;
+    header.flags |= m_hasTextureCoords ? CACHE_HAS_TEXCOORDS : 0;
+    header.flags |= m_hasNormals ? CACHE_HAS_NORMALS : 0;
+    header.flags |= m_hasTangents ? CACHE_HAS_TANGENTS : 0;
+    header.flags |= (options.tangentMethod == TANGENTS_MIKKTSPACE) ? CACHE_MIKKTSPACE : 0;
+    header.flags |= options.optimizeVertexCache ? CACHE_OPTIMIZE_VERTEX_CACHE : 0;
+    header.flags |= options.optimizeVertexFetch ? CACHE_OPTIMIZE_VERTEX_FETCH : 0;
+    header.flags |= options.mergeMeshesByMaterial ? CACHE_MERGE_MESHES : 0;
+    header.flags |= options.keepGroups ? CACHE_KEEP_GROUPS : 0;
+    header.flags |= m_vertexAttributes << CACHE_ATTRIBUTES_SHIFT;
+
+    header.numberOfVertices = getNumberOfVertices();
+    header.numberOfTriangles = m_numberOfTriangles;
+    header.numberOfMaterials = m_numberOfMaterials;
+    header.numberOfMeshes = m_numberOfMeshes;
+    header.numberOfDependencies = static_cast<int>(m_materialFiles.size());
+    header.numberOfLods = static_cast<int>(m_lods.size());
+    header.numberOfLodIndices = static_cast<int>(m_lodIndexBuffer.size());
+    header.numberOfMeshlets = static_cast<int>(m_meshlets.size());
+    header.numberOfGroups = static_cast<int>(m_groups.size());
+    header.meshletMaxVertices = options.buildMeshlets ? std::max(options.meshletMaxVertices, 3) : 0;
+    header.meshletMaxTriangles = options.buildMeshlets ? std::max(options.meshletMaxTriangles, 1) : 0;
+
+    header.center[0] = m_center[0];
+    header.center[1] = m_center[1];
+    header.center[2] = m_center[2];
+    header.width = m_width;
+    header.height = m_height;
+    header.length = m_length;
+    header.radius = m_radius;
+    header.acmrBefore = m_importStats.acmrBefore;
+    header.acmrAfter = m_importStats.acmrAfter;
+    header.atvrBefore = m_importStats.atvrBefore;
+    header.atvrAfter = m_importStats.atvrAfter;
+    header.overfetchBefore = m_importStats.overfetchBefore;
+    header.overfetchAfter = m_importStats.overfetchAfter;
+
+    std::vector<char> data;
+    int materialIndex = 0;
+    FileStamp stamp = {};
+
+    for (int i = 0; i < m_numberOfMeshes; ++i)
+    {
+        const Mesh &mesh = m_meshes[i];
+
+        materialIndex = static_cast<int>(mesh.pMaterial - &m_materials[0]);
+        AppendBytes(data, &mesh.startIndex, sizeof(mesh.startIndex));
+        AppendBytes(data, &mesh.triangleCount, sizeof(mesh.triangleCount));
+        AppendBytes(data, &materialIndex, sizeof(materialIndex));
+    }
+
+    for (int i = 0; i < m_numberOfMaterials; ++i)
+    {
+        const Material &material = m_materials[i];
+
+        AppendBytes(data, material.ambient, sizeof(material.ambient));
+        AppendBytes(data, material.diffuse, sizeof(material.diffuse));
+        AppendBytes(data, material.specular, sizeof(material.specular));
+        AppendBytes(data, &material.shininess, sizeof(material.shininess));
+        AppendBytes(data, &material.alpha, sizeof(material.alpha));
+        AppendString(data, material.name);
+        AppendString(data, material.colorMapFilename);
+        AppendString(data, material.bumpMapFilename);
+    }
+
+    for (int i = 0; i < static_cast<int>(m_materialFiles.size()); ++i)
+    {
+        stamp = GetFileStamp(m_materialFiles[i].c_str());
+        AppendString(data, m_materialFiles[i]);
+        AppendBytes(data, &stamp, sizeof(stamp));
+    }
+
+    for (int i = 0; i < static_cast<int>(m_lods.size()); ++i)
+    {
+        const Lod &lod = m_lods[i];
+
+        AppendBytes(data, &lod.ratio, sizeof(lod.ratio));
+        AppendBytes(data, &lod.error, sizeof(lod.error));
+        AppendBytes(data, &lod.startIndex, sizeof(lod.startIndex));
+        AppendBytes(data, &lod.triangleCount, sizeof(lod.triangleCount));
+    }
+
+    for (int i = 0; i < static_cast<int>(m_lodMeshes.size()); ++i)
+    {
+        AppendBytes(data, &m_lodMeshes[i].startIndex, sizeof(m_lodMeshes[i].startIndex));
+        AppendBytes(data, &m_lodMeshes[i].triangleCount, sizeof(m_lodMeshes[i].triangleCount));
+    }
+
+    if (!m_lodIndexBuffer.empty())
+        AppendBytes(data, &m_lodIndexBuffer[0], m_lodIndexBuffer.size() * sizeof(int));
+
+    if (!m_meshlets.empty())
+        AppendBytes(data, &m_meshlets[0], m_meshlets.size() * sizeof(Meshlet));
+
+    for (int i = 0; i < static_cast<int>(m_groups.size()); ++i)
+    {
+        const Group &group = m_groups[i];
+
+        AppendString(data, group.name);
+        AppendBytes(data, &group.parent, sizeof(group.parent));
+        AppendBytes(data, &group.childCount, sizeof(group.childCount));
+        AppendBytes(data, &group.startIndex, sizeof(group.startIndex));
+        AppendBytes(data, &group.triangleCount, sizeof(group.triangleCount));
+        AppendBytes(data, &group.firstMesh, sizeof(group.firstMesh));
+        AppendBytes(data, &group.meshCount, sizeof(group.meshCount));
+    }
+
+    unsigned long long vertexBytes = static_cast<unsigned long long>(header.numberOfVertices) * sizeof(Vertex);
+    unsigned long long indexBytes = static_cast<unsigned long long>(header.numberOfTriangles) * 3 * sizeof(int);
+
+    header.vertexOffset = AlignOffset(sizeof(header));
+    header.indexOffset = AlignOffset(header.vertexOffset + vertexBytes);
+    header.dataOffset = header.indexOffset + indexBytes;
+    header.fileSize = header.dataOffset + data.size();
+
+    std::string cacheFilename = std::string(pszFilename) + ".cache";
+    std::string tempFilename = cacheFilename + ".tmp";
+    FILE *pFile = fopen(tempFilename.c_str(), "wb");
+
+    if (!pFile)
+        return false;
+
+    const char padding[16] = {0};
+    size_t vertexPadding = static_cast<size_t>(header.vertexOffset - sizeof(header));
+    size_t indexPadding = static_cast<size_t>(header.indexOffset - header.vertexOffset - vertexBytes);
+    bool written = fwrite(&header, sizeof(header), 1, pFile) == 1;
+
+    written = written && fwrite(padding, 1, vertexPadding, pFile) == vertexPadding;
+    written = written && fwrite(getVertexBuffer(), sizeof(Vertex), header.numberOfVertices, pFile) == static_cast<size_t>(header.numberOfVertices);
+    written = written && fwrite(padding, 1, indexPadding, pFile) == indexPadding;
+    written = written && fwrite(getIndexBuffer(), sizeof(int), m_numberOfTriangles * 3, pFile) == static_cast<size_t>(m_numberOfTriangles * 3);
+    written = written && (data.empty() || fwrite(&data[0], 1, data.size(), pFile) == data.size());
+
+    if (fclose(pFile) != 0)
+        written = false;
+
+    if (!written)
     {
-        return lhs.pMaterial->alpha > rhs.pMaterial->alpha;
+        remove(tempFilename.c_str());
+        return false;
+    }
+
+    remove(cacheFilename.c_str());
+
+    if (rename(tempFilename.c_str(), cacheFilename.c_str()) != 0)
+    {
+        remove(tempFilename.c_str());
+        return false;
     }
+
+    return true;
 }
 
-ModelOBJ::ModelOBJ()
+bool ModelOBJ::intersectRay(const float origin[3], const float direction[3],
+                            float maxDistance, RayHit &hit) const
 {
-    m_hasPositions = false;
-    m_hasNormals = false;
-    m_hasTextureCoords = false;
-    m_hasTangents = false;
+    // Finds the closest hit within maxDistance. Distances are in units of
+    // the direction's length.
 
-    m_numberOfVertexCoords = 0;
-    m_numberOfTextureCoords = 0;
-    m_numberOfNormals = 0;
-    m_numberOfTriangles = 0;
-    m_numberOfMaterials = 0;
-    m_numberOfMeshes = 0;
+    int bvhTriangle = -1;
 
-    m_center[0] = m_center[1] = m_center[2] = 0.0f;
-    m_width = m_height = m_length = m_radius = 0.0f;
+    hit.triangle = -1;
+
+    if (m_bvhNodes.empty() ||
+        !TraceRay<false>(&m_bvhNodes[0], &m_bvhPositions[0], origin, direction, maxDistance,
+                         bvhTriangle, hit.distance, hit.barycentric[0], hit.barycentric[1]))
+    {
+        return false;
+    }
+
+    hit.triangle = m_bvhTriangles[bvhTriangle];
+    BarycentricPoint(&m_bvhPositions[bvhTriangle * 9], hit.barycentric[0], hit.barycentric[1], hit.position);
+    return true;
 }
 
-ModelOBJ::~ModelOBJ()
+bool ModelOBJ::intersectRayAny(const float origin[3], const float direction[3],
+                               float maxDistance) const
 {
-    destroy();
+    // Returns true as soon as any hit within maxDistance is found. Use this
+    // for occlusion and line of sight tests.
+
+    int bvhTriangle = -1;
+    float t = 0.0f;
+    float u = 0.0f;
+    float v = 0.0f;
+
+    return !m_bvhNodes.empty() &&
+        TraceRay<true>(&m_bvhNodes[0], &m_bvhPositions[0], origin, direction, maxDistance,
+                       bvhTriangle, t, u, v);
 }
 
-void ModelOBJ::bounds(float center[3], float &width, float &height,
-                      float &length, float &radius) const
+void ModelOBJ::intersectRays(const float *pOrigins, const float *pDirections,
+                             int count, float maxDistance, RayHit *pHits) const
 {
-    float xMax = std::numeric_limits<float>::min();
-    float yMax = std::numeric_limits<float>::min();
-    float zMax = std::numeric_limits<float>::min();
+    // Finds the closest hit of each of 'count' rays, with 3 floats per
+    // origin and per direction. The rays are traced in packets of
+    // BVH_PACKET_SIZE, which pays off when neighbouring rays are coherent,
+    // such as rays through neighbouring pixels.
 
-    float xMin = std::numeric_limits<float>::max();
-    float yMin = std::numeric_limits<float>::max();
-    float zMin = std::numeric_limits<float>::max();
+    int hitTriangles[BVH_PACKET_SIZE];
+    float t[BVH_PACKET_SIZE];
+    float u[BVH_PACKET_SIZE];
+    float v[BVH_PACKET_SIZE];
 
-    float x = 0.0f;
-    float y = 0.0f;
-    float z = 0.0f;
+    for (int i = 0; i < count; i += BVH_PACKET_SIZE)
+    {
+        int numRays = std::min(count - i, BVH_PACKET_SIZE);
 
-    int numVerts = static_cast<int>(m_vertexBuffer.size());
+        if (m_bvhNodes.empty())
+        {
+            for (int j = 0; j < numRays; ++j)
+                pHits[i + j].triangle = -1;
 
-    for (int i = 0; i < numVerts; ++i)
-    {
-        x = m_vertexBuffer[i].position[0];
-        y = m_vertexBuffer[i].position[1];
-        z = m_vertexBuffer[i].position[2];
+            continue;
+        }
+
+        TraceRayPacket(&m_bvhNodes[0], &m_bvhPositions[0], &pOrigins[i * 3], &pDirections[i * 3],
+                       numRays, maxDistance, hitTriangles, t, u, v);
 
-        if (x < xMin)
-            xMin = x;
+        for (int j = 0; j < numRays; ++j)
+        {
+            RayHit &hit = pHits[i + j];
+
+            hit.triangle = -1;
 
-        if (x > xMax)
-            xMax = x;
+            if (hitTriangles[j] < 0)
+                continue;
+
+            hit.triangle = m_bvhTriangles[hitTriangles[j]];
+            hit.distance = t[j];
+            hit.barycentric[0] = u[j];
+            hit.barycentric[1] = v[j];
+            BarycentricPoint(&m_bvhPositions[hitTriangles[j] * 9], u[j], v[j], hit.position);
+        }
+    }
+}
 
-        if (y < yMin)
-            yMin = y;
+void ModelOBJ::normalize(float scaleTo, bool center)
+{
+    float width = 0.0f;
+    float height = 0.0f;
+    float length = 0.0f;
+    float radius = 0.0f;
+    float centerPos[3] = {0.0f};
 
-        if (y > yMax)
-            yMax = y;
+    bounds(centerPos, width, height, length, radius);
 
-        if (z < zMin)
-            zMin = z;
+    float scalingFactor = scaleTo / radius;
+    float offset[3] = {0.0f};
 
-        if (z > zMax)
-            zMax = z;
+    if (center)
+    {
+        offset[0] = -centerPos[0];
+        offset[1] = -centerPos[1];
+        offset[2] = -centerPos[2];
+    }
+    else
+    {
+        offset[0] = 0.0f;
+        offset[1] = 0.0f;
+        offset[2] = 0.0f;
     }
 
-    center[0] = (xMin + xMax) / 2.0f;
-    center[1] = (yMin + yMax) / 2.0f;
-    center[2] = (zMin + zMax) / 2.0f;
+    scale(scalingFactor, offset);
+    bounds(m_center, m_width, m_height, m_length, m_radius);
+    computeMeshBounds(GetThreadCount(0));
 
-    width = xMax - xMin;
-    height = yMax - yMin;
-    length = zMax - zMin;
+    if (!m_meshlets.empty())
+        computeMeshletBounds(GetThreadCount(0));
 
-    radius = std::max(std::max(width, height), length);
+    refitBvh();
 }
 
-void ModelOBJ::destroy()
+ModelOBJ::MemoryUsage ModelOBJ::getMemoryUsage() const
 {
-    m_hasPositions = false;
-    m_hasTextureCoords = false;
-    m_hasNormals = false;
-    m_hasTangents = false;
+    // std::map nodes are estimated as the value plus three links and a
+    // color. Strings are counted when they're too long for the small string
+    // buffer inside std::string.
+
+    const size_t mapNodeSize = sizeof(std::pair<const std::string, int>) + 4 * sizeof(void *);
+    MemoryUsage usage;
+
+    memset(&usage, 0, sizeof(usage));
+
+    usage.vertexBuffer = m_vertexBuffer.capacity() * sizeof(Vertex);
+    usage.vertexStreams = m_vertexStreams.capacity() * sizeof(float);
+    usage.indexBuffer = m_indexBuffer.capacity() * sizeof(int);
+    usage.meshes = m_meshes.capacity() * sizeof(Mesh) + m_meshBounds.capacity() * sizeof(BoundingBox);
+    usage.lods = m_lods.capacity() * sizeof(Lod) + m_lodMeshes.capacity() * sizeof(Mesh) +
+        m_lodIndexBuffer.capacity() * sizeof(int);
+    usage.meshlets = m_meshlets.capacity() * sizeof(Meshlet);
+    usage.bvh = m_bvhNodes.capacity() * sizeof(BvhNode) + m_bvhTriangles.capacity() * sizeof(int) +
+        m_bvhPositions.capacity() * sizeof(float);
+    usage.groups = m_groups.capacity() * sizeof(Group) + m_groupBounds.capacity() * sizeof(BoundingBox);
+    usage.materials = m_materials.capacity() * sizeof(Material);
+
+    for (int i = 0; i < static_cast<int>(m_groups.size()); ++i)
+        usage.groups += StringHeapBytes(m_groups[i].name);
+
+    for (int i = 0; i < static_cast<int>(m_materials.size()); ++i)
+    {
+        usage.materials += StringHeapBytes(m_materials[i].name);
+        usage.materials += StringHeapBytes(m_materials[i].colorMapFilename);
+        usage.materials += StringHeapBytes(m_materials[i].bumpMapFilename);
+    }
 
-    m_numberOfVertexCoords = 0;
-    m_numberOfTextureCoords = 0;
-    m_numberOfNormals = 0;
-    m_numberOfTriangles = 0;
-    m_numberOfMaterials = 0;
-    m_numberOfMeshes = 0;
+    usage.attributeBuffer = (m_attributeBuffer.capacity() + m_groupBuffer.capacity()) * sizeof(int);
+    usage.vertexCoords = m_vertexCoords.capacity() * sizeof(float);
+    usage.textureCoords = m_textureCoords.capacity() * sizeof(float);
+    usage.normals = m_normals.capacity() * sizeof(float);
 
-    m_center[0] = m_center[1] = m_center[2] = 0.0f;
-    m_width = m_height = m_length = m_radius = 0.0f;
+    std::map<std::string, int>::const_iterator iter;
 
-    m_directoryPath.clear();
+    for (iter = m_materialCache.begin(); iter != m_materialCache.end(); ++iter)
+        usage.materialCache += mapNodeSize + StringHeapBytes(iter->first);
 
-    m_meshes.clear();
-    m_materials.clear();
-    m_vertexBuffer.clear();
-    m_indexBuffer.clear();
-    m_attributeBuffer.clear();
+    for (iter = m_groupCache.begin(); iter != m_groupCache.end(); ++iter)
+        usage.groupCache += mapNodeSize + StringHeapBytes(iter->first);
 
-    m_vertexCoords.clear();
-    m_textureCoords.clear();
-    m_normals.clear();
+    usage.vertexCache = m_vertexCache.capacity() * sizeof(VertexCacheEntry);
+    usage.vertexCache += m_texCoordCache.capacity() * sizeof(int);
+    usage.vertexCache += m_texCoordClasses.capacity() * sizeof(int);
+    usage.vertexCache += m_normalCache.capacity() * sizeof(int);
+    usage.vertexCache += m_normalClasses.capacity() * sizeof(int);
 
-    m_materialCache.clear();
-    m_vertexCache.clear();
+    usage.total = usage.vertexBuffer + usage.vertexStreams + usage.indexBuffer + usage.meshes +
+        usage.groups + usage.lods + usage.meshlets + usage.bvh + usage.materials + usage.attributeBuffer +
+        usage.vertexCoords + usage.textureCoords + usage.normals + usage.materialCache +
+        usage.groupCache + usage.vertexCache;
+
+    usage.mappedCache = m_pCacheFile ? m_pCacheFile->size() : 0;
+    return usage;
 }
 
-bool ModelOBJ::import(const char *pszFilename, bool rebuildNormals)
+void ModelOBJ::refitBvh()
 {
-    FILE *pFile = fopen(pszFilename, "r");
+    // Copies the current corner positions into the BVH and recomputes the
+    // node bounds from the leaves up, which works because children always
+    // follow their parents. The tree is kept as it is, so queries slow down
+    // if the vertices moved a lot; buildBvh() makes a new tree.
 
-    if (!pFile)
-        return false;
+    int numTriangles = static_cast<int>(m_bvhTriangles.size());
+    int numTasks = std::max(1, std::min(GetThreadCount(0), numTriangles / 4096));
+    const int *pIndices = getIndexBuffer();
 
-    // Extract the directory the OBJ file is in from the file name.
-    // This directory path will be used to load the OBJ's associated MTL file.
+    if (m_bvhNodes.empty())
+        return;
 
-    m_directoryPath.clear();
+    RunTasks(numTasks, [&](int task)
+    {
+        int begin = 0;
+        int end = 0;
 
-    std::string filename = pszFilename;
-    std::string::size_type offset = filename.find_last_of('\\');
+        GetTaskRange(numTriangles, task, numTasks, begin, end);
 
-    if (offset != std::string::npos)
-    {
-        m_directoryPath = filename.substr(0, ++offset);
-    }
-    else
+        for (int i = begin; i < end; ++i)
+        {
+            for (int j = 0; j < 3; ++j)
+                fetchPosition(pIndices[m_bvhTriangles[i] * 3 + j], &m_bvhPositions[i * 9 + j * 3]);
+        }
+    });
+
+    for (int i = static_cast<int>(m_bvhNodes.size()) - 1; i >= 0; --i)
     {
-        offset = filename.find_last_of('/');
+        BvhNode &node = m_bvhNodes[i];
 
-        if (offset != std::string::npos)
-            m_directoryPath = filename.substr(0, ++offset);
+        ResetBox(node.boundsMin, node.boundsMax);
+
+        if (node.count == 0)
+        {
+            for (int j = 0; j < 2; ++j)
+                GrowBox(node.boundsMin, node.boundsMax, m_bvhNodes[node.first + j].boundsMin, m_bvhNodes[node.first + j].boundsMax);
+
+            continue;
+        }
+
+        for (int j = node.first * 3; j < (node.first + node.count) * 3; ++j)
+            GrowBox(node.boundsMin, node.boundsMax, &m_bvhPositions[j * 3], &m_bvhPositions[j * 3]);
     }
+}
 
-    // Import the OBJ file.
+void ModelOBJ::releaseImportData()
+{
+    // Frees the buffers that are only needed while importing. The model can
+    // still be drawn, normalized, scaled and have its winding reversed.
+
+    std::vector<int>().swap(m_attributeBuffer);
+    std::vector<int>().swap(m_groupBuffer);
+    std::vector<float>().swap(m_vertexCoords);
+    std::vector<float>().swap(m_textureCoords);
+    std::vector<float>().swap(m_normals);
+
+    std::map<std::string, int>().swap(m_materialCache);
+    std::map<std::string, int>().swap(m_groupCache);
+    std::vector<std::string>().swap(m_materialFiles);
+    std::vector<VertexCacheEntry>().swap(m_vertexCache);
+    std::vector<int>().swap(m_texCoordCache);
+    std::vector<int>().swap(m_texCoordClasses);
+    std::vector<int>().swap(m_normalCache);
+    std::vector<int>().swap(m_normalClasses);
+}
 
-    importGeometryFirstPass(pFile);
-    rewind(pFile);
-    importGeometrySecondPass(pFile);
-    fclose(pFile);
+void ModelOBJ::packVertexBuffer(std::vector<PackedVertex> &vertices,
+                                PackedVertexInfo &info,
+                                TexCoordPacking texCoordPacking) const
+{
+    // Packs every vertex into 20 bytes and measures the error by decoding
+    // the packed vertex again. Normals and tangents of zero length, such as
+    // those of models without normals or tangents, aren't measured.
 
-    // Perform post import tasks.
+    int numberOfVertices = getNumberOfVertices();
+    Vertex scratch;
 
-    buildMeshes();
-    bounds(m_center, m_width, m_height, m_length, m_radius);
+    memset(&info, 0, sizeof(info));
+    vertices.resize(numberOfVertices);
 
-    // Build vertex normals if required.
+    if (numberOfVertices == 0)
+        return;
 
-    if (rebuildNormals)
+    // Find the position and texture coordinate bounds.
+
+    float minimum[5];
+    float maximum[5];
+
+    for (int i = 0; i < numberOfVertices; ++i)
     {
-        generateNormals();
+        const float *pComponents = reinterpret_cast<const float *>(&fetchVertex(i, scratch));
+
+        for (int j = COMPONENT_POSITION_X; j <= COMPONENT_TEXCOORD_V; ++j)
+        {
+            float value = pComponents[j];
+
+            minimum[j] = (i == 0 || value < minimum[j]) ? value : minimum[j];
+            maximum[j] = (i == 0 || value > maximum[j]) ? value : maximum[j];
+        }
     }
-    else
+
+    for (int j = 0; j < 3; ++j)
     {
-        if (!hasNormals())
-            generateNormals();
+        info.positionOffset[j] = minimum[j];
+        info.positionScale[j] = maximum[j] - minimum[j];
     }
 
-    // Build tangents is required.
+    for (int j = 0; j < 2; ++j)
+    {
+        info.texCoordOffset[j] = minimum[j + 3];
+        info.texCoordScale[j] = maximum[j + 3] - minimum[j + 3];
+    }
 
-    for (int i = 0; i < m_numberOfMaterials; ++i)
+    // Pack the vertices.
+
+    float decoded[4] = {0.0f};
+
+    for (int i = 0; i < numberOfVertices; ++i)
     {
-        if (!m_materials[i].bumpMapFilename.empty())
+        const Vertex &vertex = fetchVertex(i, scratch);
+        PackedVertex &packed = vertices[i];
+
+        for (int j = 0; j < 3; ++j)
         {
-            generateTangents();
-            break;
+            packed.position[j] = QuantizeUnorm16(vertex.position[j],
+                info.positionOffset[j], info.positionScale[j]);
+
+            decoded[j] = DequantizeUnorm16(packed.position[j],
+                info.positionOffset[j], info.positionScale[j]);
+
+            info.maxPositionError = std::max(info.maxPositionError, fabsf(decoded[j] - vertex.position[j]));
+        }
+
+        packed.position[3] = 0;
+
+        for (int j = 0; j < 2; ++j)
+        {
+            if (texCoordPacking == TEXCOORD_UNORM16)
+            {
+                packed.texCoord[j] = QuantizeUnorm16(vertex.texCoord[j],
+                    info.texCoordOffset[j], info.texCoordScale[j]);
+
+                decoded[j] = DequantizeUnorm16(packed.texCoord[j],
+                    info.texCoordOffset[j], info.texCoordScale[j]);
+            }
+            else
+            {
+                packed.texCoord[j] = FloatToHalf(vertex.texCoord[j]);
+                decoded[j] = HalfToFloat(packed.texCoord[j]);
+            }
+
+            info.maxTexCoordError = std::max(info.maxTexCoordError, fabsf(decoded[j] - vertex.texCoord[j]));
+        }
+
+        packed.normal = EncodeOctahedral(vertex.normal);
+
+        if (packed.normal != 0)
+        {
+            DecodeOctahedral(packed.normal, decoded);
+            info.maxNormalError = std::max(info.maxNormalError, AngleBetween(decoded, vertex.normal));
         }
+
+        packed.tangent = PackSnorm(vertex.tangent[0], 10) |
+            (PackSnorm(vertex.tangent[1], 10) << 10) |
+            (PackSnorm(vertex.tangent[2], 10) << 20) |
+            (PackSnorm(vertex.tangent[3], 2) << 30);
+
+        for (int j = 0; j < 3; ++j)
+            decoded[j] = UnpackSnorm(packed.tangent >> (j * 10), 10);
+
+        info.maxTangentError = std::max(info.maxTangentError, AngleBetween(decoded, vertex.tangent));
     }
+}
 
-    return true;
+void ModelOBJ::reverseWinding()
+{
+    int *pIndices = indexBuffer();
+    Vertex *pVertices = vertexBuffer();
+    int swap = 0;
+
+    // Reverse face winding.
+    for (int i = 0; i < m_numberOfTriangles * 3; i += 3)
+    {
+        swap = pIndices[i + 1];
+        pIndices[i + 1] = pIndices[i + 2];
+        pIndices[i + 2] = swap;
+    }
+
+    for (int i = 0; i < static_cast<int>(m_lodIndexBuffer.size()); i += 3)
+        std::swap(m_lodIndexBuffer[i + 1], m_lodIndexBuffer[i + 2]);
+
+    // The normal cones depend on the winding, and the BVH keeps its own
+    // copy of the corners in index buffer order.
+
+    if (!m_meshlets.empty())
+        computeMeshletBounds(GetThreadCount(0));
+
+    refitBvh();
+
+    float *pNormal = 0;
+    float *pTangent = 0;
+
+    // Invert normals and tangents.
+
+    if (m_vertexStorage == STORAGE_SOA)
+    {
+        NegateStream(vertexStream(COMPONENT_NORMAL_X), getNumberOfVertices());
+        NegateStream(vertexStream(COMPONENT_NORMAL_Y), getNumberOfVertices());
+        NegateStream(vertexStream(COMPONENT_NORMAL_Z), getNumberOfVertices());
+        NegateStream(vertexStream(COMPONENT_TANGENT_X), getNumberOfVertices());
+        NegateStream(vertexStream(COMPONENT_TANGENT_Y), getNumberOfVertices());
+        NegateStream(vertexStream(COMPONENT_TANGENT_Z), getNumberOfVertices());
+        return;
+    }
+
+    for (int i = 0; i < getNumberOfVertices(); ++i)
+    {
+        pNormal = pVertices[i].normal;
+        pNormal[0] = -pNormal[0];
+        pNormal[1] = -pNormal[1];
+        pNormal[2] = -pNormal[2];
+
+        pTangent = pVertices[i].tangent;
+        pTangent[0] = -pTangent[0];
+        pTangent[1] = -pTangent[1];
+        pTangent[2] = -pTangent[2];
+    }
 }
 
-void ModelOBJ::normalize(float scaleTo, bool center)
+int ModelOBJ::selectLod(float maxError) const
 {
-    float width = 0.0f;
-    float height = 0.0f;
-    float length = 0.0f;
-    float radius = 0.0f;
-    float centerPos[3] = {0.0f};
+    // Returns the coarsest LOD whose error is within maxError, or -1 if the
+    // full detail model is needed. For a screen space error of p pixels, a
+    // viewport h pixels high, a vertical field of view fovy and a distance
+    // d, maxError is p * d * 2 * tan(fovy / 2) / h.
 
-    bounds(centerPos, width, height, length, radius);
+    for (int i = static_cast<int>(m_lods.size()) - 1; i >= 0; --i)
+    {
+        if (m_lods[i].error <= maxError)
+            return i;
+    }
 
-    float scalingFactor = scaleTo / radius;
-    float offset[3] = {0.0f};
+    return -1;
+}
 
-    if (center)
+void ModelOBJ::setVertexStorage(VertexStorage storage)
+{
+    // Converts the vertices between the interleaved Vertex array used for
+    // drawing and separate per component streams used for processing.
+
+    if (storage == m_vertexStorage)
+        return;
+
+    int numberOfVertices = getNumberOfVertices();
+    float *pStreams[NUMBER_OF_COMPONENTS];
+    const float *pComponents = 0;
+
+    if (storage == STORAGE_SOA)
     {
-        offset[0] = -centerPos[0];
-        offset[1] = -centerPos[1];
-        offset[2] = -centerPos[2];
+        detachCacheFile();
+
+        // Pad each stream to a multiple of 16 floats and leave room to align
+        // the first stream to 64 bytes.
+
+        m_vertexStreamStride = (numberOfVertices + 15) & ~15;
+        m_vertexStreams.assign(m_vertexStreamStride * NUMBER_OF_COMPONENTS + 16, 0.0f);
+        m_vertexStreamOffset = static_cast<int>(((64 - (reinterpret_cast<size_t>(&m_vertexStreams[0]) & 63)) & 63) / sizeof(float));
+        m_numberOfStreamVertices = numberOfVertices;
+        m_vertexStorage = STORAGE_SOA;
+
+        for (int i = 0; i < NUMBER_OF_COMPONENTS; ++i)
+            pStreams[i] = vertexStream(static_cast<VertexComponent>(i));
+
+        for (int i = 0; i < numberOfVertices; ++i)
+        {
+            pComponents = m_vertexBuffer[i].position;
+
+            for (int j = 0; j < NUMBER_OF_COMPONENTS; ++j)
+                pStreams[j][i] = pComponents[j];
+        }
+
+        std::vector<Vertex>().swap(m_vertexBuffer);
     }
     else
     {
-        offset[0] = 0.0f;
-        offset[1] = 0.0f;
-        offset[2] = 0.0f;
-    }
+        m_vertexBuffer.resize(numberOfVertices);
+
+        for (int i = 0; i < NUMBER_OF_COMPONENTS; ++i)
+            pStreams[i] = vertexStream(static_cast<VertexComponent>(i));
+
+        for (int i = 0; i < numberOfVertices; ++i)
+        {
+            float *pVertex = m_vertexBuffer[i].position;
+
+            for (int j = 0; j < NUMBER_OF_COMPONENTS; ++j)
+                pVertex[j] = pStreams[j][i];
+        }
 
-    scale(scalingFactor, offset);
-    bounds(m_center, m_width, m_height, m_length, m_radius);
+        std::vector<float>().swap(m_vertexStreams);
+        m_vertexStreamOffset = 0;
+        m_vertexStreamStride = 0;
+        m_numberOfStreamVertices = 0;
+        m_vertexStorage = STORAGE_INTERLEAVED;
+    }
 }
 
-void ModelOBJ::reverseWinding()
+void ModelOBJ::sortTriangles(const std::vector<int> &keys, int numKeys, int numThreads)
 {
-    int swap = 0;
-
-    // Reverse face winding.
-    for (int i = 0; i < static_cast<int>(m_indexBuffer.size()); i += 3)
+    // Stable counting sort of the triangles by a key per triangle, either
+    // their material or their group. Sorting by material lets buildMeshes()
+    // make one mesh per material rather than one per run of triangles. Each
+    // task counts the keys in its share of the triangles. The counts are
+    // then laid out key by key and task by task, so the triangles with the
+    // same key keep their order. The materials and groups move with their
+    // triangles, and 'keys' is one of them.
+
+    int numTriangles = m_numberOfTriangles;
+    int numTasks = std::max(1, std::min(numThreads, numTriangles / 16384));
+    bool hasGroups = !m_groupBuffer.empty();
+    const int *pIndices = indexBuffer();
+    std::vector<int> offsets(numTasks * numKeys, 0);
+    std::vector<int> indices(numTriangles * 3);
+    std::vector<int> attributes(numTriangles);
+    std::vector<int> groups(hasGroups ? numTriangles : 0);
+
+    RunTasks(numTasks, [&](int task)
     {
-        swap = m_indexBuffer[i + 1];
-        m_indexBuffer[i + 1] = m_indexBuffer[i + 2];
-        m_indexBuffer[i + 2] = swap;
-    }
+        int *pCounts = &offsets[task * numKeys];
+        int begin = 0;
+        int end = 0;
 
-    float *pNormal = 0;
-    float *pTangent = 0;
+        GetTaskRange(numTriangles, task, numTasks, begin, end);
 
-    // Invert normals and tangents.
-    for (int i = 0; i < static_cast<int>(m_vertexBuffer.size()); ++i)
+        for (int i = begin; i < end; ++i)
+            ++pCounts[keys[i]];
+    });
+
+    for (int i = 0, total = 0; i < numKeys; ++i)
     {
-        pNormal = m_vertexBuffer[i].normal;
-        pNormal[0] = -pNormal[0];
-        pNormal[1] = -pNormal[1];
-        pNormal[2] = -pNormal[2];
+        for (int task = 0; task < numTasks; ++task)
+        {
+            int count = offsets[task * numKeys + i];
 
-        pTangent = m_vertexBuffer[i].tangent;
-        pTangent[0] = -pTangent[0];
-        pTangent[1] = -pTangent[1];
-        pTangent[2] = -pTangent[2];
+            offsets[task * numKeys + i] = total;
+            total += count;
+        }
     }
+
+    RunTasks(numTasks, [&](int task)
+    {
+        int *pOffsets = &offsets[task * numKeys];
+        int begin = 0;
+        int end = 0;
+
+        GetTaskRange(numTriangles, task, numTasks, begin, end);
+
+        for (int i = begin; i < end; ++i)
+        {
+            int triangle = pOffsets[keys[i]]++;
+
+            memcpy(&indices[triangle * 3], &pIndices[i * 3], 3 * sizeof(int));
+            attributes[triangle] = m_attributeBuffer[i];
+
+            if (hasGroups)
+                groups[triangle] = m_groupBuffer[i];
+        }
+    });
+
+    m_indexBuffer.swap(indices);
+    m_attributeBuffer.swap(attributes);
+
+    if (hasGroups)
+        m_groupBuffer.swap(groups);
+}
+
+void ModelOBJ::swap(ModelOBJ &other)
+{
+    // Exchanges the contents of two models. The meshes keep pointing at the
+    // right materials since swapping vectors doesn't move their elements.
+
+    std::swap(m_hasPositions, other.m_hasPositions);
+    std::swap(m_hasTextureCoords, other.m_hasTextureCoords);
+    std::swap(m_hasNormals, other.m_hasNormals);
+    std::swap(m_hasTangents, other.m_hasTangents);
+
+    std::swap(m_numberOfVertexCoords, other.m_numberOfVertexCoords);
+    std::swap(m_numberOfTextureCoords, other.m_numberOfTextureCoords);
+    std::swap(m_numberOfNormals, other.m_numberOfNormals);
+    std::swap(m_numberOfTriangles, other.m_numberOfTriangles);
+    std::swap(m_numberOfMaterials, other.m_numberOfMaterials);
+    std::swap(m_numberOfMeshes, other.m_numberOfMeshes);
+
+    std::swap(m_center[0], other.m_center[0]);
+    std::swap(m_center[1], other.m_center[1]);
+    std::swap(m_center[2], other.m_center[2]);
+    std::swap(m_width, other.m_width);
+    std::swap(m_height, other.m_height);
+    std::swap(m_length, other.m_length);
+    std::swap(m_radius, other.m_radius);
+
+    std::swap(m_directoryPath, other.m_directoryPath);
+    std::swap(m_pMaterialResolver, other.m_pMaterialResolver);
+    std::swap(m_vertexAttributes, other.m_vertexAttributes);
+    std::swap(m_pProgress, other.m_pProgress);
+    std::swap(m_importStats, other.m_importStats);
+
+    std::swap(m_meshes, other.m_meshes);
+    std::swap(m_meshBounds, other.m_meshBounds);
+    std::swap(m_groups, other.m_groups);
+    std::swap(m_groupBounds, other.m_groupBounds);
+    std::swap(m_materials, other.m_materials);
+    std::swap(m_vertexBuffer, other.m_vertexBuffer);
+    std::swap(m_indexBuffer, other.m_indexBuffer);
+    std::swap(m_attributeBuffer, other.m_attributeBuffer);
+    std::swap(m_groupBuffer, other.m_groupBuffer);
+    std::swap(m_vertexCoords, other.m_vertexCoords);
+    std::swap(m_textureCoords, other.m_textureCoords);
+    std::swap(m_normals, other.m_normals);
+
+    std::swap(m_lods, other.m_lods);
+    std::swap(m_lodMeshes, other.m_lodMeshes);
+    std::swap(m_lodIndexBuffer, other.m_lodIndexBuffer);
+
+    std::swap(m_meshlets, other.m_meshlets);
+
+    std::swap(m_bvhNodes, other.m_bvhNodes);
+    std::swap(m_bvhTriangles, other.m_bvhTriangles);
+    std::swap(m_bvhPositions, other.m_bvhPositions);
+
+    std::swap(m_vertexStorage, other.m_vertexStorage);
+    std::swap(m_vertexStreams, other.m_vertexStreams);
+    std::swap(m_vertexStreamOffset, other.m_vertexStreamOffset);
+    std::swap(m_vertexStreamStride, other.m_vertexStreamStride);
+    std::swap(m_numberOfStreamVertices, other.m_numberOfStreamVertices);
+
+    std::swap(m_materialCache, other.m_materialCache);
+    std::swap(m_groupCache, other.m_groupCache);
+    std::swap(m_materialFiles, other.m_materialFiles);
+    std::swap(m_vertexCache, other.m_vertexCache);
+    std::swap(m_texCoordCache, other.m_texCoordCache);
+    std::swap(m_texCoordClasses, other.m_texCoordClasses);
+    std::swap(m_normalCache, other.m_normalCache);
+    std::swap(m_normalClasses, other.m_normalClasses);
+
+    std::swap(m_pCacheFile, other.m_pCacheFile);
+    std::swap(m_pCacheVertexBuffer, other.m_pCacheVertexBuffer);
+    std::swap(m_pCacheIndexBuffer, other.m_pCacheIndexBuffer);
+    std::swap(m_numberOfCacheVertices, other.m_numberOfCacheVertices);
 }
 
 void ModelOBJ::scale(float scaleFactor, float offset[3])
 {
+    Vertex *pVertices = vertexBuffer();
     float *pPosition = 0;
 
-    for (int i = 0; i < static_cast<int>(m_vertexBuffer.size()); ++i)
+    for (int i = 0; i < static_cast<int>(m_lods.size()); ++i)
+        m_lods[i].error *= fabsf(scaleFactor);
+
+    if (m_vertexStorage == STORAGE_SOA)
+    {
+        ScaleStream(vertexStream(COMPONENT_POSITION_X), getNumberOfVertices(), offset[0], scaleFactor);
+        ScaleStream(vertexStream(COMPONENT_POSITION_Y), getNumberOfVertices(), offset[1], scaleFactor);
+        ScaleStream(vertexStream(COMPONENT_POSITION_Z), getNumberOfVertices(), offset[2], scaleFactor);
+        return;
+    }
+
+    for (int i = 0; i < getNumberOfVertices(); ++i)
     {
-        pPosition = m_vertexBuffer[i].position;
+        pPosition = pVertices[i].position;
 
         pPosition[0] += offset[0];
         pPosition[1] += offset[1];
@@ -302,6 +6556,74 @@ void ModelOBJ::scale(float scaleFactor, float offset[3])
     }
 }
 
+void ModelOBJ::recordMemoryStats()
+{
+    // The buffers only ever grow during an import, so their capacities at
+    // the end of the import are their peak sizes.
+
+    m_importStats.vertexBufferBytes = m_vertexBuffer.capacity() * sizeof(Vertex);
+    m_importStats.indexBufferBytes = m_indexBuffer.capacity() * sizeof(int);
+    m_importStats.attributeBufferBytes = (m_attributeBuffer.capacity() + m_groupBuffer.capacity()) * sizeof(int);
+    m_importStats.vertexCoordBytes = m_vertexCoords.capacity() * sizeof(float);
+    m_importStats.textureCoordBytes = m_textureCoords.capacity() * sizeof(float);
+    m_importStats.normalBytes = m_normals.capacity() * sizeof(float);
+
+    m_importStats.vertexCacheBytes = m_vertexCache.capacity() * sizeof(VertexCacheEntry);
+    m_importStats.vertexCacheBytes += m_texCoordCache.capacity() * sizeof(int);
+    m_importStats.vertexCacheBytes += m_texCoordClasses.capacity() * sizeof(int);
+    m_importStats.vertexCacheBytes += m_normalCache.capacity() * sizeof(int);
+    m_importStats.vertexCacheBytes += m_normalClasses.capacity() * sizeof(int);
+}
+
+void ModelOBJ::addDefaultMaterial()
+{
+    Material defaultMaterial =
+    {
+        0.2f, 0.2f, 0.2f, 1.0f,
+        0.8f, 0.8f, 0.8f, 1.0f,
+        0.0f, 0.0f, 0.0f, 1.0f,
+        0.0f,
+        1.0f,
+        std::string("default"),
+        std::string(),
+        std::string()
+    };
+
+    m_materials.push_back(defaultMaterial);
+    m_materialCache[defaultMaterial.name] = 0;
+}
+
+int ModelOBJ::addGroup(const std::string &object, const std::string &group)
+{
+    // Returns the group that faces following 'o object' and 'g group' go
+    // in, adding it the first time it's used. A named group in an object is
+    // added after the object, so parents always come before their children.
+    // An empty group name means the object itself.
+
+    if (object.empty() && group.empty())
+        return addGroup(object, "default");
+
+    std::string key = object + '\n' + group;
+    std::map<std::string, int>::const_iterator iter = m_groupCache.find(key);
+
+    if (iter != m_groupCache.end())
+        return iter->second;
+
+    Group newGroup;
+
+    newGroup.name = group.empty() ? object : group;
+    newGroup.parent = (object.empty() || group.empty()) ? -1 : addGroup(object, std::string());
+    newGroup.childCount = 0;
+    newGroup.startIndex = 0;
+    newGroup.triangleCount = 0;
+    newGroup.firstMesh = 0;
+    newGroup.meshCount = 0;
+
+    m_groups.push_back(newGroup);
+    m_groupCache[key] = static_cast<int>(m_groups.size()) - 1;
+    return static_cast<int>(m_groups.size()) - 1;
+}
+
 void ModelOBJ::addTrianglePos(int index, int material, int v0, int v1, int v2)
 {
     Vertex vertex =
@@ -316,22 +6638,28 @@ void ModelOBJ::addTrianglePos(int index, int material, int v0, int v1, int v2)
     vertex.position[0] = m_vertexCoords[v0 * 3];
     vertex.position[1] = m_vertexCoords[v0 * 3 + 1];
     vertex.position[2] = m_vertexCoords[v0 * 3 + 2];
-    m_indexBuffer[index * 3] = addVertex(v0, &vertex);
+    m_indexBuffer[index * 3] = addVertex(v0, -1, -1, &vertex);
 
     vertex.position[0] = m_vertexCoords[v1 * 3];
     vertex.position[1] = m_vertexCoords[v1 * 3 + 1];
     vertex.position[2] = m_vertexCoords[v1 * 3 + 2];
-    m_indexBuffer[index * 3 + 1] = addVertex(v1, &vertex);
+    m_indexBuffer[index * 3 + 1] = addVertex(v1, -1, -1, &vertex);
 
     vertex.position[0] = m_vertexCoords[v2 * 3];
     vertex.position[1] = m_vertexCoords[v2 * 3 + 1];
     vertex.position[2] = m_vertexCoords[v2 * 3 + 2];
-    m_indexBuffer[index * 3 + 2] = addVertex(v2, &vertex);
+    m_indexBuffer[index * 3 + 2] = addVertex(v2, -1, -1, &vertex);
 }
 
 void ModelOBJ::addTrianglePosNormal(int index, int material, int v0, int v1,
                                     int v2, int vn0, int vn1, int vn2)
 {
+    if (!(m_vertexAttributes & ATTRIBUTE_NORMAL))
+    {
+        addTrianglePos(index, material, v0, v1, v2);
+        return;
+    }
+
     Vertex vertex =
     {
         0.0f, 0.0f, 0.0f,
@@ -348,7 +6676,7 @@ void ModelOBJ::addTrianglePosNormal(int index, int material, int v0, int v1,
     vertex.normal[0] = m_normals[vn0 * 3];
     vertex.normal[1] = m_normals[vn0 * 3 + 1];
     vertex.normal[2] = m_normals[vn0 * 3 + 2];
-    m_indexBuffer[index * 3] = addVertex(v0, &vertex);
+    m_indexBuffer[index * 3] = addVertex(v0, -1, vn0, &vertex);
 
     vertex.position[0] = m_vertexCoords[v1 * 3];
     vertex.position[1] = m_vertexCoords[v1 * 3 + 1];
@@ -356,7 +6684,7 @@ void ModelOBJ::addTrianglePosNormal(int index, int material, int v0, int v1,
     vertex.normal[0] = m_normals[vn1 * 3];
     vertex.normal[1] = m_normals[vn1 * 3 + 1];
     vertex.normal[2] = m_normals[vn1 * 3 + 2];
-    m_indexBuffer[index * 3 + 1] = addVertex(v1, &vertex);
+    m_indexBuffer[index * 3 + 1] = addVertex(v1, -1, vn1, &vertex);
 
     vertex.position[0] = m_vertexCoords[v2 * 3];
     vertex.position[1] = m_vertexCoords[v2 * 3 + 1];
@@ -364,147 +6692,548 @@ void ModelOBJ::addTrianglePosNormal(int index, int material, int v0, int v1,
     vertex.normal[0] = m_normals[vn2 * 3];
     vertex.normal[1] = m_normals[vn2 * 3 + 1];
     vertex.normal[2] = m_normals[vn2 * 3 + 2];
-    m_indexBuffer[index * 3 + 2] = addVertex(v2, &vertex);
+    m_indexBuffer[index * 3 + 2] = addVertex(v2, -1, vn2, &vertex);
 }
 
 void ModelOBJ::addTrianglePosTexCoord(int index, int material, int v0, int v1,
                                       int v2, int vt0, int vt1, int vt2)
 {
+    if (!(m_vertexAttributes & ATTRIBUTE_TEXCOORD))
+    {
+        addTrianglePos(index, material, v0, v1, v2);
+        return;
+    }
+
+    Vertex vertex =
+    {
+        0.0f, 0.0f, 0.0f,
+        0.0f, 0.0f,
+        0.0f, 0.0f, 0.0f,
+        0.0f, 0.0f, 0.0f
+    };
+
+    m_attributeBuffer[index] = material;
+
+    vertex.position[0] = m_vertexCoords[v0 * 3];
+    vertex.position[1] = m_vertexCoords[v0 * 3 + 1];
+    vertex.position[2] = m_vertexCoords[v0 * 3 + 2];
+    vertex.texCoord[0] = m_textureCoords[vt0 * 2];
+    vertex.texCoord[1] = m_textureCoords[vt0 * 2 + 1];
+    m_indexBuffer[index * 3] = addVertex(v0, vt0, -1, &vertex);
+
+    vertex.position[0] = m_vertexCoords[v1 * 3];
+    vertex.position[1] = m_vertexCoords[v1 * 3 + 1];
+    vertex.position[2] = m_vertexCoords[v1 * 3 + 2];
+    vertex.texCoord[0] = m_textureCoords[vt1 * 2];
+    vertex.texCoord[1] = m_textureCoords[vt1 * 2 + 1];
+    m_indexBuffer[index * 3 + 1] = addVertex(v1, vt1, -1, &vertex);
+
+    vertex.position[0] = m_vertexCoords[v2 * 3];
+    vertex.position[1] = m_vertexCoords[v2 * 3 + 1];
+    vertex.position[2] = m_vertexCoords[v2 * 3 + 2];
+    vertex.texCoord[0] = m_textureCoords[vt2 * 2];
+    vertex.texCoord[1] = m_textureCoords[vt2 * 2 + 1];
+    m_indexBuffer[index * 3 + 2] = addVertex(v2, vt2, -1, &vertex);
+}
+
+void ModelOBJ::addTrianglePosTexCoordNormal(int index, int material, int v0,
+                                            int v1, int v2, int vt0, int vt1,
+                                            int vt2, int vn0, int vn1, int vn2)
+{
+    if (!(m_vertexAttributes & ATTRIBUTE_TEXCOORD))
+    {
+        addTrianglePosNormal(index, material, v0, v1, v2, vn0, vn1, vn2);
+        return;
+    }
+
+    if (!(m_vertexAttributes & ATTRIBUTE_NORMAL))
+    {
+        addTrianglePosTexCoord(index, material, v0, v1, v2, vt0, vt1, vt2);
+        return;
+    }
+
     Vertex vertex =
     {
-        0.0f, 0.0f, 0.0f,
-        0.0f, 0.0f,
-        0.0f, 0.0f, 0.0f,
-        0.0f, 0.0f, 0.0f
-    };
+        0.0f, 0.0f, 0.0f,
+        0.0f, 0.0f,
+        0.0f, 0.0f, 0.0f,
+        0.0f, 0.0f, 0.0f
+    };
+
+    m_attributeBuffer[index] = material;
+
+    vertex.position[0] = m_vertexCoords[v0 * 3];
+    vertex.position[1] = m_vertexCoords[v0 * 3 + 1];
+    vertex.position[2] = m_vertexCoords[v0 * 3 + 2];
+    vertex.texCoord[0] = m_textureCoords[vt0 * 2];
+    vertex.texCoord[1] = m_textureCoords[vt0 * 2 + 1];
+    vertex.normal[0] = m_normals[vn0 * 3];
+    vertex.normal[1] = m_normals[vn0 * 3 + 1];
+    vertex.normal[2] = m_normals[vn0 * 3 + 2];
+    m_indexBuffer[index * 3] = addVertex(v0, vt0, vn0, &vertex);
+
+    vertex.position[0] = m_vertexCoords[v1 * 3];
+    vertex.position[1] = m_vertexCoords[v1 * 3 + 1];
+    vertex.position[2] = m_vertexCoords[v1 * 3 + 2];
+    vertex.texCoord[0] = m_textureCoords[vt1 * 2];
+    vertex.texCoord[1] = m_textureCoords[vt1 * 2 + 1];
+    vertex.normal[0] = m_normals[vn1 * 3];
+    vertex.normal[1] = m_normals[vn1 * 3 + 1];
+    vertex.normal[2] = m_normals[vn1 * 3 + 2];
+    m_indexBuffer[index * 3 + 1] = addVertex(v1, vt1, vn1, &vertex);
+
+    vertex.position[0] = m_vertexCoords[v2 * 3];
+    vertex.position[1] = m_vertexCoords[v2 * 3 + 1];
+    vertex.position[2] = m_vertexCoords[v2 * 3 + 2];
+    vertex.texCoord[0] = m_textureCoords[vt2 * 2];
+    vertex.texCoord[1] = m_textureCoords[vt2 * 2 + 1];
+    vertex.normal[0] = m_normals[vn2 * 3];
+    vertex.normal[1] = m_normals[vn2 * 3 + 1];
+    vertex.normal[2] = m_normals[vn2 * 3 + 2];
+    m_indexBuffer[index * 3 + 2] = addVertex(v2, vt2, vn2, &vertex);
+}
+
+int ModelOBJ::addVertex(int v, int vt, int vn, const Vertex *pVertex)
+{
+    // Vertices are welded when they share a position index and their texture
+    // coordinates and normals are bitwise identical. This is the same test
+    // as comparing the whole Vertex structures. The texture coordinate and
+    // normal indices are first mapped to the first index holding the same
+    // value, so that the cache can be keyed on an index triple alone.
+
+    int texCoord = -1;
+    int normal = -1;
+
+    if (vt >= 0)
+    {
+        int &texCoordClass = m_texCoordClasses[vt];
+
+        if (texCoordClass == -2)
+            texCoordClass = FindAttributeClass(m_textureCoords, 2, vt, m_texCoordCache);
+
+        texCoord = texCoordClass;
+    }
+
+    if (vn >= 0)
+    {
+        int &normalClass = m_normalClasses[vn];
+
+        if (normalClass == -2)
+            normalClass = FindAttributeClass(m_normals, 3, vn, m_normalCache);
+
+        normal = normalClass;
+    }
+
+    // Keep the load factor of the cache below 70%.
+    if ((m_vertexBuffer.size() + 1) * 10 > m_vertexCache.size() * 7)
+        growVertexCache();
+
+    unsigned int mask = static_cast<unsigned int>(m_vertexCache.size()) - 1;
+    unsigned int slot = HashVertex(v, texCoord, normal) & mask;
+    int probeLength = 0;
+
+    ++m_importStats.vertexLookups;
+
+    while (true)
+    {
+        VertexCacheEntry &entry = m_vertexCache[slot];
+
+        if (entry.index == -1)
+        {
+            // Vertex doesn't exist in the cache.
+
+            entry.position = v;
+            entry.texCoord = texCoord;
+            entry.normal = normal;
+            entry.index = static_cast<int>(m_vertexBuffer.size());
+            m_vertexBuffer.push_back(*pVertex);
+            break;
+        }
+
+        if (entry.position == v && entry.texCoord == texCoord && entry.normal == normal)
+        {
+            ++m_importStats.vertexHits;
+            break;
+        }
+
+        slot = (slot + 1) & mask;
+        ++probeLength;
+    }
+
+    m_importStats.cacheProbes += probeLength;
+    m_importStats.maxProbeLength = std::max(m_importStats.maxProbeLength, probeLength);
+    return m_vertexCache[slot].index;
+}
+
+void ModelOBJ::initVertexCache(int numTriangles)
+{
+    // Size the vertex cache from the face count. Closed meshes have about
+    // half as many vertices as triangles, so this rarely needs to grow. The
+    // attribute class tables never grow since each attribute is inserted at
+    // most once.
+
+    VertexCacheEntry empty = {-1, -1, -1, -1};
+
+    m_vertexCache.assign(NextPowerOfTwo(std::max(numTriangles, 64)), empty);
+
+    m_texCoordClasses.assign(m_numberOfTextureCoords, -2);
+    m_texCoordCache.assign(NextPowerOfTwo(std::max(m_numberOfTextureCoords * 2, 16)), -1);
+
+    m_normalClasses.assign(m_numberOfNormals, -2);
+    m_normalCache.assign(NextPowerOfTwo(std::max(m_numberOfNormals * 2, 16)), -1);
+}
+
+void ModelOBJ::growVertexCache()
+{
+    VertexCacheEntry empty = {-1, -1, -1, -1};
+    std::vector<VertexCacheEntry> oldCache(m_vertexCache.size() * 2, empty);
+
+    oldCache.swap(m_vertexCache);
+
+    unsigned int mask = static_cast<unsigned int>(m_vertexCache.size()) - 1;
+    unsigned int slot = 0;
+
+    for (int i = 0; i < static_cast<int>(oldCache.size()); ++i)
+    {
+        const VertexCacheEntry &entry = oldCache[i];
+
+        if (entry.index == -1)
+            continue;
+
+        slot = HashVertex(entry.position, entry.texCoord, entry.normal) & mask;
+
+        while (m_vertexCache[slot].index != -1)
+            slot = (slot + 1) & mask;
+
+        m_vertexCache[slot] = entry;
+    }
+}
+
+void ModelOBJ::weldVertices(const std::vector<int> &corners, int numThreads)
+{
+    // Sort based alternative to addVertex(). 'corners' holds a (v, vt, vn)
+    // index triple for each triangle corner, with -1 for missing indices.
+    // Every corner is given a key of its position index and its texture
+    // coordinate and normal classes (see addVertex()). The keys are radix
+    // sorted so that equal corners end up next to each other. The sort is
+    // stable, so the first corner of each run of equal keys is the corner
+    // that addVertex() would have created the vertex for. Numbering these
+    // corners in corner order gives the same vertex and index buffers as
+    // the hash based path, but every step runs in parallel.
+
+    const int minCornersPerTask = 64 * 1024;
+    int numCorners = static_cast<int>(corners.size() / 3);
+    int numTasks = std::max(1, std::min(numThreads, numCorners / minCornersPerTask));
+
+    // Map the texture coordinates and normals to their classes.
+
+    std::vector<int> texCoordClasses(m_numberOfTextureCoords);
+    std::vector<int> normalClasses(m_numberOfNormals);
+    std::vector<int> table;
+
+    table.assign(NextPowerOfTwo(std::max(m_numberOfTextureCoords * 2, 16)), -1);
+
+    for (int i = 0; i < m_numberOfTextureCoords; ++i)
+        texCoordClasses[i] = FindAttributeClass(m_textureCoords, 2, i, table);
+
+    table.assign(NextPowerOfTwo(std::max(m_numberOfNormals * 2, 16)), -1);
+
+    for (int i = 0; i < m_numberOfNormals; ++i)
+        normalClasses[i] = FindAttributeClass(m_normals, 3, i, table);
+
+    std::vector<int>().swap(table);
+
+    // Build the keys. Classes are offset by one so that missing and all zero
+    // attributes get the key 0.
+
+    std::vector<unsigned int> keys(numCorners * 3);
+    std::vector<unsigned int> maxKeys(numTasks * 3, 0);
+
+    RunTasks(numTasks, [&](int task)
+    {
+        unsigned int *pMaxKeys = &maxKeys[task * 3];
+        const int *pCorner = 0;
+        int begin = 0;
+        int end = 0;
+
+        GetTaskRange(numCorners, task, numTasks, begin, end);
+
+        for (int i = begin; i < end; ++i)
+        {
+            pCorner = &corners[i * 3];
+            keys[i * 3] = static_cast<unsigned int>(pCorner[0]);
+            keys[i * 3 + 1] = (pCorner[1] < 0) ? 0 : static_cast<unsigned int>(texCoordClasses[pCorner[1]] + 1);
+            keys[i * 3 + 2] = (pCorner[2] < 0) ? 0 : static_cast<unsigned int>(normalClasses[pCorner[2]] + 1);
+
+            for (int j = 0; j < 3; ++j)
+                pMaxKeys[j] = std::max(pMaxKeys[j], keys[i * 3 + j]);
+        }
+    });
+
+    // Sort on the normal, then the texture coordinate, then the position.
+    // Only the bits actually used by each key are sorted on.
+
+    std::vector<SortItem> items(numCorners);
+    std::vector<SortItem> scratch(numCorners);
+
+    for (int i = 0; i < numCorners; ++i)
+        items[i].corner = i;
+
+    for (int field = 2; field >= 0; --field)
+    {
+        unsigned int maxKey = 0;
+        int numBits = 0;
+
+        for (int task = 0; task < numTasks; ++task)
+            maxKey = std::max(maxKey, maxKeys[task * 3 + field]);
+
+        while (numBits < 32 && (maxKey >> numBits) != 0)
+            ++numBits;
+
+        if (numBits == 0)
+            continue;
+
+        RunTasks(numTasks, [&](int task)
+        {
+            int begin = 0;
+            int end = 0;
+
+            GetTaskRange(numCorners, task, numTasks, begin, end);
+
+            for (int i = begin; i < end; ++i)
+                items[i].key = keys[items[i].corner * 3 + field];
+        });
+
+        for (int shift = 0; shift < numBits; shift += RADIX_BITS)
+        {
+            RadixSortPass(&items[0], &scratch[0], numCorners, shift, numTasks);
+            items.swap(scratch);
+        }
+    }
+
+    std::vector<SortItem>().swap(scratch);
+
+    // Flag the first corner of each run of equal keys, then number the
+    // flagged corners in corner order. Unflagged corners are set to -1.
+
+    std::vector<int> vertexIds(numCorners, -1);
+    std::vector<int> counts(numTasks, 0);
+
+    RunTasks(numTasks, [&](int task)
+    {
+        const unsigned int *pKey = 0;
+        const unsigned int *pPrevKey = 0;
+        int begin = 0;
+        int end = 0;
+
+        GetTaskRange(numCorners, task, numTasks, begin, end);
+
+        for (int i = begin; i < end; ++i)
+        {
+            pKey = &keys[items[i].corner * 3];
+
+            if (i == 0)
+            {
+                vertexIds[items[i].corner] = 0;
+                continue;
+            }
+
+            pPrevKey = &keys[items[i - 1].corner * 3];
+
+            if (pKey[0] != pPrevKey[0] || pKey[1] != pPrevKey[1] || pKey[2] != pPrevKey[2])
+                vertexIds[items[i].corner] = 0;
+        }
+    });
+
+    RunTasks(numTasks, [&](int task)
+    {
+        int begin = 0;
+        int end = 0;
+
+        GetTaskRange(numCorners, task, numTasks, begin, end);
+
+        for (int i = begin; i < end; ++i)
+        {
+            if (vertexIds[i] == 0)
+                ++counts[task];
+        }
+    });
+
+    int numVertices = 0;
+
+    for (int task = 0; task < numTasks; ++task)
+    {
+        int count = counts[task];
+
+        counts[task] = numVertices;
+        numVertices += count;
+    }
+
+    RunTasks(numTasks, [&](int task)
+    {
+        int next = counts[task];
+        int begin = 0;
+        int end = 0;
+
+        GetTaskRange(numCorners, task, numTasks, begin, end);
+
+        for (int i = begin; i < end; ++i)
+        {
+            if (vertexIds[i] == 0)
+                vertexIds[i] = next++;
+        }
+    });
+
+    // Every corner in a run uses the vertex of the run's first corner.
+
+    RunTasks(numTasks, [&](int task)
+    {
+        int begin = 0;
+        int end = 0;
+        int first = 0;
+        int vertexId = 0;
 
-    m_attributeBuffer[index] = material;
+        GetTaskRange(numCorners, task, numTasks, begin, end);
 
-    vertex.position[0] = m_vertexCoords[v0 * 3];
-    vertex.position[1] = m_vertexCoords[v0 * 3 + 1];
-    vertex.position[2] = m_vertexCoords[v0 * 3 + 2];
-    vertex.texCoord[0] = m_textureCoords[vt0 * 2];
-    vertex.texCoord[1] = m_textureCoords[vt0 * 2 + 1];
-    m_indexBuffer[index * 3] = addVertex(v0, &vertex);
+        if (begin == end)
+            return;
 
-    vertex.position[0] = m_vertexCoords[v1 * 3];
-    vertex.position[1] = m_vertexCoords[v1 * 3 + 1];
-    vertex.position[2] = m_vertexCoords[v1 * 3 + 2];
-    vertex.texCoord[0] = m_textureCoords[vt1 * 2];
-    vertex.texCoord[1] = m_textureCoords[vt1 * 2 + 1];
-    m_indexBuffer[index * 3 + 1] = addVertex(v1, &vertex);
+        for (first = begin; vertexIds[items[first].corner] == -1; --first)
+            ;
 
-    vertex.position[0] = m_vertexCoords[v2 * 3];
-    vertex.position[1] = m_vertexCoords[v2 * 3 + 1];
-    vertex.position[2] = m_vertexCoords[v2 * 3 + 2];
-    vertex.texCoord[0] = m_textureCoords[vt2 * 2];
-    vertex.texCoord[1] = m_textureCoords[vt2 * 2 + 1];
-    m_indexBuffer[index * 3 + 2] = addVertex(v2, &vertex);
-}
+        vertexId = vertexIds[items[first].corner];
 
-void ModelOBJ::addTrianglePosTexCoordNormal(int index, int material, int v0,
-                                            int v1, int v2, int vt0, int vt1,
-                                            int vt2, int vn0, int vn1, int vn2)
-{
-    Vertex vertex =
+        for (int i = begin; i < end; ++i)
+        {
+            if (vertexIds[items[i].corner] != -1)
+                vertexId = vertexIds[items[i].corner];
+
+            m_indexBuffer[items[i].corner] = vertexId;
+        }
+    });
+
+    m_importStats.vertexLookups += numCorners;
+    m_importStats.vertexHits += numCorners - numVertices;
+
+    // Build the vertices from their first corners.
+
+    m_vertexBuffer.resize(numVertices);
+
+    RunTasks(numTasks, [&](int task)
     {
-        0.0f, 0.0f, 0.0f,
-        0.0f, 0.0f,
-        0.0f, 0.0f, 0.0f,
-        0.0f, 0.0f, 0.0f
-    };
+        const int *pCorner = 0;
+        int begin = 0;
+        int end = 0;
 
-    m_attributeBuffer[index] = material;
+        GetTaskRange(numCorners, task, numTasks, begin, end);
 
-    vertex.position[0] = m_vertexCoords[v0 * 3];
-    vertex.position[1] = m_vertexCoords[v0 * 3 + 1];
-    vertex.position[2] = m_vertexCoords[v0 * 3 + 2];
-    vertex.texCoord[0] = m_textureCoords[vt0 * 2];
-    vertex.texCoord[1] = m_textureCoords[vt0 * 2 + 1];
-    vertex.normal[0] = m_normals[vn0 * 3];
-    vertex.normal[1] = m_normals[vn0 * 3 + 1];
-    vertex.normal[2] = m_normals[vn0 * 3 + 2];
-    m_indexBuffer[index * 3] = addVertex(v0, &vertex);
+        for (int i = begin; i < end; ++i)
+        {
+            if (vertexIds[i] == -1)
+                continue;
 
-    vertex.position[0] = m_vertexCoords[v1 * 3];
-    vertex.position[1] = m_vertexCoords[v1 * 3 + 1];
-    vertex.position[2] = m_vertexCoords[v1 * 3 + 2];
-    vertex.texCoord[0] = m_textureCoords[vt1 * 2];
-    vertex.texCoord[1] = m_textureCoords[vt1 * 2 + 1];
-    vertex.normal[0] = m_normals[vn1 * 3];
-    vertex.normal[1] = m_normals[vn1 * 3 + 1];
-    vertex.normal[2] = m_normals[vn1 * 3 + 2];
-    m_indexBuffer[index * 3 + 1] = addVertex(v1, &vertex);
+            Vertex &vertex = m_vertexBuffer[vertexIds[i]];
 
-    vertex.position[0] = m_vertexCoords[v2 * 3];
-    vertex.position[1] = m_vertexCoords[v2 * 3 + 1];
-    vertex.position[2] = m_vertexCoords[v2 * 3 + 2];
-    vertex.texCoord[0] = m_textureCoords[vt2 * 2];
-    vertex.texCoord[1] = m_textureCoords[vt2 * 2 + 1];
-    vertex.normal[0] = m_normals[vn2 * 3];
-    vertex.normal[1] = m_normals[vn2 * 3 + 1];
-    vertex.normal[2] = m_normals[vn2 * 3 + 2];
-    m_indexBuffer[index * 3 + 2] = addVertex(v2, &vertex);
+            pCorner = &corners[i * 3];
+            memset(&vertex, 0, sizeof(Vertex));
+            memcpy(vertex.position, &m_vertexCoords[pCorner[0] * 3], sizeof(vertex.position));
+
+            if (pCorner[1] >= 0)
+                memcpy(vertex.texCoord, &m_textureCoords[pCorner[1] * 2], sizeof(vertex.texCoord));
+
+            if (pCorner[2] >= 0)
+                memcpy(vertex.normal, &m_normals[pCorner[2] * 3], sizeof(vertex.normal));
+        }
+    });
 }
 
-int ModelOBJ::addVertex(int hash, const Vertex *pVertex)
+void ModelOBJ::buildGroups(int numThreads)
 {
-    int index = -1;
-    std::map<int, std::vector<int> >::const_iterator iter = m_vertexCache.find(hash);
+    // Puts each object before its groups, drops the groups without
+    // triangles, and sorts the triangles by group. The triangles of a group
+    // and of its children are then consecutive. Files that list each group's
+    // faces together are usually in order already.
+
+    int numGroups = static_cast<int>(m_groups.size());
+    std::vector<int> ownCounts(numGroups, 0);
+    std::vector<int> order;
+    std::vector<int> ranks(numGroups, -1);
+
+    for (int i = 0; i < m_numberOfTriangles; ++i)
+        ++ownCounts[m_groupBuffer[i]];
+
+    // Add each group's triangles to its object.
+
+    std::vector<int> counts(ownCounts);
 
-    if (iter == m_vertexCache.end())
+    for (int i = numGroups - 1; i >= 0; --i)
     {
-        // Vertex hash doesn't exist in the cache.
+        if (m_groups[i].parent >= 0)
+            counts[m_groups[i].parent] += counts[i];
+    }
 
-        index = static_cast<int>(m_vertexBuffer.size());
-        m_vertexBuffer.push_back(*pVertex);
-        m_vertexCache.insert(std::make_pair(hash, std::vector<int>(1, index)));
+    for (int i = 0; i < numGroups; ++i)
+    {
+        if (counts[i] > 0)
+            order.push_back(i);
     }
-    else
+
+    std::sort(order.begin(), order.end(), [this](int lhs, int rhs)
     {
-        // One or more vertices have been hashed to this entry in the cache.
+        int lhsObject = (m_groups[lhs].parent >= 0) ? m_groups[lhs].parent : lhs;
+        int rhsObject = (m_groups[rhs].parent >= 0) ? m_groups[rhs].parent : rhs;
 
-        const std::vector<int> &vertices = iter->second;
-        const Vertex *pCachedVertex = 0;
-        bool found = false;
+        return (lhsObject != rhsObject) ? lhsObject < rhsObject : lhs < rhs;
+    });
 
-        for (std::vector<int>::const_iterator i = vertices.begin(); i != vertices.end(); ++i)
-        {
-            index = *i;
-            pCachedVertex = &m_vertexBuffer[index];
+    std::vector<Group> groups(order.size());
 
-            if (memcmp(pCachedVertex, pVertex, sizeof(Vertex)) == 0)
-            {
-                found = true;
-                break;
-            }
-        }
+    for (int i = 0, startIndex = 0; i < static_cast<int>(order.size()); ++i)
+    {
+        Group &group = groups[i];
 
-        if (!found)
+        ranks[order[i]] = i;
+        group = m_groups[order[i]];
+
+        if (group.parent >= 0)
         {
-            index = static_cast<int>(m_vertexBuffer.size());
-            m_vertexBuffer.push_back(*pVertex);
-            m_vertexCache[hash].push_back(index);
+            group.parent = ranks[group.parent];
+            ++groups[group.parent].childCount;
         }
+
+        group.startIndex = startIndex;
+        group.triangleCount = counts[order[i]];
+        startIndex += ownCounts[order[i]] * 3;
     }
 
-    return index;
+    m_groups.swap(groups);
+    numGroups = static_cast<int>(m_groups.size());
+
+    for (int i = 0; i < m_numberOfTriangles; ++i)
+        m_groupBuffer[i] = ranks[m_groupBuffer[i]];
+
+    if (!std::is_sorted(m_groupBuffer.begin(), m_groupBuffer.end()))
+        sortTriangles(m_groupBuffer, numGroups, numThreads);
 }
 
 void ModelOBJ::buildMeshes()
 {
-    // Group the model's triangles based on material type.
+    // Group the model's triangles based on material type. Keeping groups
+    // also starts a new mesh wherever the group changes.
 
     Mesh *pMesh = 0;
+    bool hasGroups = !m_groups.empty();
     int materialId = -1;
+    int groupId = -1;
     int numMeshes = 0;
 
     // Count the number of meshes.
     for (int i = 0; i < static_cast<int>(m_attributeBuffer.size()); ++i)
     {
-        if (m_attributeBuffer[i] != materialId)
+        if (m_attributeBuffer[i] != materialId || (hasGroups && m_groupBuffer[i] != groupId))
         {
             materialId = m_attributeBuffer[i];
+            groupId = hasGroups ? m_groupBuffer[i] : -1;
             ++numMeshes;
         }
     }
@@ -514,13 +7243,15 @@ void ModelOBJ::buildMeshes()
     m_meshes.resize(m_numberOfMeshes);
     numMeshes = 0;
     materialId = -1;
+    groupId = -1;
 
     // Build the meshes. One mesh for each unique material.
     for (int i = 0; i < static_cast<int>(m_attributeBuffer.size()); ++i)
     {
-        if (m_attributeBuffer[i] != materialId)
+        if (m_attributeBuffer[i] != materialId || (hasGroups && m_groupBuffer[i] != groupId))
         {
             materialId = m_attributeBuffer[i];
+            groupId = hasGroups ? m_groupBuffer[i] : -1;
             pMesh = &m_meshes[numMeshes++];            
             pMesh->pMaterial = &m_materials[materialId];
             pMesh->startIndex = i * 3;
@@ -534,259 +7265,483 @@ void ModelOBJ::buildMeshes()
 
     // Sort the meshes based on its material alpha. Fully opaque meshes
     // towards the front and fully transparent towards the back.
-    std::sort(m_meshes.begin(), m_meshes.end(), MeshCompFunc);
+    if (!hasGroups)
+    {
+        std::sort(m_meshes.begin(), m_meshes.end(), MeshCompFunc);
+        return;
+    }
+
+    // With groups the meshes are sorted by group first, and then by alpha
+    // within each group. The meshes of a group and of its children are
+    // then consecutive.
+
+    const int *pGroups = &m_groupBuffer[0];
+
+    std::sort(m_meshes.begin(), m_meshes.end(), [pGroups](const Mesh &lhs, const Mesh &rhs)
+    {
+        int lhsGroup = pGroups[lhs.startIndex / 3];
+        int rhsGroup = pGroups[rhs.startIndex / 3];
+
+        return (lhsGroup != rhsGroup) ? lhsGroup < rhsGroup : MeshCompFunc(lhs, rhs);
+    });
+
+    for (int i = 0; i < static_cast<int>(m_groups.size()); ++i)
+    {
+        m_groups[i].firstMesh = -1;
+        m_groups[i].meshCount = 0;
+    }
+
+    for (int i = m_numberOfMeshes - 1; i >= 0; --i)
+    {
+        Group &group = m_groups[pGroups[m_meshes[i].startIndex / 3]];
+
+        group.firstMesh = i;
+        ++group.meshCount;
+    }
+
+    // An object without faces of its own starts at its first group's
+    // meshes. Children follow their parents, so walking backwards adds up
+    // each group's meshes before they're added to its parent.
+
+    for (int i = static_cast<int>(m_groups.size()) - 1; i >= 0; --i)
+    {
+        Group &group = m_groups[i];
+
+        if (group.firstMesh < 0)
+            group.firstMesh = m_groups[i + 1].firstMesh;
+
+        if (group.parent >= 0)
+            m_groups[group.parent].meshCount += group.meshCount;
+    }
 }
 
-void ModelOBJ::generateNormals()
+void ModelOBJ::buildMeshlets(int maxVertices, int maxTriangles, int numThreads)
 {
-    const int *pTriangle = 0;
-    Vertex *pVertex0 = 0;
-    Vertex *pVertex1 = 0;
-    Vertex *pVertex2 = 0;
-    float edge1[3] = {0.0f, 0.0f, 0.0f};
-    float edge2[3] = {0.0f, 0.0f, 0.0f};
-    float normal[3] = {0.0f, 0.0f, 0.0f};
-    float length = 0.0f;
-    int totalVertices = getNumberOfVertices();
-    int totalTriangles = getNumberOfTriangles();
+    // Each mesh is split into blocks of MESHLET_BLOCK_TRIANGLES triangles,
+    // which the threads partition independently. Meshlets never cross a
+    // block, and they're listed in mesh order and then index buffer order.
+
+    std::vector<MeshletBlock> blocks;
+
+    maxVertices = std::max(maxVertices, 3);
+    maxTriangles = std::max(maxTriangles, 1);
+
+    for (int i = 0; i < m_numberOfMeshes; ++i)
+    {
+        const Mesh &mesh = m_meshes[i];
+
+        for (int j = 0; j < mesh.triangleCount; j += MESHLET_BLOCK_TRIANGLES)
+        {
+            MeshletBlock block = {i, mesh.startIndex + j * 3,
+                                  std::min(mesh.triangleCount - j, MESHLET_BLOCK_TRIANGLES)};
+
+            blocks.push_back(block);
+        }
+    }
+
+    int numBlocks = static_cast<int>(blocks.size());
+    int numTasks = std::max(1, std::min(numThreads, numBlocks));
+    int numVertices = getNumberOfVertices();
+    int *pIndices = indexBuffer();
+    std::vector<std::vector<MeshletRange> > ranges(numBlocks);
+    std::atomic<int> nextBlock(0);
+
+    RunTasks(numTasks, [&](int /*task*/)
+    {
+        MeshletScratch scratch;
+        int block = 0;
+
+        scratch.localIndex.assign(numVertices, -1);
+
+        while ((block = nextBlock++) < numBlocks)
+        {
+            PartitionMeshlets(pIndices + blocks[block].startIndex, blocks[block].triangleCount,
+                              maxVertices, maxTriangles, scratch, ranges[block]);
+        }
+    });
+
+    m_meshlets.clear();
+
+    for (int i = 0; i < numBlocks; ++i)
+    {
+        for (int j = 0; j < static_cast<int>(ranges[i].size()); ++j)
+        {
+            const MeshletRange &range = ranges[i][j];
+            Meshlet meshlet;
+
+            memset(&meshlet, 0, sizeof(meshlet));
+            meshlet.mesh = blocks[i].mesh;
+            meshlet.startIndex = blocks[i].startIndex + range.startTriangle * 3;
+            meshlet.triangleCount = range.triangleCount;
+            meshlet.vertexCount = range.vertexCount;
+            m_meshlets.push_back(meshlet);
+        }
+    }
+
+    computeMeshletBounds(numThreads);
+}
+
+void ModelOBJ::generateLods(const std::vector<float> &ratios)
+{
+    // Each LOD is simplified from the one before it. The positions are
+    // scaled to the unit cube around the model so that the quadrics keep
+    // their precision, and the errors are scaled back afterwards.
+
+    std::vector<float> lodRatios;
+    std::vector<float> positions(getNumberOfVertices() * 3);
+    std::vector<int> triangleMeshes(m_numberOfTriangles);
+    std::vector<int> meshCounts;
+    float extent = (m_radius > 0.0f) ? m_radius : 1.0f;
+    Vertex vertex;
+
+    m_lods.clear();
+    m_lodMeshes.clear();
+    m_lodIndexBuffer.clear();
 
-    // Initialize all the vertex normals.
-    for (int i = 0; i < totalVertices; ++i)
+    NormalizeLodRatios(ratios, lodRatios);
+
+    if (lodRatios.empty() || m_numberOfTriangles == 0)
+        return;
+
+    for (int i = 0; i < getNumberOfVertices(); ++i)
+    {
+        const float *pPosition = fetchVertex(i, vertex).position;
+
+        for (int k = 0; k < 3; ++k)
+            positions[i * 3 + k] = (pPosition[k] - m_center[k]) / extent;
+    }
+
+    for (int i = 0; i < m_numberOfMeshes; ++i)
     {
-        pVertex0 = &m_vertexBuffer[i];
-        pVertex0->normal[0] = 0.0f;
-        pVertex0->normal[1] = 0.0f;
-        pVertex0->normal[2] = 0.0f;
+        for (int j = 0; j < m_meshes[i].triangleCount; ++j)
+            triangleMeshes[m_meshes[i].startIndex / 3 + j] = i;
     }
 
-    // Calculate the vertex normals.
-    for (int i = 0; i < totalTriangles; ++i)
+    Simplifier simplifier(&positions[0], getNumberOfVertices(), indexBuffer(),
+                          m_numberOfTriangles, &triangleMeshes[0]);
+
+    for (int i = 0; i < static_cast<int>(lodRatios.size()); ++i)
     {
-        pTriangle = &m_indexBuffer[i * 3];
+        if (cancelled())
+            break;
 
-        pVertex0 = &m_vertexBuffer[pTriangle[0]];
-        pVertex1 = &m_vertexBuffer[pTriangle[1]];
-        pVertex2 = &m_vertexBuffer[pTriangle[2]];
+        Lod lod;
 
-        // Calculate triangle face normal.
+        lod.ratio = lodRatios[i];
+        lod.error = simplifier.simplify(static_cast<int>(lodRatios[i] * m_numberOfTriangles)) * extent;
+        lod.startIndex = static_cast<int>(m_lodIndexBuffer.size());
+        lod.triangleCount = simplifier.getNumberOfTriangles();
 
-        edge1[0] = pVertex1->position[0] - pVertex0->position[0];
-        edge1[1] = pVertex1->position[1] - pVertex0->position[1];
-        edge1[2] = pVertex1->position[2] - pVertex0->position[2];
+        // Group the remaining triangles by mesh, in the model's mesh order.
 
-        edge2[0] = pVertex2->position[0] - pVertex0->position[0];
-        edge2[1] = pVertex2->position[1] - pVertex0->position[1];
-        edge2[2] = pVertex2->position[2] - pVertex0->position[2];
+        const int *pIndices = simplifier.getIndices();
+        const int *pMeshes = simplifier.getTriangleMeshes();
+        int start = lod.startIndex;
 
-        normal[0] = (edge1[1] * edge2[2]) - (edge1[2] * edge2[1]);
-        normal[1] = (edge1[2] * edge2[0]) - (edge1[0] * edge2[2]);
-        normal[2] = (edge1[0] * edge2[1]) - (edge1[1] * edge2[0]);
+        meshCounts.assign(m_numberOfMeshes, 0);
 
-        // Accumulate the normals.
+        for (int j = 0; j < lod.triangleCount; ++j)
+            ++meshCounts[pMeshes[j]];
 
-        pVertex0->normal[0] += normal[0];
-        pVertex0->normal[1] += normal[1];
-        pVertex0->normal[2] += normal[2];
+        for (int j = 0; j < m_numberOfMeshes; ++j)
+        {
+            Mesh mesh = {start, meshCounts[j], m_meshes[j].pMaterial};
+
+            m_lodMeshes.push_back(mesh);
+            meshCounts[j] = start;
+            start += mesh.triangleCount * 3;
+        }
+
+        m_lodIndexBuffer.resize(start);
 
-        pVertex1->normal[0] += normal[0];
-        pVertex1->normal[1] += normal[1];
-        pVertex1->normal[2] += normal[2];
+        for (int j = 0; j < lod.triangleCount; ++j)
+        {
+            memcpy(&m_lodIndexBuffer[meshCounts[pMeshes[j]]], &pIndices[j * 3], 3 * sizeof(int));
+            meshCounts[pMeshes[j]] += 3;
+        }
 
-        pVertex2->normal[0] += normal[0];
-        pVertex2->normal[1] += normal[1];
-        pVertex2->normal[2] += normal[2];
+        m_lods.push_back(lod);
     }
+}
 
-    // Normalize the vertex normals.
-    for (int i = 0; i < totalVertices; ++i)
+void ModelOBJ::generateNormals(int numThreads)
+{
+    if (m_vertexStorage == STORAGE_SOA)
     {
-        pVertex0 = &m_vertexBuffer[i];
+        SeparateVertices vertices;
 
-        length = 1.0f / sqrtf(pVertex0->normal[0] * pVertex0->normal[0] +
-            pVertex0->normal[1] * pVertex0->normal[1] +
-            pVertex0->normal[2] * pVertex0->normal[2]);
+        for (int i = 0; i < NUMBER_OF_COMPONENTS; ++i)
+            vertices.pStreams[i] = vertexStream(static_cast<VertexComponent>(i));
 
-        pVertex0->normal[0] *= length;
-        pVertex0->normal[1] *= length;
-        pVertex0->normal[2] *= length;
+        GenerateNormals(vertices, indexBuffer(), getNumberOfVertices(), getNumberOfTriangles(), numThreads);
+    }
+    else
+    {
+        InterleavedVertices vertices = {vertexBuffer()};
+
+        GenerateNormals(vertices, indexBuffer(), getNumberOfVertices(), getNumberOfTriangles(), numThreads);
     }
 
     m_hasNormals = true;
 }
 
-void ModelOBJ::generateTangents()
-{
-    const int *pTriangle = 0;
-    Vertex *pVertex0 = 0;
-    Vertex *pVertex1 = 0;
-    Vertex *pVertex2 = 0;
-    float edge1[3] = {0.0f, 0.0f, 0.0f};
-    float edge2[3] = {0.0f, 0.0f, 0.0f};
-    float texEdge1[2] = {0.0f, 0.0f};
-    float texEdge2[2] = {0.0f, 0.0f};
-    float tangent[3] = {0.0f, 0.0f, 0.0f};
-    float bitangent[3] = {0.0f, 0.0f, 0.0f};
-    float det = 0.0f;
-    float nDotT = 0.0f;
-    float bDotB = 0.0f;
-    float length = 0.0f;
-    int totalVertices = getNumberOfVertices();
-    int totalTriangles = getNumberOfTriangles();
+void ModelOBJ::generateTangents(TangentMethod method, int numThreads)
+{
+    // Bitangents are only written if they were imported. Shaders can
+    // rebuild them from the normal and the tangent's w.
+
+    bool mikkTSpace = (method == TANGENTS_MIKKTSPACE);
+    bool storeBitangents = (m_vertexAttributes & ATTRIBUTE_BITANGENT) != 0;
+
+    if (mikkTSpace)
+        splitMirroredVertices(numThreads);
 
-    // Initialize all the vertex tangents and bitangents.
-    for (int i = 0; i < totalVertices; ++i)
+    if (m_vertexStorage == STORAGE_SOA)
     {
-        pVertex0 = &m_vertexBuffer[i];
+        SeparateVertices vertices;
 
-        pVertex0->tangent[0] = 0.0f;
-        pVertex0->tangent[1] = 0.0f;
-        pVertex0->tangent[2] = 0.0f;
-        pVertex0->tangent[3] = 0.0f;
+        for (int i = 0; i < NUMBER_OF_COMPONENTS; ++i)
+            vertices.pStreams[i] = vertexStream(static_cast<VertexComponent>(i));
 
-        pVertex0->bitangent[0] = 0.0f;
-        pVertex0->bitangent[1] = 0.0f;
-        pVertex0->bitangent[2] = 0.0f;
+        GenerateTangents(vertices, indexBuffer(), getNumberOfVertices(), getNumberOfTriangles(),
+                         numThreads, mikkTSpace, storeBitangents);
+    }
+    else
+    {
+        InterleavedVertices vertices = {vertexBuffer()};
+
+        GenerateTangents(vertices, indexBuffer(), getNumberOfVertices(), getNumberOfTriangles(),
+                         numThreads, mikkTSpace, storeBitangents);
     }
 
-    // Calculate the vertex tangents and bitangents.
-    for (int i = 0; i < totalTriangles; ++i)
+    m_hasTangents = true;
+}
+
+void ModelOBJ::splitMirroredVertices(int numThreads)
+{
+    // MikkTSpace gives the corners of a vertex separate tangent frames when
+    // their triangles map the texture with opposite orientations, as on the
+    // seam between mirrored UV islands. Vertices already differ by normal
+    // and texture coordinate, so only the orientation is left to split by.
+    // Such a vertex gets a copy, placed right after it, that its mirrored
+    // triangles use instead. Triangles without texture space area keep the
+    // original. Only vertex numbers change, so the meshes stay valid.
+
+    detachCacheFile();
+
+    int numVertices = getNumberOfVertices();
+    int numTriangles = getNumberOfTriangles();
+    int *pIndices = indexBuffer();
+    std::vector<signed char> orientations;
+
+    if (m_vertexStorage == STORAGE_SOA)
     {
-        pTriangle = &m_indexBuffer[i * 3];
+        SeparateVertices vertices;
 
-        pVertex0 = &m_vertexBuffer[pTriangle[0]];
-        pVertex1 = &m_vertexBuffer[pTriangle[1]];
-        pVertex2 = &m_vertexBuffer[pTriangle[2]];
+        for (int i = 0; i < NUMBER_OF_COMPONENTS; ++i)
+            vertices.pStreams[i] = vertexStream(static_cast<VertexComponent>(i));
 
-        // Calculate the triangle face tangent and bitangent.
+        FindTexCoordOrientations(vertices, pIndices, numTriangles, numThreads, orientations);
+    }
+    else
+    {
+        InterleavedVertices vertices = {vertexBuffer()};
 
-        edge1[0] = pVertex1->position[0] - pVertex0->position[0];
-        edge1[1] = pVertex1->position[1] - pVertex0->position[1];
-        edge1[2] = pVertex1->position[2] - pVertex0->position[2];
+        FindTexCoordOrientations(vertices, pIndices, numTriangles, numThreads, orientations);
+    }
 
-        edge2[0] = pVertex2->position[0] - pVertex0->position[0];
-        edge2[1] = pVertex2->position[1] - pVertex0->position[1];
-        edge2[2] = pVertex2->position[2] - pVertex0->position[2];
+    // Bit 0 marks vertices used by a triangle that preserves the orientation
+    // and bit 1 those used by a mirrored one.
 
-        texEdge1[0] = pVertex1->texCoord[0] - pVertex0->texCoord[0];
-        texEdge1[1] = pVertex1->texCoord[1] - pVertex0->texCoord[1];
+    std::vector<unsigned char> used(numVertices, 0);
 
-        texEdge2[0] = pVertex2->texCoord[0] - pVertex0->texCoord[0];
-        texEdge2[1] = pVertex2->texCoord[1] - pVertex0->texCoord[1];
+    for (int i = 0; i < numTriangles; ++i)
+    {
+        if (orientations[i] == 0)
+            continue;
 
-        det = texEdge1[0] * texEdge2[1] - texEdge2[0] * texEdge1[1];
+        unsigned char bit = (orientations[i] > 0) ? 1 : 2;
 
-        if (fabs(det) < 1e-6f)
+        used[pIndices[i * 3]] |= bit;
+        used[pIndices[i * 3 + 1]] |= bit;
+        used[pIndices[i * 3 + 2]] |= bit;
+    }
+
+    // remap[i] is vertex i's new number. The vertex is split if the next
+    // vertex's number is two higher.
+
+    std::vector<int> remap(numVertices + 1);
+    int numCopies = 0;
+
+    for (int i = 0; i < numVertices; ++i)
+    {
+        remap[i] = i + numCopies;
+
+        if (used[i] == 3)
+            ++numCopies;
+    }
+
+    remap[numVertices] = numVertices + numCopies;
+
+    if (numCopies == 0)
+        return;
+
+    int numTasks = std::max(1, std::min(numThreads, numTriangles / 4096));
+
+    RunTasks(numTasks, [&](int task)
+    {
+        int begin = 0;
+        int end = 0;
+
+        GetTaskRange(numTriangles, task, numTasks, begin, end);
+
+        for (int i = begin * 3; i < end * 3; ++i)
         {
-            tangent[0] = 1.0f;
-            tangent[1] = 0.0f;
-            tangent[2] = 0.0f;
+            int vertex = pIndices[i];
+            bool split = remap[vertex + 1] - remap[vertex] == 2;
 
-            bitangent[0] = 0.0f;
-            bitangent[1] = 1.0f;
-            bitangent[2] = 0.0f;
+            pIndices[i] = remap[vertex] + ((split && orientations[i / 3] < 0) ? 1 : 0);
         }
-        else
+    });
+
+    // Copy the vertices into a buffer with room for the copies. The vertex
+    // streams are rebuilt from the interleaved buffer.
+
+    VertexStorage storage = m_vertexStorage;
+    std::vector<Vertex> vertexBuffer(numVertices + numCopies);
+
+    setVertexStorage(STORAGE_INTERLEAVED);
+
+    for (int i = 0; i < numVertices; ++i)
+    {
+        vertexBuffer[remap[i]] = m_vertexBuffer[i];
+
+        if (remap[i + 1] - remap[i] == 2)
+            vertexBuffer[remap[i] + 1] = m_vertexBuffer[i];
+    }
+
+    m_vertexBuffer.swap(vertexBuffer);
+    setVertexStorage(storage);
+
+    // Keep the vertex cache consistent for as long as it's kept.
+
+    for (int i = 0; i < static_cast<int>(m_vertexCache.size()); ++i)
+    {
+        if (m_vertexCache[i].index != -1)
+            m_vertexCache[i].index = remap[m_vertexCache[i].index];
+    }
+}
+
+void ModelOBJ::optimizeVertexCache(int numThreads)
+{
+    // The meshes are independent, so the threads take them one at a time.
+    // Each thread needs scratch arrays covering the whole vertex buffer.
+    // The LOD meshes follow the model's meshes but aren't measured.
+
+    int numJobs = m_numberOfMeshes + static_cast<int>(m_lodMeshes.size());
+    int numTasks = std::max(1, std::min(numThreads, numJobs));
+    int numVertices = getNumberOfVertices();
+    int *pIndices = indexBuffer();
+    std::vector<long long> counts(numTasks * 3, 0);
+    std::atomic<int> nextMesh(0);
+
+    RunTasks(numTasks, [&](int task)
+    {
+        VertexCacheScratch scratch;
+        long long *pCounts = &counts[task * 3];
+        int mesh = 0;
+        int vertices = 0;
+
+        scratch.init(numVertices);
+
+        while ((mesh = nextMesh++) < numJobs)
         {
-            det = 1.0f / det;
+            if (mesh >= m_numberOfMeshes)
+            {
+                const Mesh &lodMesh = m_lodMeshes[mesh - m_numberOfMeshes];
 
-            tangent[0] = (texEdge2[1] * edge1[0] - texEdge1[1] * edge2[0]) * det;
-            tangent[1] = (texEdge2[1] * edge1[1] - texEdge1[1] * edge2[1]) * det;
-            tangent[2] = (texEdge2[1] * edge1[2] - texEdge1[1] * edge2[2]) * det;
+                if (lodMesh.triangleCount > 0)
+                    OptimizeVertexCache(&m_lodIndexBuffer[lodMesh.startIndex], lodMesh.triangleCount, scratch);
 
-            bitangent[0] = (-texEdge2[0] * edge1[0] + texEdge1[0] * edge2[0]) * det;
-            bitangent[1] = (-texEdge2[0] * edge1[1] + texEdge1[0] * edge2[1]) * det;
-            bitangent[2] = (-texEdge2[0] * edge1[2] + texEdge1[0] * edge2[2]) * det;
-        }
+                continue;
+            }
 
-        // Accumulate the tangents and bitangents.
+            int *pMeshIndices = pIndices + m_meshes[mesh].startIndex;
+            int numTriangles = m_meshes[mesh].triangleCount;
 
-        pVertex0->tangent[0] += tangent[0];
-        pVertex0->tangent[1] += tangent[1];
-        pVertex0->tangent[2] += tangent[2];
-        pVertex0->bitangent[0] += bitangent[0];
-        pVertex0->bitangent[1] += bitangent[1];
-        pVertex0->bitangent[2] += bitangent[2];
+            if (numTriangles == 0)
+                continue;
+
+            pCounts[0] += MeasureVertexCache(pMeshIndices, numTriangles, scratch, vertices);
+            OptimizeVertexCache(pMeshIndices, numTriangles, scratch);
+            pCounts[1] += MeasureVertexCache(pMeshIndices, numTriangles, scratch, vertices);
+            pCounts[2] += vertices;
+        }
+    });
 
-        pVertex1->tangent[0] += tangent[0];
-        pVertex1->tangent[1] += tangent[1];
-        pVertex1->tangent[2] += tangent[2];
-        pVertex1->bitangent[0] += bitangent[0];
-        pVertex1->bitangent[1] += bitangent[1];
-        pVertex1->bitangent[2] += bitangent[2];
+    long long missesBefore = 0;
+    long long missesAfter = 0;
+    long long vertices = 0;
 
-        pVertex2->tangent[0] += tangent[0];
-        pVertex2->tangent[1] += tangent[1];
-        pVertex2->tangent[2] += tangent[2];
-        pVertex2->bitangent[0] += bitangent[0];
-        pVertex2->bitangent[1] += bitangent[1];
-        pVertex2->bitangent[2] += bitangent[2];
+    for (int i = 0; i < numTasks; ++i)
+    {
+        missesBefore += counts[i * 3];
+        missesAfter += counts[i * 3 + 1];
+        vertices += counts[i * 3 + 2];
     }
 
-    // Orthogonalize and normalize the vertex tangents.
-    for (int i = 0; i < totalVertices; ++i)
+    if (m_numberOfTriangles > 0 && vertices > 0)
     {
-        pVertex0 = &m_vertexBuffer[i];
+        m_importStats.acmrBefore = static_cast<float>(static_cast<double>(missesBefore) / m_numberOfTriangles);
+        m_importStats.acmrAfter = static_cast<float>(static_cast<double>(missesAfter) / m_numberOfTriangles);
+        m_importStats.atvrBefore = static_cast<float>(static_cast<double>(missesBefore) / vertices);
+        m_importStats.atvrAfter = static_cast<float>(static_cast<double>(missesAfter) / vertices);
+    }
+}
 
-        // Gram-Schmidt orthogonalize tangent with normal.
+void ModelOBJ::optimizeVertexFetch()
+{
+    // Renumber the vertices in the order the index buffer first uses them.
+    // Only vertex numbers change, so the meshes' index ranges stay valid.
+    // The LODs only use vertices the model's triangles use.
 
-        nDotT = pVertex0->normal[0] * pVertex0->tangent[0] +
-                pVertex0->normal[1] * pVertex0->tangent[1] +
-                pVertex0->normal[2] * pVertex0->tangent[2];
+    int numVertices = getNumberOfVertices();
+    int numIndices = getNumberOfIndices();
+    int *pIndices = indexBuffer();
+    std::vector<int> remap;
 
-        pVertex0->tangent[0] -= pVertex0->normal[0] * nDotT;
-        pVertex0->tangent[1] -= pVertex0->normal[1] * nDotT;
-        pVertex0->tangent[2] -= pVertex0->normal[2] * nDotT;
+    if (numVertices == 0 || numIndices == 0)
+        return;
 
-        // Normalize the tangent.
+    m_importStats.overfetchBefore = AnalyzeVertexFetch(pIndices, numIndices, numVertices, getVertexSize());
 
-        length = 1.0f / sqrtf(pVertex0->tangent[0] * pVertex0->tangent[0] +
-                              pVertex0->tangent[1] * pVertex0->tangent[1] +
-                              pVertex0->tangent[2] * pVertex0->tangent[2]);
+    BuildFetchRemap(pIndices, numIndices, numVertices, remap);
 
-        pVertex0->tangent[0] *= length;
-        pVertex0->tangent[1] *= length;
-        pVertex0->tangent[2] *= length;
+    for (int i = 0; i < numIndices; ++i)
+        pIndices[i] = remap[pIndices[i]];
 
-        // Calculate the handedness of the local tangent space.
-        // The bitangent vector is the cross product between the triangle face
-        // normal vector and the calculated tangent vector. The resulting
-        // bitangent vector should be the same as the bitangent vector
-        // calculated from the set of linear equations above. If they point in
-        // different directions then we need to invert the cross product
-        // calculated bitangent vector. We store this scalar multiplier in the
-        // tangent vector's 'w' component so that the correct bitangent vector
-        // can be generated in the normal mapping shader's vertex shader.
-        //
-        // Normal maps have a left handed coordinate system with the origin
-        // located at the top left of the normal map texture. The x coordinates
-        // run horizontally from left to right. The y coordinates run
-        // vertically from top to bottom. The z coordinates run out of the
-        // normal map texture towards the viewer. Our handedness calculations
-        // must take this fact into account as well so that the normal mapping
-        // shader's vertex shader will generate the correct bitangent vectors.
-        // Some normal map authoring tools such as Crazybump
-        // (http://www.crazybump.com/) includes options to allow you to control
-        // the orientation of the normal map normal's y-axis.
-
-        bitangent[0] = (pVertex0->normal[1] * pVertex0->tangent[2]) - 
-                       (pVertex0->normal[2] * pVertex0->tangent[1]);
-        bitangent[1] = (pVertex0->normal[2] * pVertex0->tangent[0]) -
-                       (pVertex0->normal[0] * pVertex0->tangent[2]);
-        bitangent[2] = (pVertex0->normal[0] * pVertex0->tangent[1]) - 
-                       (pVertex0->normal[1] * pVertex0->tangent[0]);
-
-        bDotB = bitangent[0] * pVertex0->bitangent[0] + 
-                bitangent[1] * pVertex0->bitangent[1] + 
-                bitangent[2] * pVertex0->bitangent[2];
-
-        pVertex0->tangent[3] = (bDotB < 0.0f) ? 1.0f : -1.0f;
-
-        pVertex0->bitangent[0] = bitangent[0];
-        pVertex0->bitangent[1] = bitangent[1];
-        pVertex0->bitangent[2] = bitangent[2];
+    for (int i = 0; i < static_cast<int>(m_lodIndexBuffer.size()); ++i)
+        m_lodIndexBuffer[i] = remap[m_lodIndexBuffer[i]];
+
+    if (m_vertexStorage == STORAGE_SOA)
+    {
+        for (int i = 0; i < NUMBER_OF_COMPONENTS; ++i)
+            RemapArray(vertexStream(static_cast<VertexComponent>(i)), remap);
+    }
+    else
+    {
+        RemapArray(vertexBuffer(), remap);
     }
 
-    m_hasTangents = true;
+    // Keep the vertex cache consistent for as long as it's kept.
+
+    for (int i = 0; i < static_cast<int>(m_vertexCache.size()); ++i)
+    {
+        if (m_vertexCache[i].index != -1)
+            m_vertexCache[i].index = remap[m_vertexCache[i].index];
+    }
+
+    m_importStats.overfetchAfter = AnalyzeVertexFetch(pIndices, numIndices, numVertices, getVertexSize());
 }
 
 void ModelOBJ::importGeometryFirstPass(FILE *pFile)
@@ -802,14 +7757,23 @@ void ModelOBJ::importGeometryFirstPass(FILE *pFile)
     int v = 0;
     int vt = 0;
     int vn = 0;
+    int numStatements = 0;
     char buffer[256] = {0};
-    std::string name;
 
     while (fscanf(pFile, "%s", buffer) != EOF)
     {
+        if (m_pProgress && (++numStatements & 0xFFFF) == 0)
+        {
+            m_pProgress->bytesParsed = static_cast<unsigned long long>(ftell(pFile));
+
+            if (m_pProgress->cancel)
+                return;
+        }
+
         switch (buffer[0])
         {
         case 'f':   // v, v//vn, v/vt, v/vt/vn.
+            ++m_importStats.faceLines;
             fscanf(pFile, "%s", buffer);
 
             if (strstr(buffer, "//")) // v//vn
@@ -852,11 +7816,10 @@ void ModelOBJ::importGeometryFirstPass(FILE *pFile)
             break;
 
         case 'm':   // mtllib
+            ++m_importStats.materialLibraryLines;
             fgets(buffer, sizeof(buffer), pFile);
             sscanf(buffer, "%s %s", buffer, buffer);
-            name = m_directoryPath;
-            name += buffer;
-            importMaterials(name.c_str());
+            importMaterials(buffer);
             break;
 
         case 'v':   // v, vt, or vn
@@ -887,9 +7850,16 @@ void ModelOBJ::importGeometryFirstPass(FILE *pFile)
         }
     }
 
+    if (m_pProgress)
+        m_pProgress->bytesParsed = m_pProgress->bytesTotal.load();
+
+    m_importStats.positionLines = m_numberOfVertexCoords;
+    m_importStats.texCoordLines = m_numberOfTextureCoords;
+    m_importStats.normalLines = m_numberOfNormals;
+
     m_hasPositions = m_numberOfVertexCoords > 0;
-    m_hasNormals = m_numberOfNormals > 0;
-    m_hasTextureCoords = m_numberOfTextureCoords > 0;
+    m_hasNormals = m_numberOfNormals > 0 && (m_vertexAttributes & ATTRIBUTE_NORMAL);
+    m_hasTextureCoords = m_numberOfTextureCoords > 0 && (m_vertexAttributes & ATTRIBUTE_TEXCOORD);
 
     // Allocate memory for the OBJ model data.
     m_vertexCoords.resize(m_numberOfVertexCoords * 3);
@@ -897,28 +7867,14 @@ void ModelOBJ::importGeometryFirstPass(FILE *pFile)
     m_normals.resize(m_numberOfNormals * 3);
     m_indexBuffer.resize(m_numberOfTriangles * 3);
     m_attributeBuffer.resize(m_numberOfTriangles);
+    initVertexCache(m_numberOfTriangles);
 
     // Define a default material if no materials were loaded.
     if (m_numberOfMaterials == 0)
-    {
-        Material defaultMaterial =
-        {
-            0.2f, 0.2f, 0.2f, 1.0f,
-            0.8f, 0.8f, 0.8f, 1.0f,
-            0.0f, 0.0f, 0.0f, 1.0f,
-            0.0f,
-            1.0f,
-            std::string("default"),
-            std::string(),
-            std::string()
-        };
-
-        m_materials.push_back(defaultMaterial);
-        m_materialCache[defaultMaterial.name] = 0;
-    }
+        addDefaultMaterial();
 }
 
-void ModelOBJ::importGeometrySecondPass(FILE *pFile)
+void ModelOBJ::importGeometrySecondPass(FILE *pFile, bool keepGroups)
 {
     int v[3] = {0};
     int vt[3] = {0};
@@ -927,19 +7883,44 @@ void ModelOBJ::importGeometrySecondPass(FILE *pFile)
     int numTexCoords = 0;
     int numNormals = 0;
     int numTriangles = 0;
+    int firstTriangle = 0;
     int activeMaterial = 0;
+    int activeGroup = -1;
+    int numStatements = 0;
     char buffer[256] = {0};
     std::string name;
+    std::string object;
     std::map<std::string, int>::const_iterator iter;
 
+    if (m_pProgress)
+    {
+        m_pProgress->phase = PHASE_BUILDING;
+        m_pProgress->trianglesTotal = m_numberOfTriangles;
+    }
+
+    if (keepGroups)
+    {
+        m_groupBuffer.resize(m_numberOfTriangles);
+        activeGroup = addGroup(object, std::string());
+    }
+
     while (fscanf(pFile, "%s", buffer) != EOF)
     {
+        if (m_pProgress && (++numStatements & 0xFFFF) == 0)
+        {
+            m_pProgress->trianglesBuilt = numTriangles;
+
+            if (m_pProgress->cancel)
+                return;
+        }
+
         switch (buffer[0])
         {
         case 'f': // v, v//vn, v/vt, or v/vt/vn.
             v[0]  = v[1]  = v[2]  = 0;
             vt[0] = vt[1] = vt[2] = 0;
             vn[0] = vn[1] = vn[2] = 0;
+            firstTriangle = numTriangles;
 
             fscanf(pFile, "%s", buffer);
 
@@ -949,13 +7930,13 @@ void ModelOBJ::importGeometrySecondPass(FILE *pFile)
                 fscanf(pFile, "%d//%d", &v[1], &vn[1]);
                 fscanf(pFile, "%d//%d", &v[2], &vn[2]);
 
-                v[0] = (v[0] < 0) ? v[0] + numVertices - 1 : v[0] - 1;
-                v[1] = (v[1] < 0) ? v[1] + numVertices - 1 : v[1] - 1;
-                v[2] = (v[2] < 0) ? v[2] + numVertices - 1 : v[2] - 1;
+                v[0] = (v[0] < 0) ? v[0] + numVertices : v[0] - 1;
+                v[1] = (v[1] < 0) ? v[1] + numVertices : v[1] - 1;
+                v[2] = (v[2] < 0) ? v[2] + numVertices : v[2] - 1;
 
-                vn[0] = (vn[0] < 0) ? vn[0] + numNormals - 1 : vn[0] - 1;
-                vn[1] = (vn[1] < 0) ? vn[1] + numNormals - 1 : vn[1] - 1;
-                vn[2] = (vn[2] < 0) ? vn[2] + numNormals - 1 : vn[2] - 1;
+                vn[0] = (vn[0] < 0) ? vn[0] + numNormals : vn[0] - 1;
+                vn[1] = (vn[1] < 0) ? vn[1] + numNormals : vn[1] - 1;
+                vn[2] = (vn[2] < 0) ? vn[2] + numNormals : vn[2] - 1;
 
                 addTrianglePosNormal(numTriangles++, activeMaterial,
                     v[0], v[1], v[2], vn[0], vn[1], vn[2]);
@@ -965,8 +7946,8 @@ void ModelOBJ::importGeometrySecondPass(FILE *pFile)
 
                 while (fscanf(pFile, "%d//%d", &v[2], &vn[2]) > 0)
                 {
-                    v[2] = (v[2] < 0) ? v[2] + numVertices - 1 : v[2] - 1;
-                    vn[2] = (vn[2] < 0) ? vn[2] + numNormals - 1 : vn[2] - 1;
+                    v[2] = (v[2] < 0) ? v[2] + numVertices : v[2] - 1;
+                    vn[2] = (vn[2] < 0) ? vn[2] + numNormals : vn[2] - 1;
 
                     addTrianglePosNormal(numTriangles++, activeMaterial,
                         v[0], v[1], v[2], vn[0], vn[1], vn[2]);
@@ -980,17 +7961,17 @@ void ModelOBJ::importGeometrySecondPass(FILE *pFile)
                 fscanf(pFile, "%d/%d/%d", &v[1], &vt[1], &vn[1]);
                 fscanf(pFile, "%d/%d/%d", &v[2], &vt[2], &vn[2]);
 
-                v[0] = (v[0] < 0) ? v[0] + numVertices - 1 : v[0] - 1;
-                v[1] = (v[1] < 0) ? v[1] + numVertices - 1 : v[1] - 1;
-                v[2] = (v[2] < 0) ? v[2] + numVertices - 1 : v[2] - 1;
+                v[0] = (v[0] < 0) ? v[0] + numVertices : v[0] - 1;
+                v[1] = (v[1] < 0) ? v[1] + numVertices : v[1] - 1;
+                v[2] = (v[2] < 0) ? v[2] + numVertices : v[2] - 1;
 
-                vt[0] = (vt[0] < 0) ? vt[0] + numTexCoords - 1 : vt[0] - 1;
-                vt[1] = (vt[1] < 0) ? vt[1] + numTexCoords - 1 : vt[1] - 1;
-                vt[2] = (vt[2] < 0) ? vt[2] + numTexCoords - 1 : vt[2] - 1;
+                vt[0] = (vt[0] < 0) ? vt[0] + numTexCoords : vt[0] - 1;
+                vt[1] = (vt[1] < 0) ? vt[1] + numTexCoords : vt[1] - 1;
+                vt[2] = (vt[2] < 0) ? vt[2] + numTexCoords : vt[2] - 1;
 
-                vn[0] = (vn[0] < 0) ? vn[0] + numNormals - 1 : vn[0] - 1;
-                vn[1] = (vn[1] < 0) ? vn[1] + numNormals - 1 : vn[1] - 1;
-                vn[2] = (vn[2] < 0) ? vn[2] + numNormals - 1 : vn[2] - 1;
+                vn[0] = (vn[0] < 0) ? vn[0] + numNormals : vn[0] - 1;
+                vn[1] = (vn[1] < 0) ? vn[1] + numNormals : vn[1] - 1;
+                vn[2] = (vn[2] < 0) ? vn[2] + numNormals : vn[2] - 1;
 
                 addTrianglePosTexCoordNormal(numTriangles++, activeMaterial,
                     v[0], v[1], v[2], vt[0], vt[1], vt[2], vn[0], vn[1], vn[2]);
@@ -1001,9 +7982,9 @@ void ModelOBJ::importGeometrySecondPass(FILE *pFile)
 
                 while (fscanf(pFile, "%d/%d/%d", &v[2], &vt[2], &vn[2]) > 0)
                 {
-                    v[2] = (v[2] < 0) ? v[2] + numVertices - 1 : v[2] - 1;
-                    vt[2] = (vt[2] < 0) ? vt[2] + numTexCoords - 1 : vt[2] - 1;
-                    vn[2] = (vn[2] < 0) ? vn[2] + numNormals - 1 : vn[2] - 1;
+                    v[2] = (v[2] < 0) ? v[2] + numVertices : v[2] - 1;
+                    vt[2] = (vt[2] < 0) ? vt[2] + numTexCoords : vt[2] - 1;
+                    vn[2] = (vn[2] < 0) ? vn[2] + numNormals : vn[2] - 1;
 
                     addTrianglePosTexCoordNormal(numTriangles++, activeMaterial,
                         v[0], v[1], v[2], vt[0], vt[1], vt[2], vn[0], vn[1], vn[2]);
@@ -1018,13 +7999,13 @@ void ModelOBJ::importGeometrySecondPass(FILE *pFile)
                 fscanf(pFile, "%d/%d", &v[1], &vt[1]);
                 fscanf(pFile, "%d/%d", &v[2], &vt[2]);
 
-                v[0] = (v[0] < 0) ? v[0] + numVertices - 1 : v[0] - 1;
-                v[1] = (v[1] < 0) ? v[1] + numVertices - 1 : v[1] - 1;
-                v[2] = (v[2] < 0) ? v[2] + numVertices - 1 : v[2] - 1;
+                v[0] = (v[0] < 0) ? v[0] + numVertices : v[0] - 1;
+                v[1] = (v[1] < 0) ? v[1] + numVertices : v[1] - 1;
+                v[2] = (v[2] < 0) ? v[2] + numVertices : v[2] - 1;
 
-                vt[0] = (vt[0] < 0) ? vt[0] + numTexCoords - 1 : vt[0] - 1;
-                vt[1] = (vt[1] < 0) ? vt[1] + numTexCoords - 1 : vt[1] - 1;
-                vt[2] = (vt[2] < 0) ? vt[2] + numTexCoords - 1 : vt[2] - 1;
+                vt[0] = (vt[0] < 0) ? vt[0] + numTexCoords : vt[0] - 1;
+                vt[1] = (vt[1] < 0) ? vt[1] + numTexCoords : vt[1] - 1;
+                vt[2] = (vt[2] < 0) ? vt[2] + numTexCoords : vt[2] - 1;
 
                 addTrianglePosTexCoord(numTriangles++, activeMaterial,
                     v[0], v[1], v[2], vt[0], vt[1], vt[2]);
@@ -1034,8 +8015,8 @@ void ModelOBJ::importGeometrySecondPass(FILE *pFile)
 
                 while (fscanf(pFile, "%d/%d", &v[2], &vt[2]) > 0)
                 {
-                    v[2] = (v[2] < 0) ? v[2] + numVertices - 1 : v[2] - 1;
-                    vt[2] = (vt[2] < 0) ? vt[2] + numTexCoords - 1 : vt[2] - 1;
+                    v[2] = (v[2] < 0) ? v[2] + numVertices : v[2] - 1;
+                    vt[2] = (vt[2] < 0) ? vt[2] + numTexCoords : vt[2] - 1;
 
                     addTrianglePosTexCoord(numTriangles++, activeMaterial,
                         v[0], v[1], v[2], vt[0], vt[1], vt[2]);
@@ -1050,9 +8031,9 @@ void ModelOBJ::importGeometrySecondPass(FILE *pFile)
                 fscanf(pFile, "%d", &v[1]);
                 fscanf(pFile, "%d", &v[2]);
 
-                v[0] = (v[0] < 0) ? v[0] + numVertices - 1 : v[0] - 1;
-                v[1] = (v[1] < 0) ? v[1] + numVertices - 1 : v[1] - 1;
-                v[2] = (v[2] < 0) ? v[2] + numVertices - 1 : v[2] - 1;
+                v[0] = (v[0] < 0) ? v[0] + numVertices : v[0] - 1;
+                v[1] = (v[1] < 0) ? v[1] + numVertices : v[1] - 1;
+                v[2] = (v[2] < 0) ? v[2] + numVertices : v[2] - 1;
 
                 addTrianglePos(numTriangles++, activeMaterial, v[0], v[1], v[2]);
 
@@ -1060,16 +8041,45 @@ void ModelOBJ::importGeometrySecondPass(FILE *pFile)
 
                 while (fscanf(pFile, "%d", &v[2]) > 0)
                 {
-                    v[2] = (v[2] < 0) ? v[2] + numVertices - 1 : v[2] - 1;
+                    v[2] = (v[2] < 0) ? v[2] + numVertices : v[2] - 1;
 
                     addTrianglePos(numTriangles++, activeMaterial, v[0], v[1], v[2]);
 
                     v[1] = v[2];
                 }
             }
+
+            if (keepGroups)
+                std::fill(m_groupBuffer.begin() + firstTriangle, m_groupBuffer.begin() + numTriangles, activeGroup);
+            break;
+
+        case 'g': // g
+        case 'o': // o
+            if (keepGroups && buffer[1] == '\0')
+            {
+                bool isObject = buffer[0] == 'o';
+
+                if (!fgets(buffer, sizeof(buffer), pFile))
+                    buffer[0] = '\0';
+
+                name = ParseLineName(buffer, buffer + strlen(buffer));
+
+                if (isObject)
+                {
+                    object = name;
+                    name.clear();
+                }
+
+                activeGroup = addGroup(object, name);
+            }
+            else
+            {
+                fgets(buffer, sizeof(buffer), pFile);
+            }
             break;
 
         case 'u': // usemtl
+            ++m_importStats.useMaterialLines;
             fgets(buffer, sizeof(buffer), pFile);
             sscanf(buffer, "%s %s", buffer, buffer);
             name = buffer;
@@ -1113,171 +8123,553 @@ void ModelOBJ::importGeometrySecondPass(FILE *pFile)
             break;
         }
     }
+
+    if (m_pProgress)
+        m_pProgress->trianglesBuilt = numTriangles;
+
+    m_importStats.trianglesEmitted = numTriangles;
 }
 
-bool ModelOBJ::importMaterials(const char *pszFilename)
+bool ModelOBJ::importGeometryMapped(const char *pBegin, const char *pEnd,
+                                    const ImportOptions &options)
 {
-    FILE *pFile = fopen(pszFilename, "r");
+    // Read the whole file in one pass. Unlike the stdio parser nothing is
+    // counted up front. The attribute arrays grow as the file is scanned.
+    //
+    // Large files are split into newline aligned chunks that are parsed in
+    // parallel. Each chunk only knows its own attribute counts, so relative
+    // face indices and the active material are fixed up when the chunks are
+    // merged in file order. The merged model is identical to one produced by
+    // parsing the whole file as a single chunk.
+
+    const size_t minChunkSize = 4 * 1024 * 1024;
+    Clock::time_point phaseStart = Clock::now();
+    size_t fileSize = static_cast<size_t>(pEnd - pBegin);
+    int numThreads = GetThreadCount(options.numThreads);
+    int numChunks = static_cast<int>(std::min<size_t>(numThreads, fileSize / minChunkSize + 1));
+    std::vector<ObjGeometry> chunks(numChunks);
+    std::vector<std::thread> workers;
+    const char *pChunkBegin = pBegin;
+    const char *pChunkEnd = pBegin;
+    const char *pFirstChunkEnd = pBegin;
+
+    for (int i = 0; i < numChunks; ++i)
+    {
+        if (i == numChunks - 1)
+        {
+            pChunkEnd = pEnd;
+        }
+        else
+        {
+            pChunkEnd = std::max(pChunkBegin, pBegin + fileSize / numChunks * (i + 1));
+            pChunkEnd = SkipLine(pChunkEnd, pEnd);
+        }
 
-    if (!pFile)
+        if (i == 0)
+            pFirstChunkEnd = pChunkEnd;     // parsed on this thread below
+        else
+            workers.push_back(std::thread(ParseGeometry, pChunkBegin, pChunkEnd, std::ref(chunks[i]), options.keepGroups, m_pProgress));
+
+        pChunkBegin = pChunkEnd;
+    }
+
+    ParseGeometry(pBegin, pFirstChunkEnd, chunks[0], options.keepGroups, m_pProgress);
+
+    for (int i = 0; i < static_cast<int>(workers.size()); ++i)
+        workers[i].join();
+
+    if (cancelled())
+        return false;
+
+    for (int i = 0; i < numChunks; ++i)
+    {
+        const ObjGeometry &chunk = chunks[i];
+
+        m_importStats.positionLines += static_cast<int>(chunk.vertexCoords.size() / 3);
+        m_importStats.texCoordLines += static_cast<int>(chunk.textureCoords.size() / 2);
+        m_importStats.normalLines += static_cast<int>(chunk.normals.size() / 3);
+        m_importStats.faceLines += static_cast<int>(chunk.faces.size());
+        m_importStats.useMaterialLines += chunk.numUseMaterials;
+        m_importStats.materialLibraryLines += static_cast<int>(chunk.materialLibraries.size());
+
+        m_importStats.parseScratchBytes += chunk.vertexCoords.capacity() * sizeof(float);
+        m_importStats.parseScratchBytes += chunk.textureCoords.capacity() * sizeof(float);
+        m_importStats.parseScratchBytes += chunk.normals.capacity() * sizeof(float);
+        m_importStats.parseScratchBytes += chunk.corners.capacity() * sizeof(int);
+        m_importStats.parseScratchBytes += chunk.relativeCorners.capacity() * sizeof(size_t);
+        m_importStats.parseScratchBytes += chunk.faces.capacity() * sizeof(ObjFace);
+        m_importStats.parseScratchBytes += chunk.faceGroups.capacity() * sizeof(int);
+    }
+
+    // Merge the attribute arrays. Each chunk's relative face indices are
+    // offset by the number of attributes read by the chunks before it.
+
+    size_t numVertexCoords = 0;
+    size_t numTextureCoords = 0;
+    size_t numNormals = 0;
+    int base[3] = {0};
+
+    for (int i = 0; i < numChunks; ++i)
+    {
+        numVertexCoords += chunks[i].vertexCoords.size();
+        numTextureCoords += chunks[i].textureCoords.size();
+        numNormals += chunks[i].normals.size();
+    }
+
+    m_vertexCoords.reserve(numVertexCoords);
+    m_textureCoords.reserve(numTextureCoords);
+    m_normals.reserve(numNormals);
+
+    for (int i = 0; i < numChunks; ++i)
+    {
+        ObjGeometry &chunk = chunks[i];
+
+        for (int j = 0; j < static_cast<int>(chunk.relativeCorners.size()); ++j)
+        {
+            size_t corner = chunk.relativeCorners[j];
+            chunk.corners[corner] += base[corner % 3];
+        }
+
+        base[0] += static_cast<int>(chunk.vertexCoords.size() / 3);
+        base[1] += static_cast<int>(chunk.textureCoords.size() / 2);
+        base[2] += static_cast<int>(chunk.normals.size() / 3);
+
+        m_vertexCoords.insert(m_vertexCoords.end(), chunk.vertexCoords.begin(), chunk.vertexCoords.end());
+        m_textureCoords.insert(m_textureCoords.end(), chunk.textureCoords.begin(), chunk.textureCoords.end());
+        m_normals.insert(m_normals.end(), chunk.normals.begin(), chunk.normals.end());
+
+        std::vector<float>().swap(chunk.vertexCoords);
+        std::vector<float>().swap(chunk.textureCoords);
+        std::vector<float>().swap(chunk.normals);
+
+        for (int j = 0; j < static_cast<int>(chunk.materialLibraries.size()); ++j)
+            importMaterials(chunk.materialLibraries[j].c_str());
+    }
+
+    m_numberOfVertexCoords = static_cast<int>(m_vertexCoords.size() / 3);
+    m_numberOfTextureCoords = static_cast<int>(m_textureCoords.size() / 2);
+    m_numberOfNormals = static_cast<int>(m_normals.size() / 3);
+
+    m_hasPositions = m_numberOfVertexCoords > 0;
+    m_hasNormals = m_numberOfNormals > 0 && (m_vertexAttributes & ATTRIBUTE_NORMAL);
+    m_hasTextureCoords = m_numberOfTextureCoords > 0 && (m_vertexAttributes & ATTRIBUTE_TEXCOORD);
+
+    // Define a default material if no materials were loaded.
+    if (m_numberOfMaterials == 0)
+        addDefaultMaterial();
+
+    // Resolve the usemtl names now that all the MTL files have been read.
+    // Unknown materials map to the first material like the stdio parser.
+
+    std::map<std::string, int>::const_iterator iter;
+
+    for (int i = 0; i < numChunks; ++i)
+    {
+        ObjGeometry &chunk = chunks[i];
+
+        chunk.materialIds.assign(chunk.materialNames.size(), 0);
+
+        for (int j = 0; j < static_cast<int>(chunk.materialNames.size()); ++j)
+        {
+            iter = m_materialCache.find(chunk.materialNames[j]);
+
+            if (iter != m_materialCache.end())
+                chunk.materialIds[j] = iter->second;
+        }
+    }
+
+    // Resolve the o and g statements in file order. A g statement that
+    // comes before its chunk's first o statement is in the object the
+    // previous chunk ended in.
+
+    std::string activeObject;
+    int activeGroup = options.keepGroups ? addGroup(activeObject, std::string()) : -1;
+
+    for (int i = 0; i < numChunks; ++i)
+    {
+        ObjGeometry &chunk = chunks[i];
+
+        chunk.groupIds.resize(chunk.groups.size());
+
+        for (int j = 0; j < static_cast<int>(chunk.groups.size()); ++j)
+        {
+            const ObjGroup &group = chunk.groups[j];
+
+            chunk.groupIds[j] = addGroup(group.objectKnown ? group.object : activeObject, group.group);
+        }
+
+        if (!chunk.groups.empty() && chunk.groups.back().objectKnown)
+            activeObject = chunk.groups.back().object;
+    }
+
+    m_importStats.parseTime = MillisecondsSince(phaseStart);
+    phaseStart = Clock::now();
+
+    // Validate the face indices and count the triangles.
+
+    const int *pCorner = 0;
+    int numTriangles = 0;
+
+    for (int i = 0; i < numChunks; ++i)
+    {
+        const ObjGeometry &chunk = chunks[i];
+
+        pCorner = chunk.corners.empty() ? 0 : &chunk.corners[0];
+
+        for (int j = 0; j < static_cast<int>(chunk.faces.size()); ++j)
+        {
+            const ObjFace &face = chunk.faces[j];
+            bool needsTexCoord = face.type == FACE_POS_TEXCOORD || face.type == FACE_POS_TEXCOORD_NORMAL;
+            bool needsNormal = face.type == FACE_POS_NORMAL || face.type == FACE_POS_TEXCOORD_NORMAL;
+
+            for (int k = 0; k < face.numCorners; ++k, pCorner += 3)
+            {
+                if (pCorner[0] < 0 || pCorner[0] >= m_numberOfVertexCoords)
+                    return false;
+
+                if (needsTexCoord && (pCorner[1] < 0 || pCorner[1] >= m_numberOfTextureCoords))
+                    return false;
+
+                if (needsNormal && (pCorner[2] < 0 || pCorner[2] >= m_numberOfNormals))
+                    return false;
+            }
+
+            numTriangles += face.numCorners - 2;
+        }
+    }
+
+    m_numberOfTriangles = numTriangles;
+    m_indexBuffer.resize(m_numberOfTriangles * 3);
+    m_attributeBuffer.resize(m_numberOfTriangles);
+
+    if (options.keepGroups)
+        m_groupBuffer.resize(m_numberOfTriangles);
+
+    if (m_pProgress)
+    {
+        m_pProgress->phase = PHASE_BUILDING;
+        m_pProgress->trianglesTotal = m_numberOfTriangles;
+    }
+
+    // Triangulate each face as a fan around its first corner. A chunk that
+    // starts without a usemtl statement inherits the previous chunk's active
+    // material, and likewise for the active group. When welding by sorting,
+    // the triangle corners are collected and welded afterwards instead of
+    // being added one at a time.
+
+    bool sortWelding = options.welding == WELD_SORT;
+    std::vector<int> triangleCorners;
+    int *pTriangleCorner = 0;
+
+    if (sortWelding)
+    {
+        triangleCorners.resize(m_numberOfTriangles * 9);
+        pTriangleCorner = triangleCorners.empty() ? 0 : &triangleCorners[0];
+    }
+    else
+    {
+        initVertexCache(m_numberOfTriangles);
+    }
+
+    const int *pFirst = 0;
+    const int *pPrev = 0;
+    int activeMaterial = 0;
+    int material = 0;
+    int group = -1;
+    int type = FACE_POS;
+
+    numTriangles = 0;
+
+    for (int i = 0; i < numChunks; ++i)
+    {
+        const ObjGeometry &chunk = chunks[i];
+
+        pCorner = chunk.corners.empty() ? 0 : &chunk.corners[0];
+
+        for (int j = 0; j < static_cast<int>(chunk.faces.size()); ++j)
+        {
+            const ObjFace &face = chunk.faces[j];
+
+            material = (face.material < 0) ? activeMaterial : chunk.materialIds[face.material];
+            type = MaskFaceType(face.type, m_vertexAttributes);
+
+            if (options.keepGroups)
+                group = (chunk.faceGroups[j] < 0) ? activeGroup : chunk.groupIds[chunk.faceGroups[j]];
+
+            pFirst = pCorner;
+            pCorner += 3;
+
+            for (int k = 2; k < face.numCorners; ++k)
+            {
+                pPrev = pCorner;
+                pCorner += 3;
+
+                if (options.keepGroups)
+                    m_groupBuffer[numTriangles] = group;
+
+                if (sortWelding)
+                {
+                    m_attributeBuffer[numTriangles++] = material;
+                    pTriangleCorner = CopyCorner(pFirst, type, pTriangleCorner);
+                    pTriangleCorner = CopyCorner(pPrev, type, pTriangleCorner);
+                    pTriangleCorner = CopyCorner(pCorner, type, pTriangleCorner);
+                    continue;
+                }
+
+                switch (type)
+                {
+                case FACE_POS:
+                    addTrianglePos(numTriangles++, material,
+                        pFirst[0], pPrev[0], pCorner[0]);
+                    break;
+
+                case FACE_POS_TEXCOORD:
+                    addTrianglePosTexCoord(numTriangles++, material,
+                        pFirst[0], pPrev[0], pCorner[0],
+                        pFirst[1], pPrev[1], pCorner[1]);
+                    break;
+
+                case FACE_POS_NORMAL:
+                    addTrianglePosNormal(numTriangles++, material,
+                        pFirst[0], pPrev[0], pCorner[0],
+                        pFirst[2], pPrev[2], pCorner[2]);
+                    break;
+
+                case FACE_POS_TEXCOORD_NORMAL:
+                    addTrianglePosTexCoordNormal(numTriangles++, material,
+                        pFirst[0], pPrev[0], pCorner[0],
+                        pFirst[1], pPrev[1], pCorner[1],
+                        pFirst[2], pPrev[2], pCorner[2]);
+                    break;
+                }
+            }
+
+            pCorner += 3;
+
+            if (m_pProgress && (j & 0xFFFF) == 0)
+            {
+                m_pProgress->trianglesBuilt = numTriangles;
+
+                if (m_pProgress->cancel)
+                    return false;
+            }
+        }
+
+        if (chunk.activeMaterial >= 0)
+            activeMaterial = chunk.materialIds[chunk.activeMaterial];
+
+        if (chunk.activeGroup >= 0)
+            activeGroup = chunk.groupIds[chunk.activeGroup];
+    }
+
+    if (sortWelding)
+        weldVertices(triangleCorners, numThreads);
+
+    if (m_pProgress)
+        m_pProgress->trianglesBuilt = numTriangles;
+
+    m_importStats.trianglesEmitted = numTriangles;
+    m_importStats.buildTime = MillisecondsSince(phaseStart);
+    return true;
+}
+
+bool ModelOBJ::importMaterials(const char *pszName)
+{
+    // Locate the MTL file named by a mtllib statement. A resolver supplied
+    // through ImportOptions takes precedence. Otherwise the MTL file must be
+    // located in the same directory as the OBJ file.
+
+    Clock::time_point start = Clock::now();
+
+    if (m_pMaterialResolver)
+    {
+        const char *pData = 0;
+        size_t size = 0;
+
+        if (!m_pMaterialResolver->resolve(pszName, pData, size))
+            return false;
+
+        importMaterials(pData, pData + size);
+        m_importStats.materialTime += MillisecondsSince(start);
+        return true;
+    }
+
+    std::string filename = m_directoryPath + pszName;
+    MappedFile mappedFile;
+
+    m_materialFiles.push_back(filename);
+
+    if (!mappedFile.open(filename.c_str()))
         return false;
 
+    importMaterials(mappedFile.data(), mappedFile.data() + mappedFile.size());
+    m_importStats.materialTime += MillisecondsSince(start);
+    return true;
+}
+
+void ModelOBJ::importMaterials(const char *pBegin, const char *pEnd)
+{
+    const char *p = 0;
     Material *pMaterial = 0;
     int illum = 0;
     int numMaterials = 0;
-    char buffer[256] = {0};
 
     // Count the number of materials in the MTL file.
-    while (fscanf(pFile, "%s", buffer) != EOF)
+    for (p = pBegin; p < pEnd; p = SkipLine(p, pEnd))
     {
-        switch (buffer[0])
-        {
-        case 'n': // newmtl
-            ++numMaterials;
-            fgets(buffer, sizeof(buffer), pFile);
-            sscanf(buffer, "%s %s", buffer, buffer);
-            break;
+        p = SkipBlanks(p, pEnd);
 
-        default:
-            fgets(buffer, sizeof(buffer), pFile);
-            break;
-        }
+        if (MatchKeyword(p, pEnd, "newmtl"))
+            ++numMaterials;
     }
 
-    rewind(pFile);
-
     m_numberOfMaterials = numMaterials;
     numMaterials = 0;
     m_materials.resize(m_numberOfMaterials);
 
     // Load the materials in the MTL file.
-    while (fscanf(pFile, "%s", buffer) != EOF)
+    for (p = pBegin; p < pEnd; p = SkipLine(p, pEnd))
     {
-        switch (buffer[0])
+        p = SkipBlanks(p, pEnd);
+
+        // Statements before the first newmtl have no material to apply to.
+        if (!pMaterial && !MatchKeyword(p, pEnd, "newmtl"))
+            continue;
+
+        switch (p < pEnd ? *p : '\0')
         {
         case 'N': // Ns
-            fscanf(pFile, "%f", &pMaterial->shininess);
+            if (MatchKeyword(p, pEnd, "Ns"))
+            {
+                p += 2;
+                ParseFloat(p, pEnd, pMaterial->shininess);
 
-            // Wavefront .MTL file shininess is from [0,1000].
-            // Scale back to a generic [0,1] range.
-            pMaterial->shininess /= 1000.0f;
+                // Wavefront .MTL file shininess is from [0,1000].
+                // Scale back to a generic [0,1] range.
+                pMaterial->shininess /= 1000.0f;
+            }
             break;
 
         case 'K': // Ka, Kd, or Ks
-            switch (buffer[1])
+            if (MatchKeyword(p, pEnd, "Ka"))
             {
-            case 'a': // Ka
-                fscanf(pFile, "%f %f %f",
-                    &pMaterial->ambient[0],
-                    &pMaterial->ambient[1],
-                    &pMaterial->ambient[2]);
+                p += 2;
+                ParseFloat(p, pEnd, pMaterial->ambient[0]);
+                ParseFloat(p, pEnd, pMaterial->ambient[1]);
+                ParseFloat(p, pEnd, pMaterial->ambient[2]);
                 pMaterial->ambient[3] = 1.0f;
-                break;
-
-            case 'd': // Kd
-                fscanf(pFile, "%f %f %f",
-                    &pMaterial->diffuse[0],
-                    &pMaterial->diffuse[1],
-                    &pMaterial->diffuse[2]);
+            }
+            else if (MatchKeyword(p, pEnd, "Kd"))
+            {
+                p += 2;
+                ParseFloat(p, pEnd, pMaterial->diffuse[0]);
+                ParseFloat(p, pEnd, pMaterial->diffuse[1]);
+                ParseFloat(p, pEnd, pMaterial->diffuse[2]);
                 pMaterial->diffuse[3] = 1.0f;
-                break;
-
-            case 's': // Ks
-                fscanf(pFile, "%f %f %f",
-                    &pMaterial->specular[0],
-                    &pMaterial->specular[1],
-                    &pMaterial->specular[2]);
+            }
+            else if (MatchKeyword(p, pEnd, "Ks"))
+            {
+                p += 2;
+                ParseFloat(p, pEnd, pMaterial->specular[0]);
+                ParseFloat(p, pEnd, pMaterial->specular[1]);
+                ParseFloat(p, pEnd, pMaterial->specular[2]);
                 pMaterial->specular[3] = 1.0f;
-                break;
-
-            default:
-                fgets(buffer, sizeof(buffer), pFile);
-                break;
             }
             break;
 
         case 'T': // Tr
-            switch (buffer[1])
+            if (MatchKeyword(p, pEnd, "Tr"))
             {
-            case 'r': // Tr
-                fscanf(pFile, "%f", &pMaterial->alpha);
+                p += 2;
+                ParseFloat(p, pEnd, pMaterial->alpha);
                 pMaterial->alpha = 1.0f - pMaterial->alpha;
-                break;
-
-            default:
-                fgets(buffer, sizeof(buffer), pFile);
-                break;
             }
             break;
 
         case 'd':
-            fscanf(pFile, "%f", &pMaterial->alpha);
+            if (MatchKeyword(p, pEnd, "d"))
+            {
+                p += 1;
+                ParseFloat(p, pEnd, pMaterial->alpha);
+            }
             break;
 
         case 'i': // illum
-            fscanf(pFile, "%d", &illum);
-
-            if (illum == 1)
+            if (MatchKeyword(p, pEnd, "illum"))
             {
-                pMaterial->specular[0] = 0.0f;
-                pMaterial->specular[1] = 0.0f;
-                pMaterial->specular[2] = 0.0f;
-                pMaterial->specular[3] = 1.0f;
+                p = SkipBlanks(p + 5, pEnd);
+
+                if (ParseInt(p, pEnd, illum) && illum == 1)
+                {
+                    pMaterial->specular[0] = 0.0f;
+                    pMaterial->specular[1] = 0.0f;
+                    pMaterial->specular[2] = 0.0f;
+                    pMaterial->specular[3] = 1.0f;
+                }
             }
             break;
 
         case 'm': // map_Kd, map_bump
-            if (strstr(buffer, "map_Kd") != 0)
-            {
-                fgets(buffer, sizeof(buffer), pFile);
-                sscanf(buffer, "%s %s", buffer, buffer);
-                pMaterial->colorMapFilename = buffer;
-            }
-            else if (strstr(buffer, "map_bump") != 0)
-            {
-                fgets(buffer, sizeof(buffer), pFile);
-                sscanf(buffer, "%s %s", buffer, buffer);
-                pMaterial->bumpMapFilename = buffer;
-            }
-            else
-            {
-                fgets(buffer, sizeof(buffer), pFile);
-            }
+            // Texture map options come before the file name, so the file
+            // name is the last name on the line.
+            if (MatchKeyword(p, pEnd, "map_Kd"))
+                pMaterial->colorMapFilename = ParseLastName(p + 6, pEnd);
+            else if (MatchKeyword(p, pEnd, "map_bump"))
+                pMaterial->bumpMapFilename = ParseLastName(p + 8, pEnd);
             break;
 
         case 'n': // newmtl
-            fgets(buffer, sizeof(buffer), pFile);
-            sscanf(buffer, "%s %s", buffer, buffer);
-
-            pMaterial = &m_materials[numMaterials];
-            pMaterial->ambient[0] = 0.2f;
-            pMaterial->ambient[1] = 0.2f;
-            pMaterial->ambient[2] = 0.2f;
-            pMaterial->ambient[3] = 1.0f;
-            pMaterial->diffuse[0] = 0.8f;
-            pMaterial->diffuse[1] = 0.8f;
-            pMaterial->diffuse[2] = 0.8f;
-            pMaterial->diffuse[3] = 1.0f;
-            pMaterial->specular[0] = 0.0f;
-            pMaterial->specular[1] = 0.0f;
-            pMaterial->specular[2] = 0.0f;
-            pMaterial->specular[3] = 1.0f;
-            pMaterial->shininess = 0.0f;
-            pMaterial->alpha = 1.0f;
-            pMaterial->name = buffer;
-            pMaterial->colorMapFilename.clear();
-            pMaterial->bumpMapFilename.clear();
-
-            m_materialCache[pMaterial->name] = numMaterials;
-            ++numMaterials;
+            if (MatchKeyword(p, pEnd, "newmtl"))
+            {
+                pMaterial = &m_materials[numMaterials];
+                pMaterial->ambient[0] = 0.2f;
+                pMaterial->ambient[1] = 0.2f;
+                pMaterial->ambient[2] = 0.2f;
+                pMaterial->ambient[3] = 1.0f;
+                pMaterial->diffuse[0] = 0.8f;
+                pMaterial->diffuse[1] = 0.8f;
+                pMaterial->diffuse[2] = 0.8f;
+                pMaterial->diffuse[3] = 1.0f;
+                pMaterial->specular[0] = 0.0f;
+                pMaterial->specular[1] = 0.0f;
+                pMaterial->specular[2] = 0.0f;
+                pMaterial->specular[3] = 1.0f;
+                pMaterial->shininess = 0.0f;
+                pMaterial->alpha = 1.0f;
+                pMaterial->name = ParseName(p + 6, pEnd);
+                pMaterial->colorMapFilename.clear();
+                pMaterial->bumpMapFilename.clear();
+
+                m_materialCache[pMaterial->name] = numMaterials;
+                ++numMaterials;
+            }
             break;
 
         default:
-            fgets(buffer, sizeof(buffer), pFile);
             break;
         }
     }
+}
 
-    fclose(pFile);
-    return true;
-}
\ No newline at end of file
+//-----------------------------------------------------------------------------
+// ModelOBJ::AsyncImport.
+//-----------------------------------------------------------------------------
+
+ModelOBJ::AsyncImport::AsyncImport(const char *pszFilename, const ImportOptions &options)
+    : m_filename(pszFilename), m_options(options), m_finished(false), m_succeeded(false)
+{
+    m_options.pProgress = &m_progress;
+    m_thread = std::thread(&AsyncImport::run, this);
+}
+
+ModelOBJ::AsyncImport::~AsyncImport()
+{
+    cancel();
+    m_thread.join();
+}
+
+void ModelOBJ::AsyncImport::run()
+{
+    m_succeeded = m_model.import(m_filename.c_str(), m_options);
+    m_finished = true;
+}
@@ -23,23 +23,26 @@
 #if !defined(MODEL_OBJ_H)
 #define MODEL_OBJ_H
 
+#include <atomic>
 #include <cstdio>
+#include <iosfwd>
 #include <map>
 #include <string>
+#include <thread>
 #include <vector>
 
 //-----------------------------------------------------------------------------
 // Alias|Wavefront OBJ file loader.
 //
 // This OBJ file loader contains the following restrictions:
-// 1. Group information is ignored. Faces are grouped based on the material
-//    that each face uses.
-// 2. Object information is ignored. This loader will merge everything into a
-//    single object.
-// 3. The MTL file must be located in the same directory as the OBJ file. If
-//    it isn't then the MTL file will fail to load and a default material is
+// 1. Object and group information is ignored unless keepGroups is set in the
+//    ImportOptions. Faces are grouped based on the material that each face
+//    uses, and everything is merged into a single object.
+// 2. The MTL file must be located in the same directory as the OBJ file,
+//    unless a MaterialResolver is supplied in the ImportOptions. If it can't
+//    be found then the MTL file will fail to load and a default material is
 //    used instead.
-// 4. This loader triangulates all polygonal faces during importing.
+// 3. This loader triangulates all polygonal faces during importing.
 //-----------------------------------------------------------------------------
 
 class ModelOBJ
@@ -67,6 +70,109 @@ public:
         float bitangent[3];
     };
 
+    enum VertexAttribute
+    {
+        ATTRIBUTE_POSITION = 1,
+        ATTRIBUTE_TEXCOORD = 2,
+        ATTRIBUTE_NORMAL = 4,
+        ATTRIBUTE_TANGENT = 8,
+        ATTRIBUTE_BITANGENT = 16,
+        ATTRIBUTE_ALL = 31
+    };
+
+    // A packed vertex holding only the attributes in the Attributes mask, in
+    // the same order as Vertex. Unused attributes take no space, so
+    // VertexLayout<ATTRIBUTE_POSITION> is 12 bytes. Vertex has the same
+    // memory layout as VertexLayout<ATTRIBUTE_ALL>. Accessing an attribute
+    // that isn't part of the layout is a compile time error.
+
+    template <unsigned int Attributes>
+    struct VertexLayout
+    {
+        enum
+        {
+            attributes = Attributes,
+
+            positionSize = (Attributes & ATTRIBUTE_POSITION) ? 3 : 0,
+            texCoordSize = (Attributes & ATTRIBUTE_TEXCOORD) ? 2 : 0,
+            normalSize = (Attributes & ATTRIBUTE_NORMAL) ? 3 : 0,
+            tangentSize = (Attributes & ATTRIBUTE_TANGENT) ? 4 : 0,
+            bitangentSize = (Attributes & ATTRIBUTE_BITANGENT) ? 3 : 0,
+
+            positionOffset = 0,
+            texCoordOffset = positionOffset + positionSize,
+            normalOffset = texCoordOffset + texCoordSize,
+            tangentOffset = normalOffset + normalSize,
+            bitangentOffset = tangentOffset + tangentSize,
+            size = bitangentOffset + bitangentSize
+        };
+
+        static_assert(size > 0, "VertexLayout needs at least one attribute");
+
+        float data[size];
+
+        float *position();
+        float *texCoord();
+        float *normal();
+        float *tangent();
+        float *bitangent();
+
+        const float *position() const;
+        const float *texCoord() const;
+        const float *normal() const;
+        const float *tangent() const;
+        const float *bitangent() const;
+
+        void set(const Vertex &vertex);
+    };
+
+    typedef VertexLayout<ATTRIBUTE_POSITION> VertexP;
+    typedef VertexLayout<ATTRIBUTE_POSITION | ATTRIBUTE_NORMAL> VertexPN;
+    typedef VertexLayout<ATTRIBUTE_POSITION | ATTRIBUTE_TEXCOORD> VertexPT;
+    typedef VertexLayout<ATTRIBUTE_POSITION | ATTRIBUTE_TEXCOORD | ATTRIBUTE_NORMAL> VertexPTN;
+    typedef VertexLayout<ATTRIBUTE_ALL> VertexPTNTB;
+
+    enum VertexStorage
+    {
+        STORAGE_INTERLEAVED,    // array of Vertex structures, ready to draw
+        STORAGE_SOA             // structure of arrays, one per component
+    };
+
+    // How tangents are generated for bump mapped models. Both methods store
+    // the w the normal mapping shader expects, bitangent = w * cross(normal,
+    // tangent) with the normal map's origin at the top left: w is -1 where
+    // the texture mapping preserves the triangle's orientation. Maps baked
+    // by MikkTSpace tools therefore need a Y- (DirectX style) green channel.
+    // TANGENTS_MIKKTSPACE splits the vertices shared by mirrored UV islands
+    // so that each copy has one w, and weights the face tangents by angle.
+    enum TangentMethod
+    {
+        TANGENTS_FACE_AVERAGE,  // sum of face tangents
+        TANGENTS_MIKKTSPACE     // may add vertices on mirrored seams
+    };
+
+    // Vertex components in the same order as the floats in Vertex. With
+    // STORAGE_SOA each component is a separate 64 byte aligned array.
+    enum VertexComponent
+    {
+        COMPONENT_POSITION_X,
+        COMPONENT_POSITION_Y,
+        COMPONENT_POSITION_Z,
+        COMPONENT_TEXCOORD_U,
+        COMPONENT_TEXCOORD_V,
+        COMPONENT_NORMAL_X,
+        COMPONENT_NORMAL_Y,
+        COMPONENT_NORMAL_Z,
+        COMPONENT_TANGENT_X,
+        COMPONENT_TANGENT_Y,
+        COMPONENT_TANGENT_Z,
+        COMPONENT_TANGENT_W,
+        COMPONENT_BITANGENT_X,
+        COMPONENT_BITANGENT_Y,
+        COMPONENT_BITANGENT_Z,
+        NUMBER_OF_COMPONENTS
+    };
+
     struct Mesh
     {
         int startIndex;
@@ -74,13 +180,320 @@ public:
         const Material *pMaterial;
     };
 
+    // Axis aligned bounds of a mesh's or a group's triangles. See
+    // getMeshBounds() and getGroupBounds().
+    struct BoundingBox
+    {
+        float boundsMin[3];
+        float boundsMax[3];
+    };
+
+    // An OBJ object or group, kept when ImportOptions::keepGroups is set.
+    // Groups are children of the object they're in and follow it, so the
+    // triangles and meshes of a group include those of its children. A
+    // group's own meshes come first and are sorted by alpha. Faces outside
+    // of any object or group belong to a group named "default". See
+    // getGroupBounds() and cullGroups().
+    struct Group
+    {
+        std::string name;
+        int parent;             // getGroup() index, -1 at the top level
+        int childCount;
+        int startIndex;
+        int triangleCount;
+        int firstMesh;          // getMesh() index
+        int meshCount;
+    };
+
+    // A small cluster of one mesh's triangles, consecutive in the index
+    // buffer, with bounds for culling. A meshlet faces away from every eye
+    // position where dot(normalize(coneApex - eye), coneAxis) >= coneCutoff.
+    struct Meshlet
+    {
+        int mesh;               // getMesh() index
+        int startIndex;
+        int triangleCount;
+        int vertexCount;        // distinct vertices used
+        float center[3];        // bounding sphere
+        float radius;
+        float coneApex[3];
+        float coneAxis[3];
+        float coneCutoff;       // 1 if the meshlet can't be back face culled
+    };
+
+    // A node of the triangle BVH. The two children of an interior node are
+    // next to each other, and children always follow their parent.
+    struct BvhNode
+    {
+        float boundsMin[3];
+        int first;              // leaf: first BVH triangle, else left child
+        float boundsMax[3];
+        int count;              // leaf: number of triangles, else 0
+    };
+
+    // Result of a BVH query. Rays hit both sides of a triangle.
+    struct RayHit
+    {
+        int triangle;           // index buffer triangle, -1 if none found
+        float distance;         // ray parameter, or distance to the point
+        float barycentric[2];   // weights of the triangle's 2nd and 3rd corners
+        float position[3];
+    };
+
+    // A simplified level of detail. It has one mesh for each of the model's
+    // meshes, in the same order, indexing the model's vertex buffer through
+    // getLodIndexBuffer(). Meshes that were simplified away have no
+    // triangles.
+    struct Lod
+    {
+        float ratio;            // requested fraction of the model's triangles
+        float error;            // largest distance the surface moved
+        int startIndex;         // first index in getLodIndexBuffer()
+        int triangleCount;
+    };
+
+    enum ParserType
+    {
+        PARSER_STDIO,           // two pass fscanf() parser
+        PARSER_MAPPED           // single pass parser over a memory mapped file
+    };
+
+    enum WeldingEngine
+    {
+        WELD_HASH,              // hash each corner as the faces are read
+        WELD_SORT               // parallel radix sort of all the corners
+    };
+
+    // Supplies the contents of the MTL files named by mtllib statements.
+    // Use this when the MTL files don't live next to the OBJ file, or when
+    // the OBJ file is imported from memory or from a stream.
+    class MaterialResolver
+    {
+    public:
+        virtual ~MaterialResolver() {}
+
+        // Points 'pData' at the contents of the MTL file 'pszName' and sets
+        // 'size' to its length in bytes. The contents must remain valid until
+        // the import returns. Returns false if the MTL file can't be found.
+        virtual bool resolve(const char *pszName, const char *&pData, size_t &size) = 0;
+    };
+
+    enum ImportPhase
+    {
+        PHASE_PARSING,          // reading the OBJ file
+        PHASE_BUILDING,         // triangulating faces and welding vertices
+        PHASE_POST_PROCESSING,  // building meshes, normals and tangents
+        PHASE_FINISHED
+    };
+
+    // Progress of an import. The importing thread updates the counters and
+    // any other thread may read them. Setting 'cancel' makes the import stop
+    // at the next check and return false.
+    struct ImportProgress
+    {
+        ImportProgress();
+
+        std::atomic<int> phase;                         // ImportPhase
+        std::atomic<unsigned long long> bytesParsed;
+        std::atomic<unsigned long long> bytesTotal;     // 0 if unknown
+        std::atomic<int> trianglesBuilt;
+        std::atomic<int> trianglesTotal;                // 0 until known
+        std::atomic<bool> cancel;
+    };
+
+    // Timings and counters gathered by the last import. Times are in
+    // milliseconds, and materialTime is included in parseTime.
+    struct ImportStats
+    {
+        ImportStats();
+
+        std::string toJson() const;
+
+        bool loadedFromCache;
+
+        double totalTime;
+        double parseTime;           // first pass, or the mapped parser
+        double buildTime;           // second pass, or triangulating
+        double materialTime;        // reading MTL files
+        double buildMeshesTime;
+        double boundsTime;
+        double normalsTime;
+        double tangentsTime;
+        double vertexCacheTime;     // optimizing the meshes for the vertex cache
+        double vertexFetchTime;     // reordering the vertices for fetch locality
+        double lodTime;             // simplifying the levels of detail
+        double meshletTime;         // partitioning the meshes into meshlets
+        double bvhTime;             // building the triangle BVH
+        double cacheTime;           // loading or saving the binary cache
+
+        unsigned long long bytesRead;
+        int positionLines;          // v
+        int texCoordLines;          // vt
+        int normalLines;            // vn
+        int faceLines;              // f
+        int useMaterialLines;       // usemtl
+        int materialLibraryLines;   // mtllib
+        int trianglesEmitted;
+
+        long long vertexLookups;    // face corners welded into vertices
+        long long vertexHits;       // corners that reused an existing vertex
+        long long cacheProbes;      // extra vertex cache slots probed
+        int maxProbeLength;
+
+        // Post-transform vertex cache efficiency of the meshes before and
+        // after ImportOptions::optimizeVertexCache, for a 16 entry FIFO
+        // cache. ACMR is transformed vertices per triangle and ATVR is
+        // transformed vertices per vertex, 1.0 being ideal. Kept in the
+        // binary cache.
+        float acmrBefore;
+        float acmrAfter;
+        float atvrBefore;
+        float atvrAfter;
+
+        // Vertex fetch locality before and after
+        // ImportOptions::optimizeVertexFetch: bytes of 64 byte cache lines
+        // loaded through a 16 KB cache per byte of vertex data used. Lower
+        // is better. Kept in the binary cache.
+        float overfetchBefore;
+        float overfetchAfter;
+
+        // Peak size of each buffer in bytes.
+        size_t vertexBufferBytes;
+        size_t indexBufferBytes;
+        size_t attributeBufferBytes;
+        size_t vertexCoordBytes;
+        size_t textureCoordBytes;
+        size_t normalBytes;
+        size_t vertexCacheBytes;    // vertex cache and attribute class tables
+        size_t parseScratchBytes;   // mapped parser chunk buffers
+    };
+
+    // Approximate heap memory used by each of the model's buffers, in bytes.
+    // The import-only buffers are empty after releaseImportData().
+    struct MemoryUsage
+    {
+        size_t vertexBuffer;
+        size_t vertexStreams;   // STORAGE_SOA only
+        size_t indexBuffer;
+        size_t meshes;
+        size_t groups;
+        size_t lods;            // LOD index buffer and meshes
+        size_t meshlets;
+        size_t bvh;             // BVH nodes and triangles
+        size_t materials;
+
+        // Import-only buffers.
+        size_t attributeBuffer; // per triangle materials and groups
+        size_t vertexCoords;
+        size_t textureCoords;
+        size_t normals;
+        size_t materialCache;
+        size_t groupCache;
+        size_t vertexCache;     // vertex cache and attribute class tables
+
+        size_t total;           // sum of the above
+        size_t mappedCache;     // mapped binary cache, not included in total
+    };
+
+    enum TexCoordPacking
+    {
+        TEXCOORD_HALF,          // half floats
+        TEXCOORD_UNORM16        // unorm16 within the texture coordinate bounds
+    };
+
+    // A 20 byte vertex for upload. Decode it in the vertex shader using the
+    // PackedVertexInfo filled in by packVertexBuffer(). The bitangent isn't
+    // stored: it's cross(normal, tangent.xyz) * tangent.w.
+    struct PackedVertex
+    {
+        unsigned short position[4]; // unorm16 within the bounds, [3] is 0
+        unsigned short texCoord[2]; // TexCoordPacking
+        unsigned int normal;        // octahedral, snorm16 x in the low bits
+        unsigned int tangent;       // snorm 10:10:10:2, w is the handedness
+    };
+
+    struct PackedVertexInfo
+    {
+        // position = positionOffset + positionScale * unorm16 position.
+        float positionOffset[3];
+        float positionScale[3];
+
+        // Same for texture coordinates when packed as TEXCOORD_UNORM16.
+        float texCoordOffset[2];
+        float texCoordScale[2];
+
+        // Largest error the packing introduced over all the vertices.
+        float maxPositionError;     // model units
+        float maxTexCoordError;     // texture coordinate units
+        float maxNormalError;       // degrees
+        float maxTangentError;      // degrees
+    };
+
+    class AsyncImport;
+
+    struct ImportOptions
+    {
+        ImportOptions();
+
+        ParserType parser;      // ignored when importing from memory or streams
+        int numThreads;         // import threads, 0 = one per core
+        WeldingEngine welding;  // mapped parser only, same output either way
+        bool rebuildNormals;
+        bool useCache;          // load and save <OBJ file>.cache
+        bool lean;              // call releaseImportData() after importing
+        unsigned int vertexAttributes;  // VertexAttribute mask to import
+        VertexStorage vertexStorage;    // STORAGE_SOA disables useCache
+        TangentMethod tangentMethod;    // bitangents skipped if not imported
+        bool optimizeVertexCache;       // reorder each mesh's triangles
+        bool optimizeVertexFetch;       // reorder vertices by first use
+        bool mergeMeshesByMaterial;     // one mesh per material, not per run
+        bool keepGroups;                // split the meshes by object and group
+        std::vector<float> lodRatios;   // LOD triangle fractions, e.g. 0.5 0.25
+        bool buildMeshlets;             // reorders each mesh's triangles
+        int meshletMaxVertices;         // 3 or more
+        int meshletMaxTriangles;        // 1 or more
+        bool buildBvh;                  // for ray and nearest point queries
+        bool normalize;                 // normalize() once imported
+        MaterialResolver *pMaterialResolver;    // 0 = MTL is next to the OBJ
+        ImportProgress *pProgress;              // 0 = no progress reporting
+    };
+
     ModelOBJ();
     ~ModelOBJ();
 
+    template <class Layout>
+    void copyVertexBuffer(std::vector<Layout> &vertices) const;
+
+    void buildBvh(int numThreads = 0);
+    int cullGroups(const float viewProjection[16], unsigned char *pVisible) const;
+    int cullMeshes(const float viewProjection[16], unsigned char *pVisible) const;
+    int cullMeshlets(const float viewProjection[16], const float *pEye,
+        unsigned char *pVisible) const;
     void destroy();
+    bool findNearestPoint(const float point[3], float maxDistance,
+        RayHit &hit) const;
     bool import(const char *pszFilename, bool rebuildNormals = false);
+    bool import(const char *pszFilename, const ImportOptions &options);
+    bool importFromMemory(const void *pData, size_t size,
+        const ImportOptions &options = ImportOptions());
+    bool importFromStream(std::istream &stream,
+        const ImportOptions &options = ImportOptions());
+    bool intersectRay(const float origin[3], const float direction[3],
+        float maxDistance, RayHit &hit) const;
+    bool intersectRayAny(const float origin[3], const float direction[3],
+        float maxDistance) const;
+    void intersectRays(const float *pOrigins, const float *pDirections,
+        int count, float maxDistance, RayHit *pHits) const;
     void normalize(float scaleTo = 1.0f, bool center = true);
+    void packVertexBuffer(std::vector<PackedVertex> &vertices,
+        PackedVertexInfo &info,
+        TexCoordPacking texCoordPacking = TEXCOORD_HALF) const;
+    void refitBvh();
+    void releaseImportData();
     void reverseWinding();
+    int selectLod(float maxError) const;
+    void setVertexStorage(VertexStorage storage);
+    void swap(ModelOBJ &other);
 
     // Getter methods.
 
@@ -90,30 +503,69 @@ public:
     float getLength() const;
     float getRadius() const;
 
+    const BvhNode &getBvhNode(int i) const;
+    const Group &getGroup(int i) const;
+    const BoundingBox &getGroupBounds(int i) const;
+
     const int *getIndexBuffer() const;
     int getIndexSize() const;
 
+    const ImportStats &getImportStats() const;
+
+    const Lod &getLod(int i) const;
+    const int *getLodIndexBuffer() const;
+    const Mesh &getLodMesh(int lod, int mesh) const;
+
     const Material &getMaterial(int i) const;
+    MemoryUsage getMemoryUsage() const;
     const Mesh &getMesh(int i) const;
+    const BoundingBox &getMeshBounds(int i) const;
+    const Meshlet &getMeshlet(int i) const;
 
+    int getNumberOfBvhNodes() const;
+    int getNumberOfGroups() const;
     int getNumberOfIndices() const;
+    int getNumberOfLods() const;
     int getNumberOfMaterials() const;
     int getNumberOfMeshes() const;
+    int getNumberOfMeshlets() const;
     int getNumberOfTriangles() const;
     int getNumberOfVertices() const;
 
     const std::string &getPath() const;
 
+    // The vertex buffer is only available with STORAGE_INTERLEAVED and the
+    // vertex streams only with STORAGE_SOA. They return 0 otherwise.
+
     const Vertex &getVertex(int i) const;
     const Vertex *getVertexBuffer() const;
+    unsigned int getVertexAttributes() const;
     int getVertexSize() const;
+    VertexStorage getVertexStorage() const;
+    const float *getVertexStream(VertexComponent component) const;
 
+    bool hasBvh() const;
     bool hasNormals() const;
     bool hasPositions() const;
     bool hasTangents() const;
     bool hasTextureCoords() const;
 
 private:
+    class CacheFile;
+
+    ModelOBJ(const ModelOBJ &);
+    ModelOBJ &operator=(const ModelOBJ &);
+
+    struct VertexCacheEntry
+    {
+        int position;       // v index
+        int texCoord;       // vt class, -1 if zero or missing
+        int normal;         // vn class, -1 if zero or missing
+        int index;          // vertex buffer index, -1 if the slot is empty
+    };
+
+    void addDefaultMaterial();
+    int addGroup(const std::string &object, const std::string &group);
     void addTrianglePos(int index, int material,
         int v0, int v1, int v2);
     void addTrianglePosNormal(int index, int material,
@@ -126,16 +578,44 @@ private:
         int v0, int v1, int v2,
         int vt0, int vt1, int vt2,
         int vn0, int vn1, int vn2);
-    int addVertex(int hash, const Vertex *pVertex);
+    int addVertex(int v, int vt, int vn, const Vertex *pVertex);
     void bounds(float center[3], float &width, float &height,
         float &length, float &radius) const;
+    void buildGroups(int numThreads);
     void buildMeshes();
-    void generateNormals();
-    void generateTangents();
+    void buildMeshlets(int maxVertices, int maxTriangles, int numThreads);
+    bool cancelled() const;
+    void computeMeshBounds(int numThreads);
+    void computeMeshletBounds(int numThreads);
+    void detachCacheFile();
+    void fetchPosition(int i, float position[3]) const;
+    const Vertex &fetchVertex(int i, Vertex &vertex) const;
+    void generateLods(const std::vector<float> &ratios);
+    void generateNormals(int numThreads);
+    void generateTangents(TangentMethod method, int numThreads);
+    void growVertexCache();
+    int *indexBuffer();
+    void initVertexCache(int numTriangles);
     void importGeometryFirstPass(FILE *pFile);
-    void importGeometrySecondPass(FILE *pFile);
-    bool importMaterials(const char *pszFilename);
+    void importGeometrySecondPass(FILE *pFile, bool keepGroups);
+    bool importGeometryMapped(const char *pBegin, const char *pEnd,
+        const ImportOptions &options);
+    bool importMaterials(const char *pszName);
+    void importMaterials(const char *pBegin, const char *pEnd);
+    bool loadCache(const char *pszFilename, const ImportOptions &options);
+    void optimizeVertexCache(int numThreads);
+    void optimizeVertexFetch();
+    bool postImport(const ImportOptions &options);
+    void recordMemoryStats();
+    bool readCache(const char *pszFilename, const ImportOptions &options,
+        char *pData, size_t size);
+    bool saveCache(const char *pszFilename, const ImportOptions &options) const;
     void scale(float scaleFactor, float offset[3]);
+    void sortTriangles(const std::vector<int> &keys, int numKeys, int numThreads);
+    void splitMirroredVertices(int numThreads);
+    Vertex *vertexBuffer();
+    float *vertexStream(VertexComponent component);
+    void weldVertices(const std::vector<int> &corners, int numThreads);
 
     bool m_hasPositions;
     bool m_hasTextureCoords;
@@ -156,18 +636,62 @@ private:
     float m_radius;
 
     std::string m_directoryPath;
+    MaterialResolver *m_pMaterialResolver;
+    unsigned int m_vertexAttributes;
+    ImportProgress *m_pProgress;
+    ImportStats m_importStats;
 
     std::vector<Mesh> m_meshes;
+    std::vector<BoundingBox> m_meshBounds;
+    std::vector<Group> m_groups;
+    std::vector<BoundingBox> m_groupBounds;
     std::vector<Material> m_materials;
     std::vector<Vertex> m_vertexBuffer;
     std::vector<int> m_indexBuffer;
     std::vector<int> m_attributeBuffer;
+    std::vector<int> m_groupBuffer;
     std::vector<float> m_vertexCoords;
     std::vector<float> m_textureCoords;
     std::vector<float> m_normals;
 
+    // Levels of detail. m_lodMeshes holds m_numberOfMeshes meshes per LOD.
+    std::vector<Lod> m_lods;
+    std::vector<Mesh> m_lodMeshes;
+    std::vector<int> m_lodIndexBuffer;
+
+    std::vector<Meshlet> m_meshlets;
+
+    // Triangle BVH. m_bvhTriangles holds index buffer triangles in leaf
+    // order and m_bvhPositions a copy of their corner positions, 9 floats
+    // per triangle, so that queries don't depend on the vertex storage.
+    std::vector<BvhNode> m_bvhNodes;
+    std::vector<int> m_bvhTriangles;
+    std::vector<float> m_bvhPositions;
+
+    // Structure of arrays vertex storage. Each component gets
+    // m_vertexStreamStride floats starting m_vertexStreamOffset floats into
+    // m_vertexStreams, which aligns the streams to 64 bytes.
+    VertexStorage m_vertexStorage;
+    std::vector<float> m_vertexStreams;
+    int m_vertexStreamOffset;
+    int m_vertexStreamStride;
+    int m_numberOfStreamVertices;
+
     std::map<std::string, int> m_materialCache;
-    std::map<int, std::vector<int> > m_vertexCache;
+    std::map<std::string, int> m_groupCache;
+    std::vector<std::string> m_materialFiles;
+    std::vector<VertexCacheEntry> m_vertexCache;
+    std::vector<int> m_texCoordCache;
+    std::vector<int> m_texCoordClasses;
+    std::vector<int> m_normalCache;
+    std::vector<int> m_normalClasses;
+
+    // Set when the model was loaded from a binary cache. The vertex and
+    // index buffers then live in the mapped cache instead of the vectors.
+    CacheFile *m_pCacheFile;
+    Vertex *m_pCacheVertexBuffer;
+    int *m_pCacheIndexBuffer;
+    int m_numberOfCacheVertices;
 };
 
 //-----------------------------------------------------------------------------
@@ -187,45 +711,101 @@ inline float ModelOBJ::getLength() const
 inline float ModelOBJ::getRadius() const
 { return m_radius; }
 
+inline const ModelOBJ::BvhNode &ModelOBJ::getBvhNode(int i) const
+{ return m_bvhNodes[i]; }
+
+inline const ModelOBJ::Group &ModelOBJ::getGroup(int i) const
+{ return m_groups[i]; }
+
+inline const ModelOBJ::BoundingBox &ModelOBJ::getGroupBounds(int i) const
+{ return m_groupBounds[i]; }
+
 inline const int *ModelOBJ::getIndexBuffer() const
-{ return &m_indexBuffer[0]; }
+{ return m_pCacheFile ? m_pCacheIndexBuffer : (m_indexBuffer.empty() ? 0 : &m_indexBuffer[0]); }
 
 inline int ModelOBJ::getIndexSize() const
 { return static_cast<int>(sizeof(int)); }
 
+inline const ModelOBJ::ImportStats &ModelOBJ::getImportStats() const
+{ return m_importStats; }
+
+inline const ModelOBJ::Lod &ModelOBJ::getLod(int i) const
+{ return m_lods[i]; }
+
+inline const int *ModelOBJ::getLodIndexBuffer() const
+{ return m_lodIndexBuffer.empty() ? 0 : &m_lodIndexBuffer[0]; }
+
+inline const ModelOBJ::Mesh &ModelOBJ::getLodMesh(int lod, int mesh) const
+{ return m_lodMeshes[lod * m_numberOfMeshes + mesh]; }
+
 inline const ModelOBJ::Material &ModelOBJ::getMaterial(int i) const
 { return m_materials[i]; }
 
 inline const ModelOBJ::Mesh &ModelOBJ::getMesh(int i) const
 { return m_meshes[i]; }
 
+inline const ModelOBJ::BoundingBox &ModelOBJ::getMeshBounds(int i) const
+{ return m_meshBounds[i]; }
+
+inline const ModelOBJ::Meshlet &ModelOBJ::getMeshlet(int i) const
+{ return m_meshlets[i]; }
+
+inline int ModelOBJ::getNumberOfBvhNodes() const
+{ return static_cast<int>(m_bvhNodes.size()); }
+
+inline int ModelOBJ::getNumberOfGroups() const
+{ return static_cast<int>(m_groups.size()); }
+
 inline int ModelOBJ::getNumberOfIndices() const
 { return m_numberOfTriangles * 3; }
 
+inline int ModelOBJ::getNumberOfLods() const
+{ return static_cast<int>(m_lods.size()); }
+
 inline int ModelOBJ::getNumberOfMaterials() const
 { return m_numberOfMaterials; }
 
 inline int ModelOBJ::getNumberOfMeshes() const
 { return m_numberOfMeshes; }
 
+inline int ModelOBJ::getNumberOfMeshlets() const
+{ return static_cast<int>(m_meshlets.size()); }
+
 inline int ModelOBJ::getNumberOfTriangles() const
 { return m_numberOfTriangles; }
 
 inline int ModelOBJ::getNumberOfVertices() const
-{ return static_cast<int>(m_vertexBuffer.size()); }
+{
+    if (m_vertexStorage == STORAGE_SOA)
+        return m_numberOfStreamVertices;
+
+    return m_pCacheFile ? m_numberOfCacheVertices : static_cast<int>(m_vertexBuffer.size());
+}
 
 inline const std::string &ModelOBJ::getPath() const
 { return m_directoryPath; }
 
 inline const ModelOBJ::Vertex &ModelOBJ::getVertex(int i) const
-{ return m_vertexBuffer[i]; }
+{ return getVertexBuffer()[i]; }
 
 inline const ModelOBJ::Vertex *ModelOBJ::getVertexBuffer() const
-{ return &m_vertexBuffer[0]; }
+{ return m_pCacheFile ? m_pCacheVertexBuffer : (m_vertexBuffer.empty() ? 0 : &m_vertexBuffer[0]); }
+
+inline ModelOBJ::VertexStorage ModelOBJ::getVertexStorage() const
+{ return m_vertexStorage; }
+
+inline const float *ModelOBJ::getVertexStream(VertexComponent component) const
+{ return m_vertexStreams.empty() ? 0 : &m_vertexStreams[m_vertexStreamOffset + component * m_vertexStreamStride]; }
+
+inline unsigned int ModelOBJ::getVertexAttributes() const
+{ return m_vertexAttributes; }
 
 inline int ModelOBJ::getVertexSize() const
 { return static_cast<int>(sizeof(Vertex)); }
 
+inline bool ModelOBJ::hasBvh() const
+{ return !m_bvhNodes.empty(); }
+
 inline bool ModelOBJ::hasNormals() const
 { return m_hasNormals; }
 
@@ -238,4 +818,187 @@ inline bool ModelOBJ::hasTangents() const
 inline bool ModelOBJ::hasTextureCoords() const
 { return m_hasTextureCoords; }
 
+inline bool ModelOBJ::cancelled() const
+{ return m_pProgress && m_pProgress->cancel; }
+
+inline int *ModelOBJ::indexBuffer()
+{ return const_cast<int *>(getIndexBuffer()); }
+
+inline ModelOBJ::Vertex *ModelOBJ::vertexBuffer()
+{ return const_cast<Vertex *>(getVertexBuffer()); }
+
+inline float *ModelOBJ::vertexStream(VertexComponent component)
+{ return const_cast<float *>(getVertexStream(component)); }
+
+template <class Layout>
+void ModelOBJ::copyVertexBuffer(std::vector<Layout> &vertices) const
+{
+    const Vertex *pVertex = getVertexBuffer();
+    int numberOfVertices = getNumberOfVertices();
+
+    vertices.resize(numberOfVertices);
+
+    if (m_vertexStorage == STORAGE_INTERLEAVED)
+    {
+        for (int i = 0; i < numberOfVertices; ++i)
+            vertices[i].set(pVertex[i]);
+
+        return;
+    }
+
+    // Gather each vertex from the separate component streams.
+
+    const float *pStreams[NUMBER_OF_COMPONENTS];
+    Vertex vertex;
+    float *pComponents = reinterpret_cast<float *>(&vertex);
+
+    for (int i = 0; i < NUMBER_OF_COMPONENTS; ++i)
+        pStreams[i] = getVertexStream(static_cast<VertexComponent>(i));
+
+    for (int i = 0; i < numberOfVertices; ++i)
+    {
+        for (int j = 0; j < NUMBER_OF_COMPONENTS; ++j)
+            pComponents[j] = pStreams[j][i];
+
+        vertices[i].set(vertex);
+    }
+}
+
+//-----------------------------------------------------------------------------
+// ModelOBJ::VertexLayout.
+//-----------------------------------------------------------------------------
+
+template <unsigned int Attributes>
+inline float *ModelOBJ::VertexLayout<Attributes>::position()
+{
+    static_assert(positionSize != 0, "layout has no position");
+    return data + positionOffset;
+}
+
+template <unsigned int Attributes>
+inline float *ModelOBJ::VertexLayout<Attributes>::texCoord()
+{
+    static_assert(texCoordSize != 0, "layout has no texture coordinates");
+    return data + texCoordOffset;
+}
+
+template <unsigned int Attributes>
+inline float *ModelOBJ::VertexLayout<Attributes>::normal()
+{
+    static_assert(normalSize != 0, "layout has no normal");
+    return data + normalOffset;
+}
+
+template <unsigned int Attributes>
+inline float *ModelOBJ::VertexLayout<Attributes>::tangent()
+{
+    static_assert(tangentSize != 0, "layout has no tangent");
+    return data + tangentOffset;
+}
+
+template <unsigned int Attributes>
+inline float *ModelOBJ::VertexLayout<Attributes>::bitangent()
+{
+    static_assert(bitangentSize != 0, "layout has no bitangent");
+    return data + bitangentOffset;
+}
+
+template <unsigned int Attributes>
+inline const float *ModelOBJ::VertexLayout<Attributes>::position() const
+{ return const_cast<VertexLayout *>(this)->position(); }
+
+template <unsigned int Attributes>
+inline const float *ModelOBJ::VertexLayout<Attributes>::texCoord() const
+{ return const_cast<VertexLayout *>(this)->texCoord(); }
+
+template <unsigned int Attributes>
+inline const float *ModelOBJ::VertexLayout<Attributes>::normal() const
+{ return const_cast<VertexLayout *>(this)->normal(); }
+
+template <unsigned int Attributes>
+inline const float *ModelOBJ::VertexLayout<Attributes>::tangent() const
+{ return const_cast<VertexLayout *>(this)->tangent(); }
+
+template <unsigned int Attributes>
+inline const float *ModelOBJ::VertexLayout<Attributes>::bitangent() const
+{ return const_cast<VertexLayout *>(this)->bitangent(); }
+
+template <unsigned int Attributes>
+inline void ModelOBJ::VertexLayout<Attributes>::set(const Vertex &vertex)
+{
+    // The sizes are constants, so the loops for unused attributes are
+    // compiled away.
+
+    for (int i = 0; i < positionSize; ++i)
+        data[positionOffset + i] = vertex.position[i];
+
+    for (int i = 0; i < texCoordSize; ++i)
+        data[texCoordOffset + i] = vertex.texCoord[i];
+
+    for (int i = 0; i < normalSize; ++i)
+        data[normalOffset + i] = vertex.normal[i];
+
+    for (int i = 0; i < tangentSize; ++i)
+        data[tangentOffset + i] = vertex.tangent[i];
+
+    for (int i = 0; i < bitangentSize; ++i)
+        data[bitangentOffset + i] = vertex.bitangent[i];
+}
+
+//-----------------------------------------------------------------------------
+// Imports an OBJ file on a background thread. The thread that starts the
+// import may poll its progress and cancel it. Once finished() returns true
+// the imported model is ready and is usually swapped into the model that is
+// currently displayed. Destroying an unfinished import cancels it and waits
+// for the background thread to stop.
+//-----------------------------------------------------------------------------
+
+class ModelOBJ::AsyncImport
+{
+public:
+    explicit AsyncImport(const char *pszFilename,
+        const ImportOptions &options = ImportOptions());
+    ~AsyncImport();
+
+    void cancel();
+    bool finished() const;
+    bool succeeded() const;     // only valid once finished
+
+    const std::string &getFilename() const;
+    ModelOBJ &getModel();       // only valid once finished
+    const ImportProgress &getProgress() const;
+
+private:
+    AsyncImport(const AsyncImport &);
+    AsyncImport &operator=(const AsyncImport &);
+
+    void run();
+
+    std::string m_filename;
+    ImportOptions m_options;
+    ImportProgress m_progress;
+    ModelOBJ m_model;
+    std::atomic<bool> m_finished;
+    bool m_succeeded;
+    std::thread m_thread;
+};
+
+inline void ModelOBJ::AsyncImport::cancel()
+{ m_progress.cancel = true; }
+
+inline bool ModelOBJ::AsyncImport::finished() const
+{ return m_finished; }
+
+inline bool ModelOBJ::AsyncImport::succeeded() const
+{ return m_succeeded; }
+
+inline const std::string &ModelOBJ::AsyncImport::getFilename() const
+{ return m_filename; }
+
+inline ModelOBJ &ModelOBJ::AsyncImport::getModel()
+{ return m_model; }
+
+inline const ModelOBJ::ImportProgress &ModelOBJ::AsyncImport::getProgress() const
+{ return m_progress; }
+
 #endif
\ No newline at end of file
@@ -0,0 +1,185 @@
+//-----------------------------------------------------------------------------
+// Mirrored UV seam test for ModelOBJ's MikkTSpace tangents.
+//
+// Imports two quads side by side in the XY plane. The right quad's texture
+// mapping mirrors the left one's, so the two vertices on the shared edge
+// have the same position, texture coordinate and normal but are used by
+// triangles of both orientations. TANGENTS_FACE_AVERAGE keeps 6 vertices.
+// TANGENTS_MIKKTSPACE must split the 2 seam vertices so that each side has
+// its own tangent and w:
+//
+//   left side   tangent +X   w -1 (the mapping preserves the orientation)
+//   right side  tangent -X   w +1 (the mapping mirrors it)
+//
+// Both sides must rebuild the same bitangent, w * cross(normal, tangent),
+// which points along -Y for the shader's top left texture origin.
+//
+// This isn't part of the viewer's project. Build and run it on its own, e.g.
+//
+//   g++ -O2 -std=c++14 -pthread -I.. -o tangent_seam tangent_seam.cpp ../model_obj.cpp
+//   cl /O2 /EHsc /I.. tangent_seam.cpp ..\model_obj.cpp
+//
+// Exits with 0 if every check passes.
+//-----------------------------------------------------------------------------
+
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <vector>
+
+#include "model_obj.h"
+
+namespace
+{
+    const char SEAM_OBJ[] =
+        "mtllib seam.mtl\n"
+        "v 0 0 0\n"
+        "v 1 0 0\n"
+        "v 2 0 0\n"
+        "v 0 1 0\n"
+        "v 1 1 0\n"
+        "v 2 1 0\n"
+        "vt 0 0\n"
+        "vt 0.5 0\n"
+        "vt 0 1\n"
+        "vt 0.5 1\n"
+        "vn 0 0 1\n"
+        "usemtl bricks\n"
+        "f 1/1/1 2/2/1 5/4/1 4/3/1\n"
+        "f 2/2/1 3/1/1 6/3/1 5/4/1\n";
+
+    const char SEAM_MTL[] =
+        "newmtl bricks\n"
+        "map_Kd bricks_color_map.jpg\n"
+        "map_bump bricks_normal_map.jpg\n";
+
+    class SeamResolver : public ModelOBJ::MaterialResolver
+    {
+    public:
+        bool resolve(const char *pszName, const char *&pData, size_t &size)
+        {
+            if (strcmp(pszName, "seam.mtl") != 0)
+                return false;
+
+            pData = SEAM_MTL;
+            size = sizeof(SEAM_MTL) - 1;
+            return true;
+        }
+    };
+
+    int g_failures = 0;
+
+    void Check(bool condition, const char *pszWhat)
+    {
+        if (!condition)
+        {
+            printf("FAILED: %s\n", pszWhat);
+            ++g_failures;
+        }
+    }
+
+    bool Near(float a, float b)
+    {
+        return fabsf(a - b) < 1e-5f;
+    }
+
+    bool Import(ModelOBJ &model, ModelOBJ::TangentMethod method,
+                ModelOBJ::VertexStorage storage)
+    {
+        SeamResolver resolver;
+        ModelOBJ::ImportOptions options;
+
+        options.tangentMethod = method;
+        options.vertexStorage = storage;
+        options.pMaterialResolver = &resolver;
+
+        return model.importFromMemory(SEAM_OBJ, sizeof(SEAM_OBJ) - 1, options);
+    }
+
+    void TestSeam(ModelOBJ::VertexStorage storage)
+    {
+        ModelOBJ faceAverage;
+        ModelOBJ mikkTSpace;
+
+        Check(Import(faceAverage, ModelOBJ::TANGENTS_FACE_AVERAGE, storage), "face average import");
+        Check(Import(mikkTSpace, ModelOBJ::TANGENTS_MIKKTSPACE, storage), "MikkTSpace import");
+        Check(faceAverage.getNumberOfVertices() == 6, "face average keeps the seam vertices shared");
+        Check(mikkTSpace.getNumberOfVertices() == 8, "MikkTSpace splits the 2 seam vertices");
+        Check(mikkTSpace.hasTangents(), "MikkTSpace tangents generated");
+
+        std::vector<ModelOBJ::VertexPTNTB> vertices;
+        mikkTSpace.copyVertexBuffer(vertices);
+
+        // Every triangle on the left (x < 1) must see w -1 and tangent +X on
+        // all of its corners, and every triangle on the right w +1 and
+        // tangent -X, including the corners on the seam at x = 1.
+
+        const int *pIndices = mikkTSpace.getIndexBuffer();
+        int seamCorners[2] = {0, 0};
+
+        for (int i = 0; i < mikkTSpace.getNumberOfTriangles(); ++i)
+        {
+            const int *pTriangle = &pIndices[i * 3];
+            float centerX = 0.0f;
+
+            for (int k = 0; k < 3; ++k)
+                centerX += vertices[pTriangle[k]].position()[0] / 3.0f;
+
+            bool right = centerX > 1.0f;
+            float expectedW = right ? 1.0f : -1.0f;
+            float expectedX = right ? -1.0f : 1.0f;
+
+            for (int k = 0; k < 3; ++k)
+            {
+                const ModelOBJ::VertexPTNTB &vertex = vertices[pTriangle[k]];
+                const float *pTangent = vertex.tangent();
+                const float *pNormal = vertex.normal();
+                const float *pBitangent = vertex.bitangent();
+
+                Check(Near(pTangent[3], expectedW), "w of the corner's side");
+                Check(Near(pTangent[0], expectedX) && Near(pTangent[1], 0.0f) && Near(pTangent[2], 0.0f),
+                      "tangent of the corner's side");
+
+                float rebuilt[3] =
+                {
+                    pTangent[3] * (pNormal[1] * pTangent[2] - pNormal[2] * pTangent[1]),
+                    pTangent[3] * (pNormal[2] * pTangent[0] - pNormal[0] * pTangent[2]),
+                    pTangent[3] * (pNormal[0] * pTangent[1] - pNormal[1] * pTangent[0])
+                };
+
+                Check(Near(rebuilt[0], 0.0f) && Near(rebuilt[1], -1.0f) && Near(rebuilt[2], 0.0f),
+                      "rebuilt bitangent along -Y on both sides");
+                Check(Near(pBitangent[0], rebuilt[0]) && Near(pBitangent[1], rebuilt[1]) &&
+                      Near(pBitangent[2], rebuilt[2]), "stored bitangent matches the shader's");
+
+                if (Near(vertex.position()[0], 1.0f))
+                    ++seamCorners[right ? 1 : 0];
+            }
+        }
+
+        Check(seamCorners[0] > 0 && seamCorners[1] > 0, "both sides use the seam");
+
+        // The face average tangents follow the same w convention on the
+        // left quad, whose vertices aren't shared with the mirrored side.
+
+        std::vector<ModelOBJ::VertexPTNTB> averaged;
+        faceAverage.copyVertexBuffer(averaged);
+
+        for (int i = 0; i < static_cast<int>(averaged.size()); ++i)
+        {
+            if (Near(averaged[i].position()[0], 0.0f))
+                Check(Near(averaged[i].tangent()[3], -1.0f), "face average w on the left side");
+        }
+    }
+}
+
+int main()
+{
+    TestSeam(ModelOBJ::STORAGE_INTERLEAVED);
+    TestSeam(ModelOBJ::STORAGE_SOA);
+
+    if (g_failures == 0)
+        printf("tangent_seam: all checks passed\n");
+
+    return (g_failures == 0) ? 0 : 1;
+}